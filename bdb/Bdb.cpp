@@ -18,6 +18,7 @@
 #include <iomanip>
 #include <boost/thread/tss.hpp>
 #include "Bdb.h"
+#include "SplitPoints.h"
 
 Bdb::
 Bdb() :
@@ -47,7 +48,7 @@ create(boost::shared_ptr<DbEnv> env,
     numRetries_ = numRetries;
     db_.reset(new Db(env_.get(), DB_CXX_NO_EXCEPTIONS));
     assert(0 == db_->set_pagesize(pageSizeKb * 1024));
-    int flags = DB_AUTO_COMMIT | DB_CREATE | DB_EXCL| DB_THREAD;
+    int flags = DB_AUTO_COMMIT | DB_CREATE | DB_EXCL| DB_THREAD | DB_MULTIVERSION;
     int rc = db_->open(NULL, databaseName.c_str(), NULL, DB_BTREE, flags, 0);
     if (rc == EEXIST) {
         return DbExists;
@@ -74,7 +75,9 @@ open(boost::shared_ptr<DbEnv> env,
     numRetries_ = numRetries;
     db_.reset(new Db(env_.get(), DB_CXX_NO_EXCEPTIONS));
     assert(0 == db_->set_pagesize(pageSizeKb * 1024));
-    int flags = DB_AUTO_COMMIT | DB_THREAD;
+    // DB_MULTIVERSION lets scan cursors read from a snapshot without 
+    // holding page locks between openScan and nextScan calls.
+    int flags = DB_AUTO_COMMIT | DB_THREAD | DB_MULTIVERSION;
     int rc = db_->open(NULL, databaseName.c_str(), NULL, DB_BTREE, flags, 0);
     if (rc == ENOENT) {
         return DbNotFound;
@@ -129,7 +132,7 @@ drop()
 }
 
 Bdb::ResponseCode Bdb::
-get(const std::string& key, std::string& value)
+get(const std::string& key, std::string& value, DbTxn* txn)
 {
     if (!inited_) {
         fprintf(stderr, "get called on uninitialized database");
@@ -147,7 +150,7 @@ get(const std::string& key, std::string& value)
          * get operation is implicitly transaction protected.
          * http://download.oracle.com/docs/cd/E17076_02/html/api_reference/CXX/dbget.html
          */
-        rc = db_->get(NULL, &dbkey, &dbval, 0);
+        rc = db_->get(txn, &dbkey, &dbval, 0);
         if (rc == 0) {
             value.assign((char*)(dbval.get_data()), dbval.get_size());
             free(dbval.get_data());
@@ -163,6 +166,51 @@ get(const std::string& key, std::string& value)
     return Error;
 }
 
+Bdb::ResponseCode Bdb::
+multiGet(const std::vector<std::string>& keys, 
+         std::vector<std::string>& values,
+         std::vector<ResponseCode>& results)
+{
+    if (!inited_) {
+        fprintf(stderr, "multiGet called on uninitialized database");
+        return Error;
+    }
+    Dbc* cursor = NULL;
+    int rc = db_->cursor(NULL, &cursor, DB_READ_COMMITTED);
+    if (rc != 0) {
+        fprintf(stderr, "Db::cursor() returned: %s", db_strerror(rc));
+        return Error;
+    }
+
+    // DB_DBT_REALLOC lets all the lookups share the same value buffer.
+    Dbt dbkey, dbval;
+    dbval.set_flags(DB_DBT_REALLOC);
+    values.resize(keys.size());
+    results.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        dbkey.set_data(const_cast<char*>(keys[i].c_str()));
+        dbkey.set_size(keys[i].size());
+        results[i] = Error;
+        for (uint32_t idx = 0; idx < numRetries_; idx++) {
+            rc = cursor->get(&dbkey, &dbval, DB_SET);
+            if (rc == 0) {
+                values[i].assign((char*)(dbval.get_data()), dbval.get_size());
+                results[i] = Success;
+                break;
+            } else if (rc == DB_NOTFOUND) {
+                results[i] = KeyNotFound;
+                break;
+            } else if (rc != DB_LOCK_DEADLOCK) {
+                fprintf(stderr, "Dbc::get() returned: %s", db_strerror(rc));
+                break;
+            }
+        }
+    }
+    free(dbval.get_data());
+    cursor->close();
+    return Success;
+}
+
 Bdb::ResponseCode Bdb::
 insert(const std::string& key, const std::string& value)
 {
@@ -256,6 +304,137 @@ update(const std::string& key, const std::string& value)
     return Error;
 }
 
+Bdb::ResponseCode Bdb::
+compareAndSet(const std::string& key, const std::string& expectedValue, 
+              const std::string& newValue)
+{
+    if (!inited_) {
+        fprintf(stderr, "compareAndSet called on uninitialized database");
+        return Error;
+    }
+    DbTxn* txn = NULL;
+    Dbc* cursor = NULL;
+
+    Dbt dbkey, dbdata;
+    dbkey.set_data(const_cast<char*>(key.c_str()));
+    dbkey.set_size(key.size());
+    dbdata.set_data(const_cast<char*>(newValue.c_str()));
+    dbdata.set_size(newValue.size());
+
+    int rc = 0;
+    for (uint32_t idx = 0; idx < numRetries_; idx++) {
+        env_->txn_begin(NULL, &txn, 0);
+        (*db_).cursor(txn, &cursor, DB_READ_COMMITTED);
+
+        // read the current value, and keep the record locked.
+        Dbt currentData;
+        currentData.set_flags(DB_DBT_MALLOC);
+        rc = cursor->get(&dbkey, &currentData, DB_SET | DB_RMW);
+        if (rc != 0) {
+            cursor->close();
+            txn->abort();
+            if (rc == DB_NOTFOUND) {
+                return KeyNotFound;
+            } else if (rc != DB_LOCK_DEADLOCK) {
+                fprintf(stderr, "Db::get() returned: %s", db_strerror(rc));
+                return Error;
+            }
+            continue;
+        }
+        bool match = currentData.get_size() == expectedValue.size() &&
+            memcmp(currentData.get_data(), expectedValue.data(), expectedValue.size()) == 0;
+        free(currentData.get_data());
+        if (!match) {
+            cursor->close();
+            txn->abort();
+            return ValueMismatch;
+        }
+
+        rc = cursor->put(NULL, &dbdata, DB_CURRENT);
+        cursor->close();
+        if (rc == 0) {
+            txn->commit(DB_TXN_SYNC);
+            return Success;
+        } else {
+            txn->abort();
+            if (rc != DB_LOCK_DEADLOCK) {
+                fprintf(stderr, "Db::put() returned: %s", db_strerror(rc));
+                return Error;
+            }
+        }
+    }
+    fprintf(stderr, "compareAndSet failed %d times", numRetries_);
+    return Error;
+}
+
+Bdb::ResponseCode Bdb::
+merge(const std::string& key, const std::string& operand, 
+      MergeFunction mergeFunction, std::string& result)
+{
+    if (!inited_) {
+        fprintf(stderr, "merge called on uninitialized database");
+        return Error;
+    }
+    DbTxn* txn = NULL;
+    Dbc* cursor = NULL;
+
+    Dbt dbkey;
+    dbkey.set_data(const_cast<char*>(key.c_str()));
+    dbkey.set_size(key.size());
+
+    int rc = 0;
+    for (uint32_t idx = 0; idx < numRetries_; idx++) {
+        env_->txn_begin(NULL, &txn, 0);
+        (*db_).cursor(txn, &cursor, DB_READ_COMMITTED);
+
+        // read the current value, and keep the record locked.
+        Dbt currentData;
+        currentData.set_flags(DB_DBT_MALLOC);
+        rc = cursor->get(&dbkey, &currentData, DB_SET | DB_RMW);
+        if (rc != 0 && rc != DB_NOTFOUND) {
+            cursor->close();
+            txn->abort();
+            if (rc != DB_LOCK_DEADLOCK) {
+                fprintf(stderr, "Db::get() returned: %s", db_strerror(rc));
+                return Error;
+            }
+            continue;
+        }
+        bool merged;
+        if (rc == 0) {
+            std::string current((char*)currentData.get_data(), currentData.get_size());
+            free(currentData.get_data());
+            merged = mergeFunction(&current, operand, result);
+        } else {
+            merged = mergeFunction(NULL, operand, result);
+        }
+        if (!merged) {
+            cursor->close();
+            txn->abort();
+            return Error;
+        }
+
+        Dbt dbdata;
+        dbdata.set_data(const_cast<char*>(result.c_str()));
+        dbdata.set_size(result.size());
+        rc = rc == 0 ? cursor->put(NULL, &dbdata, DB_CURRENT) 
+                     : cursor->put(&dbkey, &dbdata, DB_KEYFIRST);
+        cursor->close();
+        if (rc == 0) {
+            txn->commit(DB_TXN_SYNC);
+            return Success;
+        } else {
+            txn->abort();
+            if (rc != DB_LOCK_DEADLOCK) {
+                fprintf(stderr, "Db::put() returned: %s", db_strerror(rc));
+                return Error;
+            }
+        }
+    }
+    fprintf(stderr, "merge failed %d times", numRetries_);
+    return Error;
+}
+
 Bdb::ResponseCode Bdb::
 remove(const std::string& key)
 {
@@ -282,6 +461,348 @@ remove(const std::string& key)
     return Error;
 }
 
+Bdb::ResponseCode Bdb::
+insertMany(const std::vector<mapkeeper::Record>& records)
+{
+    if (!inited_) {
+        fprintf(stderr, "insertMany called on uninitialized database");
+        return Error;
+    }
+    // DB_MULTIPLE_KEY buffer. It must be aligned for u_int32_t, and it's
+    // refilled as many times as needed within the transaction.
+    const uint32_t bulkBufferSize = 4 * 1024 * 1024;
+    std::vector<u_int32_t> buffer(bulkBufferSize / sizeof(u_int32_t));
+    DbTxn* txn = NULL;
+
+    int rc = 0;
+    for (uint32_t idx = 0; idx < numRetries_; idx++) {
+        env_->txn_begin(NULL, &txn, 0);
+        size_t next = 0;
+        while (next < records.size()) {
+            Dbt bulk(&buffer[0], bulkBufferSize);
+            bulk.set_ulen(bulkBufferSize);
+            bulk.set_flags(DB_DBT_USERMEM);
+            DbMultipleKeyDataBuilder builder(bulk);
+            size_t numRecords = 0;
+            for (; next < records.size(); next++, numRecords++) {
+                const mapkeeper::Record& record = records[next];
+                if (!builder.append(const_cast<char*>(record.key.c_str()), record.key.size(),
+                                    const_cast<char*>(record.value.c_str()), record.value.size())) {
+                    break;
+                }
+            }
+            if (numRecords == 0) {
+                // this record alone doesn't fit in the bulk buffer.
+                const mapkeeper::Record& record = records[next++];
+                Dbt dbkey, dbdata;
+                dbkey.set_data(const_cast<char*>(record.key.c_str()));
+                dbkey.set_size(record.key.size());
+                dbdata.set_data(const_cast<char*>(record.value.c_str()));
+                dbdata.set_size(record.value.size());
+                rc = db_->put(txn, &dbkey, &dbdata, DB_NOOVERWRITE);
+            } else {
+                rc = db_->put(txn, &bulk, NULL, DB_MULTIPLE_KEY | DB_NOOVERWRITE);
+            }
+            if (rc != 0) {
+                break;
+            }
+        }
+        if (rc == 0) {
+            rc = txn->commit(DB_TXN_SYNC);
+            if (rc != 0) {
+                fprintf(stderr, "DbTxn::commit() returned: %s", db_strerror(rc));
+                return Error;
+            }
+            return Success;
+        }
+        txn->abort();
+        if (rc == DB_KEYEXIST) {
+            return KeyExists;
+        } else if (rc != DB_LOCK_DEADLOCK) {
+            fprintf(stderr, "Db::put() returned: %s", db_strerror(rc));
+            return Error;
+        }
+    }
+    fprintf(stderr, "insertMany failed %d times", numRetries_);
+    return Error;
+}
+
+Bdb::ResponseCode Bdb::
+writeBatch(const std::vector<mapkeeper::Mutation>& mutations)
+{
+    if (!inited_) {
+        fprintf(stderr, "writeBatch called on uninitialized database");
+        return Error;
+    }
+    DbTxn* txn = NULL;
+    Dbt currentData;
+    currentData.set_data(NULL);
+    currentData.set_ulen(0);
+    currentData.set_dlen(0);
+    currentData.set_doff(0);
+    currentData.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+
+    int rc = 0;
+    for (uint32_t idx = 0; idx < numRetries_; idx++) {
+        env_->txn_begin(NULL, &txn, 0);
+        ResponseCode result = Success;
+        std::vector<mapkeeper::Mutation>::const_iterator mutation;
+        for (mutation = mutations.begin(); mutation != mutations.end(); mutation++) {
+            Dbt dbkey, dbdata;
+            dbkey.set_data(const_cast<char*>(mutation->key.c_str()));
+            dbkey.set_size(mutation->key.size());
+            dbdata.set_data(const_cast<char*>(mutation->value.c_str()));
+            dbdata.set_size(mutation->value.size());
+            switch (mutation->type) {
+            case mapkeeper::MutationType::Put:
+                rc = db_->put(txn, &dbkey, &dbdata, 0);
+                break;
+            case mapkeeper::MutationType::Insert:
+                rc = db_->put(txn, &dbkey, &dbdata, DB_NOOVERWRITE);
+                if (rc == DB_KEYEXIST) {
+                    result = KeyExists;
+                }
+                break;
+            case mapkeeper::MutationType::Update:
+                rc = db_->get(txn, &dbkey, &currentData, DB_RMW);
+                if (rc == 0) {
+                    rc = db_->put(txn, &dbkey, &dbdata, 0);
+                } else if (rc == DB_NOTFOUND) {
+                    result = KeyNotFound;
+                }
+                break;
+            case mapkeeper::MutationType::Remove:
+                rc = db_->del(txn, &dbkey, 0);
+                if (rc == DB_NOTFOUND) {
+                    result = KeyNotFound;
+                }
+                break;
+            }
+            if (rc != 0) {
+                break;
+            }
+        }
+        if (rc == 0) {
+            rc = txn->commit(DB_TXN_SYNC);
+            if (rc != 0) {
+                fprintf(stderr, "DbTxn::commit() returned: %s", db_strerror(rc));
+                return Error;
+            }
+            return Success;
+        }
+        txn->abort();
+        if (result != Success) {
+            return result;
+        } else if (rc != DB_LOCK_DEADLOCK) {
+            fprintf(stderr, "writeBatch failed: %s", db_strerror(rc));
+            return Error;
+        }
+    }
+    fprintf(stderr, "writeBatch failed %d times", numRetries_);
+    return Error;
+}
+
+Bdb::ResponseCode Bdb::
+removeRange(const std::string& startKey, const std::string& endKey, uint64_t& count)
+{
+    if (!inited_) {
+        fprintf(stderr, "removeRange called on uninitialized database");
+        return Error;
+    }
+    DbTxn* txn = NULL;
+    Dbc* cursor = NULL;
+
+    // only the keys are needed.
+    Dbt data;
+    data.set_data(NULL);
+    data.set_ulen(0);
+    data.set_dlen(0);
+    data.set_doff(0);
+    data.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+
+    count = 0;
+    std::string nextKey = startKey;
+    bool done = false;
+    while (!done) {
+        uint64_t removed = 0;
+        std::string lastKey;
+        int rc = 0;
+        uint32_t idx;
+        for (idx = 0; idx < numRetries_; idx++) {
+            env_->txn_begin(NULL, &txn, 0);
+            (*db_).cursor(txn, &cursor, 0);
+            removed = 0;
+            Dbt dbkey;
+            dbkey.set_data(const_cast<char*>(nextKey.c_str()));
+            dbkey.set_size(nextKey.size());
+            dbkey.set_flags(DB_DBT_MALLOC);
+            uint32_t flags = DB_SET_RANGE | DB_RMW;
+            while (removed < removeRangeBatchSize && 
+                   (rc = cursor->get(&dbkey, &data, flags)) == 0) {
+                flags = DB_NEXT | DB_RMW;
+                lastKey.assign((char*)dbkey.get_data(), dbkey.get_size());
+                free(dbkey.get_data());
+                if (!endKey.empty() && endKey <= lastKey) {
+                    done = true;
+                    break;
+                }
+                rc = cursor->del(0);
+                if (rc != 0) {
+                    break;
+                }
+                removed++;
+            }
+            if (rc == DB_NOTFOUND) {
+                done = true;
+                rc = 0;
+            }
+            cursor->close();
+            if (rc == 0) {
+                rc = txn->commit(DB_TXN_SYNC);
+                if (rc != 0) {
+                    fprintf(stderr, "DbTxn::commit() returned: %s", db_strerror(rc));
+                    return Error;
+                }
+                break;
+            }
+            txn->abort();
+            done = false;
+            if (rc != DB_LOCK_DEADLOCK) {
+                fprintf(stderr, "removeRange failed: %s", db_strerror(rc));
+                return Error;
+            }
+        }
+        if (idx == numRetries_) {
+            fprintf(stderr, "removeRange failed %d times", numRetries_);
+            return Error;
+        }
+        count += removed;
+        // the last removed key is gone, DB_SET_RANGE finds the one after it.
+        nextKey = lastKey;
+    }
+    return Success;
+}
+
+Bdb::ResponseCode Bdb::
+approximateSize(const std::string& startKey, const std::string& endKey, uint64_t& size)
+{
+    if (!inited_) {
+        fprintf(stderr, "approximateSize called on uninitialized database");
+        return Error;
+    }
+
+    DB_BTREE_STAT* stat = NULL;
+    int rc = db_->stat(NULL, &stat, DB_FAST_STAT);
+    if (rc != 0) {
+        fprintf(stderr, "Db::stat() returned: %s", db_strerror(rc));
+        return Error;
+    }
+    uint64_t totalSize = (uint64_t)stat->bt_pagecnt * stat->bt_pagesize;
+    free(stat);
+
+    // key_range gives the fraction of the keys that are less than, 
+    // equal to and greater than a key.
+    double start = 0.0;
+    double end = 1.0;
+    DB_KEY_RANGE range;
+    Dbt dbkey;
+    if (!startKey.empty()) {
+        dbkey.set_data(const_cast<char*>(startKey.c_str()));
+        dbkey.set_size(startKey.size());
+        rc = db_->key_range(NULL, &dbkey, &range, 0);
+        if (rc != 0) {
+            fprintf(stderr, "Db::key_range() returned: %s", db_strerror(rc));
+            return Error;
+        }
+        start = range.less;
+    }
+    if (!endKey.empty()) {
+        dbkey.set_data(const_cast<char*>(endKey.c_str()));
+        dbkey.set_size(endKey.size());
+        rc = db_->key_range(NULL, &dbkey, &range, 0);
+        if (rc != 0) {
+            fprintf(stderr, "Db::key_range() returned: %s", db_strerror(rc));
+            return Error;
+        }
+        end = range.less;
+    }
+    size = end > start ? (uint64_t)((end - start) * totalSize) : 0;
+    return Success;
+}
+
+/**
+ * Estimates the fraction of a database before a key with DB->key_range.
+ */
+class KeyRangeEstimator : public KeyRankEstimator {
+public:
+    KeyRangeEstimator(Db* db) :
+        db_(db)
+    {
+    }
+
+    bool fractionBelow(const std::string& key, double& fraction)
+    {
+        DB_KEY_RANGE range;
+        Dbt dbkey;
+        dbkey.set_data(const_cast<char*>(key.c_str()));
+        dbkey.set_size(key.size());
+        int rc = db_->key_range(NULL, &dbkey, &range, 0);
+        if (rc != 0) {
+            fprintf(stderr, "Db::key_range() returned: %s", db_strerror(rc));
+            return false;
+        }
+        fraction = range.less;
+        return true;
+    }
+
+private:
+    Db* db_;
+};
+
+Bdb::ResponseCode Bdb::
+sampleSplitPoints(int32_t numSplits, std::vector<std::string>& splitPoints)
+{
+    if (!inited_) {
+        fprintf(stderr, "sampleSplitPoints called on uninitialized database");
+        return Error;
+    }
+
+    // only the first and the last key are read.
+    Dbt data;
+    data.set_data(NULL);
+    data.set_ulen(0);
+    data.set_dlen(0);
+    data.set_doff(0);
+    data.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+    Dbc* cursor = NULL;
+    int rc = db_->cursor(NULL, &cursor, 0);
+    if (rc != 0) {
+        fprintf(stderr, "Db::cursor() returned: %s", db_strerror(rc));
+        return Error;
+    }
+    std::string keys[2];
+    uint32_t flags[2] = {DB_FIRST, DB_LAST};
+    for (int i = 0; i < 2 && rc == 0; i++) {
+        Dbt dbkey;
+        dbkey.set_flags(DB_DBT_MALLOC);
+        rc = cursor->get(&dbkey, &data, flags[i]);
+        if (rc == 0) {
+            keys[i].assign((char*)dbkey.get_data(), dbkey.get_size());
+            free(dbkey.get_data());
+        }
+    }
+    cursor->close();
+    if (rc == DB_NOTFOUND) {
+        // the database is empty.
+        return Success;
+    } else if (rc != 0) {
+        fprintf(stderr, "Dbc::get() returned: %s", db_strerror(rc));
+        return Error;
+    }
+    KeyRangeEstimator estimator(db_.get());
+    return bisectSplitPoints(estimator, keys[0], keys[1], numSplits, splitPoints) ? Success : Error;
+}
+
 Db* Bdb::
 getDb() 
 {
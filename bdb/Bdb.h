@@ -16,7 +16,11 @@
 #ifndef BDB_H
 #define BDB_H
 
+#include <string>
+#include <vector>
 #include <db_cxx.h>
+#include "MapKeeper.h"
+#include "MergeOperator.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
 
@@ -29,6 +33,7 @@ public:
         KeyNotFound,
         DbExists,
         DbNotFound,
+        ValueMismatch,
     };
 
     Bdb();
@@ -62,13 +67,122 @@ public:
 
     ResponseCode close();
     ResponseCode drop();
-    ResponseCode get(const std::string& key, std::string& value);
+
+    /**
+     * Retrieves a record. If txn is given, the record is read within 
+     * the transaction.
+     *
+     * @returns Success on success
+     *          KeyNotFound if the record doesn't exist.
+     */
+    ResponseCode get(const std::string& key, std::string& value, DbTxn* txn = NULL);
+
+    /**
+     * Looks up multiple keys using a single cursor.
+     *
+     * results[i] is set to Success, KeyNotFound or Error for keys[i], and
+     * values[i] holds the value of the record when it's Success.
+     *
+     * @returns Success if all the lookups were attempted.
+     *          Error if the cursor couldn't be opened.
+     */
+    ResponseCode multiGet(const std::vector<std::string>& keys, 
+                          std::vector<std::string>& values,
+                          std::vector<ResponseCode>& results);
     ResponseCode insert(const std::string& key, const std::string& value);
     ResponseCode update(const std::string& key, const std::string& value);
+
+    /**
+     * Replaces the value of a record if it's equal to expectedValue. The
+     * record is read with a write lock, so nothing can change it in 
+     * between.
+     *
+     * @returns Success if the value was replaced.
+     *          KeyNotFound if the record doesn't exist.
+     *          ValueMismatch if the record has a different value.
+     *          Error on any other errors. 
+     */
+    ResponseCode compareAndSet(const std::string& key, 
+                               const std::string& expectedValue,
+                               const std::string& newValue);
+
+    /**
+     * Replaces the value of a record with mergeFunction(value, operand).
+     * The function gets NULL if the record doesn't exist. The record is 
+     * read with a write lock, so nothing can change it in between.
+     *
+     * @param result new value of the record.
+     * @returns Success if the record was written.
+     *          Error if mergeFunction fails, or on any other errors.
+     */
+    ResponseCode merge(const std::string& key, const std::string& operand,
+                       MergeFunction mergeFunction, std::string& result);
     ResponseCode remove(const std::string& key);
+
+    /**
+     * Inserts the records in a single transaction using bulk puts. 
+     *
+     * @returns Success if all the records were inserted.
+     *          KeyExists if one of the records already exists, in which
+     *                    case nothing is inserted.
+     *          Error on any other errors. 
+     */
+    ResponseCode insertMany(const std::vector<mapkeeper::Record>& records);
+
+    /**
+     * Applies the mutations in a single transaction. 
+     *
+     * @returns Success if all the mutations were applied.
+     *          KeyExists if an Insert mutation found an existing record.
+     *          KeyNotFound if an Update or Remove mutation didn't find
+     *                      its record.
+     *          Error on any other errors. 
+     *          Nothing is applied unless Success is returned.
+     */
+    ResponseCode writeBatch(const std::vector<mapkeeper::Mutation>& mutations);
+
+    /**
+     * Removes the records in [startKey, endKey) with a cursor. An empty
+     * endKey means the end of the database. 
+     *
+     * Each transaction removes at most removeRangeBatchSize records, so
+     * a large range doesn't run out of locks. 
+     *
+     * @param count number of records removed, including the ones 
+     *              removed before an error.
+     * @returns Success on success
+     *          Error on any errors. 
+     */
+    ResponseCode removeRange(const std::string& startKey, 
+                             const std::string& endKey,
+                             uint64_t& count);
+
+    /**
+     * Estimates the size of [startKey, endKey) from the page count of
+     * the database and the fraction of keys in the range, as reported 
+     * by DB->key_range. An empty key means the end of the database. 
+     *
+     * @returns Success on success
+     *          Error on any errors. 
+     */
+    ResponseCode approximateSize(const std::string& startKey, 
+                                 const std::string& endKey,
+                                 uint64_t& size);
+
+    /**
+     * Finds keys that split the database into numSplits ranges of 
+     * about the same number of records, by bisecting the key space
+     * with DB->key_range. See bisectSplitPoints in SplitPoints.h.
+     *
+     * @returns Success on success
+     *          Error on any errors. 
+     */
+    ResponseCode sampleSplitPoints(int32_t numSplits,
+                                   std::vector<std::string>& splitPoints);
     Db* getDb();
 
 private:
+    static const uint64_t removeRangeBatchSize = 10000;
     boost::shared_ptr<DbEnv> env_;
     boost::scoped_ptr<Db> db_;
     std::string dbName_;
@@ -35,19 +35,29 @@ BdbIterator() :
     startKey_(""),
     startKeyIncluded_(false),
     endKey_(""),
-    endKeyIncluded_(false)
+    endKeyIncluded_(false),
+    partialValue_(false),
+    valueOffset_(0),
+    valueLength_(0)
 
 {
 }
 
 BdbIterator::
 ~BdbIterator()
+{
+    close();
+}
+
+void BdbIterator::
+close()
 {
     if (cursor_ != NULL) {
         int rc = cursor_->close();
         if (rc) {
             fprintf(stderr, "Dbc::close() returned: %s", db_strerror(rc));
         }
+        cursor_ = NULL;
     }
 }
 
@@ -60,7 +70,7 @@ BdbIterator::
 BdbIterator::ResponseCode BdbIterator::
 init(Bdb* bdb, const std::string& startKey, bool startKeyIncluded,
         const std::string& endKey, bool endKeyIncluded,
-        mapkeeper::ScanOrder::type order)
+        mapkeeper::ScanOrder::type order, DbTxn* txn)
 {
     scanEnded_ = false;
     order_ = order;
@@ -69,7 +79,12 @@ init(Bdb* bdb, const std::string& startKey, bool startKeyIncluded,
     startKeyIncluded_ = startKeyIncluded;
     endKey_ = endKey;
     endKeyIncluded_ = endKeyIncluded;
-    bdb_->getDb()->cursor(NULL, &cursor_, DB_READ_COMMITTED);
+    int rc = bdb_->getDb()->cursor(txn, &cursor_, txn ? 0 : DB_READ_COMMITTED);
+    if (rc != 0) {
+        fprintf(stderr, "Db::cursor() returned: %s", db_strerror(rc));
+        cursor_ = NULL;
+        return BdbIterator::Error;
+    }
     if (order_ == mapkeeper::ScanOrder::Ascending) {
         return initAscendingScan();
     } else {
@@ -90,6 +105,11 @@ next(RecordBuffer& buffer)
     dbval.set_data(buffer.getValueBuffer());
     dbval.set_ulen(buffer.getValueBufferSize());
     dbval.set_flags(DB_DBT_USERMEM);
+    if (partialValue_ && !hasValueFilter(filter_)) {
+        dbval.set_doff(valueOffset_);
+        dbval.set_dlen(std::min(valueLength_, buffer.getValueBufferSize()));
+        dbval.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+    }
 
     if (order_ == mapkeeper::ScanOrder::Ascending) {
         return nextAscending(buffer, dbkey, dbval);
@@ -98,6 +118,40 @@ next(RecordBuffer& buffer)
     }
 }
 
+void BdbIterator::
+setValueRange(uint32_t valueOffset, uint32_t valueLength)
+{
+    partialValue_ = true;
+    valueOffset_ = valueOffset;
+    valueLength_ = valueLength;
+}
+
+void BdbIterator::
+setFilter(const mapkeeper::ScanFilter& filter)
+{
+    filter_ = filter;
+}
+
+/**
+ * Checks the record in buffer against the filter, and cuts a matching
+ * value down to the value range if it was read whole for the filter.
+ */
+bool BdbIterator::
+matches(RecordBuffer& buffer)
+{
+    if (!matchesFilter(filter_, buffer.getKeyBuffer(), buffer.getKeySize(),
+                       buffer.getValueBuffer(), buffer.getValueSize())) {
+        return false;
+    }
+    if (partialValue_ && hasValueFilter(filter_)) {
+        uint32_t offset = std::min(valueOffset_, buffer.getValueSize());
+        uint32_t length = std::min(valueLength_, buffer.getValueSize() - offset);
+        memmove(buffer.getValueBuffer(), buffer.getValueBuffer() + offset, length);
+        buffer.setValueSize(length);
+    }
+    return true;
+}
+
 BdbIterator::ResponseCode BdbIterator::
 nextAscending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval)
 {
@@ -128,7 +182,7 @@ nextAscending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval)
                 }
             }
         }
-        found = true;
+        found = matches(buffer);
     }
     return BdbIterator::Success;
 }
@@ -166,7 +220,7 @@ nextDescending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval)
                 return BdbIterator::ScanEnded;
             }
         }
-        found = true;
+        found = matches(buffer);
     }
     return BdbIterator::Success;
 }
@@ -18,6 +18,7 @@
 
 #include "MapKeeper.h"
 #include "Bdb.h"
+#include "ScanFilter.h"
 #include "RecordBuffer.h"
 
 class BdbIterator
@@ -38,13 +39,38 @@ public:
      * startKey is supposed to be smaller than or equal to endKey regardless
      * of the scan order. If startKey is larger than endKey, scan result will
      * be empty.
+     *
+     * If txn is given, the cursor is opened within the transaction, and 
+     * the transaction must outlive the iterator.
      */
     ResponseCode init(Bdb* bdb, 
                       const std::string& startKey, bool startKeyIncluded,
                       const std::string& endKey, bool endKeyIncluded,
-                      mapkeeper::ScanOrder::type order);
+                      mapkeeper::ScanOrder::type order,
+                      DbTxn* txn = NULL);
     ResponseCode next(RecordBuffer& buffer);
 
+    /**
+     * Makes next() read only valueLength bytes of each value, starting
+     * at valueOffset, with a partial get. Use a valueLength of 0 to 
+     * skip the values altogether.
+     */
+    void setValueRange(uint32_t valueOffset, uint32_t valueLength);
+
+    /**
+     * Makes next() skip the records that don't match filter. If the 
+     * filter looks at values, whole values are read and cut down to
+     * the value range once the record matches.
+     */
+    void setFilter(const mapkeeper::ScanFilter& filter);
+
+    /**
+     * Closes the underlying cursor. It's called by the destructor, but
+     * needs to be called explicitly before committing the transaction 
+     * the iterator was initialized with.
+     */
+    void close();
+
 private:
     BdbIterator(const BdbIterator&);
     BdbIterator& operator=(const BdbIterator&);
@@ -54,6 +80,7 @@ private:
     ResponseCode nextAscending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval);
     ResponseCode nextDescending(RecordBuffer& buffer, Dbt& dbkey, Dbt& dbval);
     void initEmptyData(Dbt& data);
+    bool matches(RecordBuffer& buffer);
     bool inited_;
     bool scanEnded_;
     Bdb* bdb_;
@@ -64,6 +91,10 @@ private:
     bool startKeyIncluded_;
     std::string endKey_;
     bool endKeyIncluded_;
+    bool partialValue_;
+    uint32_t valueOffset_;
+    uint32_t valueLength_;
+    mapkeeper::ScanFilter filter_;
 };
 
 #endif /* BDB_ITERATOR_H */
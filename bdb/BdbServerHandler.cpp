@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include <arpa/inet.h>
+#include <iostream>
 #include <sstream>
 #include <cerrno>
 #include <dirent.h>
@@ -21,17 +22,24 @@
 #include <stdio.h>
 #include <boost/thread/tss.hpp>
 #include <boost/thread/thread.hpp>
-#include <server/TThreadedServer.h>
+#include <boost/program_options.hpp>
 #include "BdbServerHandler.h"
+#include "ChangeLogHandler.h"
+#include "TtlHandler.h"
 #include "BdbIterator.h"
 #include "RecordBuffer.h"
+#include "ServerRunner.h"
 #include "MapKeeper.h"
+#include "Aggregator.h"
+#include "SplitPoints.h"
+#include "ValueProjection.h"
 
 using namespace ::apache::thrift;
 using namespace ::apache::thrift::protocol;
 using namespace ::apache::thrift::transport;
 using namespace ::apache::thrift::server;
 using namespace ::apache::thrift::concurrency;
+namespace po = boost::program_options;
 
 std::string BdbServerHandler::DBNAME_PREFIX = "mapkeeper_";
 
@@ -152,6 +160,13 @@ ping()
     return ResponseCode::Success;
 }
 
+// answered by StatsHandler, which ServerRunner puts in front.
+void BdbServerHandler::
+getStats(StatsResponse& _return, const bool reset)
+{
+    _return.responseCode = ResponseCode::Error;
+}
+
 ResponseCode::type BdbServerHandler::
 addMap(const std::string& mapName) 
 {
@@ -177,6 +192,9 @@ dropMap(const std::string& mapName)
     if (itr == maps_.end()) {
         return ResponseCode::MapNotFound;
     }
+    cursors_.removeMap(mapName);
+    snapshots_.removeMap(mapName);
+    handles_.remove(mapName);
     itr->second->drop();
     maps_.erase(itr);
     return ResponseCode::Success;
@@ -205,32 +223,116 @@ listMaps(StringListResponse& _return)
 }
 
 void BdbServerHandler::
-scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, 
+openMap(MapHandleResponse& _return, const std::string& mapName) 
+{
+    boost::unique_lock<boost::shared_mutex> writeLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    _return.handle = handles_.add(mapName, itr->second);
+    _return.responseCode = _return.handle >= 0 ? ResponseCode::Success : ResponseCode::TooManyHandles;
+}
+
+void BdbServerHandler::
+getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& recordName) 
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    Bdb* db;
+    if (!handles_.get(mapHandle, db)) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    getRecord(_return, db, recordName);
+}
+
+ResponseCode::type BdbServerHandler::
+putByHandle(const int32_t mapHandle, const std::string& recordName, const std::string& recordBody) 
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    Bdb* db;
+    if (!handles_.get(mapHandle, db)) {
+        return ResponseCode::MapNotFound;
+    }
+    return putRecord(db, recordName, recordBody);
+}
+
+void BdbServerHandler::
+scanByHandle(RecordListResponse& _return, const int32_t mapHandle, const ScanOrder::type order, 
             const std::string& startKey, const bool startKeyIncluded,
             const std::string& endKey, const bool endKeyIncluded,
-            const int32_t maxRecords, const int32_t maxBytes)
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options)
 {
-    BdbIterator itr;
-    boost::thread_specific_ptr<RecordBuffer> buffer;
-    if (buffer.get() == NULL) {
-        buffer.reset(new RecordBuffer(keyBufferSizeBytes_, valueBufferSizeBytes_));
-    }
-    if (endKey.empty()) {
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    Bdb* db;
+    if (!handles_.get(mapHandle, db)) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
     }
+    scanRecords(_return, db, order, startKey, startKeyIncluded,
+                endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void BdbServerHandler::
+scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options)
+{
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
     boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
     if (mapItr == maps_.end()) {
         _return.responseCode = ResponseCode::MapNotFound;
         return;
     }
- 
-    itr.init(mapItr->second, const_cast<std::string&>(startKey), startKeyIncluded, const_cast<std::string&>(endKey), endKeyIncluded, order);
+    scanRecords(_return, mapItr->second, order, startKey, startKeyIncluded,
+                endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
+void BdbServerHandler::
+scanRecords(RecordListResponse& _return, Bdb* db, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options, DbTxn* txn)
+{
+    BdbIterator itr;
+    boost::thread_specific_ptr<RecordBuffer> buffer;
+    if (buffer.get() == NULL) {
+        buffer.reset(new RecordBuffer(keyBufferSizeBytes_, valueBufferSizeBytes_));
+    }
+    itr.init(db, const_cast<std::string&>(startKey), startKeyIncluded, const_cast<std::string&>(endKey), endKeyIncluded, order, txn);
+    setValueRange(itr, options);
+    readRecords(_return, itr, *buffer, maxRecords, maxBytes);
+}
+
+/**
+ * Sets up partial gets, so that BDB copies only the requested part of 
+ * each value into the record buffer, and the filter.
+ */
+void BdbServerHandler::
+setValueRange(BdbIterator& itr, const ScanOptions& options)
+{
+    itr.setFilter(options.filter);
+    if (options.keysOnly) {
+        itr.setValueRange(0, 0);
+    } else if (!isFullValue(options)) {
+        itr.setValueRange(projectionOffset(options), projectionLength(options));
+    }
+}
 
+void BdbServerHandler::
+readRecords(RecordListResponse& _return, BdbIterator& itr, RecordBuffer& buffer,
+            const int32_t maxRecords, const int32_t maxBytes)
+{
     int32_t resultSize = 0;
     _return.responseCode = ResponseCode::Success;
     while ((maxRecords == 0 || (int32_t)(_return.records.size()) < maxRecords) && 
            (maxBytes == 0 || resultSize < maxBytes)) {
-        BdbIterator::ResponseCode rc = itr.next(*buffer);
+        BdbIterator::ResponseCode rc = itr.next(buffer);
         if (rc == BdbIterator::ScanEnded) {
             _return.responseCode = ResponseCode::ScanEnded;
             break;
@@ -239,13 +341,273 @@ scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::t
             break;
         }
         Record rec;
-        rec.key.assign(buffer->getKeyBuffer(), buffer->getKeySize());
-        rec.value.assign(buffer->getValueBuffer(), buffer->getValueSize());
+        rec.key.assign(buffer.getKeyBuffer(), buffer.getKeySize());
+        rec.value.assign(buffer.getValueBuffer(), buffer.getValueSize());
         _return.records.push_back(rec);
-        resultSize += buffer->getKeySize() + buffer->getValueSize();
+        resultSize += buffer.getKeySize() + buffer.getValueSize();
     } 
 }
 
+void BdbServerHandler::
+openScan(ScanCursorResponse& _return, const std::string& mapName, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const ScanOptions& options)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    boost::shared_ptr<ScanCursor> cursor(new ScanCursor(mapName, keyBufferSizeBytes_, valueBufferSizeBytes_));
+
+    // The snapshot transaction doesn't hold any read locks, so an idle
+    // cursor doesn't block writers.
+    int rc = env_->txn_begin(NULL, &cursor->txn, DB_TXN_SNAPSHOT);
+    if (rc != 0) {
+        fprintf(stderr, "DbEnv::txn_begin() returned: %s", db_strerror(rc));
+        cursor->txn = NULL;
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    if (cursor->itr.init(mapItr->second, startKey, startKeyIncluded, 
+                         endKey, endKeyIncluded, order, cursor->txn) != BdbIterator::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    setValueRange(cursor->itr, options);
+    _return.cursorId = cursors_.add(cursor);
+    _return.responseCode = _return.cursorId ? ResponseCode::Success : ResponseCode::TooManyCursors;
+}
+
+void BdbServerHandler::
+nextScan(RecordListResponse& _return, const int64_t cursorId,
+         const int32_t maxRecords, const int32_t maxBytes)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::shared_ptr<ScanCursor> cursor = cursors_.get(cursorId);
+    if (!cursor) {
+        _return.responseCode = ResponseCode::CursorNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock cursorLock(cursor->mutex);
+    readRecords(_return, cursor->itr, cursor->buffer, maxRecords, maxBytes);
+    if (_return.responseCode != ResponseCode::Success) {
+        cursors_.remove(cursorId);
+    }
+}
+
+ResponseCode::type BdbServerHandler::
+closeScan(const int64_t cursorId)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    if (!cursors_.remove(cursorId)) {
+        return ResponseCode::CursorNotFound;
+    }
+    return ResponseCode::Success;
+}
+
+void BdbServerHandler::
+createSnapshot(SnapshotResponse& _return, const std::string& mapName)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    boost::shared_ptr<Snapshot> snapshot(new Snapshot(mapName, mapItr->second));
+
+    // same as openScan, the snapshot transaction doesn't block writers.
+    int rc = env_->txn_begin(NULL, &snapshot->txn, DB_TXN_SNAPSHOT);
+    if (rc != 0) {
+        fprintf(stderr, "DbEnv::txn_begin() returned: %s", db_strerror(rc));
+        snapshot->txn = NULL;
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.snapshotId = snapshots_.add(snapshot);
+    _return.responseCode = _return.snapshotId ? ResponseCode::Success : ResponseCode::TooManySnapshots;
+}
+
+ResponseCode::type BdbServerHandler::
+releaseSnapshot(const int64_t snapshotId)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    if (!snapshots_.remove(snapshotId)) {
+        return ResponseCode::SnapshotNotFound;
+    }
+    return ResponseCode::Success;
+}
+
+void BdbServerHandler::
+getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& recordName)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+    if (!snapshot) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock snapshotLock(snapshot->mutex);
+    getRecord(_return, snapshot->db, recordName, snapshot->txn);
+}
+
+void BdbServerHandler::
+scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+    if (!snapshot) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock snapshotLock(snapshot->mutex);
+    scanRecords(_return, snapshot->db, order, startKey, startKeyIncluded,
+                endKey, endKeyIncluded, maxRecords, maxBytes, options, snapshot->txn);
+}
+
+void BdbServerHandler::
+countRange(Int64Response& _return, const std::string& mapName, 
+           const std::string& startKey, const std::string& endKey)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    BdbIterator itr;
+    if (itr.init(mapItr->second, startKey, true, endKey, false, ScanOrder::Ascending) != BdbIterator::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    // only the keys are copied out.
+    itr.setValueRange(0, 0);
+    RecordBuffer buffer(keyBufferSizeBytes_, 0);
+    BdbIterator::ResponseCode rc;
+    _return.value = 0;
+    while ((rc = itr.next(buffer)) == BdbIterator::Success) {
+        _return.value++;
+    }
+    _return.responseCode = rc == BdbIterator::ScanEnded ? ResponseCode::Success : ResponseCode::Error;
+}
+
+void BdbServerHandler::
+aggregate(AggregateResponse& _return, const std::string& mapName,
+          const std::string& startKey, const std::string& endKey,
+          const AggregateOp::type op, const ValueEncoding::type encoding)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    Aggregator aggregator(op, encoding);
+    if (!aggregator.isValid()) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    BdbIterator itr;
+    if (itr.init(mapItr->second, startKey, true, endKey, false, ScanOrder::Ascending) != BdbIterator::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    if (!aggregator.needsValues()) {
+        itr.setValueRange(0, 0);
+    }
+    RecordBuffer buffer(keyBufferSizeBytes_, aggregator.needsValues() ? valueBufferSizeBytes_ : 0);
+    BdbIterator::ResponseCode rc;
+    while ((rc = itr.next(buffer)) == BdbIterator::Success) {
+        aggregator.add(buffer.getValueBuffer(), buffer.getValueSize());
+    }
+    aggregator.getResult(_return);
+    _return.responseCode = rc == BdbIterator::ScanEnded ? ResponseCode::Success : ResponseCode::Error;
+}
+
+void BdbServerHandler::
+approximateSize(Int64Response& _return, const std::string& mapName, 
+                const std::string& startKey, const std::string& endKey)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    uint64_t size = 0;
+    if (mapItr->second->approximateSize(startKey, endKey, size) != Bdb::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.value = size;
+    _return.responseCode = ResponseCode::Success;
+}
+
+void BdbServerHandler::
+sampleSplitPoints(KeyListResponse& _return, const std::string& mapName, const int32_t numSplits)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    if (!validSplitCount(numSplits) ||
+        mapItr->second->sampleSplitPoints(numSplits, _return.keys) != Bdb::Success) {
+        _return.keys.clear();
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.responseCode = ResponseCode::Success;
+}
+
+BdbServerHandler::ScanCursor::
+ScanCursor(const std::string& mapName_, uint32_t keyBufferSizeBytes, uint32_t valueBufferSizeBytes) :
+    mapName(mapName_),
+    txn(NULL),
+    buffer(keyBufferSizeBytes, valueBufferSizeBytes)
+{
+}
+
+BdbServerHandler::ScanCursor::
+~ScanCursor()
+{
+    // the iterator's cursor must be closed before the transaction ends.
+    itr.close();
+    if (txn != NULL) {
+        int rc = txn->commit(0);
+        if (rc != 0) {
+            fprintf(stderr, "DbTxn::commit() returned: %s", db_strerror(rc));
+        }
+    }
+}
+
+BdbServerHandler::Snapshot::
+Snapshot(const std::string& mapName_, Bdb* db_) :
+    mapName(mapName_),
+    db(db_),
+    txn(NULL)
+{
+}
+
+BdbServerHandler::Snapshot::
+~Snapshot()
+{
+    if (txn != NULL) {
+        int rc = txn->commit(0);
+        if (rc != 0) {
+            fprintf(stderr, "DbTxn::commit() returned: %s", db_strerror(rc));
+        }
+    }
+}
+
 void BdbServerHandler::
 get(BinaryResponse& _return, const std::string& mapName, const std::string& recordName) 
 {
@@ -255,7 +617,13 @@ get(BinaryResponse& _return, const std::string& mapName, const std::string& reco
         _return.responseCode = ResponseCode::MapNotFound;
         return;
     }
-    Bdb::ResponseCode dbrc = itr->second->get(recordName, _return.value);
+    getRecord(_return, itr->second, recordName);
+}
+
+void BdbServerHandler::
+getRecord(BinaryResponse& _return, Bdb* db, const std::string& recordName, DbTxn* txn) 
+{
+    Bdb::ResponseCode dbrc = db->get(recordName, _return.value, txn);
     if (dbrc == Bdb::Success) {
         _return.responseCode = ResponseCode::Success;
     } else if (dbrc == Bdb::KeyNotFound) {
@@ -265,17 +633,53 @@ get(BinaryResponse& _return, const std::string& mapName, const std::string& reco
     }
 }
 
+void BdbServerHandler::
+multiGet(BinaryListResponse& _return, const std::string& mapName, const std::vector<std::string>& recordNames) 
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    std::vector<std::string> values;
+    std::vector<Bdb::ResponseCode> results;
+    if (itr->second->multiGet(recordNames, values, results) != Bdb::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.responses.resize(recordNames.size());
+    for (size_t i = 0; i < recordNames.size(); i++) {
+        if (results[i] == Bdb::Success) {
+            _return.responses[i].responseCode = ResponseCode::Success;
+            _return.responses[i].value.swap(values[i]);
+        } else if (results[i] == Bdb::KeyNotFound) {
+            _return.responses[i].responseCode = ResponseCode::RecordNotFound;
+        } else {
+            _return.responses[i].responseCode = ResponseCode::Error;
+        }
+    }
+    _return.responseCode = ResponseCode::Success;
+}
+
 ResponseCode::type BdbServerHandler::
 put(const std::string& mapName, 
        const std::string& recordName, 
-       const std::string& recordBody) 
+       const std::string& recordBody,
+       const WriteOptions& options) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
     if (itr == maps_.end()) {
         return ResponseCode::MapNotFound;
     }
-    Bdb::ResponseCode dbrc = itr->second->insert(recordName, recordBody);
+    return putRecord(itr->second, recordName, recordBody);
+}
+
+ResponseCode::type BdbServerHandler::
+putRecord(Bdb* db, const std::string& recordName, const std::string& recordBody) 
+{
+    Bdb::ResponseCode dbrc = db->insert(recordName, recordBody);
     if (dbrc == Bdb::KeyExists) {
         return ResponseCode::RecordExists;
     } else if (dbrc != Bdb::Success) {
@@ -287,7 +691,8 @@ put(const std::string& mapName,
 ResponseCode::type BdbServerHandler::
 insert(const std::string& mapName, 
        const std::string& recordName, 
-       const std::string& recordBody) 
+       const std::string& recordBody,
+       const WriteOptions& options) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
@@ -307,13 +712,34 @@ insert(const std::string& mapName,
 ResponseCode::type BdbServerHandler::
 insertMany(const std::string& databaseName, const std::vector<Record> & records)
 {
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(databaseName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    Bdb::ResponseCode dbrc = itr->second->insertMany(records);
+    if (dbrc == Bdb::KeyExists) {
+        return ResponseCode::RecordExists;
+    } else if (dbrc != Bdb::Success) {
+        return ResponseCode::Error;
+    }
     return ResponseCode::Success;
 }
 
+/**
+ * Only the LevelDB backend can load table files directly.
+ */
+ResponseCode::type BdbServerHandler::
+ingestFile(const std::string& databaseName, const std::string& path)
+{
+    return ResponseCode::Error;
+}
+
 ResponseCode::type BdbServerHandler::
 update(const std::string& mapName, 
        const std::string& recordName, 
-       const std::string& recordBody) 
+       const std::string& recordBody,
+       const WriteOptions& options) 
 {
     boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
     boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
@@ -331,6 +757,74 @@ update(const std::string& mapName,
     }
 }
 
+ResponseCode::type BdbServerHandler::
+compareAndSet(const std::string& mapName, 
+              const std::string& recordName, 
+              const std::string& expectedBody,
+              const std::string& recordBody) 
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+ 
+    Bdb::ResponseCode dbrc = itr->second->compareAndSet(recordName, expectedBody, recordBody);
+    if (dbrc == Bdb::Success) {
+        return ResponseCode::Success;
+    } else if (dbrc == Bdb::KeyNotFound) {
+        return ResponseCode::RecordNotFound;
+    } else if (dbrc == Bdb::ValueMismatch) {
+        return ResponseCode::ValueMismatch;
+    } else {
+        return ResponseCode::Error;
+    }
+}
+
+void BdbServerHandler::
+increment(Int64Response& _return,
+          const std::string& mapName, 
+          const std::string& recordName, 
+          const int64_t delta) 
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+
+    std::string operand;
+    std::string result;
+    encodeCounter(delta, operand);
+    Bdb::ResponseCode dbrc = itr->second->merge(recordName, operand, mergeIncrement, result);
+    if (dbrc != Bdb::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    decodeCounter(result, _return.value);
+    _return.responseCode = ResponseCode::Success;
+}
+
+ResponseCode::type BdbServerHandler::
+append(const std::string& mapName, 
+       const std::string& recordName, 
+       const std::string& recordBody) 
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+
+    std::string result;
+    Bdb::ResponseCode dbrc = itr->second->merge(recordName, recordBody, mergeAppend, result);
+    if (dbrc != Bdb::Success) {
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
 ResponseCode::type BdbServerHandler::
 remove(const std::string& mapName, const std::string& recordName) 
 {
@@ -349,8 +843,53 @@ remove(const std::string& mapName, const std::string& recordName)
     }
 }
 
+void BdbServerHandler::
+removeRange(Int64Response& _return, const std::string& mapName, 
+            const std::string& startKey, const std::string& endKey)
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator mapItr = maps_.find(mapName);
+    if (mapItr == maps_.end()) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    uint64_t count = 0;
+    Bdb::ResponseCode dbrc = mapItr->second->removeRange(startKey, endKey, count);
+    _return.value = count;
+    _return.responseCode = dbrc == Bdb::Success ? ResponseCode::Success : ResponseCode::Error;
+}
+
+ResponseCode::type BdbServerHandler::
+writeBatch(const std::string& mapName, const std::vector<Mutation>& mutations) 
+{
+    boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+    boost::ptr_map<std::string, Bdb>::iterator itr = maps_.find(mapName);
+    if (itr == maps_.end()) {
+        return ResponseCode::MapNotFound;
+    }
+    Bdb::ResponseCode dbrc = itr->second->writeBatch(mutations);
+    if (dbrc == Bdb::Success) {
+        return ResponseCode::Success;
+    } else if (dbrc == Bdb::KeyExists) {
+        return ResponseCode::RecordExists;
+    } else if (dbrc == Bdb::KeyNotFound) {
+        return ResponseCode::RecordNotFound;
+    } else {
+        return ResponseCode::Error;
+    }
+}
+
+void BdbServerHandler::
+tailChanges(ChangeListResponse& _return, const std::string& mapName, 
+            const int64_t fromSeq, const int32_t maxRecords)
+{
+    // changes are logged by ChangeLogHandler, which main() puts in front
+    // of this handler.
+    _return.responseCode = ResponseCode::Error;
+}
+
 int main(int argc, char **argv) {
-    int port = 9090;
+    int port;
     std::string homeDir = "data";
     uint32_t pageSizeKb = 16;
     uint32_t numRetries = 100;
@@ -358,17 +897,37 @@ int main(int argc, char **argv) {
     uint32_t valueBufferSizeBytes = 10000;
     uint32_t checkpointFrequencyMs = 1000;
     uint32_t checkpointMinChangeKb = 1000;
-    shared_ptr<BdbServerHandler> handler(new BdbServerHandler());
-    handler->init(homeDir, pageSizeKb, numRetries, 
+    int changeLogSize;
+    ServerRunner runner;
+    po::variables_map vm;
+    po::options_description config("");
+    config.add_options()
+        ("help,h", "produce help message")
+        ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
+        ("change-log-size", po::value<int>(&changeLogSize)->default_value(10000), "number of changes per map to keep for tailChanges (0 to disable)")
+        ;
+    runner.addOptions(config);
+    po::options_description cmdline_options;
+    cmdline_options.add(config);
+    store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    notify(vm);
+    if (vm.count("help")) {
+        std::cout << config << std::endl;
+        exit(0);
+    }
+    shared_ptr<BdbServerHandler> server(new BdbServerHandler());
+    server->init(homeDir, pageSizeKb, numRetries, 
     keyBufferSizeBytes,
     valueBufferSizeBytes,
     checkpointFrequencyMs,
     checkpointMinChangeKb);
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server(processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    shared_ptr<MapKeeperIf> handler(server);
+    handler = runner.groupCommit(handler);
+    handler = runner.cache(handler);
+    if (changeLogSize > 0) {
+        handler.reset(new ChangeLogHandler(handler, changeLogSize));
+    }
+    handler.reset(new TtlHandler(handler));
+    runner.serve(handler, port);
     return 0;
 }
@@ -22,6 +22,10 @@
 #include <transport/TBufferTransports.h>
 #include <db_cxx.h>
 #include "Bdb.h"
+#include "BdbIterator.h"
+#include "RecordBuffer.h"
+#include "CursorTable.h"
+#include "MapHandleTable.h"
 #include "MapKeeper.h"
 
 using namespace ::apache::thrift;
@@ -40,21 +44,104 @@ public:
              uint32_t keyBufferSizeBytes, uint32_t valueBufferSizeBytes,
              uint32_t checkpointFrequencyMs, uint32_t checkpointMinChangeKb);
     ResponseCode::type ping();
+    void getStats(StatsResponse& _return, const bool reset);
     ResponseCode::type addMap(const std::string& databaseName);
     ResponseCode::type dropMap(const std::string& databaseName);
     void listMaps(StringListResponse& _return);
+    void openMap(MapHandleResponse& _return, const std::string& databaseName);
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& recordName);
+    ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& recordName, const std::string& recordBody);
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options);
     void scan(RecordListResponse& _return, const std::string& databaseName, const ScanOrder::type order, 
             const std::string& startKey, const bool startKeyIncluded,
             const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options);
+    void openScan(ScanCursorResponse& _return, const std::string& databaseName, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const ScanOptions& options);
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
             const int32_t maxRecords, const int32_t maxBytes);
+    ResponseCode::type closeScan(const int64_t cursorId);
+    void createSnapshot(SnapshotResponse& _return, const std::string& databaseName);
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId);
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& recordName);
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options);
+    void countRange(Int64Response& _return, const std::string& databaseName, 
+            const std::string& startKey, const std::string& endKey);
+    void approximateSize(Int64Response& _return, const std::string& databaseName, 
+            const std::string& startKey, const std::string& endKey);
+    void sampleSplitPoints(KeyListResponse& _return, const std::string& databaseName,
+            const int32_t numSplits);
+    void aggregate(AggregateResponse& _return, const std::string& databaseName,
+            const std::string& startKey, const std::string& endKey,
+            const AggregateOp::type op, const ValueEncoding::type encoding);
     void get(BinaryResponse& _return, const std::string& databaseName, const std::string& recordName);
-    ResponseCode::type put(const std::string& databaseName, const std::string& recordName, const std::string& recordBody);
-    ResponseCode::type insert(const std::string& databaseName, const std::string& recordName, const std::string& recordBody);
+    void multiGet(BinaryListResponse& _return, const std::string& databaseName, const std::vector<std::string>& recordNames);
+    ResponseCode::type put(const std::string& databaseName, const std::string& recordName, const std::string& recordBody,
+            const WriteOptions& options);
+    ResponseCode::type insert(const std::string& databaseName, const std::string& recordName, const std::string& recordBody,
+            const WriteOptions& options);
     ResponseCode::type insertMany(const std::string& databaseName, const std::vector<Record> & records);
-    ResponseCode::type update(const std::string& databaseName, const std::string& recordName, const std::string& recordBody);
+    ResponseCode::type ingestFile(const std::string& databaseName, const std::string& path);
+    ResponseCode::type update(const std::string& databaseName, const std::string& recordName, const std::string& recordBody,
+            const WriteOptions& options);
+    ResponseCode::type compareAndSet(const std::string& databaseName, const std::string& recordName, 
+            const std::string& expectedBody, const std::string& recordBody);
+    void increment(Int64Response& _return, const std::string& databaseName, const std::string& recordName, const int64_t delta);
+    ResponseCode::type append(const std::string& databaseName, const std::string& recordName, const std::string& recordBody);
     ResponseCode::type remove(const std::string& databaseName, const std::string& recordName);
+    void removeRange(Int64Response& _return, const std::string& databaseName, 
+            const std::string& startKey, const std::string& endKey);
+    ResponseCode::type writeBatch(const std::string& databaseName, const std::vector<Mutation>& mutations);
+    void tailChanges(ChangeListResponse& _return, const std::string& databaseName, 
+            const int64_t fromSeq, const int32_t maxRecords);
 
 private:
+    /**
+     * State of a scan opened with openScan.
+     */
+    struct ScanCursor {
+        ScanCursor(const std::string& mapName_, uint32_t keyBufferSizeBytes, uint32_t valueBufferSizeBytes);
+        ~ScanCursor();
+        std::string mapName;
+        DbTxn* txn;
+        BdbIterator itr;
+        RecordBuffer buffer;
+        boost::mutex mutex; // serialize nextScan calls on this cursor
+    };
+
+    /**
+     * A snapshot transaction handed out by createSnapshot.
+     */
+    struct Snapshot {
+        Snapshot(const std::string& mapName_, Bdb* db_);
+        ~Snapshot();
+        std::string mapName;
+        Bdb* db;
+        DbTxn* txn;
+        boost::mutex mutex; // serialize reads in the transaction
+    };
+
+    void getRecord(BinaryResponse& _return, Bdb* db, const std::string& recordName, DbTxn* txn = NULL);
+    ResponseCode::type putRecord(Bdb* db, const std::string& recordName, const std::string& recordBody);
+    void scanRecords(RecordListResponse& _return, Bdb* db, const ScanOrder::type order, 
+            const std::string& startKey, const bool startKeyIncluded,
+            const std::string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options, DbTxn* txn = NULL);
+    static void setValueRange(BdbIterator& itr, const ScanOptions& options);
+    void readRecords(RecordListResponse& _return, BdbIterator& itr, RecordBuffer& buffer,
+            const int32_t maxRecords, const int32_t maxBytes);
     void checkpoint(uint32_t checkpointFrequencyMs, uint32_t checkpointMinChangeKb);
     void initEnv(const std::string& homeDir);
     static void bdbMessageCallback(const DbEnv *dbenv, const char *errpfx, const char *msg);
@@ -65,4 +152,7 @@ private:
     uint32_t keyBufferSizeBytes_;
     uint32_t valueBufferSizeBytes_;
     static std::string DBNAME_PREFIX;
+    CursorTable<ScanCursor> cursors_;
+    CursorTable<Snapshot> snapshots_;
+    MapHandleTable<Bdb*> handles_;
 };
@@ -93,6 +93,19 @@ class BdbJavaServer implements MapKeeper.Iface {
         return ResponseCode.Success;
     }
 
+    /**
+     * Latency stats aren't kept by this server.
+     *
+     * @return StatsResponse
+     *              responseCode - Error
+     */
+    public StatsResponse getStats(boolean reset) throws TException
+    {
+        StatsResponse response = new StatsResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
     /**
      * Add a new map to this persistent store.
      * 
@@ -205,6 +218,9 @@ class BdbJavaServer implements MapKeeper.Iface {
      * @param maxBytes Advise scan to return at most $maxBytes bytes. This
      *                 method is not required to strictly keep the response
      *                 size less than $maxBytes bytes.
+     * @param options  keysOnly, valueOffset and valueLength are applied to
+     *                 the values returned. Scan filters aren't supported, and
+     *                 a scan with a filter returns Error.
      * @return RecordListResponse
      *             responseCode - Success if the scan was successful
      *                          - ScanEnded if the scan was successful and
@@ -216,7 +232,7 @@ class BdbJavaServer implements MapKeeper.Iface {
     public RecordListResponse scan(String databaseName, ScanOrder order, 
         ByteBuffer startKey, boolean startKeyIncluded, 
         ByteBuffer endKey, boolean endKeyIncluded, 
-        int maxRecords, int maxBytes) throws TException 
+        int maxRecords, int maxBytes, ScanOptions options) throws TException 
     {
         this.readLock.lock();
         RecordListResponse response = new RecordListResponse();
@@ -227,11 +243,17 @@ class BdbJavaServer implements MapKeeper.Iface {
                 response.responseCode = ResponseCode.MapNotFound;
                 return response;
             }
+            if (options == null) {
+                options = new ScanOptions();
+            } else if (options.isSetFilter()) {
+                response.responseCode = ResponseCode.Error;
+                return response;
+            }
             cursor = db.openCursor(null, null);
             if (order == ScanOrder.Ascending) {
-                return scanAscending(cursor, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+                return scanAscending(cursor, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
             } else {
-                return scanDescending(cursor, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+                return scanDescending(cursor, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
             }
         } catch (DatabaseException ex) {
             response.responseCode = ResponseCode.Error;
@@ -247,11 +269,14 @@ class BdbJavaServer implements MapKeeper.Iface {
     public RecordListResponse scanAscending(Cursor cursor,
         ByteBuffer startKey, boolean startKeyIncluded, 
         ByteBuffer endKey, boolean endKeyIncluded, 
-        int maxRecords, int maxBytes) throws TException  {
+        int maxRecords, int maxBytes, ScanOptions options) throws TException  {
         RecordListResponse response = new RecordListResponse();
         try {
             DatabaseEntry key = new DatabaseEntry(startKey.array(), startKey.position(), startKey.remaining());
             DatabaseEntry value = new DatabaseEntry();
+            if (options.keysOnly) {
+                value.setPartial(0, 0, true);
+            }
             OperationStatus status = cursor.getSearchKeyRange(key, value, null);
             int numBytes = 0;
             while (true) {
@@ -271,8 +296,9 @@ class BdbJavaServer implements MapKeeper.Iface {
                         break;
                     }
                 }
-                response.addToRecords(new Record(currentKey, ByteBuffer.wrap(value.getData())));
-                numBytes += key.getData().length + value.getData().length;
+                ByteBuffer currentValue = project(value.getData(), options);
+                response.addToRecords(new Record(currentKey, currentValue));
+                numBytes += key.getData().length + currentValue.remaining();
                 if (response.records.size() == maxRecords || numBytes >= maxBytes) {
                     response.responseCode = ResponseCode.Success;
                     break;
@@ -288,11 +314,14 @@ class BdbJavaServer implements MapKeeper.Iface {
     public RecordListResponse scanDescending(Cursor cursor,
         ByteBuffer startKey, boolean startKeyIncluded, 
         ByteBuffer endKey, boolean endKeyIncluded, 
-        int maxRecords, int maxBytes) throws TException  {
+        int maxRecords, int maxBytes, ScanOptions options) throws TException  {
         RecordListResponse response = new RecordListResponse();
         try {
             DatabaseEntry key = new DatabaseEntry(endKey.array(), endKey.position(), endKey.remaining());
             DatabaseEntry value = new DatabaseEntry();
+            if (options.keysOnly) {
+                value.setPartial(0, 0, true);
+            }
             OperationStatus status = OperationStatus.SUCCESS;
             if (endKey.remaining() > 0) {
                 status = cursor.getSearchKeyRange(key, value, null);
@@ -325,8 +354,9 @@ class BdbJavaServer implements MapKeeper.Iface {
                         break;
                     }
                 }
-                response.addToRecords(new Record(currentKey, ByteBuffer.wrap(value.getData())));
-                numBytes += key.getData().length + value.getData().length;
+                ByteBuffer currentValue = project(value.getData(), options);
+                response.addToRecords(new Record(currentKey, currentValue));
+                numBytes += key.getData().length + currentValue.remaining();
                 if (response.records.size() == maxRecords || numBytes >= maxBytes) {
                     response.responseCode = ResponseCode.Success;
                     break;
@@ -340,6 +370,162 @@ class BdbJavaServer implements MapKeeper.Iface {
         return response;
     }
 
+    /**
+     * Applies keysOnly, valueOffset and valueLength of scan options to a
+     * value.
+     */
+    private static ByteBuffer project(byte[] value, ScanOptions options) {
+        if (options.keysOnly) {
+            return ByteBuffer.allocate(0);
+        }
+        int offset = Math.max(options.valueOffset, 0);
+        if (offset >= value.length) {
+            return ByteBuffer.allocate(0);
+        }
+        int length = value.length - offset;
+        if (options.valueLength >= 0 && options.valueLength < length) {
+            length = options.valueLength;
+        }
+        return ByteBuffer.wrap(value, offset, length).slice();
+    }
+
+    private static DatabaseEntry entry(ByteBuffer buffer) {
+        return new DatabaseEntry(buffer.array(), buffer.position(), buffer.remaining());
+    }
+
+    /**
+     * Map handles aren't supported by this server.
+     *
+     * @return MapHandleResponse
+     *              responseCode - Error
+     */
+    public MapHandleResponse openMap(String databaseName) throws TException
+    {
+        MapHandleResponse response = new MapHandleResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public BinaryResponse getByHandle(int mapHandle, ByteBuffer recordKey) throws TException
+    {
+        BinaryResponse response = new BinaryResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public ResponseCode putByHandle(int mapHandle, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    {
+        return ResponseCode.Error;
+    }
+
+    public RecordListResponse scanByHandle(int mapHandle, ScanOrder order, 
+        ByteBuffer startKey, boolean startKeyIncluded, 
+        ByteBuffer endKey, boolean endKeyIncluded, 
+        int maxRecords, int maxBytes, ScanOptions options) throws TException 
+    {
+        RecordListResponse response = new RecordListResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    /**
+     * Scan cursors aren't supported by this server. Clients page through
+     * a map with scan instead.
+     *
+     * @return ScanCursorResponse
+     *              responseCode - Error
+     */
+    public ScanCursorResponse openScan(String databaseName, ScanOrder order, 
+        ByteBuffer startKey, boolean startKeyIncluded, 
+        ByteBuffer endKey, boolean endKeyIncluded, 
+        ScanOptions options) throws TException 
+    {
+        ScanCursorResponse response = new ScanCursorResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public RecordListResponse nextScan(long cursorId, int maxRecords, int maxBytes) throws TException
+    {
+        RecordListResponse response = new RecordListResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public ResponseCode closeScan(long cursorId) throws TException
+    {
+        return ResponseCode.Error;
+    }
+
+    /**
+     * Snapshots aren't supported by this server.
+     *
+     * @return SnapshotResponse
+     *              responseCode - Error
+     */
+    public SnapshotResponse createSnapshot(String databaseName) throws TException
+    {
+        SnapshotResponse response = new SnapshotResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public ResponseCode releaseSnapshot(long snapshotId) throws TException
+    {
+        return ResponseCode.Error;
+    }
+
+    public BinaryResponse getAtSnapshot(long snapshotId, ByteBuffer recordKey) throws TException
+    {
+        BinaryResponse response = new BinaryResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public RecordListResponse scanAtSnapshot(long snapshotId, ScanOrder order, 
+        ByteBuffer startKey, boolean startKeyIncluded, 
+        ByteBuffer endKey, boolean endKeyIncluded, 
+        int maxRecords, int maxBytes, ScanOptions options) throws TException 
+    {
+        RecordListResponse response = new RecordListResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    /**
+     * Range statistics and aggregates aren't supported by this server.
+     *
+     * @return Error
+     */
+    public Int64Response countRange(String databaseName, ByteBuffer startKey, ByteBuffer endKey) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public Int64Response approximateSize(String databaseName, ByteBuffer startKey, ByteBuffer endKey) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public KeyListResponse sampleSplitPoints(String databaseName, int numSplits) throws TException
+    {
+        KeyListResponse response = new KeyListResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public AggregateResponse aggregate(String databaseName, ByteBuffer startKey, ByteBuffer endKey,
+        AggregateOp op, ValueEncoding encoding) throws TException
+    {
+        AggregateResponse response = new AggregateResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
     /**
      * Retrieves a record from a database.
      * 
@@ -378,18 +564,71 @@ class BdbJavaServer implements MapKeeper.Iface {
         }
     }
 
+    /**
+     * Retrieves multiple records from a database.
+     * 
+     * @param databaseName
+     * @param recordKeys
+     * @return BinaryListResponse
+     *              responseCode - Success
+     *                             MapNotFound database doesn't exist.
+     *                             Error on any other errors.
+     *              responses - a response for each key, in the same order,
+     *                          as get would return it.
+     */
+    public BinaryListResponse multiGet(String databaseName, List<ByteBuffer> recordKeys) throws TException
+    {
+        this.readLock.lock();
+        try {
+            BinaryListResponse response = new BinaryListResponse();
+            Database db = this.db.get(databaseName);
+            if (db == null) {
+                response.responseCode = ResponseCode.MapNotFound;
+                return response;
+            }
+            response.responses = new ArrayList<BinaryResponse>(recordKeys.size());
+            for (ByteBuffer recordKey : recordKeys) {
+                BinaryResponse record = new BinaryResponse();
+                DatabaseEntry value = new DatabaseEntry();
+                OperationStatus status = db.get(null, entry(recordKey), value, LockMode.READ_COMMITTED);
+                if (status == OperationStatus.NOTFOUND) {
+                    record.responseCode = ResponseCode.RecordNotFound;
+                } else {
+                    record.responseCode = ResponseCode.Success;
+                    record.value = ByteBuffer.wrap(value.getData());
+                }
+                response.responses.add(record);
+            }
+            response.responseCode = ResponseCode.Success;
+            return response;
+        } catch (DatabaseException ex) {
+            logger.error(ex.getMessage());
+            BinaryListResponse response = new BinaryListResponse();
+            response.responseCode = ResponseCode.Error;
+            return response;
+        } finally {
+            this.readLock.unlock();
+        }
+    }
+
     /**
      * Puts a record into a database.
      * 
      * @param databaseName
      * @param recordKey
      * @param recordValue
+     * @param options  TTLs aren't supported; a write with a TTL returns Error.
      * @return Success
      *         MapNotFound database doesn't exist.
      *         Error
      */
-    public ResponseCode put(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    public ResponseCode put(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue,
+        WriteOptions options) throws TException
     {
+        if (options != null && options.ttlSeconds != 0) {
+            // TTLs aren't supported.
+            return ResponseCode.Error;
+        }
         this.readLock.lock();
         try {
             Database db = this.db.get(databaseName);
@@ -412,13 +651,19 @@ class BdbJavaServer implements MapKeeper.Iface {
      * @param databaseName
      * @param recordKey
      * @param recordValue
+     * @param options  TTLs aren't supported; a write with a TTL returns Error.
      * @return Success
      *          MapNotFound database doesn't exist.
      *          RecordExists
      *          Error
      */
-    public ResponseCode insert(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    public ResponseCode insert(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue,
+        WriteOptions options) throws TException
     {
+        if (options != null && options.ttlSeconds != 0) {
+            // TTLs aren't supported.
+            return ResponseCode.Error;
+        }
         this.readLock.lock();
         try {
             Database db = this.db.get(databaseName);
@@ -463,19 +708,35 @@ class BdbJavaServer implements MapKeeper.Iface {
         }
     }
     
+    /**
+     * Bulk ingest isn't supported by this server.
+     *
+     * @return Error
+     */
+    public ResponseCode ingestFile(String databaseName, String path) throws TException
+    {
+        return ResponseCode.Error;
+    }
+
     /**
      * Updates a record in a database.
      * 
      * @param databaseName
      * @param recordKey
      * @param recordValue
+     * @param options  TTLs aren't supported; a write with a TTL returns Error.
      * @return Success
      *          MapNotFound map doesn't exist.
      *          RecordNotFound
      *          Error
      */
-    public ResponseCode update(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    public ResponseCode update(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue,
+        WriteOptions options) throws TException
     {
+        if (options != null && options.ttlSeconds != 0) {
+            // TTLs aren't supported.
+            return ResponseCode.Error;
+        }
         Transaction txn = null;
         Cursor cursor = null;
         this.readLock.lock();
@@ -541,6 +802,120 @@ class BdbJavaServer implements MapKeeper.Iface {
         }
     }
 
+    /**
+     * Conditional and read-modify-write updates aren't supported by this
+     * server.
+     *
+     * @return Error
+     */
+    public ResponseCode compareAndSet(String databaseName, ByteBuffer recordKey,
+        ByteBuffer expectedValue, ByteBuffer newValue) throws TException
+    {
+        return ResponseCode.Error;
+    }
+
+    public Int64Response increment(String databaseName, ByteBuffer recordKey, long delta) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    public ResponseCode append(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    {
+        return ResponseCode.Error;
+    }
+
+    /**
+     * Range removes aren't supported by this server.
+     *
+     * @return Error
+     */
+    public Int64Response removeRange(String databaseName, ByteBuffer startKey, ByteBuffer endKey) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
+    /**
+     * Applies a list of mutations to a database in one transaction.
+     * 
+     * Either all the mutations are applied or none is.
+     * 
+     * @param databaseName
+     * @param mutations
+     * @return Success
+     *          MapNotFound map doesn't exist.
+     *          RecordExists an insert found an existing record.
+     *          RecordNotFound an update or remove found no record.
+     *          Error
+     */
+    public ResponseCode writeBatch(String databaseName, List<Mutation> mutations) throws TException
+    {
+        Transaction txn = null;
+        this.readLock.lock();
+        try {
+            Database db = this.db.get(databaseName);
+            if (db == null) {
+                return ResponseCode.MapNotFound;
+            }
+            txn = env.beginTransaction(null, null);
+            for (Mutation mutation : mutations) {
+                DatabaseEntry key = entry(mutation.key);
+                OperationStatus status;
+                if (mutation.type == MutationType.Put) {
+                    status = db.put(txn, key, entry(mutation.value));
+                } else if (mutation.type == MutationType.Insert) {
+                    status = db.putNoOverwrite(txn, key, entry(mutation.value));
+                    if (status == OperationStatus.KEYEXIST) {
+                        txn.abort();
+                        txn = null;
+                        return ResponseCode.RecordExists;
+                    }
+                } else if (mutation.type == MutationType.Update) {
+                    DatabaseEntry value = new DatabaseEntry();
+                    value.setPartial(0, 0, true);
+                    status = db.get(txn, key, value, LockMode.RMW);
+                    if (status == OperationStatus.SUCCESS) {
+                        status = db.put(txn, key, entry(mutation.value));
+                    }
+                } else {
+                    status = db.delete(txn, key);
+                }
+                if (status == OperationStatus.NOTFOUND) {
+                    txn.abort();
+                    txn = null;
+                    return ResponseCode.RecordNotFound;
+                }
+            }
+            txn.commit();
+            txn = null;
+            return ResponseCode.Success;
+        } catch (DatabaseException ex) {
+            logger.error(ex.getMessage());
+            return ResponseCode.Error;
+        } finally {
+            if (txn != null) {
+                txn.abort();
+            }
+            this.readLock.unlock();
+        }
+    }
+
+    /**
+     * Writes aren't logged by this server.
+     *
+     * @return ChangeListResponse
+     *              responseCode - Error
+     */
+    public ChangeListResponse tailChanges(String databaseName, long fromSeq, int maxRecords) throws TException
+    {
+        ChangeListResponse response = new ChangeListResponse();
+        response.responseCode = ResponseCode.Error;
+        return response;
+    }
+
     public static void main(String argv[]) {
         Logger logger = LoggerFactory.getLogger(BdbJavaServer.class);
         try {
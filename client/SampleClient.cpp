@@ -17,7 +17,14 @@
 #include <arpa/inet.h>
 #include <boost/lexical_cast.hpp>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unistd.h>
 #include "MapKeeper.h"
+#include "PipelinedClient.h"
+#include "ScanStreamClient.h"
 #include <protocol/TBinaryProtocol.h>
 #include <transport/TServerSocket.h>
 #include <transport/TSocket.h>
@@ -34,24 +41,25 @@ using namespace mapkeeper;
 
 void testScan(mapkeeper::MapKeeperClient& client) {
     mapkeeper::RecordListResponse scanResponse;
+    mapkeeper::ScanOptions options;
     string mapName("scan_test");
     assert(mapkeeper::ResponseCode::Success == client.addMap("scan_test"));
 
     // test scanning empty map
-    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 1000, 1000);
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 1000, 1000, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
     assert(scanResponse.records.size() == 0);
-    client.scan(scanResponse, mapName, ScanOrder::Descending, "", true, "", true, 1000, 1000);
+    client.scan(scanResponse, mapName, ScanOrder::Descending, "", true, "", true, 1000, 1000, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
     assert(scanResponse.records.size() == 0);
 
     for (int i = 0; i < 10; i++) {
         string key = "key" + boost::lexical_cast<string>(i);
         string val = "val" + boost::lexical_cast<string>(i);
-        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val));
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val, mapkeeper::WriteOptions()));
     }
 
-    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 1000, 1000);
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 1000, 1000, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
     assert(scanResponse.records.size() == 10);
     vector<mapkeeper::Record>::iterator itr = scanResponse.records.begin();
@@ -64,7 +72,7 @@ void testScan(mapkeeper::MapKeeperClient& client) {
     }
     assert(itr == scanResponse.records.end());
 
-    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", false, "key5", true, 1000, 1000);
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", false, "key5", true, 1000, 1000, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
     assert(scanResponse.records.size() == 6);
     itr = scanResponse.records.begin();
@@ -77,7 +85,7 @@ void testScan(mapkeeper::MapKeeperClient& client) {
     }
     assert(itr == scanResponse.records.end());
 
-    client.scan(scanResponse, mapName, ScanOrder::Ascending, "key2", true, "key7", false, 1000, 1000);
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "key2", true, "key7", false, 1000, 1000, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
     assert(scanResponse.records.size() == 5);
     itr = scanResponse.records.begin();
@@ -90,7 +98,7 @@ void testScan(mapkeeper::MapKeeperClient& client) {
     }
     assert(itr == scanResponse.records.end());
 
-    client.scan(scanResponse, mapName, ScanOrder::Descending, "key3", false, "", true, 1000, 1000);
+    client.scan(scanResponse, mapName, ScanOrder::Descending, "key3", false, "", true, 1000, 1000, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
     assert(scanResponse.records.size() == 6);
     itr = scanResponse.records.begin();
@@ -104,7 +112,7 @@ void testScan(mapkeeper::MapKeeperClient& client) {
     assert(itr == scanResponse.records.end());
 
     // test record limit
-    client.scan(scanResponse, mapName, ScanOrder::Ascending, "key4", true, "", true, 3, 1000);
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "key4", true, "", true, 3, 1000, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success);
     assert(scanResponse.records.size() == 3);
     itr = scanResponse.records.begin();
@@ -118,7 +126,7 @@ void testScan(mapkeeper::MapKeeperClient& client) {
     assert(itr == scanResponse.records.end());
 
     // test byte limit
-    client.scan(scanResponse, mapName, ScanOrder::Descending, "key4", true, "key9", false, 1000, 16);
+    client.scan(scanResponse, mapName, ScanOrder::Descending, "key4", true, "key9", false, 1000, 16, options);
     assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success);
     assert(scanResponse.records.size() == 2);
     itr = scanResponse.records.begin();
@@ -135,6 +143,713 @@ void testScan(mapkeeper::MapKeeperClient& client) {
     assert(mapkeeper::ResponseCode::Success == client.dropMap("scan_test"));
 }
 
+void testScanCursor(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::ScanCursorResponse cursorResponse;
+    mapkeeper::RecordListResponse scanResponse;
+    mapkeeper::ScanOptions options;
+    string mapName("scan_cursor_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        string key = "key" + boost::lexical_cast<string>(i);
+        string val = "val" + boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val, mapkeeper::WriteOptions()));
+    }
+
+    client.openScan(cursorResponse, "no_such_map", ScanOrder::Ascending, "", true, "", true, options);
+    assert(cursorResponse.responseCode == mapkeeper::ResponseCode::MapNotFound);
+
+    // page through the whole map, 3 records at a time
+    client.openScan(cursorResponse, mapName, ScanOrder::Ascending, "", true, "", true, options);
+    assert(cursorResponse.responseCode == mapkeeper::ResponseCode::Success);
+    int i = 0;
+    do {
+        client.nextScan(scanResponse, cursorResponse.cursorId, 3, 1000);
+        assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success ||
+               scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+        vector<mapkeeper::Record>::iterator itr;
+        for (itr = scanResponse.records.begin(); itr != scanResponse.records.end(); itr++) {
+            assert("key" + boost::lexical_cast<string>(i) == itr->key);
+            assert("val" + boost::lexical_cast<string>(i) == itr->value);
+            i++;
+        }
+    } while (scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(i == 10);
+    // the cursor is closed once the scan ends
+    client.nextScan(scanResponse, cursorResponse.cursorId, 3, 1000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::CursorNotFound);
+    assert(mapkeeper::ResponseCode::CursorNotFound == client.closeScan(cursorResponse.cursorId));
+
+    // descending scan with bounds, closed before reaching the end
+    client.openScan(cursorResponse, mapName, ScanOrder::Descending, "key2", true, "key7", false, options);
+    assert(cursorResponse.responseCode == mapkeeper::ResponseCode::Success);
+    client.nextScan(scanResponse, cursorResponse.cursorId, 2, 1000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(scanResponse.records.size() == 2);
+    assert(scanResponse.records[0].key == "key6");
+    assert(scanResponse.records[1].key == "key5");
+    client.nextScan(scanResponse, cursorResponse.cursorId, 2, 1000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(scanResponse.records.size() == 2);
+    assert(scanResponse.records[0].key == "key4");
+    assert(scanResponse.records[1].key == "key3");
+    assert(mapkeeper::ResponseCode::Success == client.closeScan(cursorResponse.cursorId));
+    client.nextScan(scanResponse, cursorResponse.cursorId, 2, 1000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::CursorNotFound);
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testScanOptions(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::ScanCursorResponse cursorResponse;
+    mapkeeper::RecordListResponse scanResponse;
+    mapkeeper::ScanOptions options;
+    string mapName("scan_options_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        string key = "key" + boost::lexical_cast<string>(i);
+        string val = "value" + boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val, mapkeeper::WriteOptions()));
+    }
+
+    // keys only
+    options.keysOnly = true;
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 1000, 1000, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 10);
+    for (int i = 0; i < 10; i++) {
+        assert("key" + boost::lexical_cast<string>(i) == scanResponse.records[i].key);
+        assert(scanResponse.records[i].value.empty());
+    }
+
+    // "value3" -> "lu"
+    options.keysOnly = false;
+    options.valueOffset = 2;
+    options.valueLength = 2;
+    client.scan(scanResponse, mapName, ScanOrder::Descending, "key3", true, "key3", true, 1000, 1000, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 1);
+    assert(scanResponse.records[0].value == "lu");
+
+    // "value8" -> "e8", and nothing past the end of the value
+    options.valueOffset = 4;
+    options.valueLength = -1;
+    client.openScan(cursorResponse, mapName, ScanOrder::Ascending, "key8", true, "", true, options);
+    assert(cursorResponse.responseCode == mapkeeper::ResponseCode::Success);
+    client.nextScan(scanResponse, cursorResponse.cursorId, 1000, 1000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 2);
+    assert(scanResponse.records[0].value == "e8");
+    assert(scanResponse.records[1].value == "e9");
+    options.valueOffset = 100;
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "key0", true, "key0", true, 1000, 1000, options);
+    assert(scanResponse.records.size() == 1);
+    assert(scanResponse.records[0].value.empty());
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testCountRange(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::Int64Response response;
+    string mapName("count_range_test");
+    client.countRange(response, mapName, "", "");
+    assert(response.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    client.countRange(response, mapName, "", "");
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.value == 0);
+    for (int i = 0; i < 10; i++) {
+        string key = "key" + boost::lexical_cast<string>(i);
+        string val = "val" + boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val, mapkeeper::WriteOptions()));
+    }
+
+    client.countRange(response, mapName, "", "");
+    assert(response.value == 10);
+    client.countRange(response, mapName, "key2", "key7");
+    assert(response.value == 5);
+    client.countRange(response, mapName, "key5", "");
+    assert(response.value == 5);
+    client.countRange(response, mapName, "key7", "key2");
+    assert(response.value == 0);
+
+    // the estimate depends on the backend, but it can't be negative.
+    client.approximateSize(response, mapName, "", "");
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.value >= 0);
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testCompareAndSet(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::BinaryResponse getResponse;
+    string mapName("compare_and_set_test");
+    assert(mapkeeper::ResponseCode::MapNotFound == client.compareAndSet(mapName, "k", "v1", "v2"));
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    assert(mapkeeper::ResponseCode::RecordNotFound == client.compareAndSet(mapName, "k", "v1", "v2"));
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "k", "v1", mapkeeper::WriteOptions()));
+
+    assert(mapkeeper::ResponseCode::Success == client.compareAndSet(mapName, "k", "v1", "v2"));
+    client.get(getResponse, mapName, "k");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == "v2");
+
+    // a stale expected value must not overwrite the record.
+    assert(mapkeeper::ResponseCode::ValueMismatch == client.compareAndSet(mapName, "k", "v1", "v3"));
+    client.get(getResponse, mapName, "k");
+    assert(getResponse.value == "v2");
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testIncrementAppend(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::Int64Response counter;
+    mapkeeper::BinaryResponse getResponse;
+    string mapName("increment_append_test");
+    client.increment(counter, mapName, "counter", 1);
+    assert(counter.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::MapNotFound == client.append(mapName, "log", "a"));
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+
+    // missing counters start from 0.
+    client.increment(counter, mapName, "counter", 5);
+    assert(counter.responseCode == mapkeeper::ResponseCode::Success);
+    assert(counter.value == 5);
+    client.increment(counter, mapName, "counter", -7);
+    assert(counter.responseCode == mapkeeper::ResponseCode::Success);
+    assert(counter.value == -2);
+
+    // only 8 byte values are counters.
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "text", "abc", mapkeeper::WriteOptions()));
+    client.increment(counter, mapName, "text", 1);
+    assert(counter.responseCode == mapkeeper::ResponseCode::Error);
+
+    assert(mapkeeper::ResponseCode::Success == client.append(mapName, "log", "a"));
+    assert(mapkeeper::ResponseCode::Success == client.append(mapName, "log", "bc"));
+    client.get(getResponse, mapName, "log");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == "abc");
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testRemoveRange(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::Int64Response response;
+    string mapName("remove_range_test");
+    client.removeRange(response, mapName, "", "");
+    assert(response.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        string key = "key" + boost::lexical_cast<string>(i);
+        string val = "val" + boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val, mapkeeper::WriteOptions()));
+    }
+
+    client.removeRange(response, mapName, "key2", "key5");
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.value == 3);
+    assert(mapkeeper::ResponseCode::RecordNotFound == client.remove(mapName, "key2"));
+    assert(mapkeeper::ResponseCode::Success == client.remove(mapName, "key5"));
+    client.removeRange(response, mapName, "key7", "key2");
+    assert(response.value == 0);
+    client.removeRange(response, mapName, "key8", "");
+    assert(response.value == 2);
+    client.countRange(response, mapName, "", "");
+    assert(response.value == 4);
+    client.removeRange(response, mapName, "", "");
+    assert(response.value == 4);
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testMapHandles(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::MapHandleResponse handle;
+    string mapName("map_handle_test");
+    client.openMap(handle, mapName);
+    assert(handle.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    client.openMap(handle, mapName);
+    assert(handle.responseCode == mapkeeper::ResponseCode::Success);
+    for (int i = 0; i < 10; i++) {
+        string key = "key" + boost::lexical_cast<string>(i);
+        string val = "val" + boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.putByHandle(handle.handle, key, val));
+    }
+
+    mapkeeper::BinaryResponse getResponse;
+    client.getByHandle(getResponse, handle.handle, "key3");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == "val3");
+    client.get(getResponse, mapName, "key4");
+    assert(getResponse.value == "val4");
+
+    mapkeeper::RecordListResponse scanResponse;
+    client.scanByHandle(scanResponse, handle.handle, ScanOrder::Ascending, "key2", true, "key5", false, 
+                        1000, 1000000, mapkeeper::ScanOptions());
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 3);
+    assert(scanResponse.records[0].key == "key2");
+
+    mapkeeper::MapHandleResponse reopened;
+    client.openMap(reopened, mapName);
+    assert(reopened.handle == handle.handle);
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+    client.getByHandle(getResponse, handle.handle, "key3");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::MapNotFound);
+}
+
+void testSnapshots(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::SnapshotResponse snapshot;
+    string mapName("snapshot_test");
+    client.createSnapshot(snapshot, mapName);
+    assert(snapshot.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        string key = "key" + boost::lexical_cast<string>(i);
+        string val = "val" + boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val, mapkeeper::WriteOptions()));
+    }
+    client.createSnapshot(snapshot, mapName);
+    if (snapshot.responseCode == mapkeeper::ResponseCode::Error) {
+        // the backend doesn't support snapshots.
+        assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+        return;
+    }
+    assert(snapshot.responseCode == mapkeeper::ResponseCode::Success);
+
+    // writes after the snapshot aren't visible through it.
+    assert(mapkeeper::ResponseCode::Success == client.update(mapName, "key3", "new3", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::Success == client.remove(mapName, "key4"));
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "key45", "val45", mapkeeper::WriteOptions()));
+
+    mapkeeper::BinaryResponse getResponse;
+    client.getAtSnapshot(getResponse, snapshot.snapshotId, "key3");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == "val3");
+    client.getAtSnapshot(getResponse, snapshot.snapshotId, "key45");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    client.get(getResponse, mapName, "key3");
+    assert(getResponse.value == "new3");
+
+    mapkeeper::RecordListResponse scanResponse;
+    client.scanAtSnapshot(scanResponse, snapshot.snapshotId, ScanOrder::Ascending, "key3", true, "key5", true, 
+                          1000, 1000000, mapkeeper::ScanOptions());
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 3);
+    assert(scanResponse.records[0].value == "val3");
+    assert(scanResponse.records[1].key == "key4");
+    assert(scanResponse.records[2].key == "key5");
+
+    assert(mapkeeper::ResponseCode::Success == client.releaseSnapshot(snapshot.snapshotId));
+    assert(mapkeeper::ResponseCode::SnapshotNotFound == client.releaseSnapshot(snapshot.snapshotId));
+    client.getAtSnapshot(getResponse, snapshot.snapshotId, "key3");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::SnapshotNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testChangeLog(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::ChangeListResponse changes;
+    string mapName("change_log_test");
+    client.tailChanges(changes, mapName, 0, 100);
+    assert(changes.responseCode == mapkeeper::ResponseCode::MapNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    client.tailChanges(changes, mapName, 0, 100);
+    if (changes.responseCode == mapkeeper::ResponseCode::Error) {
+        // the server doesn't keep a change log.
+        assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+        return;
+    }
+    // a new consumer is told to scan the map first.
+    assert(changes.responseCode == mapkeeper::ResponseCode::ChangesTruncated);
+    int64_t seq = changes.nextSeq;
+
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "key1", "val1", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::Success == client.update(mapName, "key1", "new1", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::RecordExists == client.insert(mapName, "key1", "val1", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::Success == client.remove(mapName, "key1"));
+
+    changes.changes.clear();
+    client.tailChanges(changes, mapName, seq, 2);
+    assert(changes.responseCode == mapkeeper::ResponseCode::Success);
+    assert(changes.changes.size() == 2);
+    assert(changes.changes[0].type == mapkeeper::ChangeType::Put);
+    assert(changes.changes[0].value == "val1");
+    assert(changes.changes[1].type == mapkeeper::ChangeType::Put);
+    assert(changes.changes[1].value == "new1");
+    assert(changes.changes[0].seq < changes.changes[1].seq);
+    seq = changes.nextSeq;
+
+    changes.changes.clear();
+    client.tailChanges(changes, mapName, seq, 100);
+    assert(changes.responseCode == mapkeeper::ResponseCode::Success);
+    assert(changes.changes.size() == 1);
+    assert(changes.changes[0].type == mapkeeper::ChangeType::Remove);
+    assert(changes.changes[0].key == "key1");
+    seq = changes.nextSeq;
+
+    // nothing new yet.
+    changes.changes.clear();
+    client.tailChanges(changes, mapName, seq, 100);
+    assert(changes.responseCode == mapkeeper::ResponseCode::Success);
+    assert(changes.changes.size() == 0);
+    assert(changes.nextSeq == seq);
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+    client.tailChanges(changes, mapName, seq, 100);
+    assert(changes.responseCode == mapkeeper::ResponseCode::MapNotFound);
+}
+
+void testTtl(mapkeeper::MapKeeperClient& client) {
+    string mapName("ttl_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    mapkeeper::WriteOptions shortTtl;
+    shortTtl.ttlSeconds = 1;
+    mapkeeper::WriteOptions longTtl;
+    longTtl.ttlSeconds = 3600;
+    mapkeeper::ResponseCode::type rc = client.insert(mapName, "short", "v1", shortTtl);
+    if (rc == mapkeeper::ResponseCode::Error) {
+        // the server doesn't expire records.
+        assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+        return;
+    }
+    assert(rc == mapkeeper::ResponseCode::Success);
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "long", "v2", longTtl));
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "none", "v3", mapkeeper::WriteOptions()));
+    mapkeeper::BinaryResponse getResponse;
+    client.get(getResponse, mapName, "short");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    sleep(2);
+
+    // expired records are hidden whether or not they've been reclaimed.
+    client.get(getResponse, mapName, "short");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    mapkeeper::RecordListResponse scanResponse;
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 
+                1000, 1000000, mapkeeper::ScanOptions());
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 2);
+    assert(scanResponse.records[0].key == "long");
+    assert(scanResponse.records[1].key == "none");
+    mapkeeper::Int64Response countResponse;
+    client.countRange(countResponse, mapName, "", "");
+    assert(countResponse.value == 2);
+    assert(mapkeeper::ResponseCode::RecordNotFound == client.update(mapName, "short", "v4", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "short", "v4", mapkeeper::WriteOptions()));
+
+    // writing a record again replaces its TTL.
+    assert(mapkeeper::ResponseCode::Success == client.update(mapName, "none", "v5", shortTtl));
+    assert(mapkeeper::ResponseCode::Success == client.update(mapName, "long", "v6", mapkeeper::WriteOptions()));
+    sleep(2);
+    client.get(getResponse, mapName, "none");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    client.get(getResponse, mapName, "short");
+    assert(getResponse.value == "v4");
+    client.get(getResponse, mapName, "long");
+    assert(getResponse.value == "v6");
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testScanFilter(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::ScanCursorResponse cursorResponse;
+    mapkeeper::RecordListResponse scanResponse;
+    mapkeeper::ScanOptions options;
+    string mapName("scan_filter_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        string digit = boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == 
+               client.insert(mapName, "a" + digit, "x" + digit, mapkeeper::WriteOptions()));
+        assert(mapkeeper::ResponseCode::Success == 
+               client.insert(mapName, "b" + digit, "y" + digit, mapkeeper::WriteOptions()));
+    }
+
+    options.filter.keyPrefix = "b";
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 1000, 1000, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 10);
+    assert(scanResponse.records[0].key == "b0");
+
+    // skipped records don't count against maxRecords.
+    options.filter.keyPrefix = "";
+    options.filter.keySuffix = "7";
+    client.scan(scanResponse, mapName, ScanOrder::Descending, "", true, "", true, 1, 1000, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(scanResponse.records.size() == 1);
+    assert(scanResponse.records[0].key == "b7");
+
+    // value filters see the whole value, even for keys-only scans.
+    options.filter.keySuffix = "";
+    options.filter.valuePrefix = "x";
+    mapkeeper::ValueCondition condition;
+    condition.offset = 1;
+    condition.op = mapkeeper::CompareOp::GreaterOrEqual;
+    condition.operand = "8";
+    options.filter.valueConditions.push_back(condition);
+    options.keysOnly = true;
+    client.openScan(cursorResponse, mapName, ScanOrder::Ascending, "", true, "", true, options);
+    assert(cursorResponse.responseCode == mapkeeper::ResponseCode::Success);
+    client.nextScan(scanResponse, cursorResponse.cursorId, 1000, 1000);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.size() == 2);
+    assert(scanResponse.records[0].key == "a8");
+    assert(scanResponse.records[0].value.empty());
+    assert(scanResponse.records[1].key == "a9");
+
+    // a condition past the end of the value matches nothing.
+    options.filter.valuePrefix = "";
+    options.filter.valueConditions[0].offset = 2;
+    client.scan(scanResponse, mapName, ScanOrder::Ascending, "", true, "", true, 1000, 1000, options);
+    assert(scanResponse.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(scanResponse.records.empty());
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testSplitPoints(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::KeyListResponse response;
+    string mapName("split_points_test");
+    client.sampleSplitPoints(response, mapName, 4);
+    assert(response.responseCode == mapkeeper::ResponseCode::MapNotFound);
+
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    client.sampleSplitPoints(response, mapName, 4);
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.keys.empty());
+
+    for (int i = 0; i < 100; i++) {
+        char key[16];
+        sprintf(key, "key%03d", i);
+        assert(mapkeeper::ResponseCode::Success == 
+               client.insert(mapName, key, "value", mapkeeper::WriteOptions()));
+    }
+    // the split points are estimates, but they are always in order and
+    // inside the map.
+    client.sampleSplitPoints(response, mapName, 4);
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.keys.size() <= 3);
+    for (size_t i = 0; i < response.keys.size(); i++) {
+        assert(response.keys[i] > "key000" && response.keys[i] <= "key099");
+        assert(i == 0 || response.keys[i - 1] < response.keys[i]);
+    }
+
+    client.sampleSplitPoints(response, mapName, 1);
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.keys.empty());
+    client.sampleSplitPoints(response, mapName, 0);
+    assert(response.responseCode == mapkeeper::ResponseCode::Error);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testAggregate(mapkeeper::MapKeeperClient& client) {
+    mapkeeper::AggregateResponse response;
+    string mapName("aggregate_test");
+    client.aggregate(response, mapName, "", "", mapkeeper::AggregateOp::Count,
+                     mapkeeper::ValueEncoding::Int64BigEndian);
+    assert(response.responseCode == mapkeeper::ResponseCode::MapNotFound);
+
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        uint64_t bits = (uint64_t)(int64_t)(i - 5);
+        string value;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            value.push_back((char)(bits >> shift));
+        }
+        assert(mapkeeper::ResponseCode::Success == 
+               client.insert(mapName, "i" + boost::lexical_cast<string>(i), value,
+                             mapkeeper::WriteOptions()));
+    }
+    // values that aren't 8 bytes are counted, but not aggregated.
+    assert(mapkeeper::ResponseCode::Success == 
+           client.insert(mapName, "ix", "short", mapkeeper::WriteOptions()));
+    double numbers[] = {0.5, 1.5};
+    for (int i = 0; i < 2; i++) {
+        uint64_t bits;
+        memcpy(&bits, &numbers[i], sizeof(bits));
+        string value;
+        for (int shift = 0; shift < 64; shift += 8) {
+            value.push_back((char)(bits >> shift));
+        }
+        assert(mapkeeper::ResponseCode::Success == 
+               client.insert(mapName, "d" + boost::lexical_cast<string>(i), value,
+                             mapkeeper::WriteOptions()));
+    }
+
+    client.aggregate(response, mapName, "i", "j", mapkeeper::AggregateOp::Count,
+                     mapkeeper::ValueEncoding::Int64BigEndian);
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.count == 11);
+    assert(response.int64Value == 11);
+    client.aggregate(response, mapName, "i", "j", mapkeeper::AggregateOp::Sum,
+                     mapkeeper::ValueEncoding::Int64BigEndian);
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.count == 10);
+    assert(response.int64Value == -5);
+    client.aggregate(response, mapName, "i2", "i5", mapkeeper::AggregateOp::Min,
+                     mapkeeper::ValueEncoding::Int64BigEndian);
+    assert(response.count == 3);
+    assert(response.int64Value == -3);
+    client.aggregate(response, mapName, "i", "j", mapkeeper::AggregateOp::Max,
+                     mapkeeper::ValueEncoding::Int64BigEndian);
+    assert(response.int64Value == 4);
+    client.aggregate(response, mapName, "d", "e", mapkeeper::AggregateOp::Sum,
+                     mapkeeper::ValueEncoding::DoubleLittleEndian);
+    assert(response.responseCode == mapkeeper::ResponseCode::Success);
+    assert(response.count == 2);
+    assert(response.doubleValue == 2.0);
+
+    client.aggregate(response, mapName, "", "", (mapkeeper::AggregateOp::type)100,
+                     mapkeeper::ValueEncoding::Int64BigEndian);
+    assert(response.responseCode == mapkeeper::ResponseCode::Error);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void writeIngestRecord(FILE* file, const string& key, const string& value) {
+    uint32_t length = htonl(key.size());
+    fwrite(&length, 1, sizeof(length), file);
+    fwrite(key.data(), 1, key.size(), file);
+    length = htonl(value.size());
+    fwrite(&length, 1, sizeof(length), file);
+    fwrite(value.data(), 1, value.size(), file);
+}
+
+void testIngest(mapkeeper::MapKeeperClient& client) {
+    string mapName("ingest_test");
+    string path("/tmp/mapkeeper_ingest_test");
+    FILE* file = fopen(path.c_str(), "wb");
+    assert(file);
+    for (int i = 0; i < 100; i++) {
+        char key[16];
+        sprintf(key, "key%03d", i);
+        writeIngestRecord(file, key, "value" + boost::lexical_cast<string>(i));
+    }
+    fclose(file);
+
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    mapkeeper::ResponseCode::type rc = client.ingestFile(mapName, path);
+    if (rc == mapkeeper::ResponseCode::Error) {
+        // the server can't load files, or it runs on another machine.
+        assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+        unlink(path.c_str());
+        return;
+    }
+    assert(rc == mapkeeper::ResponseCode::Success);
+    mapkeeper::BinaryResponse getResponse;
+    client.get(getResponse, mapName, "key042");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == "value42");
+    mapkeeper::Int64Response countResponse;
+    client.countRange(countResponse, mapName, "", "");
+    assert(countResponse.value == 100);
+
+    // only empty maps can be loaded, and a failed load leaves the map alone.
+    assert(mapkeeper::ResponseCode::Error == client.ingestFile(mapName, path));
+    client.countRange(countResponse, mapName, "", "");
+    assert(countResponse.value == 100);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+    unlink(path.c_str());
+}
+
+void testPipelined(mapkeeper::MapKeeperClient& client) {
+    string mapName("pipelined_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    PipelinedClient pipeline("localhost", 9090);
+    map<int32_t, int> requests;
+    for (int i = 0; i < 100; i++) {
+        pipeline.client().send_insert(mapName, "k" + boost::lexical_cast<string>(i),
+                                      "v" + boost::lexical_cast<string>(i), mapkeeper::WriteOptions());
+        requests[pipeline.send()] = i;
+    }
+    for (int i = 0; i < 100; i++) {
+        int32_t seqId = pipeline.receive();
+        assert(requests.erase(seqId) == 1);
+        assert(mapkeeper::ResponseCode::Success == pipeline.client().recv_insert());
+    }
+
+    // responses may come back in any order; the sequence ids tell them apart.
+    for (int i = 0; i < 100; i++) {
+        pipeline.client().send_get(mapName, "k" + boost::lexical_cast<string>(i));
+        requests[pipeline.send()] = i;
+    }
+    for (int i = 0; i < 100; i++) {
+        int32_t seqId = pipeline.receive();
+        assert(requests.count(seqId) == 1);
+        mapkeeper::BinaryResponse response;
+        pipeline.client().recv_get(response);
+        assert(response.responseCode == mapkeeper::ResponseCode::Success);
+        assert(response.value == "v" + boost::lexical_cast<string>(requests[seqId]));
+        requests.erase(seqId);
+    }
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testStats(mapkeeper::MapKeeperClient& client) {
+    string mapName("stats_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    assert(mapkeeper::ResponseCode::Success == client.insert(mapName, "k", "v", mapkeeper::WriteOptions()));
+    mapkeeper::BinaryResponse getResponse;
+    client.get(getResponse, mapName, "k");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+
+    mapkeeper::StatsResponse statsResponse;
+    client.getStats(statsResponse, false);
+    assert(statsResponse.responseCode == mapkeeper::ResponseCode::Success);
+    bool foundOperation = false;
+    bool foundMap = false;
+    for (size_t i = 0; i < statsResponse.operations.size(); i++) {
+        const mapkeeper::OperationStats& stats = statsResponse.operations[i];
+        if (stats.operation != "get") {
+            continue;
+        }
+        assert(!stats.latencies.empty());
+        assert(stats.latencies.back().count > 0);
+        assert(stats.latencies.back().p50 <= stats.latencies.back().max);
+        if (stats.mapName.empty()) {
+            foundOperation = true;
+        } else if (stats.mapName == mapName) {
+            foundMap = true;
+        }
+    }
+    assert(foundOperation && foundMap);
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
+void testScanStream(mapkeeper::MapKeeperClient& client, int streamPort) {
+    string mapName("scan_stream_test");
+    assert(mapkeeper::ResponseCode::Success == client.addMap(mapName));
+    for (int i = 0; i < 10; i++) {
+        string key = "key" + boost::lexical_cast<string>(i);
+        string val = "val" + boost::lexical_cast<string>(i);
+        assert(mapkeeper::ResponseCode::Success == client.insert(mapName, key, val, mapkeeper::WriteOptions()));
+    }
+
+    mapkeeper::ScanStreamRequest request;
+    request.mapName = mapName;
+    request.order = ScanOrder::Descending;
+    request.startKey = "key2";
+    request.startKeyIncluded = true;
+    request.endKey = "";
+    request.endKeyIncluded = true;
+    request.maxRecords = 3;
+    request.maxBytes = 1000;
+    ScanStreamClient stream("localhost", streamPort);
+    stream.open(request);
+    mapkeeper::RecordListResponse chunk;
+    int i = 9;
+    do {
+        stream.next(chunk);
+        assert(chunk.records.size() <= 3);
+        vector<mapkeeper::Record>::iterator itr;
+        for (itr = chunk.records.begin(); itr != chunk.records.end(); itr++) {
+            assert("key" + boost::lexical_cast<string>(i) == itr->key);
+            i--;
+        }
+    } while (chunk.responseCode == mapkeeper::ResponseCode::Success);
+    assert(chunk.responseCode == mapkeeper::ResponseCode::ScanEnded);
+    assert(i == 1);
+
+    assert(mapkeeper::ResponseCode::Success == client.dropMap(mapName));
+}
+
 int main(int argc, char **argv) {
     boost::shared_ptr<TSocket> socket(new TSocket("localhost", 9090));
     boost::shared_ptr<TTransport> transport(new TFramedTransport(socket));
@@ -155,9 +870,27 @@ int main(int argc, char **argv) {
     assert(mapkeeper::ResponseCode::Success == client.addMap("db3"));
 
     // test insert
-    assert(mapkeeper::ResponseCode::Success == client.insert("db1", "k1", "v1"));
-    assert(mapkeeper::ResponseCode::RecordExists == client.insert("db1", "k1", "v1"));
-    assert(mapkeeper::ResponseCode::MapNotFound == client.insert("db2", "k1", "v1"));
+    assert(mapkeeper::ResponseCode::Success == client.insert("db1", "k1", "v1", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::RecordExists == client.insert("db1", "k1", "v1", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::MapNotFound == client.insert("db2", "k1", "v1", mapkeeper::WriteOptions()));
+
+    // test insertMany
+    vector<mapkeeper::Record> records(2);
+    records[0].key = "k6";
+    records[0].value = "v6";
+    records[1].key = "k7";
+    records[1].value = "v7";
+    assert(mapkeeper::ResponseCode::Success == client.insertMany("db1", records));
+    assert(mapkeeper::ResponseCode::MapNotFound == client.insertMany("db2", records));
+    records[0].key = "k8";
+    assert(mapkeeper::ResponseCode::RecordExists == client.insertMany("db1", records));
+    client.get(getResponse, "db1", "k8");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    client.get(getResponse, "db1", "k7");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == "v7");
+    assert(mapkeeper::ResponseCode::Success == client.remove("db1", "k6"));
+    assert(mapkeeper::ResponseCode::Success == client.remove("db1", "k7"));
 
     // test get
     client.get(getResponse, "db1", "k1");
@@ -168,16 +901,50 @@ int main(int argc, char **argv) {
     client.get(getResponse, "db1", "k2");
     assert(getResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
 
+    // test multiGet
+    mapkeeper::BinaryListResponse multiGetResponse;
+    vector<string> keys;
+    keys.push_back("k2");
+    keys.push_back("k1");
+    client.multiGet(multiGetResponse, "db1", keys);
+    assert(multiGetResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(multiGetResponse.responses.size() == 2);
+    assert(multiGetResponse.responses[0].responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    assert(multiGetResponse.responses[1].responseCode == mapkeeper::ResponseCode::Success);
+    assert(multiGetResponse.responses[1].value == "v1");
+    client.multiGet(multiGetResponse, "db2", keys);
+    assert(multiGetResponse.responseCode == mapkeeper::ResponseCode::MapNotFound);
+
     // test update
-    assert(mapkeeper::ResponseCode::Success == client.update("db1", "k1", "v2"));
-    assert(mapkeeper::ResponseCode::MapNotFound == client.update("db2", "k1", "v1"));
-    assert(mapkeeper::ResponseCode::RecordNotFound == client.update("db1", "k2", "v2"));
+    assert(mapkeeper::ResponseCode::Success == client.update("db1", "k1", "v2", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::MapNotFound == client.update("db2", "k1", "v1", mapkeeper::WriteOptions()));
+    assert(mapkeeper::ResponseCode::RecordNotFound == client.update("db1", "k2", "v2", mapkeeper::WriteOptions()));
     client.get(getResponse, "db1", "k1");
     assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
     assert(getResponse.value == "v2");
  
     // test scan
     testScan(client);
+    testScanCursor(client);
+    testScanOptions(client);
+    testCountRange(client);
+    testCompareAndSet(client);
+    testIncrementAppend(client);
+    testRemoveRange(client);
+    testMapHandles(client);
+    testSnapshots(client);
+    testChangeLog(client);
+    testTtl(client);
+    testScanFilter(client);
+    testSplitPoints(client);
+    testAggregate(client);
+    testIngest(client);
+    testPipelined(client);
+    testStats(client);
+    if (argc > 1) {
+        // only some servers have a streaming scan port.
+        testScanStream(client, atoi(argv[1]));
+    }
 
     // test remove
     assert(mapkeeper::ResponseCode::Success == client.remove("db1", "k1"));
@@ -185,6 +952,32 @@ int main(int argc, char **argv) {
     assert(mapkeeper::ResponseCode::RecordNotFound== client.remove("db1", "k2"));
     assert(mapkeeper::ResponseCode::MapNotFound == client.remove("db2", "k1"));
 
+    // test writeBatch
+    vector<mapkeeper::Mutation> mutations(3);
+    mutations[0].type = mapkeeper::MutationType::Insert;
+    mutations[0].key = "k3";
+    mutations[0].value = "v3";
+    mutations[1].type = mapkeeper::MutationType::Put;
+    mutations[1].key = "k4";
+    mutations[1].value = "v4";
+    mutations[2].type = mapkeeper::MutationType::Remove;
+    mutations[2].key = "k3";
+    assert(mapkeeper::ResponseCode::Success == client.writeBatch("db1", mutations));
+    assert(mapkeeper::ResponseCode::MapNotFound == client.writeBatch("db2", mutations));
+    client.get(getResponse, "db1", "k3");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    client.get(getResponse, "db1", "k4");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::Success);
+    assert(getResponse.value == "v4");
+    mutations[0].type = mapkeeper::MutationType::Put;
+    mutations[0].key = "k5";
+    mutations[1].type = mapkeeper::MutationType::Insert;
+    mutations.pop_back();
+    assert(mapkeeper::ResponseCode::RecordExists == client.writeBatch("db1", mutations));
+    client.get(getResponse, "db1", "k5");
+    assert(getResponse.responseCode == mapkeeper::ResponseCode::RecordNotFound);
+    assert(mapkeeper::ResponseCode::Success == client.remove("db1", "k4"));
+
     // test listMaps and dropMap
     client.listMaps(listResponse);
     assert(listResponse.responseCode == mapkeeper::ResponseCode::Success);
@@ -0,0 +1,480 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ADMISSION_HANDLER_H
+#define ADMISSION_HANDLER_H
+
+/**
+ * Turns away calls with Busy when the server has more work than it can
+ * answer in time, instead of letting every request get slower.
+ *
+ * A call is rejected, without reaching the backend, if
+ *
+ *   - maxRequests calls are already running,
+ *   - maxRequestsPerMap calls on the same map are already running, so a
+ *     hot map can't take every worker, or
+ *   - it waited more than maxQueueMillis between being read and getting
+ *     to the handler. The client has likely given up on it by now.
+ *
+ * A limit of 0 turns it off. The queue wait is known for the pipelined
+ * server, which reads requests before a worker is free, and comes from
+ * StatsEventHandler (see ServerStats::requestReadTime). Calls that take
+ * a handle, cursor or snapshot only count against maxRequests. ping,
+ * getStats, closeScan and releaseSnapshot are never rejected; the last
+ * two free resources, which is what an overloaded server wants.
+ *
+ * Checking the limits is a few atomic operations and, with
+ * maxRequestsPerMap, a short lock on one of NUM_SHARDS shards of the
+ * per-map counters; no call waits for another. A map only has a
+ * counter while calls are running on it.
+ */
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "ForwardingHandler.h"
+#include "ServerStats.h"
+#include "StripedLock.h"
+
+class AdmissionHandler: public ForwardingHandler {
+public:
+    AdmissionHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> next, int maxRequests,
+                     int maxRequestsPerMap, int maxQueueMillis) :
+        ForwardingHandler(next),
+        maxRequests_(maxRequests),
+        maxRequestsPerMap_(maxRequestsPerMap),
+        maxQueueMicros_((uint64_t)maxQueueMillis * 1000),
+        numRunning_(0),
+        mapShards_(new MapShard[NUM_SHARDS]) {
+    }
+
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->addMap(mapName);
+    }
+
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->dropMap(mapName);
+    }
+
+    void listMaps(mapkeeper::StringListResponse& _return) {
+        Admission admission(*this, NULL);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->listMaps(_return);
+    }
+
+    void openMap(mapkeeper::MapHandleResponse& _return, const std::string& mapName) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->openMap(_return, mapName);
+    }
+
+    void getByHandle(mapkeeper::BinaryResponse& _return, const int32_t mapHandle,
+                     const std::string& key) {
+        Admission admission(*this, NULL);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->getByHandle(_return, mapHandle, key);
+    }
+
+    mapkeeper::ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key,
+                                              const std::string& value) {
+        Admission admission(*this, NULL);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->putByHandle(mapHandle, key, value);
+    }
+
+    void scanByHandle(mapkeeper::RecordListResponse& _return, const int32_t mapHandle,
+                      const mapkeeper::ScanOrder::type order,
+                      const std::string& startKey, const bool startKeyIncluded,
+                      const std::string& endKey, const bool endKeyIncluded,
+                      const int32_t maxRecords, const int32_t maxBytes,
+                      const mapkeeper::ScanOptions& options) {
+        Admission admission(*this, NULL);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->scanByHandle(_return, mapHandle, order, startKey, startKeyIncluded,
+                            endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const mapkeeper::ScanOptions& options) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->scan(_return, mapName, order, startKey, startKeyIncluded,
+                    endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void openScan(mapkeeper::ScanCursorResponse& _return, const std::string& mapName,
+                  const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const mapkeeper::ScanOptions& options) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->openScan(_return, mapName, order, startKey, startKeyIncluded,
+                        endKey, endKeyIncluded, options);
+    }
+
+    void nextScan(mapkeeper::RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        Admission admission(*this, NULL);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->nextScan(_return, cursorId, maxRecords, maxBytes);
+    }
+
+    void createSnapshot(mapkeeper::SnapshotResponse& _return, const std::string& mapName) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->createSnapshot(_return, mapName);
+    }
+
+    void getAtSnapshot(mapkeeper::BinaryResponse& _return, const int64_t snapshotId,
+                       const std::string& key) {
+        Admission admission(*this, NULL);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->getAtSnapshot(_return, snapshotId, key);
+    }
+
+    void scanAtSnapshot(mapkeeper::RecordListResponse& _return, const int64_t snapshotId,
+                        const mapkeeper::ScanOrder::type order,
+                        const std::string& startKey, const bool startKeyIncluded,
+                        const std::string& endKey, const bool endKeyIncluded,
+                        const int32_t maxRecords, const int32_t maxBytes,
+                        const mapkeeper::ScanOptions& options) {
+        Admission admission(*this, NULL);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->scanAtSnapshot(_return, snapshotId, order, startKey, startKeyIncluded,
+                              endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void countRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                    const std::string& startKey, const std::string& endKey) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->countRange(_return, mapName, startKey, endKey);
+    }
+
+    void approximateSize(mapkeeper::Int64Response& _return, const std::string& mapName,
+                         const std::string& startKey, const std::string& endKey) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->approximateSize(_return, mapName, startKey, endKey);
+    }
+
+    void sampleSplitPoints(mapkeeper::KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->sampleSplitPoints(_return, mapName, numSplits);
+    }
+
+    void aggregate(mapkeeper::AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const mapkeeper::AggregateOp::type op,
+                   const mapkeeper::ValueEncoding::type encoding) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->aggregate(_return, mapName, startKey, endKey, op, encoding);
+    }
+
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName,
+             const std::string& key) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->get(_return, mapName, key);
+    }
+
+    void multiGet(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->multiGet(_return, mapName, keys);
+    }
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key,
+                                      const std::string& value,
+                                      const mapkeeper::WriteOptions& options) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->put(mapName, key, value, options);
+    }
+
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->insert(mapName, key, value, options);
+    }
+
+    mapkeeper::ResponseCode::type insertMany(const std::string& mapName,
+                                             const std::vector<mapkeeper::Record>& records) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->insertMany(mapName, records);
+    }
+
+    mapkeeper::ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->ingestFile(mapName, path);
+    }
+
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->update(mapName, key, value, options);
+    }
+
+    mapkeeper::ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key,
+                                                const std::string& expectedValue,
+                                                const std::string& newValue) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->compareAndSet(mapName, key, expectedValue, newValue);
+    }
+
+    void increment(mapkeeper::Int64Response& _return, const std::string& mapName,
+                   const std::string& key, const int64_t delta) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->increment(_return, mapName, key, delta);
+    }
+
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& value) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->append(mapName, key, value);
+    }
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->remove(mapName, key);
+    }
+
+    void removeRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->removeRange(_return, mapName, startKey, endKey);
+    }
+
+    mapkeeper::ResponseCode::type writeBatch(const std::string& mapName,
+                                             const std::vector<mapkeeper::Mutation>& mutations) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            return mapkeeper::ResponseCode::Busy;
+        }
+        return next_->writeBatch(mapName, mutations);
+    }
+
+    void tailChanges(mapkeeper::ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        Admission admission(*this, &mapName);
+        if (!admission.admitted()) {
+            _return.responseCode = mapkeeper::ResponseCode::Busy;
+            return;
+        }
+        next_->tailChanges(_return, mapName, fromSeq, maxRecords);
+    }
+
+private:
+    /**
+     * Takes a slot for a call, and gives it back when it goes out of
+     * scope if it got one.
+     */
+    class Admission {
+    public:
+        /**
+         * @param mapName the map the call is on, or NULL.
+         */
+        Admission(AdmissionHandler& handler, const std::string* mapName) :
+            handler_(handler),
+            mapName_(NULL),
+            admitted_(false) {
+            if (handler.maxQueueMicros_ > 0) {
+                uint64_t readTime = ServerStats::requestReadTime();
+                if (readTime > 0 && ServerStats::now() - readTime > handler.maxQueueMicros_) {
+                    return;
+                }
+            }
+            if (!take(&handler.numRunning_, handler.maxRequests_)) {
+                return;
+            }
+            if (mapName && handler.maxRequestsPerMap_ > 0) {
+                if (!handler.takeMap(*mapName)) {
+                    __sync_fetch_and_sub(&handler.numRunning_, 1);
+                    return;
+                }
+                mapName_ = mapName;
+            }
+            admitted_ = true;
+        }
+
+        ~Admission() {
+            if (admitted_) {
+                __sync_fetch_and_sub(&handler_.numRunning_, 1);
+                if (mapName_) {
+                    handler_.releaseMap(*mapName_);
+                }
+            }
+        }
+
+        bool admitted() const {
+            return admitted_;
+        }
+
+    private:
+        static bool take(int* running, int max) {
+            if (__sync_add_and_fetch(running, 1) > max && max > 0) {
+                __sync_fetch_and_sub(running, 1);
+                return false;
+            }
+            return true;
+        }
+
+        AdmissionHandler& handler_;
+        const std::string* mapName_; // the map it holds a slot of, if any
+        bool admitted_;
+    };
+
+    static const uint32_t NUM_SHARDS = 16;
+
+    struct MapShard {
+        std::map<std::string, int> running; // calls running on each map, if any
+        boost::mutex mutex; // protect running
+    };
+
+    MapShard& mapShard(const std::string& mapName) {
+        return mapShards_[StripedLock::hash(mapName) % NUM_SHARDS];
+    }
+
+    bool takeMap(const std::string& mapName) {
+        MapShard& shard = mapShard(mapName);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        int& running = shard.running[mapName];
+        if (running >= maxRequestsPerMap_) {
+            return false;
+        }
+        running++;
+        return true;
+    }
+
+    void releaseMap(const std::string& mapName) {
+        MapShard& shard = mapShard(mapName);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        std::map<std::string, int>::iterator itr = shard.running.find(mapName);
+        if (itr != shard.running.end() && --itr->second == 0) {
+            shard.running.erase(itr);
+        }
+    }
+
+    int maxRequests_;
+    int maxRequestsPerMap_;
+    uint64_t maxQueueMicros_;
+    int numRunning_;
+    boost::scoped_array<MapShard> mapShards_;
+};
+
+#endif // ADMISSION_HANDLER_H
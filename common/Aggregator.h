@@ -0,0 +1,128 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+/**
+ * Computes the result of aggregate.
+ *
+ * Backends walk the range the same way countRange does and pass each
+ * value to add, pointing into their own buffers. Count doesn't need the
+ * values; backends check needsValues and skip reading them.
+ */
+#include <cstring>
+#include <stdint.h>
+#include "MapKeeper.h"
+
+class Aggregator {
+public:
+    Aggregator(mapkeeper::AggregateOp::type op, mapkeeper::ValueEncoding::type encoding) :
+        op_(op),
+        encoding_(encoding),
+        count_(0),
+        int64Value_(0),
+        doubleValue_(0.0) {
+    }
+
+    /**
+     * @returns false if op or encoding isn't one this version knows.
+     *          Thrift doesn't check enum values on the way in.
+     */
+    bool isValid() const {
+        return op_ >= mapkeeper::AggregateOp::Count && op_ <= mapkeeper::AggregateOp::Max &&
+               encoding_ >= mapkeeper::ValueEncoding::Int64BigEndian &&
+               encoding_ <= mapkeeper::ValueEncoding::DoubleLittleEndian;
+    }
+
+    bool needsValues() const {
+        return op_ != mapkeeper::AggregateOp::Count;
+    }
+
+    /**
+     * Adds the value of a record. value may be NULL if needsValues is
+     * false.
+     */
+    void add(const char* value, size_t size) {
+        if (op_ == mapkeeper::AggregateOp::Count) {
+            count_++;
+            int64Value_++;
+            return;
+        }
+        if (size != 8) {
+            return;
+        }
+        uint64_t bits = 0;
+        if (encoding_ == mapkeeper::ValueEncoding::Int64BigEndian ||
+            encoding_ == mapkeeper::ValueEncoding::DoubleBigEndian) {
+            for (size_t i = 0; i < 8; i++) {
+                bits = (bits << 8) | (unsigned char)value[i];
+            }
+        } else {
+            for (size_t i = 8; i > 0; i--) {
+                bits = (bits << 8) | (unsigned char)value[i - 1];
+            }
+        }
+        if (encoding_ == mapkeeper::ValueEncoding::DoubleBigEndian ||
+            encoding_ == mapkeeper::ValueEncoding::DoubleLittleEndian) {
+            double number;
+            memcpy(&number, &bits, sizeof(number));
+            addDouble(number);
+        } else {
+            addInt64(bits);
+        }
+        count_++;
+    }
+
+    void getResult(mapkeeper::AggregateResponse& _return) const {
+        _return.count = count_;
+        _return.int64Value = int64Value_;
+        _return.doubleValue = doubleValue_;
+    }
+
+private:
+    /**
+     * bits is added as unsigned so the sum wraps around instead of
+     * overflowing.
+     */
+    void addInt64(uint64_t bits) {
+        int64_t number = (int64_t)bits;
+        if (op_ == mapkeeper::AggregateOp::Sum) {
+            int64Value_ = (int64_t)((uint64_t)int64Value_ + bits);
+        } else if (count_ == 0 ||
+                   (op_ == mapkeeper::AggregateOp::Min && number < int64Value_) ||
+                   (op_ == mapkeeper::AggregateOp::Max && number > int64Value_)) {
+            int64Value_ = number;
+        }
+    }
+
+    void addDouble(double number) {
+        if (op_ == mapkeeper::AggregateOp::Sum) {
+            doubleValue_ += number;
+        } else if (count_ == 0 ||
+                   (op_ == mapkeeper::AggregateOp::Min && number < doubleValue_) ||
+                   (op_ == mapkeeper::AggregateOp::Max && number > doubleValue_)) {
+            doubleValue_ = number;
+        }
+    }
+
+    mapkeeper::AggregateOp::type op_;
+    mapkeeper::ValueEncoding::type encoding_;
+    int64_t count_;
+    int64_t int64Value_;
+    double doubleValue_;
+};
+
+#endif // AGGREGATOR_H
@@ -0,0 +1,302 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CACHING_HANDLER_H
+#define CACHING_HANDLER_H
+
+/**
+ * Keeps the values of recently read records in memory, so gets of hot
+ * keys are answered without reaching the backend.
+ *
+ * The cache is split into shards that records are hashed onto, each
+ * with its own lock, LRU list and an even share of the byte budget, so
+ * concurrent gets rarely wait for each other. Only get fills the
+ * cache. multiGet, scans and snapshot reads always go to the backend,
+ * since they promise a consistent view of the map.
+ *
+ * Every write removes the records it touches from the cache once the
+ * backend has applied it; dropMap, removeRange and ingestFile remove
+ * the whole map. A get that misses remembers the version of its shard,
+ * and only fills the cache if no record in the shard was removed while
+ * it read the backend, so a value read before a write can't be cached
+ * after it.
+ *
+ * The cache only sees the writes that go through it. It goes under the
+ * change log and TTL handlers, so the TTL sweeper's removes reach it,
+ * but a backend whose data is also changed from outside the server
+ * (MySQL, HandlerSocket) will serve stale values.
+ */
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "ForwardingHandler.h"
+#include "StripedLock.h"
+
+class CachingHandler: public ForwardingHandler {
+public:
+    /**
+     * @param maxBytes memory for keys and values, across all maps.
+     * @param maps maps to cache. All maps are cached if it's empty.
+     */
+    CachingHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> next, size_t maxBytes,
+                   const std::set<std::string>& maps = std::set<std::string>()) :
+        ForwardingHandler(next),
+        maps_(maps),
+        shards_(new Shard[NUM_SHARDS]) {
+        for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+            shards_[i].maxBytes = maxBytes / NUM_SHARDS;
+        }
+    }
+
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName) {
+        mapkeeper::ResponseCode::type rc = next_->dropMap(mapName);
+        invalidateMap(mapName);
+        boost::mutex::scoped_lock lock(handlesMutex_);
+        std::map<int32_t, std::string>::iterator itr = handles_.begin();
+        while (itr != handles_.end()) {
+            if (itr->second == mapName) {
+                handles_.erase(itr++);
+            } else {
+                itr++;
+            }
+        }
+        return rc;
+    }
+
+    void openMap(mapkeeper::MapHandleResponse& _return, const std::string& mapName) {
+        next_->openMap(_return, mapName);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success) {
+            boost::mutex::scoped_lock lock(handlesMutex_);
+            handles_[_return.handle] = mapName;
+        }
+    }
+
+    mapkeeper::ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key,
+                                              const std::string& value) {
+        mapkeeper::ResponseCode::type rc = next_->putByHandle(mapHandle, key, value);
+        boost::mutex::scoped_lock lock(handlesMutex_);
+        std::map<int32_t, std::string>::iterator itr = handles_.find(mapHandle);
+        if (itr != handles_.end()) {
+            invalidate(itr->second, key);
+        }
+        return rc;
+    }
+
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName,
+             const std::string& key) {
+        if (!maps_.empty() && maps_.find(mapName) == maps_.end()) {
+            next_->get(_return, mapName, key);
+            return;
+        }
+        Shard& shard = shards_[shardOf(mapName, key)];
+        uint64_t version;
+        {
+            boost::mutex::scoped_lock lock(shard.mutex);
+            EntryMap::iterator itr = shard.entries.find(std::make_pair(mapName, key));
+            if (itr != shard.entries.end()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, itr->second);
+                _return.responseCode = mapkeeper::ResponseCode::Success;
+                _return.value = itr->second->value;
+                return;
+            }
+            version = shard.version;
+        }
+        next_->get(_return, mapName, key);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success) {
+            fill(shard, version, mapName, key, _return.value);
+        }
+    }
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key,
+                                      const std::string& value,
+                                      const mapkeeper::WriteOptions& options) {
+        mapkeeper::ResponseCode::type rc = next_->put(mapName, key, value, options);
+        invalidate(mapName, key);
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        mapkeeper::ResponseCode::type rc = next_->insert(mapName, key, value, options);
+        invalidate(mapName, key);
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type insertMany(const std::string& mapName,
+                                             const std::vector<mapkeeper::Record>& records) {
+        mapkeeper::ResponseCode::type rc = next_->insertMany(mapName, records);
+        for (size_t i = 0; i < records.size(); i++) {
+            invalidate(mapName, records[i].key);
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        mapkeeper::ResponseCode::type rc = next_->ingestFile(mapName, path);
+        invalidateMap(mapName);
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        mapkeeper::ResponseCode::type rc = next_->update(mapName, key, value, options);
+        invalidate(mapName, key);
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key,
+                                                const std::string& expectedValue,
+                                                const std::string& newValue) {
+        mapkeeper::ResponseCode::type rc = next_->compareAndSet(mapName, key, expectedValue, newValue);
+        invalidate(mapName, key);
+        return rc;
+    }
+
+    void increment(mapkeeper::Int64Response& _return, const std::string& mapName,
+                   const std::string& key, const int64_t delta) {
+        next_->increment(_return, mapName, key, delta);
+        invalidate(mapName, key);
+    }
+
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& value) {
+        mapkeeper::ResponseCode::type rc = next_->append(mapName, key, value);
+        invalidate(mapName, key);
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        mapkeeper::ResponseCode::type rc = next_->remove(mapName, key);
+        invalidate(mapName, key);
+        return rc;
+    }
+
+    void removeRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        next_->removeRange(_return, mapName, startKey, endKey);
+        invalidateMap(mapName);
+    }
+
+    mapkeeper::ResponseCode::type writeBatch(const std::string& mapName,
+                                             const std::vector<mapkeeper::Mutation>& mutations) {
+        mapkeeper::ResponseCode::type rc = next_->writeBatch(mapName, mutations);
+        for (size_t i = 0; i < mutations.size(); i++) {
+            invalidate(mapName, mutations[i].key);
+        }
+        return rc;
+    }
+
+private:
+    static const uint32_t NUM_SHARDS = 64;
+    // rough cost of an entry besides its key and value.
+    static const size_t ENTRY_OVERHEAD = 128;
+
+    struct Entry {
+        std::pair<std::string, std::string> key; // map name and record key
+        std::string value;
+    };
+    typedef std::list<Entry> EntryList;
+    typedef std::map<std::pair<std::string, std::string>, EntryList::iterator> EntryMap;
+
+    struct Shard {
+        Shard() :
+            maxBytes(0),
+            numBytes(0),
+            version(0) {
+        }
+
+        boost::mutex mutex;
+        EntryList lru;      // most recently used first
+        EntryMap entries;
+        size_t maxBytes;
+        size_t numBytes;
+        uint64_t version;   // bumped whenever an entry is invalidated
+    };
+
+    static size_t cost(const std::string& mapName, const std::string& key, const std::string& value) {
+        return mapName.size() + key.size() + value.size() + ENTRY_OVERHEAD;
+    }
+
+    uint32_t shardOf(const std::string& mapName, const std::string& key) const {
+        return StripedLock::hash(mapName, key) % NUM_SHARDS;
+    }
+
+    void fill(Shard& shard, uint64_t version, const std::string& mapName,
+              const std::string& key, const std::string& value) {
+        size_t size = cost(mapName, key, value);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        if (shard.version != version || size > shard.maxBytes) {
+            return;
+        }
+        std::pair<std::string, std::string> entryKey(mapName, key);
+        if (shard.entries.find(entryKey) != shard.entries.end()) {
+            // another get filled it first.
+            return;
+        }
+        while (shard.numBytes + size > shard.maxBytes) {
+            erase(shard, shard.entries.find(shard.lru.back().key));
+        }
+        shard.lru.push_front(Entry());
+        shard.lru.front().key = entryKey;
+        shard.lru.front().value = value;
+        shard.entries[entryKey] = shard.lru.begin();
+        shard.numBytes += size;
+    }
+
+    void erase(Shard& shard, EntryMap::iterator itr) {
+        const Entry& entry = *itr->second;
+        shard.numBytes -= cost(entry.key.first, entry.key.second, entry.value);
+        shard.lru.erase(itr->second);
+        shard.entries.erase(itr);
+    }
+
+    void invalidate(const std::string& mapName, const std::string& key) {
+        Shard& shard = shards_[shardOf(mapName, key)];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        shard.version++;
+        EntryMap::iterator itr = shard.entries.find(std::make_pair(mapName, key));
+        if (itr != shard.entries.end()) {
+            erase(shard, itr);
+        }
+    }
+
+    void invalidateMap(const std::string& mapName) {
+        for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+            Shard& shard = shards_[i];
+            boost::mutex::scoped_lock lock(shard.mutex);
+            shard.version++;
+            EntryMap::iterator itr = shard.entries.lower_bound(std::make_pair(mapName, std::string()));
+            while (itr != shard.entries.end() && itr->first.first == mapName) {
+                erase(shard, itr++);
+            }
+        }
+    }
+
+    std::set<std::string> maps_;
+    boost::scoped_array<Shard> shards_;
+    boost::mutex handlesMutex_; // protect handles_
+    std::map<int32_t, std::string> handles_;
+};
+
+#endif // CACHING_HANDLER_H
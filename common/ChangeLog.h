@@ -0,0 +1,151 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CHANGE_LOG_H
+#define CHANGE_LOG_H
+
+/**
+ * Keeps the most recent changes of each map for tailChanges.
+ *
+ * Every change gets a sequence number from a single counter shared by
+ * all the maps, and each map keeps at most maxChanges changes. The log
+ * of a map remembers the first sequence number it still has everything
+ * from, so a consumer asking for older changes can be told to rescan.
+ *
+ * The counter starts at the current time in microseconds, so sequence
+ * numbers keep increasing across restarts (unless the server averages
+ * more than a million changes a second), and a consumer of the old log
+ * gets ChangesTruncated instead of missing changes.
+ *
+ * The log is only in memory. It's synchronized internally.
+ */
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+#include <boost/thread/mutex.hpp>
+#include "MapKeeper.h"
+
+class ChangeLog {
+public:
+    ChangeLog(uint32_t maxChanges = 10000) :
+        maxChanges_(maxChanges),
+        nextSeq_(initialSeq()) {
+    }
+
+    /**
+     * Adds a change to the log of a map, and drops the oldest change of
+     * the map if its log is full.
+     */
+    void append(const std::string& mapName, mapkeeper::ChangeType::type type,
+                const std::string& key, const std::string& value,
+                const std::string& endKey = std::string()) {
+        boost::mutex::scoped_lock lock(mutex_);
+        MapLog& log = getLog(mapName);
+        mapkeeper::Change change;
+        change.seq = nextSeq_++;
+        change.type = type;
+        change.key = key;
+        change.value = value;
+        change.endKey = endKey;
+        log.changes.push_back(change);
+        if (log.changes.size() > maxChanges_) {
+            log.firstSeq = log.changes.front().seq + 1;
+            log.changes.pop_front();
+        }
+    }
+
+    /**
+     * Copies at most maxRecords changes of a map with seq >= fromSeq,
+     * and sets nextSeq to the fromSeq of the next call.
+     *
+     * @returns false if some of the changes since fromSeq are no longer
+     *          in the log. nextSeq is then the sequence number to tail
+     *          from after rescanning the map.
+     */
+    bool tail(const std::string& mapName, int64_t fromSeq, int32_t maxRecords,
+              std::vector<mapkeeper::Change>& changes, int64_t& nextSeq) {
+        boost::mutex::scoped_lock lock(mutex_);
+        MapLog& log = getLog(mapName);
+        if (fromSeq < log.firstSeq || fromSeq > nextSeq_) {
+            nextSeq = nextSeq_;
+            return false;
+        }
+        std::deque<mapkeeper::Change>::iterator itr =
+            std::lower_bound(log.changes.begin(), log.changes.end(), fromSeq, SeqLess());
+        for (; itr != log.changes.end() && changes.size() < (uint32_t)maxRecords; itr++) {
+            changes.push_back(*itr);
+        }
+        nextSeq = itr == log.changes.end() ? nextSeq_ : itr->seq;
+        return true;
+    }
+
+    /**
+     * @returns true if the map has a log. Maps get one with their first
+     *          change or tail call.
+     */
+    bool contains(const std::string& mapName) {
+        boost::mutex::scoped_lock lock(mutex_);
+        return logs_.find(mapName) != logs_.end();
+    }
+
+    /**
+     * Drops the log of a map that is being dropped. A consumer of the
+     * old map gets ChangesTruncated if a map with the same name is
+     * added again.
+     */
+    void removeMap(const std::string& mapName) {
+        boost::mutex::scoped_lock lock(mutex_);
+        logs_.erase(mapName);
+    }
+
+private:
+    struct MapLog {
+        int64_t firstSeq;
+        std::deque<mapkeeper::Change> changes;
+    };
+
+    struct SeqLess {
+        bool operator()(const mapkeeper::Change& change, int64_t seq) const {
+            return change.seq < seq;
+        }
+    };
+
+    MapLog& getLog(const std::string& mapName) {
+        std::map<std::string, MapLog>::iterator itr = logs_.find(mapName);
+        if (itr != logs_.end()) {
+            return itr->second;
+        }
+        MapLog& log = logs_[mapName];
+        log.firstSeq = nextSeq_;
+        return log;
+    }
+
+    static int64_t initialSeq() {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+    }
+
+    uint32_t maxChanges_;
+    int64_t nextSeq_;
+    std::map<std::string, MapLog> logs_;
+    boost::mutex mutex_; // protect logs_ and nextSeq_
+};
+
+#endif // CHANGE_LOG_H
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CHANGE_LOG_HANDLER_H
+#define CHANGE_LOG_HANDLER_H
+
+/**
+ * Records the writes that succeed on the backend in a ChangeLog, and
+ * serves tailChanges from it.
+ *
+ * Each write holds the stripe of its key (see StripedLock.h) while it
+ * runs on the backend and while it's added to the log, so changes to
+ * the same key are logged in the order they were applied. The backend
+ * handler doesn't need to know about the log.
+ */
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include "ChangeLog.h"
+#include "ForwardingHandler.h"
+#include "MergeOperator.h"
+#include "StripedLock.h"
+
+class ChangeLogHandler: public ForwardingHandler {
+public:
+    ChangeLogHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> next, uint32_t maxChanges) :
+        ForwardingHandler(next),
+        log_(maxChanges) {
+    }
+
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName) {
+        mapkeeper::ResponseCode::type rc = next_->dropMap(mapName);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.removeMap(mapName);
+            boost::mutex::scoped_lock lock(handlesMutex_);
+            std::map<int32_t, std::string>::iterator itr = handles_.begin();
+            while (itr != handles_.end()) {
+                if (itr->second == mapName) {
+                    handles_.erase(itr++);
+                } else {
+                    itr++;
+                }
+            }
+        }
+        return rc;
+    }
+
+    void openMap(mapkeeper::MapHandleResponse& _return, const std::string& mapName) {
+        next_->openMap(_return, mapName);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success) {
+            boost::mutex::scoped_lock lock(handlesMutex_);
+            handles_[_return.handle] = mapName;
+        }
+    }
+
+    mapkeeper::ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key,
+                                              const std::string& value) {
+        std::string mapName;
+        {
+            boost::mutex::scoped_lock lock(handlesMutex_);
+            std::map<int32_t, std::string>::iterator itr = handles_.find(mapHandle);
+            if (itr == handles_.end()) {
+                return mapkeeper::ResponseCode::MapNotFound;
+            }
+            mapName = itr->second;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        mapkeeper::ResponseCode::type rc = next_->putByHandle(mapHandle, key, value);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.append(mapName, mapkeeper::ChangeType::Put, key, value);
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key,
+                                      const std::string& value,
+                                      const mapkeeper::WriteOptions& options) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        mapkeeper::ResponseCode::type rc = next_->put(mapName, key, value, options);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.append(mapName, mapkeeper::ChangeType::Put, key, value);
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        mapkeeper::ResponseCode::type rc = next_->insert(mapName, key, value, options);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.append(mapName, mapkeeper::ChangeType::Put, key, value);
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type insertMany(const std::string& mapName,
+                                             const std::vector<mapkeeper::Record>& records) {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < records.size(); i++) {
+            keys.push_back(records[i].key);
+        }
+        StripedLock::ScopedMultiLock keyLocks(locks_, keys);
+        mapkeeper::ResponseCode::type rc = next_->insertMany(mapName, records);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            for (size_t i = 0; i < records.size(); i++) {
+                log_.append(mapName, mapkeeper::ChangeType::Put, records[i].key, records[i].value);
+            }
+        }
+        return rc;
+    }
+
+    /**
+     * The loaded records aren't logged one by one; consumers have to
+     * rescan the map.
+     */
+    mapkeeper::ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        mapkeeper::ResponseCode::type rc = next_->ingestFile(mapName, path);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.removeMap(mapName);
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        mapkeeper::ResponseCode::type rc = next_->update(mapName, key, value, options);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.append(mapName, mapkeeper::ChangeType::Put, key, value);
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key,
+                                                const std::string& expectedValue,
+                                                const std::string& newValue) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        mapkeeper::ResponseCode::type rc = next_->compareAndSet(mapName, key, expectedValue, newValue);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.append(mapName, mapkeeper::ChangeType::Put, key, newValue);
+        }
+        return rc;
+    }
+
+    void increment(mapkeeper::Int64Response& _return, const std::string& mapName,
+                   const std::string& key, const int64_t delta) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        next_->increment(_return, mapName, key, delta);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success) {
+            std::string value;
+            encodeCounter(_return.value, value);
+            log_.append(mapName, mapkeeper::ChangeType::Put, key, value);
+        }
+    }
+
+    /**
+     * append doesn't return the new value, so it's read back while the
+     * key's stripe is still held.
+     */
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& value) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        mapkeeper::ResponseCode::type rc = next_->append(mapName, key, value);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            mapkeeper::BinaryResponse record;
+            next_->get(record, mapName, key);
+            if (record.responseCode == mapkeeper::ResponseCode::Success) {
+                log_.append(mapName, mapkeeper::ChangeType::Put, key, record.value);
+            } else {
+                fprintf(stderr, "ChangeLogHandler failed to read back an appended record: %d\n",
+                        record.responseCode);
+            }
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        mapkeeper::ResponseCode::type rc = next_->remove(mapName, key);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            log_.append(mapName, mapkeeper::ChangeType::Remove, key, std::string());
+        }
+        return rc;
+    }
+
+    /**
+     * Holding the stripes of every key in the range isn't practical, so
+     * the range is logged once it's gone.
+     */
+    void removeRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        next_->removeRange(_return, mapName, startKey, endKey);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success && _return.value > 0) {
+            log_.append(mapName, mapkeeper::ChangeType::RemoveRange, startKey, std::string(), endKey);
+        }
+    }
+
+    mapkeeper::ResponseCode::type writeBatch(const std::string& mapName,
+                                             const std::vector<mapkeeper::Mutation>& mutations) {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < mutations.size(); i++) {
+            keys.push_back(mutations[i].key);
+        }
+        StripedLock::ScopedMultiLock keyLocks(locks_, keys);
+        mapkeeper::ResponseCode::type rc = next_->writeBatch(mapName, mutations);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            for (size_t i = 0; i < mutations.size(); i++) {
+                if (mutations[i].type == mapkeeper::MutationType::Remove) {
+                    log_.append(mapName, mapkeeper::ChangeType::Remove, mutations[i].key, std::string());
+                } else {
+                    log_.append(mapName, mapkeeper::ChangeType::Put, mutations[i].key, mutations[i].value);
+                }
+            }
+        }
+        return rc;
+    }
+
+    void tailChanges(mapkeeper::ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        if (!log_.contains(mapName)) {
+            // the map hasn't been written to since the server started;
+            // make sure it exists before giving it a log.
+            mapkeeper::BinaryResponse record;
+            next_->get(record, mapName, std::string());
+            if (record.responseCode == mapkeeper::ResponseCode::MapNotFound) {
+                _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+                return;
+            }
+        }
+        if (log_.tail(mapName, fromSeq, maxRecords, _return.changes, _return.nextSeq)) {
+            _return.responseCode = mapkeeper::ResponseCode::Success;
+        } else {
+            _return.responseCode = mapkeeper::ResponseCode::ChangesTruncated;
+        }
+    }
+
+private:
+    ChangeLog log_;
+    StripedLock locks_; // order the changes to a key
+    std::map<int32_t, std::string> handles_; // map names of the handles from openMap
+    boost::mutex handlesMutex_; // protect handles_
+};
+
+#endif // CHANGE_LOG_HANDLER_H
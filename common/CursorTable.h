@@ -0,0 +1,158 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CURSOR_TABLE_H
+#define CURSOR_TABLE_H
+
+/**
+ * Keeps track of the scan cursors opened with openScan.
+ *
+ * Each cursor is identified by a 64-bit id that is handed to the
+ * client. Cursors that haven't been used for idleTimeoutSeconds are
+ * dropped the next time a cursor is added, and at most maxCursors
+ * cursors can be open at a time.
+ *
+ * The table only owns the cursors through shared_ptr, so a cursor
+ * removed while another thread is still using it is destroyed once
+ * that thread is done with it. Callers are responsible for serializing
+ * the use of a single cursor (see Cursor::mutex in the servers).
+ */
+#include <map>
+#include <string>
+#include <ctime>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+template <class Cursor>
+class CursorTable {
+public:
+    CursorTable(uint32_t maxCursors = 1024, uint32_t idleTimeoutSeconds = 60) :
+        maxCursors_(maxCursors),
+        idleTimeoutSeconds_(idleTimeoutSeconds),
+        nextId_(1) {
+    }
+
+    /**
+     * Adds a cursor to the table.
+     *
+     * @returns the id of the cursor, or 0 if there are too many cursors
+     *          open already.
+     */
+    int64_t add(boost::shared_ptr<Cursor> cursor) {
+        boost::mutex::scoped_lock lock(mutex_);
+        int64_t id = nextId_;
+        if (!insert(id, cursor)) {
+            return 0;
+        }
+        nextId_++;
+        return id;
+    }
+
+    /**
+     * Adds a cursor under an id handed out elsewhere, like the backend
+     * behind a handler that tracks its cursors.
+     *
+     * @returns false if there are too many cursors open already.
+     */
+    bool add(int64_t id, boost::shared_ptr<Cursor> cursor) {
+        boost::mutex::scoped_lock lock(mutex_);
+        return insert(id, cursor);
+    }
+
+    /**
+     * Looks up a cursor and refreshes its idle timer.
+     *
+     * @returns the cursor, or an empty pointer if it doesn't exist or
+     *          has expired.
+     */
+    boost::shared_ptr<Cursor> get(int64_t id) {
+        boost::mutex::scoped_lock lock(mutex_);
+        typename std::map<int64_t, Entry>::iterator itr = cursors_.find(id);
+        if (itr == cursors_.end()) {
+            return boost::shared_ptr<Cursor>();
+        }
+        time_t now = time(NULL);
+        if (now - itr->second.lastAccess > (time_t)idleTimeoutSeconds_) {
+            cursors_.erase(itr);
+            return boost::shared_ptr<Cursor>();
+        }
+        itr->second.lastAccess = now;
+        return itr->second.cursor;
+    }
+
+    /**
+     * @returns true if the cursor was found and removed.
+     */
+    bool remove(int64_t id) {
+        boost::mutex::scoped_lock lock(mutex_);
+        return cursors_.erase(id) > 0;
+    }
+
+    /**
+     * Removes all the cursors over the given map. Used to get rid of 
+     * the cursors of a map that is being dropped. Cursor must have a 
+     * mapName member.
+     */
+    void removeMap(const std::string& mapName) {
+        boost::mutex::scoped_lock lock(mutex_);
+        typename std::map<int64_t, Entry>::iterator itr = cursors_.begin();
+        while (itr != cursors_.end()) {
+            if (itr->second.cursor->mapName == mapName) {
+                cursors_.erase(itr++);
+            } else {
+                itr++;
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        boost::shared_ptr<Cursor> cursor;
+        time_t lastAccess;
+    };
+
+    bool insert(int64_t id, boost::shared_ptr<Cursor> cursor) {
+        time_t now = time(NULL);
+        expire(now);
+        if (cursors_.size() >= maxCursors_) {
+            return false;
+        }
+        Entry entry;
+        entry.cursor = cursor;
+        entry.lastAccess = now;
+        cursors_[id] = entry;
+        return true;
+    }
+
+    void expire(time_t now) {
+        typename std::map<int64_t, Entry>::iterator itr = cursors_.begin();
+        while (itr != cursors_.end()) {
+            if (now - itr->second.lastAccess > (time_t)idleTimeoutSeconds_) {
+                cursors_.erase(itr++);
+            } else {
+                itr++;
+            }
+        }
+    }
+
+    uint32_t maxCursors_;
+    uint32_t idleTimeoutSeconds_;
+    int64_t nextId_;
+    std::map<int64_t, Entry> cursors_;
+    boost::mutex mutex_; // protect cursors_ and nextId_
+};
+
+#endif // CURSOR_TABLE_H
@@ -0,0 +1,505 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef EPOLL_SERVER_H
+#define EPOLL_SERVER_H
+
+/**
+ * A Thrift server made of independent epoll event loops, one thread
+ * each, pinned to a core each.
+ *
+ * TNonblockingServer accepts every connection on one thread and hands
+ * the requests to a ThreadManager, so all the I/O goes through one core
+ * and every request crosses threads twice. Here every loop has its own
+ * listening socket bound to the same port with SO_REUSEPORT, and the
+ * kernel spreads new connections across them. A connection stays on the
+ * loop that accepted it. Loops share nothing but the processor.
+ *
+ * Clients may send any number of requests without waiting for the
+ * responses. Without a ThreadManager, the requests are decoded, run and
+ * answered on the loop's thread, in order. A request blocks its whole
+ * loop while it runs, so this is only for handlers that answer from
+ * local storage without waiting on anything else for long.
+ *
+ * With a ThreadManager, the loops only read and write, and the requests
+ * of a connection run on the workers at the same time. Each response is
+ * sent as soon as its request finishes, so responses may come back in a
+ * different order than the requests. Clients match them by the sequence
+ * id of the Thrift message, which the processor copies from the request
+ * into the response (see PipelinedClient.h).
+ *
+ * The wire format is framed binary protocol, the same as the other
+ * servers. Needs Linux 3.9 or later for SO_REUSEPORT.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include "MapKeeper.h"
+#include "ServerStats.h"
+
+class EpollServer {
+public:
+    /**
+     * @param numLoops number of event loops. Loop i is pinned to core
+     *                 i modulo the number of cores.
+     * @param threadManager runs the requests if set, out of order.
+     */
+    EpollServer(boost::shared_ptr<apache::thrift::TProcessor> processor, int port, size_t numLoops,
+                boost::shared_ptr<apache::thrift::concurrency::ThreadManager> threadManager =
+                boost::shared_ptr<apache::thrift::concurrency::ThreadManager>()) :
+        processor_(processor),
+        port_(port),
+        numLoops_(numLoops),
+        threadManager_(threadManager) {
+    }
+
+    /**
+     * Runs the event loops. Never returns; exits the process if the
+     * port can't be bound.
+     */
+    void serve() {
+        long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (numCpus < 1) {
+            numCpus = 1;
+        }
+        boost::ptr_vector<EventLoop> loops;
+        for (size_t i = 0; i < numLoops_; i++) {
+            loops.push_back(new EventLoop(processor_, threadManager_, i % numCpus));
+            loops.back().listen(port_);
+        }
+        boost::thread_group threads;
+        for (size_t i = 0; i < loops.size(); i++) {
+            threads.create_thread(boost::bind(&EventLoop::run, &loops[i]));
+        }
+        threads.join_all();
+    }
+
+private:
+    struct Connection {
+        Connection(int fd) :
+            fd(fd),
+            outputOffset(0),
+            events(EPOLLIN),
+            numRunning(0),
+            closed(false) {
+        }
+
+        int fd;
+        std::string input;  // bytes read but not yet run
+        std::string output; // responses not yet sent
+        size_t outputOffset;
+        uint32_t events;    // events the connection is watched for
+        size_t numRunning;  // requests on the ThreadManager
+        bool closed;        // the loop dropped the connection
+    };
+
+    class EventLoop;
+
+    /**
+     * A request running on the ThreadManager. The response goes back to
+     * the loop, which writes it if the connection is still open.
+     */
+    class Task: public apache::thrift::concurrency::Runnable {
+    public:
+        Task(EventLoop& loop, boost::shared_ptr<Connection> connection, const char* request, uint32_t size) :
+            loop_(loop),
+            connection_(connection),
+            request_(request, size),
+            readTime_(ServerStats::now()) {
+        }
+
+        void run() {
+            boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> input(
+                new apache::thrift::transport::TMemoryBuffer((uint8_t*)request_.data(), request_.size()));
+            boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> output(
+                new apache::thrift::transport::TMemoryBuffer());
+            boost::shared_ptr<apache::thrift::protocol::TProtocol> inputProtocol(
+                new apache::thrift::protocol::TBinaryProtocol(input));
+            boost::shared_ptr<apache::thrift::protocol::TProtocol> outputProtocol(
+                new apache::thrift::protocol::TBinaryProtocol(output));
+            std::string response;
+            bool ok = loop_.process(inputProtocol, outputProtocol, *output, response, &readTime_);
+            loop_.complete(connection_, response, ok);
+        }
+
+    private:
+        EventLoop& loop_;
+        boost::shared_ptr<Connection> connection_;
+        std::string request_;
+        uint64_t readTime_; // for the queue wait in StatsEventHandler
+    };
+
+    class EventLoop {
+    public:
+        EventLoop(boost::shared_ptr<apache::thrift::TProcessor> processor,
+                  boost::shared_ptr<apache::thrift::concurrency::ThreadManager> threadManager, int cpu) :
+            processor_(processor),
+            threadManager_(threadManager),
+            input_(new apache::thrift::transport::TMemoryBuffer()),
+            output_(new apache::thrift::transport::TMemoryBuffer()),
+            inputProtocol_(new apache::thrift::protocol::TBinaryProtocol(input_)),
+            outputProtocol_(new apache::thrift::protocol::TBinaryProtocol(output_)),
+            cpu_(cpu),
+            listenFd_(-1),
+            epollFd_(-1),
+            eventFd_(-1) {
+        }
+
+        ~EventLoop() {
+            for (ConnectionMap::iterator itr = connections_.begin(); itr != connections_.end(); ++itr) {
+                close(itr->first);
+            }
+            if (listenFd_ >= 0) {
+                close(listenFd_);
+            }
+            if (eventFd_ >= 0) {
+                close(eventFd_);
+            }
+            if (epollFd_ >= 0) {
+                close(epollFd_);
+            }
+        }
+
+        void listen(int port) {
+            listenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            epollFd_ = epoll_create1(0);
+            eventFd_ = eventfd(0, EFD_NONBLOCK);
+            int on = 1;
+            sockaddr_in address;
+            memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_ANY);
+            address.sin_port = htons(port);
+            if (listenFd_ < 0 || epollFd_ < 0 || eventFd_ < 0 ||
+                setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+                setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0 ||
+                bind(listenFd_, (sockaddr*)&address, sizeof(address)) != 0 ||
+                ::listen(listenFd_, LISTEN_BACKLOG) != 0 ||
+                !watch(listenFd_, EPOLLIN, EPOLL_CTL_ADD) ||
+                !watch(eventFd_, EPOLLIN, EPOLL_CTL_ADD)) {
+                fprintf(stderr, "EpollServer failed to listen on port %d: %s\n", port, strerror(errno));
+                exit(1);
+            }
+        }
+
+        void run() {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu_, &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            epoll_event events[MAX_EVENTS];
+            while (true) {
+                int numEvents = epoll_wait(epollFd_, events, MAX_EVENTS, -1);
+                if (numEvents < 0 && errno != EINTR) {
+                    fprintf(stderr, "EpollServer epoll_wait failed: %s\n", strerror(errno));
+                    return;
+                }
+                for (int i = 0; i < numEvents; i++) {
+                    if (events[i].data.fd == listenFd_) {
+                        acceptConnections();
+                    } else if (events[i].data.fd == eventFd_) {
+                        finishTasks();
+                    } else {
+                        handle(events[i].data.fd, events[i].events);
+                    }
+                }
+            }
+        }
+
+        /**
+         * Runs one request and frames the response. Called on the loop
+         * without a ThreadManager, and by Task on the workers.
+         *
+         * @param output the buffer outputProtocol writes to.
+         * @param readTime when the request was read, if it was queued.
+         * @returns false if the request couldn't be decoded.
+         */
+        bool process(boost::shared_ptr<apache::thrift::protocol::TProtocol> inputProtocol,
+                     boost::shared_ptr<apache::thrift::protocol::TProtocol> outputProtocol,
+                     apache::thrift::transport::TMemoryBuffer& output, std::string& response,
+                     uint64_t* readTime) {
+            try {
+                processor_->process(inputProtocol, outputProtocol, readTime);
+            } catch (apache::thrift::TException& e) {
+                fprintf(stderr, "EpollServer failed to process request: %s\n", e.what());
+                return false;
+            }
+            uint8_t* buffer;
+            uint32_t size;
+            output.getBuffer(&buffer, &size);
+            if (size > 0) {
+                uint32_t frameSize = htonl(size);
+                response.append((char*)&frameSize, sizeof(frameSize));
+                response.append((char*)buffer, size);
+            }
+            return true;
+        }
+
+        /**
+         * Hands a finished Task back to the loop. Called on the workers.
+         */
+        void complete(boost::shared_ptr<Connection> connection, const std::string& response, bool ok) {
+            {
+                boost::mutex::scoped_lock lock(finishedMutex_);
+                finished_.push_back(Finished());
+                finished_.back().connection = connection;
+                finished_.back().response = response;
+                finished_.back().ok = ok;
+            }
+            uint64_t one = 1;
+            if (write(eventFd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                fprintf(stderr, "EpollServer failed to wake up loop: %s\n", strerror(errno));
+            }
+        }
+
+    private:
+        static const int LISTEN_BACKLOG = 1024;
+        static const int MAX_EVENTS = 256;
+        static const size_t READ_SIZE = 64 * 1024;
+        static const uint32_t MAX_FRAME_SIZE = 256 * 1024 * 1024;
+        // requests of one connection on the ThreadManager at a time.
+        // more are left unread until some finish.
+        static const size_t MAX_RUNNING = 256;
+
+        struct Finished {
+            boost::shared_ptr<Connection> connection;
+            std::string response;
+            bool ok;
+        };
+        typedef std::map<int, boost::shared_ptr<Connection> > ConnectionMap;
+
+        bool watch(int fd, uint32_t events, int op) {
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = events;
+            event.data.fd = fd;
+            return epoll_ctl(epollFd_, op, fd, &event) == 0;
+        }
+
+        void acceptConnections() {
+            while (true) {
+                int fd = accept4(listenFd_, NULL, NULL, SOCK_NONBLOCK);
+                if (fd < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        fprintf(stderr, "EpollServer accept failed: %s\n", strerror(errno));
+                    }
+                    return;
+                }
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                if (!watch(fd, EPOLLIN, EPOLL_CTL_ADD)) {
+                    close(fd);
+                    continue;
+                }
+                connections_[fd].reset(new Connection(fd));
+            }
+        }
+
+        void handle(int fd, uint32_t events) {
+            ConnectionMap::iterator itr = connections_.find(fd);
+            if (itr == connections_.end()) {
+                return;
+            }
+            boost::shared_ptr<Connection> connection = itr->second;
+            bool open = (events & EPOLLERR) == 0;
+            if (open && (events & (EPOLLIN | EPOLLHUP))) {
+                open = readRequests(connection);
+            }
+            if (open) {
+                open = update(*connection);
+            }
+            if (!open) {
+                closeConnection(*connection);
+            }
+        }
+
+        /**
+         * Writes the responses of the finished Tasks, and starts the
+         * requests that were waiting for them.
+         */
+        void finishTasks() {
+            uint64_t count;
+            if (read(eventFd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                fprintf(stderr, "EpollServer failed to read eventfd: %s\n", strerror(errno));
+            }
+            std::vector<Finished> finished;
+            {
+                boost::mutex::scoped_lock lock(finishedMutex_);
+                finished.swap(finished_);
+            }
+            for (size_t i = 0; i < finished.size(); i++) {
+                Connection& connection = *finished[i].connection;
+                connection.numRunning--;
+                if (connection.closed) {
+                    continue;
+                }
+                connection.output.append(finished[i].response);
+                if (!finished[i].ok || !runRequests(finished[i].connection) || !update(connection)) {
+                    closeConnection(connection);
+                }
+            }
+        }
+
+        /**
+         * Reads what's available and runs the complete requests.
+         *
+         * @returns false if the connection should be closed.
+         */
+        bool readRequests(boost::shared_ptr<Connection> connection) {
+            char buffer[READ_SIZE];
+            ssize_t size = recv(connection->fd, buffer, sizeof(buffer), 0);
+            if (size == 0) {
+                return false;
+            }
+            if (size < 0) {
+                return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            }
+            connection->input.append(buffer, size);
+            return runRequests(connection);
+        }
+
+        /**
+         * Runs the complete requests in the input, on the loop or on the
+         * ThreadManager.
+         */
+        bool runRequests(boost::shared_ptr<Connection> connection) {
+            std::string& input = connection->input;
+            size_t offset = 0;
+            bool ok = true;
+            while (ok && input.size() - offset >= sizeof(uint32_t) &&
+                   connection->numRunning < MAX_RUNNING) {
+                uint32_t frameSize;
+                memcpy(&frameSize, input.data() + offset, sizeof(frameSize));
+                frameSize = ntohl(frameSize);
+                if (frameSize > MAX_FRAME_SIZE) {
+                    fprintf(stderr, "EpollServer closing connection with %u byte frame\n", frameSize);
+                    return false;
+                }
+                if (input.size() - offset - sizeof(uint32_t) < frameSize) {
+                    break;
+                }
+                const char* request = input.data() + offset + sizeof(uint32_t);
+                if (threadManager_) {
+                    boost::shared_ptr<apache::thrift::concurrency::Runnable> task(
+                        new Task(*this, connection, request, frameSize));
+                    connection->numRunning++;
+                    threadManager_->add(task);
+                } else {
+                    input_->resetBuffer((uint8_t*)request, frameSize);
+                    output_->resetBuffer();
+                    ok = process(inputProtocol_, outputProtocol_, *output_, connection->output, NULL);
+                }
+                offset += sizeof(uint32_t) + frameSize;
+            }
+            input.erase(0, offset);
+            return ok;
+        }
+
+        /**
+         * Sends as much of the output as the socket takes and picks the
+         * events to wait for. While some output is left, or too many
+         * requests are running, the connection isn't read from, so a
+         * client that doesn't read its responses can't make the server
+         * buffer more of them.
+         */
+        bool update(Connection& connection) {
+            while (connection.outputOffset < connection.output.size()) {
+                ssize_t size = send(connection.fd, connection.output.data() + connection.outputOffset,
+                                    connection.output.size() - connection.outputOffset, MSG_NOSIGNAL);
+                if (size < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        return false;
+                    }
+                    break;
+                }
+                connection.outputOffset += size;
+            }
+            uint32_t events = 0;
+            if (connection.outputOffset < connection.output.size()) {
+                events = EPOLLOUT;
+            } else {
+                connection.output.clear();
+                connection.outputOffset = 0;
+                if (connection.numRunning < MAX_RUNNING) {
+                    events = EPOLLIN;
+                }
+            }
+            if (events != connection.events) {
+                connection.events = events;
+                return watch(connection.fd, events, EPOLL_CTL_MOD);
+            }
+            return true;
+        }
+
+        /**
+         * Running Tasks keep the Connection alive until they finish,
+         * but their responses are dropped.
+         */
+        void closeConnection(Connection& connection) {
+            // closing the socket also takes it out of the epoll set.
+            close(connection.fd);
+            connection.closed = true;
+            connections_.erase(connection.fd);
+        }
+
+        boost::shared_ptr<apache::thrift::TProcessor> processor_;
+        boost::shared_ptr<apache::thrift::concurrency::ThreadManager> threadManager_;
+        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> input_;
+        boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> output_;
+        boost::shared_ptr<apache::thrift::protocol::TProtocol> inputProtocol_;
+        boost::shared_ptr<apache::thrift::protocol::TProtocol> outputProtocol_;
+        int cpu_;
+        int listenFd_;
+        int epollFd_;
+        int eventFd_; // workers wake the loop up through it
+        ConnectionMap connections_;
+        boost::mutex finishedMutex_; // protect finished_
+        std::vector<Finished> finished_;
+    };
+
+    boost::shared_ptr<apache::thrift::TProcessor> processor_;
+    int port_;
+    size_t numLoops_;
+    boost::shared_ptr<apache::thrift::concurrency::ThreadManager> threadManager_;
+};
+
+#endif // EPOLL_SERVER_H
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef FORWARDING_HANDLER_H
+#define FORWARDING_HANDLER_H
+
+/**
+ * A handler that passes every call to another handler.
+ *
+ * Features that work the same way on top of any backend (the change
+ * log, for example) derive from it, override the calls they care about,
+ * and are stacked in front of the backend in main():
+ *
+ *   shared_ptr<MapKeeperIf> handler(new LevelDbServer(...));
+ *   handler.reset(new ChangeLogHandler(handler, changeLogSize));
+ *   shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
+ */
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "MapKeeper.h"
+
+class ForwardingHandler: virtual public mapkeeper::MapKeeperIf {
+public:
+    ForwardingHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> next) :
+        next_(next) {
+    }
+
+    mapkeeper::ResponseCode::type ping() {
+        return next_->ping();
+    }
+
+    void getStats(mapkeeper::StatsResponse& _return, const bool reset) {
+        next_->getStats(_return, reset);
+    }
+
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName) {
+        return next_->addMap(mapName);
+    }
+
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName) {
+        return next_->dropMap(mapName);
+    }
+
+    void listMaps(mapkeeper::StringListResponse& _return) {
+        next_->listMaps(_return);
+    }
+
+    void openMap(mapkeeper::MapHandleResponse& _return, const std::string& mapName) {
+        next_->openMap(_return, mapName);
+    }
+
+    void getByHandle(mapkeeper::BinaryResponse& _return, const int32_t mapHandle,
+                     const std::string& key) {
+        next_->getByHandle(_return, mapHandle, key);
+    }
+
+    mapkeeper::ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key,
+                                              const std::string& value) {
+        return next_->putByHandle(mapHandle, key, value);
+    }
+
+    void scanByHandle(mapkeeper::RecordListResponse& _return, const int32_t mapHandle,
+                      const mapkeeper::ScanOrder::type order,
+                      const std::string& startKey, const bool startKeyIncluded,
+                      const std::string& endKey, const bool endKeyIncluded,
+                      const int32_t maxRecords, const int32_t maxBytes,
+                      const mapkeeper::ScanOptions& options) {
+        next_->scanByHandle(_return, mapHandle, order, startKey, startKeyIncluded,
+                            endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const mapkeeper::ScanOptions& options) {
+        next_->scan(_return, mapName, order, startKey, startKeyIncluded,
+                    endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void openScan(mapkeeper::ScanCursorResponse& _return, const std::string& mapName,
+                  const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const mapkeeper::ScanOptions& options) {
+        next_->openScan(_return, mapName, order, startKey, startKeyIncluded,
+                        endKey, endKeyIncluded, options);
+    }
+
+    void nextScan(mapkeeper::RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        next_->nextScan(_return, cursorId, maxRecords, maxBytes);
+    }
+
+    mapkeeper::ResponseCode::type closeScan(const int64_t cursorId) {
+        return next_->closeScan(cursorId);
+    }
+
+    void createSnapshot(mapkeeper::SnapshotResponse& _return, const std::string& mapName) {
+        next_->createSnapshot(_return, mapName);
+    }
+
+    mapkeeper::ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        return next_->releaseSnapshot(snapshotId);
+    }
+
+    void getAtSnapshot(mapkeeper::BinaryResponse& _return, const int64_t snapshotId,
+                       const std::string& key) {
+        next_->getAtSnapshot(_return, snapshotId, key);
+    }
+
+    void scanAtSnapshot(mapkeeper::RecordListResponse& _return, const int64_t snapshotId,
+                        const mapkeeper::ScanOrder::type order,
+                        const std::string& startKey, const bool startKeyIncluded,
+                        const std::string& endKey, const bool endKeyIncluded,
+                        const int32_t maxRecords, const int32_t maxBytes,
+                        const mapkeeper::ScanOptions& options) {
+        next_->scanAtSnapshot(_return, snapshotId, order, startKey, startKeyIncluded,
+                              endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void countRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                    const std::string& startKey, const std::string& endKey) {
+        next_->countRange(_return, mapName, startKey, endKey);
+    }
+
+    void approximateSize(mapkeeper::Int64Response& _return, const std::string& mapName,
+                         const std::string& startKey, const std::string& endKey) {
+        next_->approximateSize(_return, mapName, startKey, endKey);
+    }
+
+    void sampleSplitPoints(mapkeeper::KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        next_->sampleSplitPoints(_return, mapName, numSplits);
+    }
+
+    void aggregate(mapkeeper::AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const mapkeeper::AggregateOp::type op,
+                   const mapkeeper::ValueEncoding::type encoding) {
+        next_->aggregate(_return, mapName, startKey, endKey, op, encoding);
+    }
+
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName,
+             const std::string& key) {
+        next_->get(_return, mapName, key);
+    }
+
+    void multiGet(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys) {
+        next_->multiGet(_return, mapName, keys);
+    }
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key,
+                                      const std::string& value,
+                                      const mapkeeper::WriteOptions& options) {
+        return next_->put(mapName, key, value, options);
+    }
+
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        return next_->insert(mapName, key, value, options);
+    }
+
+    mapkeeper::ResponseCode::type insertMany(const std::string& mapName,
+                                             const std::vector<mapkeeper::Record>& records) {
+        return next_->insertMany(mapName, records);
+    }
+
+    mapkeeper::ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        return next_->ingestFile(mapName, path);
+    }
+
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        return next_->update(mapName, key, value, options);
+    }
+
+    mapkeeper::ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key,
+                                                const std::string& expectedValue,
+                                                const std::string& newValue) {
+        return next_->compareAndSet(mapName, key, expectedValue, newValue);
+    }
+
+    void increment(mapkeeper::Int64Response& _return, const std::string& mapName,
+                   const std::string& key, const int64_t delta) {
+        next_->increment(_return, mapName, key, delta);
+    }
+
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& value) {
+        return next_->append(mapName, key, value);
+    }
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        return next_->remove(mapName, key);
+    }
+
+    void removeRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        next_->removeRange(_return, mapName, startKey, endKey);
+    }
+
+    mapkeeper::ResponseCode::type writeBatch(const std::string& mapName,
+                                             const std::vector<mapkeeper::Mutation>& mutations) {
+        return next_->writeBatch(mapName, mutations);
+    }
+
+    void tailChanges(mapkeeper::ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        next_->tailChanges(_return, mapName, fromSeq, maxRecords);
+    }
+
+protected:
+    boost::shared_ptr<mapkeeper::MapKeeperIf> next_;
+};
+
+#endif // FORWARDING_HANDLER_H
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef GROUP_COMMIT_HANDLER_H
+#define GROUP_COMMIT_HANDLER_H
+
+/**
+ * Merges concurrent put, insert, update and remove calls on the same
+ * map into one writeBatch, so a backend that syncs every write syncs
+ * once for the whole group.
+ *
+ * The first write to arrive on a map leads a group. It waits up to
+ * windowMicros for more writes to join, and for the group before it on
+ * the same map to finish, then sends the group to the backend while the
+ * next group forms. A group stops taking writes once it holds maxBytes
+ * of keys and values. The callers return once their group is applied,
+ * so a Success is as durable as it would be without grouping. Even with
+ * a window of 0, writes that arrive while a group is being applied are
+ * grouped.
+ *
+ * writeBatch applies all of its mutations or none. If a group fails
+ * because of one of its writes (an insert of an existing key, say), its
+ * writes are applied one by one, in the order they arrived, so each
+ * caller gets the answer it would have gotten alone. A group of one is
+ * never turned into a batch.
+ *
+ * Each map being written to has a queue of its groups, in the order
+ * they were started, with its own lock. A group is applied once the
+ * ones before it are, and the queue is removed when no write is using
+ * it, so maps that aren't being written to cost nothing.
+ *
+ * It goes right in front of the backend, before the handlers that hold
+ * a key lock across the backend call (ChangeLogHandler, TtlHandler), so
+ * two writes to the same key are never in one group and the other
+ * handlers still see every write on its own. Writes with a TTL are
+ * passed through; the TTL handler never sends those to the backend.
+ */
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
+#include "ForwardingHandler.h"
+
+class GroupCommitHandler: public ForwardingHandler {
+public:
+    GroupCommitHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> next, int windowMicros,
+                       size_t maxBytes) :
+        ForwardingHandler(next),
+        windowMicros_(windowMicros),
+        maxBytes_(maxBytes) {
+    }
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key,
+                                      const std::string& value,
+                                      const mapkeeper::WriteOptions& options) {
+        if (options.ttlSeconds != 0) {
+            return next_->put(mapName, key, value, options);
+        }
+        return write(mapName, mapkeeper::MutationType::Put, key, value);
+    }
+
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        if (options.ttlSeconds != 0) {
+            return next_->insert(mapName, key, value, options);
+        }
+        return write(mapName, mapkeeper::MutationType::Insert, key, value);
+    }
+
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        if (options.ttlSeconds != 0) {
+            return next_->update(mapName, key, value, options);
+        }
+        return write(mapName, mapkeeper::MutationType::Update, key, value);
+    }
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        return write(mapName, mapkeeper::MutationType::Remove, key, "");
+    }
+
+private:
+    struct Group {
+        Group() :
+            numBytes(0),
+            done(false) {
+        }
+
+        std::vector<mapkeeper::Mutation> mutations;
+        std::vector<mapkeeper::ResponseCode::type> results;
+        size_t numBytes;
+        bool done;
+    };
+
+    struct MapQueue {
+        MapQueue() :
+            numWriters(0) {
+        }
+
+        boost::shared_ptr<Group> pending; // taking writes, if any
+        std::deque<boost::shared_ptr<Group> > groups; // not applied yet, oldest first
+        boost::mutex mutex; // protect pending, groups and the groups in them
+        boost::condition_variable changed;
+        int numWriters; // writes using the queue, protected by queuesMutex_
+    };
+
+    /**
+     * Holds the queue of a map for as long as a write uses it.
+     */
+    class QueueRef {
+    public:
+        QueueRef(GroupCommitHandler& handler, const std::string& mapName) :
+            handler_(handler),
+            mapName_(mapName) {
+            boost::mutex::scoped_lock lock(handler_.queuesMutex_);
+            boost::shared_ptr<MapQueue>& queue = handler_.queues_[mapName_];
+            if (!queue) {
+                queue.reset(new MapQueue());
+            }
+            queue->numWriters++;
+            queue_ = queue;
+        }
+
+        ~QueueRef() {
+            boost::mutex::scoped_lock lock(handler_.queuesMutex_);
+            if (--queue_->numWriters == 0) {
+                // every group it held has been applied.
+                handler_.queues_.erase(mapName_);
+            }
+        }
+
+        MapQueue& operator*() const {
+            return *queue_;
+        }
+
+    private:
+        GroupCommitHandler& handler_;
+        const std::string& mapName_;
+        boost::shared_ptr<MapQueue> queue_;
+    };
+
+    mapkeeper::ResponseCode::type write(const std::string& mapName, mapkeeper::MutationType::type type,
+                                        const std::string& key, const std::string& value) {
+        QueueRef ref(*this, mapName);
+        MapQueue& queue = *ref;
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        bool leader = !queue.pending;
+        if (leader) {
+            queue.pending.reset(new Group());
+            queue.groups.push_back(queue.pending);
+        }
+        boost::shared_ptr<Group> group = queue.pending;
+        size_t index = group->mutations.size();
+        group->mutations.push_back(mapkeeper::Mutation());
+        group->mutations.back().type = type;
+        group->mutations.back().key = key;
+        group->mutations.back().value = value;
+        group->numBytes += key.size() + value.size();
+        if (group->numBytes >= maxBytes_) {
+            // the next write starts a new group.
+            queue.pending.reset();
+            queue.changed.notify_all();
+        }
+        if (!leader) {
+            while (!group->done) {
+                queue.changed.wait(lock);
+            }
+            return group->results[index];
+        }
+
+        boost::system_time deadline = boost::get_system_time() +
+            boost::posix_time::microseconds(windowMicros_);
+        while (queue.pending == group && queue.changed.timed_wait(lock, deadline)) {
+        }
+        // the groups before this one are applied first.
+        while (queue.groups.front() != group) {
+            queue.changed.wait(lock);
+        }
+        if (queue.pending == group) {
+            queue.pending.reset();
+        }
+        lock.unlock();
+        try {
+            commit(mapName, *group);
+        } catch (...) {
+            // the callers would wait forever otherwise.
+            group->results.assign(group->mutations.size(), mapkeeper::ResponseCode::Error);
+        }
+        lock.lock();
+        queue.groups.pop_front();
+        group->done = true;
+        queue.changed.notify_all();
+        return group->results[index];
+    }
+
+    void commit(const std::string& mapName, Group& group) {
+        mapkeeper::ResponseCode::type rc = mapkeeper::ResponseCode::Error;
+        if (group.mutations.size() > 1) {
+            rc = next_->writeBatch(mapName, group.mutations);
+        }
+        if (rc == mapkeeper::ResponseCode::Success || rc == mapkeeper::ResponseCode::MapNotFound) {
+            group.results.assign(group.mutations.size(), rc);
+            return;
+        }
+        // nothing was applied; apply the writes one by one.
+        for (size_t i = 0; i < group.mutations.size(); i++) {
+            group.results.push_back(apply(mapName, group.mutations[i]));
+        }
+    }
+
+    mapkeeper::ResponseCode::type apply(const std::string& mapName, const mapkeeper::Mutation& mutation) {
+        switch (mutation.type) {
+        case mapkeeper::MutationType::Put:
+            return next_->put(mapName, mutation.key, mutation.value, mapkeeper::WriteOptions());
+        case mapkeeper::MutationType::Insert:
+            return next_->insert(mapName, mutation.key, mutation.value, mapkeeper::WriteOptions());
+        case mapkeeper::MutationType::Update:
+            return next_->update(mapName, mutation.key, mutation.value, mapkeeper::WriteOptions());
+        case mapkeeper::MutationType::Remove:
+            return next_->remove(mapName, mutation.key);
+        default:
+            return mapkeeper::ResponseCode::Error;
+        }
+    }
+
+    int windowMicros_;
+    size_t maxBytes_;
+    std::map<std::string, boost::shared_ptr<MapQueue> > queues_; // maps being written to
+    boost::mutex queuesMutex_; // protect queues_ and numWriters
+};
+
+#endif // GROUP_COMMIT_HANDLER_H
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+/**
+ * A histogram of latencies in microseconds, in the style of
+ * HdrHistogram.
+ *
+ * Latencies below 64us get a bucket each. Above that, every power of
+ * two is split into 32 buckets, so a bucket is never wider than about
+ * 3% of the latencies in it, up to 2^40us (about 12 days). Recording
+ * is an atomic increment and never takes a lock, so any number of
+ * threads can record into the same histogram.
+ */
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void record(uint64_t micros) {
+        __sync_fetch_and_add(&counts_[bucket(micros)], 1);
+        __sync_fetch_and_add(&count_, 1);
+        uint64_t max = max_;
+        while (micros > max) {
+            uint64_t previous = __sync_val_compare_and_swap(&max_, max, micros);
+            if (previous == max) {
+                break;
+            }
+            max = previous;
+        }
+    }
+
+    uint64_t count() const {
+        return count_;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    /**
+     * @param fraction between 0 and 1, 0.99 for the 99th percentile.
+     * @returns the latency fraction of the records are at or below, or
+     *          0 if there aren't any.
+     */
+    uint64_t percentile(double fraction) const {
+        uint64_t total = 0;
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            total += counts_[i];
+        }
+        // the first record at or above the fraction, counting from 1.
+        uint64_t target = (uint64_t)(fraction * total);
+        if (target < fraction * total || target == 0) {
+            target++;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < NUM_BUCKETS && total > 0; i++) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return std::min(highestValue(i), max_);
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * Not atomic; records made during a reset may be half counted.
+     */
+    void reset() {
+        memset(counts_, 0, sizeof(counts_));
+        count_ = 0;
+        max_ = 0;
+    }
+
+private:
+    static const int PRECISION_BITS = 6;
+    static const int SUB_BUCKETS = 1 << PRECISION_BITS;
+    static const int HALF_BUCKETS = SUB_BUCKETS / 2;
+    static const int MAX_BITS = 41;
+    static const int NUM_BUCKETS = SUB_BUCKETS + (MAX_BITS - PRECISION_BITS) * HALF_BUCKETS;
+
+    static int bucket(uint64_t micros) {
+        if (micros < (uint64_t)SUB_BUCKETS) {
+            return micros;
+        }
+        if (micros >> MAX_BITS) {
+            micros = (1ULL << MAX_BITS) - 1;
+        }
+        // micros >> shift is between HALF_BUCKETS and SUB_BUCKETS - 1.
+        int shift = 63 - __builtin_clzll(micros) - (PRECISION_BITS - 1);
+        return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + (int)(micros >> shift) - HALF_BUCKETS;
+    }
+
+    static uint64_t highestValue(int bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int shift = (bucket - SUB_BUCKETS) / HALF_BUCKETS + 1;
+        uint64_t top = (bucket - SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+        return ((top + 1) << shift) - 1;
+    }
+
+    uint64_t counts_[NUM_BUCKETS];
+    uint64_t count_;
+    uint64_t max_;
+};
+
+#endif // LATENCY_HISTOGRAM_H
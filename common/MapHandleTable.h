@@ -0,0 +1,170 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MAP_HANDLE_TABLE_H
+#define MAP_HANDLE_TABLE_H
+
+/**
+ * Keeps track of the map handles handed out by openMap.
+ *
+ * A handle is an index into a fixed array of slots, so resolving it
+ * doesn't hash or compare the map name. Each slot holds whatever the
+ * server needs to reach the map directly (a leveldb::DB*, an MDB_dbi,
+ * ...).
+ *
+ * The low 16 bits of a handle are the slot index and the rest is the
+ * generation of the slot. The generation changes every time the slot
+ * is reused, so the handle of a dropped map doesn't resolve to another
+ * map that got the same slot later.
+ *
+ * add, update and remove must be serialized by the server, which
+ * already has a lock that protects its list of maps from addMap and
+ * dropMap. get doesn't need any lock: each slot has a version that is
+ * odd while the slot is being changed, and get reads the slot again if
+ * the version changed under it, so it sees a slot either before or
+ * after a change. Map must be a plain value, like a pointer or an id.
+ *
+ * That only makes the slot safe to read. Servers whose Map points to
+ * an object that dropMap deletes (a leveldb::DB*, a TreeDB*, ...) still
+ * hold their map lock, shared, across the whole call, since it's what
+ * keeps the object alive until the call is done.
+ */
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+template <class Map>
+class MapHandleTable {
+public:
+    MapHandleTable(uint32_t maxHandles = 1024) :
+        slots_(maxHandles < 0x10000 ? maxHandles : 0x10000) {
+    }
+
+    /**
+     * Returns the handle of a map, and assigns one if it doesn't have
+     * one yet.
+     *
+     * @returns the handle, or -1 if all the handles are taken.
+     */
+    int32_t add(const std::string& mapName, const Map& map) {
+        int32_t freeSlot = -1;
+        for (size_t i = 0; i < slots_.size(); i++) {
+            if (slots_[i].used && slots_[i].mapName == mapName) {
+                beginWrite(slots_[i]);
+                slots_[i].map = map;
+                endWrite(slots_[i]);
+                return handle(i);
+            } else if (!slots_[i].used && freeSlot < 0) {
+                freeSlot = i;
+            }
+        }
+        if (freeSlot < 0) {
+            return -1;
+        }
+        Slot& slot = slots_[freeSlot];
+        beginWrite(slot);
+        slot.used = true;
+        slot.generation = (slot.generation + 1) & 0x7fff;
+        slot.mapName = mapName;
+        slot.map = map;
+        endWrite(slot);
+        return handle(freeSlot);
+    }
+
+    /**
+     * @returns true if the handle is valid, and sets map.
+     */
+    bool get(int32_t mapHandle, Map& map) const {
+        uint32_t index = mapHandle & 0xffff;
+        if (mapHandle < 0 || index >= slots_.size()) {
+            return false;
+        }
+        const Slot& slot = slots_[index];
+        while (true) {
+            uint32_t version = slot.version;
+            __sync_synchronize();
+            if (version & 1) {
+                continue;
+            }
+            bool valid = slot.used && slot.generation == (uint32_t)mapHandle >> 16;
+            Map found = slot.map;
+            __sync_synchronize();
+            if (slot.version == version) {
+                if (valid) {
+                    map = found;
+                }
+                return valid;
+            }
+        }
+    }
+
+    /**
+     * Points the handle of a map, if it has one, to a reopened map.
+     */
+    void update(const std::string& mapName, const Map& map) {
+        for (size_t i = 0; i < slots_.size(); i++) {
+            if (slots_[i].used && slots_[i].mapName == mapName) {
+                beginWrite(slots_[i]);
+                slots_[i].map = map;
+                endWrite(slots_[i]);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Invalidates the handle of a map that is being dropped.
+     */
+    void remove(const std::string& mapName) {
+        for (size_t i = 0; i < slots_.size(); i++) {
+            if (slots_[i].used && slots_[i].mapName == mapName) {
+                beginWrite(slots_[i]);
+                slots_[i].used = false;
+                slots_[i].map = Map();
+                endWrite(slots_[i]);
+                slots_[i].mapName.clear();
+                return;
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        Slot() : version(0), used(false), generation(0), map() {}
+        volatile uint32_t version; // odd while the slot is being changed
+        bool used;
+        uint32_t generation;
+        std::string mapName; // only read by add, update and remove
+        Map map;
+    };
+
+    static void beginWrite(Slot& slot) {
+        slot.version++;
+        __sync_synchronize();
+    }
+
+    static void endWrite(Slot& slot) {
+        __sync_synchronize();
+        slot.version++;
+    }
+
+    int32_t handle(size_t index) const {
+        return (int32_t)(slots_[index].generation << 16 | index);
+    }
+
+    std::vector<Slot> slots_;
+};
+
+#endif // MAP_HANDLE_TABLE_H
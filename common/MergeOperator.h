@@ -0,0 +1,102 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MERGE_OPERATOR_H
+#define MERGE_OPERATOR_H
+
+/**
+ * Read-modify-write operations executed inside the server (increment,
+ * append).
+ *
+ * A backend reads the current value of the record, computes the new
+ * value with a MergeFunction, and writes it back while holding whatever
+ * lock or transaction makes the three steps atomic.
+ *
+ * Counters are 8 byte big-endian two's complement integers. That's the
+ * format Kyoto Cabinet's increment() uses, so a counter reads the same
+ * regardless of the backend that wrote it.
+ */
+#include <string>
+#include <stdint.h>
+
+/**
+ * Computes the new value of a record.
+ *
+ * @param current current value, or NULL if the record doesn't exist.
+ * @param operand argument of the operation.
+ * @param result new value of the record.
+ * @returns false if the current value can't be merged with the operand.
+ */
+typedef bool (*MergeFunction)(const std::string* current, 
+                              const std::string& operand,
+                              std::string& result);
+
+inline void encodeCounter(int64_t value, std::string& data) {
+    uint64_t bits = value;
+    data.resize(8);
+    for (int i = 7; i >= 0; i--) {
+        data[i] = (char)(bits & 0xff);
+        bits >>= 8;
+    }
+}
+
+/**
+ * @returns false if data isn't an 8 byte counter.
+ */
+inline bool decodeCounter(const std::string& data, int64_t& value) {
+    if (data.size() != 8) {
+        return false;
+    }
+    uint64_t bits = 0;
+    for (size_t i = 0; i < 8; i++) {
+        bits = (bits << 8) | (unsigned char)data[i];
+    }
+    value = (int64_t)bits;
+    return true;
+}
+
+/**
+ * Adds the counter in operand to the current counter. A missing record
+ * counts as 0. Overflow wraps around.
+ */
+inline bool mergeIncrement(const std::string* current, const std::string& operand,
+                           std::string& result) {
+    int64_t value = 0;
+    int64_t delta = 0;
+    if (current && !decodeCounter(*current, value)) {
+        return false;
+    }
+    if (!decodeCounter(operand, delta)) {
+        return false;
+    }
+    encodeCounter((int64_t)((uint64_t)value + (uint64_t)delta), result);
+    return true;
+}
+
+/**
+ * Appends operand to the current value.
+ */
+inline bool mergeAppend(const std::string* current, const std::string& operand,
+                        std::string& result) {
+    if (current) {
+        result = *current;
+    } else {
+        result.clear();
+    }
+    result += operand;
+    return true;
+}
+
+#endif // MERGE_OPERATOR_H
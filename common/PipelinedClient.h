@@ -0,0 +1,160 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef PIPELINED_CLIENT_H
+#define PIPELINED_CLIENT_H
+
+/**
+ * A client that keeps many requests in flight on one connection.
+ *
+ * MapKeeperClient waits for the response of a call before the next one
+ * can be sent. PipelinedClient splits every call in two, using the
+ * send_ and recv_ functions of a MapKeeperClient that writes into and
+ * reads from memory buffers:
+ *
+ *   PipelinedClient pipeline("localhost", 9090);
+ *   pipeline.client().send_get("users", "alice");
+ *   int32_t aliceId = pipeline.send();
+ *   pipeline.client().send_get("users", "bob");
+ *   int32_t bobId = pipeline.send();
+ *   for (int i = 0; i < 2; i++) {
+ *       int32_t seqId = pipeline.receive();
+ *       BinaryResponse response;
+ *       pipeline.client().recv_get(response);
+ *       // seqId is aliceId or bobId
+ *   }
+ *
+ * Every request gets its own sequence id, and receive returns the id of
+ * the response it read, so the caller knows which recv_ function to
+ * call. A "pipelined" server (see EpollServer.h) may answer in any
+ * order; the other servers answer in order.
+ *
+ * Not thread safe. Requests are buffered until receive or flush.
+ */
+#include <cstring>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <arpa/inet.h>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TBufferTransports.h>
+#include "MapKeeper.h"
+
+class PipelinedClient {
+public:
+    PipelinedClient(const std::string& host, int port) :
+        socket_(new apache::thrift::transport::TSocket(host, port)),
+        transport_(new apache::thrift::transport::TBufferedTransport(socket_)),
+        request_(new apache::thrift::transport::TMemoryBuffer()),
+        response_(new apache::thrift::transport::TMemoryBuffer()),
+        client_(boost::shared_ptr<apache::thrift::protocol::TProtocol>(
+                    new apache::thrift::protocol::TBinaryProtocol(response_)),
+                boost::shared_ptr<apache::thrift::protocol::TProtocol>(
+                    new apache::thrift::protocol::TBinaryProtocol(request_))),
+        nextSeqId_(1) {
+        transport_->open();
+    }
+
+    ~PipelinedClient() {
+        transport_->close();
+    }
+
+    /**
+     * Call send_ functions on this before send, and recv_ functions
+     * after receive. Don't call the blocking functions.
+     */
+    mapkeeper::MapKeeperClient& client() {
+        return client_;
+    }
+
+    /**
+     * Queues the request made by the last send_ call.
+     *
+     * @returns the sequence id of the request.
+     */
+    int32_t send() {
+        uint8_t* request;
+        uint32_t size;
+        request_->getBuffer(&request, &size);
+        int32_t seqId = nextSeqId_++;
+        uint32_t seqIdBytes = htonl(seqId);
+        memcpy(request + seqIdOffset(request, size), &seqIdBytes, sizeof(seqIdBytes));
+        uint32_t frameSize = htonl(size);
+        transport_->write((uint8_t*)&frameSize, sizeof(frameSize));
+        transport_->write(request, size);
+        request_->resetBuffer();
+        return seqId;
+    }
+
+    /**
+     * Sends the queued requests.
+     */
+    void flush() {
+        transport_->flush();
+    }
+
+    /**
+     * Sends the queued requests and waits for the next response.
+     *
+     * @returns the sequence id of the request it answers.
+     */
+    int32_t receive() {
+        flush();
+        uint32_t frameSize;
+        transport_->readAll((uint8_t*)&frameSize, sizeof(frameSize));
+        frameSize = ntohl(frameSize);
+        if (frameSize < MIN_MESSAGE_SIZE) {
+            throw apache::thrift::transport::TTransportException("response too short");
+        }
+        responseBuffer_.resize(frameSize);
+        transport_->readAll((uint8_t*)&responseBuffer_[0], frameSize);
+        uint8_t* response = (uint8_t*)&responseBuffer_[0];
+        uint32_t seqIdBytes;
+        memcpy(&seqIdBytes, response + seqIdOffset(response, frameSize), sizeof(seqIdBytes));
+        response_->resetBuffer(response, frameSize);
+        return ntohl(seqIdBytes);
+    }
+
+private:
+    // the smallest message header: a non-strict one with an empty name.
+    static const uint32_t MIN_MESSAGE_SIZE = 9;
+
+    /**
+     * The message header is the version and message type, the length
+     * and bytes of the function name, then the sequence id. Peers that
+     * don't use strict mode send the name first, then the message type
+     * as a single byte.
+     */
+    static uint32_t seqIdOffset(const uint8_t* message, uint32_t size) {
+        bool strict = (message[0] & 0x80) != 0;
+        uint32_t nameLength;
+        memcpy(&nameLength, message + (strict ? 4 : 0), sizeof(nameLength));
+        uint64_t offset = (strict ? 8 : 5) + (uint64_t)ntohl(nameLength);
+        if (offset + 4 > size) {
+            throw apache::thrift::transport::TTransportException("malformed message header");
+        }
+        return offset;
+    }
+
+    boost::shared_ptr<apache::thrift::transport::TTransport> socket_;
+    boost::shared_ptr<apache::thrift::transport::TTransport> transport_;
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> request_;
+    boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> response_;
+    mapkeeper::MapKeeperClient client_;
+    std::string responseBuffer_;
+    int32_t nextSeqId_;
+};
+
+#endif // PIPELINED_CLIENT_H
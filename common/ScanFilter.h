@@ -0,0 +1,99 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCAN_FILTER_H
+#define SCAN_FILTER_H
+
+/**
+ * Evaluates the ScanFilter of ScanOptions.
+ *
+ * Backends call these from their scan loops on the key and value they
+ * point to in place (an iterator slice, an MDB_val, ...), so records
+ * that don't match are skipped before anything is copied. Backends that
+ * don't read values for keys-only or projected scans check
+ * hasValueFilter first; value filters need the whole value.
+ */
+#include <cstring>
+#include <string>
+#include <vector>
+#include "MapKeeper.h"
+
+/**
+ * @returns true if the filter looks at values.
+ */
+inline bool hasValueFilter(const mapkeeper::ScanFilter& filter) {
+    return !filter.valuePrefix.empty() || !filter.valueConditions.empty();
+}
+
+/**
+ * @returns true if the filter skips some records.
+ */
+inline bool hasFilter(const mapkeeper::ScanFilter& filter) {
+    return !filter.keyPrefix.empty() || !filter.keySuffix.empty() || hasValueFilter(filter);
+}
+
+inline bool matchesKey(const mapkeeper::ScanFilter& filter, const char* key, size_t size) {
+    if (filter.keyPrefix.size() > size || filter.keySuffix.size() > size) {
+        return false;
+    }
+    return memcmp(key, filter.keyPrefix.data(), filter.keyPrefix.size()) == 0 &&
+           memcmp(key + size - filter.keySuffix.size(), filter.keySuffix.data(),
+                  filter.keySuffix.size()) == 0;
+}
+
+inline bool matchesCondition(const mapkeeper::ValueCondition& condition,
+                             const char* value, size_t size) {
+    if (condition.offset < 0 || (size_t)condition.offset + condition.operand.size() > size) {
+        return false;
+    }
+    int cmp = memcmp(value + condition.offset, condition.operand.data(), condition.operand.size());
+    switch (condition.op) {
+    case mapkeeper::CompareOp::Equal:
+        return cmp == 0;
+    case mapkeeper::CompareOp::NotEqual:
+        return cmp != 0;
+    case mapkeeper::CompareOp::Less:
+        return cmp < 0;
+    case mapkeeper::CompareOp::LessOrEqual:
+        return cmp <= 0;
+    case mapkeeper::CompareOp::Greater:
+        return cmp > 0;
+    case mapkeeper::CompareOp::GreaterOrEqual:
+        return cmp >= 0;
+    }
+    return false;
+}
+
+inline bool matchesValue(const mapkeeper::ScanFilter& filter, const char* value, size_t size) {
+    if (filter.valuePrefix.size() > size ||
+        memcmp(value, filter.valuePrefix.data(), filter.valuePrefix.size()) != 0) {
+        return false;
+    }
+    std::vector<mapkeeper::ValueCondition>::const_iterator itr;
+    for (itr = filter.valueConditions.begin(); itr != filter.valueConditions.end(); itr++) {
+        if (!matchesCondition(*itr, value, size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool matchesFilter(const mapkeeper::ScanFilter& filter,
+                          const char* key, size_t keySize,
+                          const char* value, size_t valueSize) {
+    return matchesKey(filter, key, keySize) && matchesValue(filter, value, valueSize);
+}
+
+#endif // SCAN_FILTER_H
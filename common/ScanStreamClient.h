@@ -0,0 +1,78 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCAN_STREAM_CLIENT_H
+#define SCAN_STREAM_CLIENT_H
+
+/**
+ * Client side of the streaming scan transport (see ScanStreamServer.h).
+ *
+ *   ScanStreamClient stream("localhost", 9091);
+ *   stream.open(request);
+ *   RecordListResponse chunk;
+ *   while (stream.next(chunk) == ResponseCode::Success) {
+ *       // consume chunk.records
+ *   }
+ *   // consume the records of the last chunk if it's ScanEnded
+ */
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TSocket.h>
+#include <transport/TBufferTransports.h>
+#include "MapKeeper.h"
+
+class ScanStreamClient {
+public:
+    ScanStreamClient(const std::string& host, int port) :
+        socket_(new apache::thrift::transport::TSocket(host, port)),
+        transport_(new apache::thrift::transport::TFramedTransport(socket_)),
+        protocol_(new apache::thrift::protocol::TBinaryProtocol(transport_)) {
+    }
+
+    ~ScanStreamClient() {
+        transport_->close();
+    }
+
+    /**
+     * Connects to the server and sends the scan request.
+     */
+    void open(const mapkeeper::ScanStreamRequest& request) {
+        transport_->open();
+        request.write(protocol_.get());
+        transport_->writeEnd();
+        transport_->flush();
+    }
+
+    /**
+     * Reads the next chunk of records.
+     *
+     * @returns chunk.responseCode. Success means more chunks follow;
+     *          anything else is the last chunk of the stream.
+     */
+    mapkeeper::ResponseCode::type next(mapkeeper::RecordListResponse& chunk) {
+        chunk.records.clear();
+        chunk.read(protocol_.get());
+        transport_->readEnd();
+        return chunk.responseCode;
+    }
+
+private:
+    boost::shared_ptr<apache::thrift::transport::TTransport> socket_;
+    boost::shared_ptr<apache::thrift::transport::TTransport> transport_;
+    boost::shared_ptr<apache::thrift::protocol::TProtocol> protocol_;
+};
+
+#endif // SCAN_STREAM_CLIENT_H
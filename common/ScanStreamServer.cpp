@@ -0,0 +1,135 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstdio>
+#include <boost/bind.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+#include <transport/TSocket.h>
+#include "ScanStreamServer.h"
+
+using namespace mapkeeper;
+using namespace ::apache::thrift;
+using namespace ::apache::thrift::protocol;
+using namespace ::apache::thrift::transport;
+using boost::shared_ptr;
+
+ScanStreamServer::
+ScanStreamServer(shared_ptr<MapKeeperIf> handler, int port, int maxStreams) :
+    handler_(handler),
+    port_(port),
+    maxStreams_(maxStreams),
+    numStreams_(0)
+{
+}
+
+void ScanStreamServer::
+start()
+{
+    serverSocket_.reset(new TServerSocket(port_));
+    serverSocket_->listen();
+    acceptor_.reset(new boost::thread(boost::bind(&ScanStreamServer::serve, this)));
+}
+
+void ScanStreamServer::
+serve()
+{
+    while (true) {
+        try {
+            shared_ptr<TTransport> client = serverSocket_->accept();
+            if (__sync_add_and_fetch(&numStreams_, 1) > maxStreams_) {
+                __sync_fetch_and_sub(&numStreams_, 1);
+                refuse(client);
+                continue;
+            }
+            // one thread per stream, like TThreadedServer.
+            boost::thread streamer(boost::bind(&ScanStreamServer::stream, this, client));
+            streamer.detach();
+        } catch (TTransportException& e) {
+            fprintf(stderr, "ScanStreamServer accept failed: %s\n", e.what());
+        }
+    }
+}
+
+void ScanStreamServer::
+stream(shared_ptr<TTransport> client)
+{
+    shared_ptr<TTransport> transport(new TFramedTransport(client));
+    TBinaryProtocol protocol(transport);
+    ScanCursorResponse cursor;
+    cursor.cursorId = 0;
+    try {
+        ScanStreamRequest request;
+        request.read(&protocol);
+        transport->readEnd();
+
+        handler_->openScan(cursor, request.mapName, request.order,
+                           request.startKey, request.startKeyIncluded,
+                           request.endKey, request.endKeyIncluded,
+                           request.options);
+        RecordListResponse chunk;
+        chunk.responseCode = cursor.responseCode;
+        while (chunk.responseCode == ResponseCode::Success) {
+            chunk.records.clear();
+            handler_->nextScan(chunk, cursor.cursorId, request.maxRecords, request.maxBytes);
+            chunk.write(&protocol);
+            transport->writeEnd();
+            transport->flush();
+        }
+        if (cursor.responseCode != ResponseCode::Success) {
+            chunk.write(&protocol);
+            transport->writeEnd();
+            transport->flush();
+        }
+    } catch (TException& e) {
+        // most likely the client went away in the middle of the stream.
+        fprintf(stderr, "ScanStreamServer stream failed: %s\n", e.what());
+        if (cursor.cursorId) {
+            handler_->closeScan(cursor.cursorId);
+        }
+    }
+    client->close();
+    __sync_fetch_and_sub(&numStreams_, 1);
+}
+
+/**
+ * Answers Busy on the acceptor thread. The request is read first, so
+ * closing the socket doesn't reset the connection before the client has
+ * read the answer, but only for a short while, so a slow client can't
+ * hold up the other connections.
+ */
+void ScanStreamServer::
+refuse(shared_ptr<TTransport> client)
+{
+    shared_ptr<TSocket> socket = boost::dynamic_pointer_cast<TSocket>(client);
+    if (socket) {
+        socket->setRecvTimeout(REFUSE_TIMEOUT_MS);
+    }
+    shared_ptr<TTransport> transport(new TFramedTransport(client));
+    TBinaryProtocol protocol(transport);
+    try {
+        ScanStreamRequest request;
+        request.read(&protocol);
+        transport->readEnd();
+        RecordListResponse chunk;
+        chunk.responseCode = ResponseCode::Busy;
+        chunk.write(&protocol);
+        transport->writeEnd();
+        transport->flush();
+    } catch (TException& e) {
+        fprintf(stderr, "ScanStreamServer refusing a stream failed: %s\n", e.what());
+    }
+    client->close();
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SCAN_STREAM_SERVER_H
+#define SCAN_STREAM_SERVER_H
+
+/**
+ * Streaming scan transport.
+ *
+ * A regular scan builds the whole RecordListResponse before it's
+ * serialized, so a large scan holds the records twice in memory and the
+ * client doesn't see anything until the last record has been read.
+ *
+ * ScanStreamServer listens on a separate port. A client sends a single
+ * framed ScanStreamRequest, and the server pushes the records back as a
+ * sequence of framed RecordListResponse chunks while it advances a scan
+ * cursor (openScan/nextScan) on the handler. Memory per scan is bounded
+ * by the chunk size, and the first chunk is sent as soon as it's read.
+ *
+ * Each stream runs on its own thread, up to maxStreams at once. Past
+ * that, a client gets a single chunk with Busy. Pass the handler from
+ * ServerRunner::admit so streamed scans count against the same
+ * admission limits and stats as the other calls.
+ *
+ * Any handler that implements openScan and nextScan can be streamed.
+ */
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <transport/TServerSocket.h>
+#include "MapKeeper.h"
+
+class ScanStreamServer {
+public:
+    ScanStreamServer(boost::shared_ptr<mapkeeper::MapKeeperIf> handler, int port, int maxStreams);
+
+    /**
+     * Starts accepting connections in a background thread.
+     */
+    void start();
+
+private:
+    ScanStreamServer(const ScanStreamServer&);
+    ScanStreamServer& operator=(const ScanStreamServer&);
+    void serve();
+    void stream(boost::shared_ptr<apache::thrift::transport::TTransport> client);
+    void refuse(boost::shared_ptr<apache::thrift::transport::TTransport> client);
+
+    static const int REFUSE_TIMEOUT_MS = 100; // wait for the request of a refused stream
+
+    boost::shared_ptr<mapkeeper::MapKeeperIf> handler_;
+    int port_;
+    int maxStreams_;
+    volatile int numStreams_; // streams running now
+    boost::scoped_ptr<apache::thrift::transport::TServerSocket> serverSocket_;
+    boost::scoped_ptr<boost::thread> acceptor_;
+};
+
+#endif // SCAN_STREAM_SERVER_H
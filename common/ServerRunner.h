@@ -0,0 +1,322 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SERVER_RUNNER_H
+#define SERVER_RUNNER_H
+
+/**
+ * Runs a handler in the Thrift server picked with --server-type:
+ *
+ *   threaded     TThreadedServer, a thread per connection.
+ *   threadpool   TThreadPoolServer, a connection holds one of --threads
+ *                threads while it's open.
+ *   nonblocking  TNonblockingServer, requests run on the --io-threads
+ *                event loop threads.
+ *   hsha         TNonblockingServer with a pool of --threads workers.
+ *                The event loops read and write the requests and the
+ *                workers run them (half-sync/half-async).
+ *   epoll        EpollServer, --io-threads event loops that each accept
+ *                their own connections and run their requests. Only
+ *                offered by backends that pass allowEpoll.
+ *   pipelined    EpollServer with a pool of --threads workers. Requests
+ *                of a connection run at the same time and are answered
+ *                as they finish, so a client can keep many requests in
+ *                flight on one connection (see PipelinedClient.h).
+ *
+ * Only threaded and threadpool tie up a thread per open connection.
+ * --io-threads defaults to one per core. Every server uses framed
+ * transport and the binary protocol, so clients work with any of them.
+ *
+ * Every server keeps latency stats for getStats (see ServerStats.h),
+ * and prints them every --stats-interval seconds if it isn't 0.
+ *
+ * --max-requests, --max-requests-per-map and --max-queue-ms turn away
+ * calls with Busy past those limits (see AdmissionHandler.h). The hsha
+ * server can't tell the handler how long a request was queued, so it
+ * drops requests that waited longer than --max-queue-ms for a worker
+ * itself, and closes their connection.
+ *
+ * Backends that sync their writes can call groupCommit on their handler
+ * before stacking the others on it. With --group-commit, concurrent
+ * writes to a map are then applied in one batch (see
+ * GroupCommitHandler.h). Writes wait for their group, so it's refused
+ * with nonblocking and epoll, where the wait would hold up every
+ * connection on the event loop.
+ *
+ * Servers that answer calls of the handler on another port, like
+ * ScanStreamServer, take the handler from admit, so their calls count
+ * against the same limits and show up in the same stats.
+ *
+ * Likewise, backends call cache on their handler to keep the values of
+ * recently read records in --cache-mb of memory (see CachingHandler.h),
+ * for every map or only the --cache-maps ones.
+ *
+ * Backends add the options to their own options_description before
+ * parsing the command line and call serve once the handler is set up:
+ *
+ *   ServerRunner runner;
+ *   runner.addOptions(config);
+ *   ...parse the command line...
+ *   runner.serve(handler, port);
+ */
+#include <algorithm>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <protocol/TBinaryProtocol.h>
+#include <server/TNonblockingServer.h>
+#include <server/TThreadPoolServer.h>
+#include <server/TThreadedServer.h>
+#include <transport/TServerSocket.h>
+#include <transport/TBufferTransports.h>
+#include <thrift/concurrency/ThreadManager.h>
+#include <thrift/concurrency/PosixThreadFactory.h>
+#include "AdmissionHandler.h"
+#include "CachingHandler.h"
+#include "EpollServer.h"
+#include "GroupCommitHandler.h"
+#include "MapKeeper.h"
+#include "ServerStats.h"
+#include "StatsHandler.h"
+
+class ServerRunner {
+public:
+    /**
+     * @param defaultType server type used if --server-type isn't given.
+     * @param allowEpoll whether to offer the epoll server. Its requests
+     *                   run on the event loops, so backends that pass
+     *                   true refuse the options that make their calls
+     *                   block for long when eventLoops() is true.
+     */
+    ServerRunner(const std::string& defaultType = "threaded", bool allowEpoll = false) :
+        defaultType_(defaultType),
+        allowEpoll_(allowEpoll),
+        numThreads_(32),
+        numIoThreads_(0),
+        statsInterval_(0),
+        maxRequests_(0),
+        maxRequestsPerMap_(0),
+        maxQueueMillis_(0),
+        groupCommit_(false),
+        groupCommitMicros_(0),
+        groupCommitKb_(1024),
+        cacheMb_(0),
+        stats_(new ServerStats()) {
+    }
+
+    void addOptions(boost::program_options::options_description& config) {
+        namespace po = boost::program_options;
+        config.add_options()
+            ("server-type", po::value<std::string>(&serverType_)->default_value(defaultType_)->notifier(boost::bind(&ServerRunner::checkServerType, this, _1)),
+             allowEpoll_ ? "threaded, threadpool, nonblocking, hsha, pipelined or epoll" :
+                           "threaded, threadpool, nonblocking, hsha or pipelined")
+            ("threads,t", po::value<size_t>(&numThreads_)->default_value(numThreads_), "number of worker threads (threadpool, hsha, pipelined)")
+            ("io-threads", po::value<size_t>(&numIoThreads_)->default_value(numIoThreads_), "number of event loop threads (nonblocking, hsha, pipelined, epoll), 0 for one per core")
+            ("stats-interval", po::value<int>(&statsInterval_)->default_value(statsInterval_), "seconds between latency stats printed to stderr, 0 for never")
+            ("max-requests", po::value<int>(&maxRequests_)->default_value(maxRequests_), "calls running at once before the rest get Busy, 0 for no limit")
+            ("max-requests-per-map", po::value<int>(&maxRequestsPerMap_)->default_value(maxRequestsPerMap_), "calls running on one map at once before the rest get Busy, 0 for no limit")
+            ("max-queue-ms", po::value<int>(&maxQueueMillis_)->default_value(maxQueueMillis_), "milliseconds a request may wait for a worker before it gets Busy, 0 for no limit")
+            ("group-commit", po::bool_switch(&groupCommit_), "apply concurrent writes to a map in one batch")
+            ("group-commit-us", po::value<int>(&groupCommitMicros_)->default_value(groupCommitMicros_), "microseconds a group waits for more writes")
+            ("group-commit-kb", po::value<int>(&groupCommitKb_)->default_value(groupCommitKb_), "KB of keys and values that close a group")
+            ("cache-mb", po::value<int>(&cacheMb_)->default_value(cacheMb_), "MB of recently read records to keep in memory, 0 for no cache")
+            ("cache-maps", po::value<std::vector<std::string> >(&cacheMaps_)->multitoken(), "maps to cache, all of them if not given")
+            ;
+    }
+
+    size_t numThreads() const {
+        return numThreads_;
+    }
+
+    /**
+     * @returns whether the chosen server runs the calls on its event
+     *          loops (nonblocking and epoll), where a call that waits
+     *          holds up every connection on its loop. Call it after the
+     *          options are parsed.
+     */
+    bool eventLoops() const {
+        return serverType_ == "nonblocking" || serverType_ == "epoll";
+    }
+
+    const std::string& serverType() const {
+        return serverType_;
+    }
+
+    /**
+     * @returns the most calls the handler runs at once with the chosen
+     *          server type and --max-requests, or 0 if nothing bounds it
+     *          (threaded without --max-requests). Backends that hold a
+     *          resource for the length of a call size their pools with
+     *          it. Call it after the options are parsed.
+     */
+    size_t maxConcurrentCalls() const {
+        size_t calls = 0;
+        if (serverType_ == "threadpool" || serverType_ == "hsha" || serverType_ == "pipelined") {
+            calls = numThreads_;
+        } else if (eventLoops()) {
+            calls = numIoThreads();
+        }
+        if (maxRequests_ > 0 && (calls == 0 || (size_t)maxRequests_ < calls)) {
+            calls = maxRequests_;
+        }
+        return calls;
+    }
+
+    /**
+     * @returns backend, behind a CachingHandler if --cache-mb was given.
+     */
+    boost::shared_ptr<mapkeeper::MapKeeperIf> cache(boost::shared_ptr<mapkeeper::MapKeeperIf> backend) {
+        if (cacheMb_ <= 0) {
+            return backend;
+        }
+        std::set<std::string> maps(cacheMaps_.begin(), cacheMaps_.end());
+        return boost::shared_ptr<mapkeeper::MapKeeperIf>(
+            new CachingHandler(backend, (size_t)cacheMb_ * 1024 * 1024, maps));
+    }
+
+    /**
+     * @returns backend, behind a GroupCommitHandler if --group-commit
+     *          was given.
+     */
+    boost::shared_ptr<mapkeeper::MapKeeperIf> groupCommit(boost::shared_ptr<mapkeeper::MapKeeperIf> backend) {
+        if (!groupCommit_) {
+            return backend;
+        }
+        if (eventLoops()) {
+            fprintf(stderr, "--group-commit can't be used with the %s server, which runs "
+                    "requests on its event loops\n", serverType_.c_str());
+            exit(1);
+        }
+        return boost::shared_ptr<mapkeeper::MapKeeperIf>(
+            new GroupCommitHandler(backend, groupCommitMicros_, (size_t)groupCommitKb_ * 1024));
+    }
+
+    /**
+     * @returns handler behind the AdmissionHandler and StatsHandler that
+     *          serve puts in front of it. Calling it again with the same
+     *          handler returns the same wrapper, so serve and the other
+     *          servers share the limits. Call it after the options are
+     *          parsed.
+     */
+    boost::shared_ptr<mapkeeper::MapKeeperIf> admit(boost::shared_ptr<mapkeeper::MapKeeperIf> handler) {
+        if (handler == admittedFrom_) {
+            return admitted_;
+        }
+        admittedFrom_ = handler;
+        if (maxRequests_ > 0 || maxRequestsPerMap_ > 0 || maxQueueMillis_ > 0) {
+            handler.reset(new AdmissionHandler(handler, maxRequests_, maxRequestsPerMap_, maxQueueMillis_));
+        }
+        admitted_.reset(new StatsHandler(handler, stats_));
+        return admitted_;
+    }
+
+    /**
+     * Serves handler on port. Returns when the server stops.
+     */
+    void serve(boost::shared_ptr<mapkeeper::MapKeeperIf> handler, int port) {
+        using namespace apache::thrift;
+        using namespace apache::thrift::concurrency;
+        using namespace apache::thrift::protocol;
+        using namespace apache::thrift::server;
+        using namespace apache::thrift::transport;
+        using boost::shared_ptr;
+        fprintf(stderr, "serving on port %d with %s server\n", port, serverType_.c_str());
+        if (statsInterval_ > 0) {
+            stats_->startDumping(statsInterval_);
+        }
+        shared_ptr<TProcessor> processor(new mapkeeper::MapKeeperProcessor(admit(handler)));
+        shared_ptr<TProcessorEventHandler> eventHandler(new StatsEventHandler(stats_));
+        processor->setEventHandler(eventHandler);
+        if (serverType_ == "epoll") {
+            EpollServer(processor, port, numIoThreads()).serve();
+            return;
+        }
+        shared_ptr<ThreadManager> threadManager;
+        if (serverType_ == "threadpool" || serverType_ == "hsha" || serverType_ == "pipelined") {
+            threadManager = ThreadManager::newSimpleThreadManager(numThreads_);
+            shared_ptr<ThreadFactory> threadFactory(new PosixThreadFactory());
+            threadManager->threadFactory(threadFactory);
+            threadManager->start();
+        }
+        if (serverType_ == "pipelined") {
+            EpollServer(processor, port, numIoThreads(), threadManager).serve();
+            return;
+        }
+        shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
+        shared_ptr<TServer> server;
+        if (serverType_ == "nonblocking" || serverType_ == "hsha") {
+            // TNonblockingServer always uses framed transport.
+            shared_ptr<TNonblockingServer> nonblockingServer(
+                new TNonblockingServer(processor, protocolFactory, port, threadManager));
+            nonblockingServer->setNumIOThreads(numIoThreads());
+            if (threadManager && maxQueueMillis_ > 0) {
+                nonblockingServer->setTaskExpireTime(maxQueueMillis_);
+            }
+            server = nonblockingServer;
+        } else {
+            shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
+            shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
+            if (serverType_ == "threadpool") {
+                server.reset(new TThreadPoolServer(processor, serverTransport, transportFactory,
+                                                   protocolFactory, threadManager));
+            } else {
+                server.reset(new TThreadedServer(processor, serverTransport, transportFactory,
+                                                 protocolFactory));
+            }
+        }
+        server->serve();
+    }
+
+private:
+    void checkServerType(const std::string& serverType) {
+        if (serverType != "threaded" && serverType != "threadpool" &&
+            serverType != "nonblocking" && serverType != "hsha" && serverType != "pipelined" &&
+            (serverType != "epoll" || !allowEpoll_)) {
+            throw boost::program_options::invalid_option_value(serverType);
+        }
+    }
+
+    size_t numIoThreads() const {
+        if (numIoThreads_ > 0) {
+            return numIoThreads_;
+        }
+        return std::max(boost::thread::hardware_concurrency(), 1u);
+    }
+
+    std::string defaultType_;
+    bool allowEpoll_;
+    std::string serverType_;
+    size_t numThreads_;
+    size_t numIoThreads_;
+    int statsInterval_;
+    int maxRequests_;
+    int maxRequestsPerMap_;
+    int maxQueueMillis_;
+    bool groupCommit_;
+    int groupCommitMicros_;
+    int groupCommitKb_;
+    int cacheMb_;
+    std::vector<std::string> cacheMaps_;
+    boost::shared_ptr<ServerStats> stats_;
+    boost::shared_ptr<mapkeeper::MapKeeperIf> admittedFrom_; // last handler passed to admit
+    boost::shared_ptr<mapkeeper::MapKeeperIf> admitted_; // and what admit made of it
+};
+
+#endif // SERVER_RUNNER_H
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+/**
+ * Latency histograms of the requests a server answers, for getStats.
+ *
+ * Every operation has a histogram for each phase of a request. The
+ * phases are timed by StatsEventHandler, which the processor calls
+ * around reading the arguments, running the handler and writing the
+ * response. StatsHandler adds a histogram of the call latency for each
+ * map an operation is called on. ServerRunner sets both up for every
+ * backend.
+ *
+ * The histograms of every operation in the IDL are created up front, so
+ * looking one up never takes a lock. Each operation keeps the
+ * histograms of at most MAX_MAPS maps; calls on further maps are
+ * recorded under otherName(). Histograms are never removed; a reset only
+ * empties them.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_map.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <TProcessor.h>
+#include "LatencyHistogram.h"
+#include "MapKeeper.h"
+
+class ServerStats {
+public:
+    enum Phase {
+        QueueWait,
+        Deserialize,
+        Call,
+        Serialize,
+        Total,
+        NUM_PHASES
+    };
+
+    struct OperationHistograms {
+        LatencyHistogram phases[NUM_PHASES];
+        boost::ptr_map<std::string, LatencyHistogram> maps; // call latency on each map
+        boost::shared_mutex mapsMutex; // protect maps
+    };
+
+    static const size_t MAX_MAPS = 64;
+
+    /**
+     * Where the calls on maps beyond the first MAX_MAPS of an operation
+     * are recorded, and the calls of operations that aren't in the IDL.
+     */
+    static const char* otherName() {
+        return "(other)";
+    }
+
+    ServerStats() :
+        startTime_(now()) {
+        static const char* names[] = {
+            "ping", "getStats", "addMap", "dropMap", "listMaps", "openMap",
+            "getByHandle", "putByHandle", "scanByHandle", "scan", "openScan",
+            "nextScan", "closeScan", "createSnapshot", "releaseSnapshot",
+            "getAtSnapshot", "scanAtSnapshot", "countRange", "approximateSize",
+            "sampleSplitPoints", "aggregate", "get", "multiGet", "put", "insert",
+            "insertMany", "ingestFile", "update", "compareAndSet", "increment",
+            "append", "remove", "removeRange", "writeBatch", "tailChanges",
+        };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            std::string name = names[i];
+            operations_.insert(name, new OperationHistograms());
+        }
+        std::string other = otherName();
+        operations_.insert(other, new OperationHistograms());
+    }
+
+    ~ServerStats() {
+        if (dumper_) {
+            dumper_->interrupt();
+            dumper_->join();
+        }
+    }
+
+    /**
+     * @returns a monotonic time in microseconds.
+     */
+    static uint64_t now() {
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+    }
+
+    /**
+     * When the request the calling thread is running was read, set by
+     * StatsEventHandler, or 0 outside of a request. Handlers use it to
+     * tell how long a request waited before it got to them.
+     */
+    static uint64_t& requestReadTime() {
+        static __thread uint64_t readTime = 0;
+        return readTime;
+    }
+
+    /**
+     * operations_ isn't changed after the constructor, so this doesn't
+     * lock anything.
+     */
+    OperationHistograms& operation(const std::string& name) {
+        Operations::iterator itr = operations_.find(name);
+        if (itr == operations_.end()) {
+            itr = operations_.find(otherName());
+        }
+        return *itr->second;
+    }
+
+    LatencyHistogram& mapOperation(const std::string& operation, const std::string& mapName) {
+        OperationHistograms& histograms = this->operation(operation);
+        {
+            boost::shared_lock< boost::shared_mutex> readLock(histograms.mapsMutex);;
+            MapHistograms::iterator itr = histograms.maps.find(mapName);
+            if (itr != histograms.maps.end()) {
+                return *itr->second;
+            }
+        }
+        boost::unique_lock< boost::shared_mutex> writeLock(histograms.mapsMutex);;
+        MapHistograms::iterator itr = histograms.maps.find(mapName);
+        if (itr == histograms.maps.end()) {
+            std::string name = histograms.maps.size() < MAX_MAPS ? mapName : otherName();
+            itr = histograms.maps.find(name);
+            if (itr == histograms.maps.end()) {
+                itr = histograms.maps.insert(name, new LatencyHistogram()).first;
+            }
+        }
+        return *itr->second;
+    }
+
+    void getStats(mapkeeper::StatsResponse& _return, bool reset) {
+        boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
+        uint64_t time = now();
+        _return.seconds = (time - startTime_) / 1000000.0;
+        for (Operations::iterator itr = operations_.begin(); itr != operations_.end(); ++itr) {
+            OperationHistograms& histograms = *itr->second;
+            if (histograms.phases[Total].count() > 0) {
+                mapkeeper::OperationStats stats;
+                stats.operation = itr->first;
+                for (int phase = 0; phase < NUM_PHASES; phase++) {
+                    addLatency(stats, (Phase)phase, histograms.phases[phase]);
+                }
+                stats.requestsPerSecond = requestsPerSecond(histograms.phases[Total], _return.seconds);
+                _return.operations.push_back(stats);
+            }
+            boost::shared_lock< boost::shared_mutex> readLock(histograms.mapsMutex);;
+            for (MapHistograms::iterator map = histograms.maps.begin(); map != histograms.maps.end(); ++map) {
+                mapkeeper::OperationStats stats;
+                stats.operation = itr->first;
+                stats.mapName = map->first;
+                addLatency(stats, Call, *map->second);
+                stats.requestsPerSecond = requestsPerSecond(*map->second, _return.seconds);
+                _return.operations.push_back(stats);
+            }
+        }
+        if (reset) {
+            for (Operations::iterator itr = operations_.begin(); itr != operations_.end(); ++itr) {
+                OperationHistograms& histograms = *itr->second;
+                for (int phase = 0; phase < NUM_PHASES; phase++) {
+                    histograms.phases[phase].reset();
+                }
+                boost::shared_lock< boost::shared_mutex> readLock(histograms.mapsMutex);;
+                for (MapHistograms::iterator map = histograms.maps.begin(); map != histograms.maps.end(); ++map) {
+                    map->second->reset();
+                }
+            }
+            startTime_ = time;
+        }
+        _return.responseCode = mapkeeper::ResponseCode::Success;
+    }
+
+    /**
+     * Prints the total latency of every operation, and the call latency
+     * of every operation on every map, to stderr every intervalSeconds.
+     * The stats aren't reset.
+     */
+    void startDumping(int intervalSeconds) {
+        dumper_.reset(new boost::thread(boost::bind(&ServerStats::dump, this, intervalSeconds)));
+    }
+
+private:
+    typedef boost::ptr_map<std::string, OperationHistograms> Operations;
+    typedef boost::ptr_map<std::string, LatencyHistogram> MapHistograms;
+
+    static const char* phaseName(Phase phase) {
+        switch (phase) {
+        case QueueWait:
+            return "queueWait";
+        case Deserialize:
+            return "deserialize";
+        case Call:
+            return "call";
+        case Serialize:
+            return "serialize";
+        default:
+            return "total";
+        }
+    }
+
+    static void addLatency(mapkeeper::OperationStats& stats, Phase phase,
+                           const LatencyHistogram& histogram) {
+        if (histogram.count() == 0) {
+            return;
+        }
+        mapkeeper::LatencyStats latency;
+        latency.phase = phaseName(phase);
+        latency.count = histogram.count();
+        latency.p50 = histogram.percentile(0.5);
+        latency.p99 = histogram.percentile(0.99);
+        latency.p999 = histogram.percentile(0.999);
+        latency.max = histogram.max();
+        stats.latencies.push_back(latency);
+    }
+
+    static double requestsPerSecond(const LatencyHistogram& histogram, double seconds) {
+        return seconds > 0 ? histogram.count() / seconds : 0.0;
+    }
+
+    void dump(int intervalSeconds) {
+        while (true) {
+            boost::this_thread::sleep(boost::posix_time::seconds(intervalSeconds));
+            mapkeeper::StatsResponse response;
+            getStats(response, false);
+            fprintf(stderr, "stats over %.1f seconds\n", response.seconds);
+            fprintf(stderr, "%-20s %-20s %12s %10s %10s %10s %10s %10s\n", "operation", "map",
+                    "count", "req/s", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+            for (size_t i = 0; i < response.operations.size(); i++) {
+                const mapkeeper::OperationStats& stats = response.operations[i];
+                // the last latency is total for operations, call for maps.
+                if (stats.latencies.empty()) {
+                    continue;
+                }
+                const mapkeeper::LatencyStats& latency = stats.latencies.back();
+                fprintf(stderr, "%-20s %-20s %12lld %10.1f %10lld %10lld %10lld %10lld\n",
+                        stats.operation.c_str(), stats.mapName.empty() ? "-" : stats.mapName.c_str(),
+                        (long long)latency.count, stats.requestsPerSecond,
+                        (long long)latency.p50, (long long)latency.p99,
+                        (long long)latency.p999, (long long)latency.max);
+            }
+        }
+    }
+
+    Operations operations_;
+    boost::shared_mutex mutex_; // protect startTime_, and serialize getStats
+    uint64_t startTime_;
+    boost::scoped_ptr<boost::thread> dumper_;
+};
+
+/**
+ * Times the phases of every request the processor handles.
+ *
+ * Servers that queue requests for a worker pass the time the request
+ * was read, from ServerStats::now, as the connection context of
+ * TProcessor::process, and it's recorded as QueueWait. Thrift's own
+ * servers pass NULL.
+ */
+class StatsEventHandler: public apache::thrift::TProcessorEventHandler {
+public:
+    StatsEventHandler(boost::shared_ptr<ServerStats> stats) :
+        stats_(stats) {
+    }
+
+    void* getContext(const char* fn_name, void* serverContext) {
+        Request* request = new Request();
+        request->readTime = serverContext ? *(uint64_t*)serverContext : 0;
+        return request;
+    }
+
+    void freeContext(void* ctx, const char* fn_name) {
+        ServerStats::requestReadTime() = 0;
+        delete (Request*)ctx;
+    }
+
+    void preRead(void* ctx, const char* fn_name) {
+        Request* request = (Request*)ctx;
+        request->startTime = ServerStats::now();
+        if (request->readTime == 0) {
+            request->readTime = request->startTime;
+        }
+        ServerStats::requestReadTime() = request->readTime;
+    }
+
+    void postRead(void* ctx, const char* fn_name, uint32_t bytes) {
+        ((Request*)ctx)->callTime = ServerStats::now();
+    }
+
+    void preWrite(void* ctx, const char* fn_name) {
+        ((Request*)ctx)->writeTime = ServerStats::now();
+    }
+
+    void postWrite(void* ctx, const char* fn_name, uint32_t bytes) {
+        Request* request = (Request*)ctx;
+        uint64_t endTime = ServerStats::now();
+        // fn_name is "MapKeeper.<operation>".
+        const char* operation = strchr(fn_name, '.');
+        operation = operation ? operation + 1 : fn_name;
+        ServerStats::OperationHistograms& histograms = stats_->operation(operation);
+        if (request->startTime > request->readTime) {
+            histograms.phases[ServerStats::QueueWait].record(request->startTime - request->readTime);
+        }
+        histograms.phases[ServerStats::Deserialize].record(request->callTime - request->startTime);
+        histograms.phases[ServerStats::Call].record(request->writeTime - request->callTime);
+        histograms.phases[ServerStats::Serialize].record(endTime - request->writeTime);
+        histograms.phases[ServerStats::Total].record(endTime - request->readTime);
+    }
+
+private:
+    struct Request {
+        uint64_t readTime;
+        uint64_t startTime;
+        uint64_t callTime;
+        uint64_t writeTime;
+    };
+
+    boost::shared_ptr<ServerStats> stats_;
+};
+
+#endif // SERVER_STATS_H
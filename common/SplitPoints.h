@@ -0,0 +1,192 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SPLIT_POINTS_H
+#define SPLIT_POINTS_H
+
+/**
+ * Helpers for sampleSplitPoints.
+ *
+ * Backends that can estimate how much of a map sorts before a key
+ * (LevelDB's approximate sizes, BDB's key_range) implement
+ * KeyRankEstimator and find the split points with bisectSplitPoints.
+ * Backends that can only walk their keys pick every n-th key with
+ * StridePicker, and backends that can sample random records sort the
+ * sample and pick from it the same way.
+ */
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+const int32_t MAX_SPLITS = 4096;
+
+/**
+ * @returns true if sampleSplitPoints accepts numSplits.
+ */
+inline bool validSplitCount(int32_t numSplits) {
+    return numSplits >= 1 && numSplits <= MAX_SPLITS;
+}
+
+class KeyRankEstimator {
+public:
+    virtual ~KeyRankEstimator() {}
+
+    /**
+     * Estimates the fraction of the map, between 0 and 1, that sorts
+     * before key.
+     *
+     * @returns false on errors.
+     */
+    virtual bool fractionBelow(const std::string& key, double& fraction) = 0;
+};
+
+/**
+ * Reads the 8 bytes after the common prefix of a key as a big-endian
+ * number, padding short keys with zeros.
+ */
+inline uint64_t keyPosition(const std::string& key, size_t prefixSize) {
+    uint64_t position = 0;
+    for (size_t i = prefixSize; i < prefixSize + 8; i++) {
+        position <<= 8;
+        if (i < key.size()) {
+            position |= (unsigned char)key[i];
+        }
+    }
+    return position;
+}
+
+/**
+ * The inverse of keyPosition, without the trailing zeros.
+ */
+inline std::string positionKey(const std::string& prefix, uint64_t position) {
+    std::string key = prefix;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        key.push_back((char)(position >> shift));
+    }
+    size_t size = key.size();
+    while (size > prefix.size() && key[size - 1] == '\0') {
+        size--;
+    }
+    key.resize(size);
+    return key;
+}
+
+/**
+ * Finds the keys that split [firstKey, lastKey] into numSplits parts
+ * the estimator thinks are about the same size.
+ *
+ * Keys are mapped to numbers with keyPosition, and each split point is
+ * bisected between the previous one and lastKey until the estimate is
+ * within a sixteenth of a part of its target. The split points are
+ * usually keys that aren't in the map, which is fine for range bounds.
+ * Parts the estimator can't tell apart are merged, so there may be
+ * fewer than numSplits - 1 split points.
+ *
+ * @returns false if the estimator failed.
+ */
+inline bool bisectSplitPoints(KeyRankEstimator& estimator,
+                              const std::string& firstKey, const std::string& lastKey,
+                              int32_t numSplits, std::vector<std::string>& splitPoints) {
+    size_t prefixSize = 0;
+    while (prefixSize < firstKey.size() && prefixSize < lastKey.size() &&
+           firstKey[prefixSize] == lastKey[prefixSize]) {
+        prefixSize++;
+    }
+    std::string prefix = firstKey.substr(0, prefixSize);
+    uint64_t low = keyPosition(firstKey, prefixSize);
+    uint64_t high = keyPosition(lastKey, prefixSize);
+    double tolerance = 1.0 / numSplits / 16;
+    for (int32_t i = 1; i < numSplits; i++) {
+        double target = (double)i / numSplits;
+        uint64_t below = low;
+        uint64_t above = high;
+        while (below + 1 < above) {
+            uint64_t middle = below + (above - below) / 2;
+            double fraction = 0.0;
+            if (!estimator.fractionBelow(positionKey(prefix, middle), fraction)) {
+                return false;
+            }
+            if (fraction < target - tolerance) {
+                below = middle;
+            } else {
+                above = middle;
+                if (fraction <= target + tolerance) {
+                    break;
+                }
+            }
+        }
+        std::string key = positionKey(prefix, above);
+        if (key > firstKey && key <= lastKey &&
+            (splitPoints.empty() || key > splitPoints.back())) {
+            splitPoints.push_back(key);
+        }
+        low = above;
+    }
+    return true;
+}
+
+/**
+ * Picks split points out of a walk over count keys in order: call pick
+ * with the index of each key, and add the keys it returns true for.
+ */
+class StridePicker {
+public:
+    StridePicker(uint64_t count, int32_t numSplits) :
+        count_(count),
+        numSplits_(numSplits),
+        next_(1) {
+    }
+
+    bool pick(uint64_t index) {
+        bool picked = false;
+        while (!done() && index >= next_ * count_ / numSplits_) {
+            // the first key would only split off an empty range.
+            picked = index > 0;
+            next_++;
+        }
+        return picked;
+    }
+
+    /**
+     * @returns true once all the split points are picked, so the walk
+     *          can stop early.
+     */
+    bool done() const {
+        return next_ >= (uint64_t)numSplits_;
+    }
+
+private:
+    uint64_t count_;
+    int32_t numSplits_;
+    uint64_t next_; // split point to pick next, from 1 to numSplits - 1
+};
+
+/**
+ * Picks split points out of a random sample of keys.
+ */
+inline void pickSplitPoints(std::vector<std::string>& sample, int32_t numSplits,
+                            std::vector<std::string>& splitPoints) {
+    std::sort(sample.begin(), sample.end());
+    sample.erase(std::unique(sample.begin(), sample.end()), sample.end());
+    StridePicker picker(sample.size(), numSplits);
+    for (size_t i = 0; i < sample.size() && !picker.done(); i++) {
+        if (picker.pick(i)) {
+            splitPoints.push_back(sample[i]);
+        }
+    }
+}
+
+#endif // SPLIT_POINTS_H
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef STATS_HANDLER_H
+#define STATS_HANDLER_H
+
+/**
+ * Answers getStats from a ServerStats, and records the call latency of
+ * every operation that takes a map name under that map.
+ *
+ * The per-operation phases are recorded by StatsEventHandler, which
+ * sees the requests before they're decoded. Only the handler sees the
+ * map names. ServerRunner puts it in front of every backend.
+ */
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include "ForwardingHandler.h"
+#include "ServerStats.h"
+
+class StatsHandler: public ForwardingHandler {
+public:
+    StatsHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> next,
+                 boost::shared_ptr<ServerStats> stats) :
+        ForwardingHandler(next),
+        stats_(stats) {
+    }
+
+    void getStats(mapkeeper::StatsResponse& _return, const bool reset) {
+        stats_->getStats(_return, reset);
+    }
+
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName) {
+        CallTimer timer(*stats_, "addMap", mapName);
+        return timer.done(next_->addMap(mapName));
+    }
+
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName) {
+        CallTimer timer(*stats_, "dropMap", mapName);
+        return timer.done(next_->dropMap(mapName));
+    }
+
+    void openMap(mapkeeper::MapHandleResponse& _return, const std::string& mapName) {
+        CallTimer timer(*stats_, "openMap", mapName);
+        next_->openMap(_return, mapName);
+        timer.done(_return.responseCode);
+    }
+
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const mapkeeper::ScanOptions& options) {
+        CallTimer timer(*stats_, "scan", mapName);
+        next_->scan(_return, mapName, order, startKey, startKeyIncluded,
+                    endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        timer.done(_return.responseCode);
+    }
+
+    void openScan(mapkeeper::ScanCursorResponse& _return, const std::string& mapName,
+                  const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const mapkeeper::ScanOptions& options) {
+        CallTimer timer(*stats_, "openScan", mapName);
+        next_->openScan(_return, mapName, order, startKey, startKeyIncluded,
+                        endKey, endKeyIncluded, options);
+        timer.done(_return.responseCode);
+    }
+
+    void createSnapshot(mapkeeper::SnapshotResponse& _return, const std::string& mapName) {
+        CallTimer timer(*stats_, "createSnapshot", mapName);
+        next_->createSnapshot(_return, mapName);
+        timer.done(_return.responseCode);
+    }
+
+    void countRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                    const std::string& startKey, const std::string& endKey) {
+        CallTimer timer(*stats_, "countRange", mapName);
+        next_->countRange(_return, mapName, startKey, endKey);
+        timer.done(_return.responseCode);
+    }
+
+    void approximateSize(mapkeeper::Int64Response& _return, const std::string& mapName,
+                         const std::string& startKey, const std::string& endKey) {
+        CallTimer timer(*stats_, "approximateSize", mapName);
+        next_->approximateSize(_return, mapName, startKey, endKey);
+        timer.done(_return.responseCode);
+    }
+
+    void sampleSplitPoints(mapkeeper::KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        CallTimer timer(*stats_, "sampleSplitPoints", mapName);
+        next_->sampleSplitPoints(_return, mapName, numSplits);
+        timer.done(_return.responseCode);
+    }
+
+    void aggregate(mapkeeper::AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const mapkeeper::AggregateOp::type op,
+                   const mapkeeper::ValueEncoding::type encoding) {
+        CallTimer timer(*stats_, "aggregate", mapName);
+        next_->aggregate(_return, mapName, startKey, endKey, op, encoding);
+        timer.done(_return.responseCode);
+    }
+
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName,
+             const std::string& key) {
+        CallTimer timer(*stats_, "get", mapName);
+        next_->get(_return, mapName, key);
+        timer.done(_return.responseCode);
+    }
+
+    void multiGet(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys) {
+        CallTimer timer(*stats_, "multiGet", mapName);
+        next_->multiGet(_return, mapName, keys);
+        timer.done(_return.responseCode);
+    }
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key,
+                                      const std::string& value,
+                                      const mapkeeper::WriteOptions& options) {
+        CallTimer timer(*stats_, "put", mapName);
+        return timer.done(next_->put(mapName, key, value, options));
+    }
+
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        CallTimer timer(*stats_, "insert", mapName);
+        return timer.done(next_->insert(mapName, key, value, options));
+    }
+
+    mapkeeper::ResponseCode::type insertMany(const std::string& mapName,
+                                             const std::vector<mapkeeper::Record>& records) {
+        CallTimer timer(*stats_, "insertMany", mapName);
+        return timer.done(next_->insertMany(mapName, records));
+    }
+
+    mapkeeper::ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        CallTimer timer(*stats_, "ingestFile", mapName);
+        return timer.done(next_->ingestFile(mapName, path));
+    }
+
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        CallTimer timer(*stats_, "update", mapName);
+        return timer.done(next_->update(mapName, key, value, options));
+    }
+
+    mapkeeper::ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key,
+                                                const std::string& expectedValue,
+                                                const std::string& newValue) {
+        CallTimer timer(*stats_, "compareAndSet", mapName);
+        return timer.done(next_->compareAndSet(mapName, key, expectedValue, newValue));
+    }
+
+    void increment(mapkeeper::Int64Response& _return, const std::string& mapName,
+                   const std::string& key, const int64_t delta) {
+        CallTimer timer(*stats_, "increment", mapName);
+        next_->increment(_return, mapName, key, delta);
+        timer.done(_return.responseCode);
+    }
+
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& value) {
+        CallTimer timer(*stats_, "append", mapName);
+        return timer.done(next_->append(mapName, key, value));
+    }
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        CallTimer timer(*stats_, "remove", mapName);
+        return timer.done(next_->remove(mapName, key));
+    }
+
+    void removeRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        CallTimer timer(*stats_, "removeRange", mapName);
+        next_->removeRange(_return, mapName, startKey, endKey);
+        timer.done(_return.responseCode);
+    }
+
+    mapkeeper::ResponseCode::type writeBatch(const std::string& mapName,
+                                             const std::vector<mapkeeper::Mutation>& mutations) {
+        CallTimer timer(*stats_, "writeBatch", mapName);
+        return timer.done(next_->writeBatch(mapName, mutations));
+    }
+
+    void tailChanges(mapkeeper::ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        CallTimer timer(*stats_, "tailChanges", mapName);
+        next_->tailChanges(_return, mapName, fromSeq, maxRecords);
+        timer.done(_return.responseCode);
+    }
+
+private:
+    /**
+     * Records the time until it goes out of scope, so the call is timed
+     * even if it throws. Calls on maps that don't exist aren't recorded,
+     * so they can't make the stats grow with names clients make up.
+     */
+    class CallTimer {
+    public:
+        CallTimer(ServerStats& stats, const char* operation, const std::string& mapName) :
+            stats_(stats),
+            operation_(operation),
+            mapName_(mapName),
+            startTime_(ServerStats::now()),
+            mapFound_(true) {
+        }
+
+        ~CallTimer() {
+            if (mapFound_) {
+                stats_.mapOperation(operation_, mapName_).record(ServerStats::now() - startTime_);
+            }
+        }
+
+        mapkeeper::ResponseCode::type done(mapkeeper::ResponseCode::type rc) {
+            mapFound_ = rc != mapkeeper::ResponseCode::MapNotFound;
+            return rc;
+        }
+
+    private:
+        ServerStats& stats_;
+        const char* operation_;
+        const std::string& mapName_;
+        uint64_t startTime_;
+        bool mapFound_;
+    };
+
+    boost::shared_ptr<ServerStats> stats_;
+};
+
+#endif // STATS_HANDLER_H
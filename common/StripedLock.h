@@ -0,0 +1,126 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef STRIPED_LOCK_H
+#define STRIPED_LOCK_H
+
+/**
+ * A fixed set of mutexes that keys are hashed onto.
+ *
+ * Backends without transactions use it to make read-modify-write
+ * operations (insert, update, compareAndSet, ...) atomic with respect
+ * to each other. Writes to different keys rarely share a stripe, so
+ * they still run in parallel.
+ *
+ *   StripedLock::ScopedLock lock(locks_, key);
+ *
+ * Every write to a key has to hold its stripe, including blind puts, or
+ * a read-modify-write could overwrite them.
+ *
+ * hash is the FNV-1a hash the stripes are picked with. The handlers
+ * that split their state into shards by key or map use it too.
+ */
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+class StripedLock {
+public:
+    StripedLock(uint32_t numStripes = 1024) :
+        numStripes_(numStripes),
+        stripes_(new boost::mutex[numStripes]) {
+    }
+
+    /**
+     * Holds the stripe of a single key.
+     */
+    class ScopedLock {
+    public:
+        ScopedLock(StripedLock& locks, const std::string& key) :
+            lock_(locks.stripes_[locks.stripe(key)]) {
+        }
+
+    private:
+        boost::mutex::scoped_lock lock_;
+    };
+
+    /**
+     * Holds the stripes of several keys. Stripes are always locked in
+     * increasing order, so two multi-key locks can't deadlock.
+     */
+    class ScopedMultiLock {
+    public:
+        ScopedMultiLock(StripedLock& locks, const std::vector<std::string>& keys) :
+            locks_(locks) {
+            std::vector<std::string>::const_iterator key;
+            for (key = keys.begin(); key != keys.end(); key++) {
+                stripes_.insert(locks_.stripe(*key));
+            }
+            std::set<uint32_t>::iterator itr;
+            for (itr = stripes_.begin(); itr != stripes_.end(); itr++) {
+                locks_.stripes_[*itr].lock();
+            }
+        }
+
+        ~ScopedMultiLock() {
+            std::set<uint32_t>::reverse_iterator itr;
+            for (itr = stripes_.rbegin(); itr != stripes_.rend(); itr++) {
+                locks_.stripes_[*itr].unlock();
+            }
+        }
+
+    private:
+        ScopedMultiLock(const ScopedMultiLock&);
+        ScopedMultiLock& operator=(const ScopedMultiLock&);
+        StripedLock& locks_;
+        std::set<uint32_t> stripes_;
+    };
+
+    static uint32_t hash(const std::string& key) {
+        return fnv1a(2166136261u, key);
+    }
+
+    /**
+     * Hashes a key of a map, so the same key in two maps usually lands
+     * in different places.
+     */
+    static uint32_t hash(const std::string& mapName, const std::string& key) {
+        return fnv1a(fnv1a(2166136261u, mapName) * 16777619u, key);
+    }
+
+private:
+    StripedLock(const StripedLock&);
+    StripedLock& operator=(const StripedLock&);
+
+    static uint32_t fnv1a(uint32_t value, const std::string& bytes) {
+        for (size_t i = 0; i < bytes.size(); i++) {
+            value ^= (unsigned char)bytes[i];
+            value *= 16777619u;
+        }
+        return value;
+    }
+
+    uint32_t stripe(const std::string& key) const {
+        return hash(key) % numStripes_;
+    }
+
+    uint32_t numStripes_;
+    boost::scoped_array<boost::mutex> stripes_;
+};
+
+#endif // STRIPED_LOCK_H
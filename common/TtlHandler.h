@@ -0,0 +1,994 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef TTL_HANDLER_H
+#define TTL_HANDLER_H
+
+/**
+ * Expires the records written with WriteOptions.ttlSeconds.
+ *
+ * The handler keeps an index of the records that have a TTL: the expiry
+ * time of each key, and all the keys ordered by expiry time. Reads look
+ * the records up in the index and hide the ones that have expired. A
+ * background thread walks the front of the ordered keys once a second
+ * and removes the expired records from the backend, so reclaiming them
+ * costs a remove per record instead of a scan of the map.
+ *
+ * The index is also kept in the backend, in a map hidden from clients,
+ * and it's read back when the server starts. listMaps leaves it out and
+ * every other call that takes its name answers MapNotFound, so a client
+ * can't drop it and lose the TTLs at the next start. Its keys are the map name,
+ * the expiry time and the record key, so the entries of a dropped map
+ * are removed with one removeRange. A record and its index entry aren't
+ * written atomically; a crash between the two writes can leave the
+ * record with its previous TTL.
+ *
+ * Writes hold the stripe of their key (see StripedLock.h), so the
+ * sweeper never removes a record that was written again after it
+ * expired. Writes to an expired record that hasn't been reclaimed yet
+ * remove it first, so insert, update, increment, ... see it as missing.
+ *
+ * The index is split into shards by key, each with its own lock, and
+ * reads don't lock anything while no record has a TTL, so a server
+ * that doesn't use TTLs only pays for a counter check per read.
+ */
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include "CursorTable.h"
+#include "ForwardingHandler.h"
+#include "MergeOperator.h"
+#include "StripedLock.h"
+
+class TtlHandler: public ForwardingHandler {
+public:
+    TtlHandler(boost::shared_ptr<mapkeeper::MapKeeperIf> next) :
+        ForwardingHandler(next),
+        shards_(new Shard[NUM_SHARDS]),
+        numExpiries_(0) {
+        loadIndex();
+        sweeper_.reset(new boost::thread(boost::bind(&TtlHandler::sweep, this)));
+    }
+
+    ~TtlHandler() {
+        sweeper_->interrupt();
+        sweeper_->join();
+    }
+
+    /**
+     * Fails with Error rather than MapExists for the index map's name,
+     * since the map doesn't show up in listMaps.
+     */
+    mapkeeper::ResponseCode::type addMap(const std::string& mapName) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::Error;
+        }
+        return next_->addMap(mapName);
+    }
+
+    mapkeeper::ResponseCode::type dropMap(const std::string& mapName) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        mapkeeper::ResponseCode::type rc = next_->dropMap(mapName);
+        if (rc != mapkeeper::ResponseCode::Success) {
+            return rc;
+        }
+        bool hadExpiries = false;
+        for (uint32_t i = 0; i < NUM_SHARDS && hasExpiries(); i++) {
+            Shard& shard = shards_[i];
+            boost::mutex::scoped_lock lock(shard.mutex);
+            std::map<std::string, KeyExpiries>::iterator itr = shard.expiries.find(mapName);
+            if (itr != shard.expiries.end()) {
+                KeyExpiries::iterator key;
+                for (key = itr->second.begin(); key != itr->second.end(); key++) {
+                    shard.queue.erase(Expiry(key->second, mapName, key->first));
+                }
+                __sync_fetch_and_sub(&numExpiries_, (int)itr->second.size());
+                shard.expiries.erase(itr);
+                hadExpiries = true;
+            }
+        }
+        if (hadExpiries) {
+            std::string prefix = indexPrefix(mapName);
+            mapkeeper::Int64Response removed;
+            next_->removeRange(removed, indexMap(), prefix, prefix + '\x80');
+        }
+        cursors_.removeMap(mapName);
+        snapshots_.removeMap(mapName);
+        boost::mutex::scoped_lock lock(namesMutex_);
+        std::map<int32_t, std::string>::iterator itr = handles_.begin();
+        while (itr != handles_.end()) {
+            if (itr->second == mapName) {
+                handles_.erase(itr++);
+            } else {
+                itr++;
+            }
+        }
+        return rc;
+    }
+
+    void listMaps(mapkeeper::StringListResponse& _return) {
+        next_->listMaps(_return);
+        std::vector<std::string>::iterator itr = _return.values.begin();
+        while (itr != _return.values.end()) {
+            if (*itr == indexMap()) {
+                itr = _return.values.erase(itr);
+            } else {
+                itr++;
+            }
+        }
+    }
+
+    void openMap(mapkeeper::MapHandleResponse& _return, const std::string& mapName) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->openMap(_return, mapName);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success) {
+            boost::mutex::scoped_lock lock(namesMutex_);
+            handles_[_return.handle] = mapName;
+        }
+    }
+
+    void getByHandle(mapkeeper::BinaryResponse& _return, const int32_t mapHandle,
+                     const std::string& key) {
+        next_->getByHandle(_return, mapHandle, key);
+        std::string mapName;
+        if (_return.responseCode == mapkeeper::ResponseCode::Success &&
+            findName(handles_, mapHandle, mapName) && isExpired(mapName, key)) {
+            _return.responseCode = mapkeeper::ResponseCode::RecordNotFound;
+            _return.value.clear();
+        }
+    }
+
+    mapkeeper::ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key,
+                                              const std::string& value) {
+        std::string mapName;
+        if (!findName(handles_, mapHandle, mapName)) {
+            return next_->putByHandle(mapHandle, key, value);
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        mapkeeper::ResponseCode::type rc = next_->putByHandle(mapHandle, key, value);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            setExpiry(mapName, key, 0);
+        }
+        return rc;
+    }
+
+    void scanByHandle(mapkeeper::RecordListResponse& _return, const int32_t mapHandle,
+                      const mapkeeper::ScanOrder::type order,
+                      const std::string& startKey, const bool startKeyIncluded,
+                      const std::string& endKey, const bool endKeyIncluded,
+                      const int32_t maxRecords, const int32_t maxBytes,
+                      const mapkeeper::ScanOptions& options) {
+        std::string mapName;
+        if (!findName(handles_, mapHandle, mapName)) {
+            next_->scanByHandle(_return, mapHandle, order, startKey, startKeyIncluded,
+                                endKey, endKeyIncluded, maxRecords, maxBytes, options);
+            return;
+        }
+        ScanRange range(startKey, startKeyIncluded, endKey, endKeyIncluded);
+        do {
+            next_->scanByHandle(_return, mapHandle, order, range.startKey, range.startKeyIncluded,
+                                range.endKey, range.endKeyIncluded, maxRecords, maxBytes, options);
+        } while (skipExpired(mapName, order, _return, range));
+    }
+
+    void scan(mapkeeper::RecordListResponse& _return, const std::string& mapName,
+              const mapkeeper::ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded,
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const mapkeeper::ScanOptions& options) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        ScanRange range(startKey, startKeyIncluded, endKey, endKeyIncluded);
+        do {
+            next_->scan(_return, mapName, order, range.startKey, range.startKeyIncluded,
+                        range.endKey, range.endKeyIncluded, maxRecords, maxBytes, options);
+        } while (skipExpired(mapName, order, _return, range));
+    }
+
+    void openScan(mapkeeper::ScanCursorResponse& _return, const std::string& mapName,
+                  const mapkeeper::ScanOrder::type order,
+                  const std::string& startKey, const bool startKeyIncluded,
+                  const std::string& endKey, const bool endKeyIncluded,
+                  const mapkeeper::ScanOptions& options) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->openScan(_return, mapName, order, startKey, startKeyIncluded,
+                        endKey, endKeyIncluded, options);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success &&
+            !cursors_.add(_return.cursorId, boost::shared_ptr<MapName>(new MapName(mapName)))) {
+            // without its map name the batches couldn't be filtered
+            next_->closeScan(_return.cursorId);
+            _return.responseCode = mapkeeper::ResponseCode::TooManyCursors;
+        }
+    }
+
+    /**
+     * A cursor keeps going if a whole batch has expired; an empty batch
+     * would look like the end of the scan to some clients.
+     */
+    void nextScan(mapkeeper::RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        boost::shared_ptr<MapName> cursor = cursors_.get(cursorId);
+        if (!cursor) {
+            next_->nextScan(_return, cursorId, maxRecords, maxBytes);
+            return;
+        }
+        const std::string& mapName = cursor->mapName;
+        do {
+            next_->nextScan(_return, cursorId, maxRecords, maxBytes);
+            removeExpired(mapName, _return.records);
+        } while (_return.responseCode == mapkeeper::ResponseCode::Success &&
+                 _return.records.empty());
+        if (_return.responseCode != mapkeeper::ResponseCode::Success) {
+            cursors_.remove(cursorId);
+        }
+    }
+
+    mapkeeper::ResponseCode::type closeScan(const int64_t cursorId) {
+        cursors_.remove(cursorId);
+        return next_->closeScan(cursorId);
+    }
+
+    void createSnapshot(mapkeeper::SnapshotResponse& _return, const std::string& mapName) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->createSnapshot(_return, mapName);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success &&
+            !snapshots_.add(_return.snapshotId, boost::shared_ptr<MapName>(new MapName(mapName)))) {
+            next_->releaseSnapshot(_return.snapshotId);
+            _return.responseCode = mapkeeper::ResponseCode::TooManySnapshots;
+        }
+    }
+
+    mapkeeper::ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        snapshots_.remove(snapshotId);
+        return next_->releaseSnapshot(snapshotId);
+    }
+
+    void getAtSnapshot(mapkeeper::BinaryResponse& _return, const int64_t snapshotId,
+                       const std::string& key) {
+        next_->getAtSnapshot(_return, snapshotId, key);
+        if (_return.responseCode != mapkeeper::ResponseCode::Success) {
+            return;
+        }
+        boost::shared_ptr<MapName> snapshot = snapshots_.get(snapshotId);
+        if (snapshot && isExpired(snapshot->mapName, key)) {
+            _return.responseCode = mapkeeper::ResponseCode::RecordNotFound;
+            _return.value.clear();
+        }
+    }
+
+    void scanAtSnapshot(mapkeeper::RecordListResponse& _return, const int64_t snapshotId,
+                        const mapkeeper::ScanOrder::type order,
+                        const std::string& startKey, const bool startKeyIncluded,
+                        const std::string& endKey, const bool endKeyIncluded,
+                        const int32_t maxRecords, const int32_t maxBytes,
+                        const mapkeeper::ScanOptions& options) {
+        boost::shared_ptr<MapName> snapshot = snapshots_.get(snapshotId);
+        if (!snapshot) {
+            next_->scanAtSnapshot(_return, snapshotId, order, startKey, startKeyIncluded,
+                                  endKey, endKeyIncluded, maxRecords, maxBytes, options);
+            return;
+        }
+        const std::string& mapName = snapshot->mapName;
+        ScanRange range(startKey, startKeyIncluded, endKey, endKeyIncluded);
+        do {
+            next_->scanAtSnapshot(_return, snapshotId, order, range.startKey, range.startKeyIncluded,
+                                  range.endKey, range.endKeyIncluded, maxRecords, maxBytes, options);
+        } while (skipExpired(mapName, order, _return, range));
+    }
+
+    void countRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                    const std::string& startKey, const std::string& endKey) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->countRange(_return, mapName, startKey, endKey);
+        if (_return.responseCode != mapkeeper::ResponseCode::Success) {
+            return;
+        }
+        int64_t time = now();
+        for (uint32_t i = 0; i < NUM_SHARDS && hasExpiries(); i++) {
+            Shard& shard = shards_[i];
+            boost::mutex::scoped_lock lock(shard.mutex);
+            std::map<std::string, KeyExpiries>::iterator itr = shard.expiries.find(mapName);
+            if (itr == shard.expiries.end()) {
+                continue;
+            }
+            KeyExpiries::iterator key;
+            for (key = itr->second.lower_bound(startKey);
+                 key != itr->second.end() && (endKey.empty() || key->first < endKey); key++) {
+                if (key->second <= time) {
+                    _return.value--;
+                }
+            }
+        }
+    }
+
+    void approximateSize(mapkeeper::Int64Response& _return, const std::string& mapName,
+                         const std::string& startKey, const std::string& endKey) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->approximateSize(_return, mapName, startKey, endKey);
+    }
+
+    void sampleSplitPoints(mapkeeper::KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->sampleSplitPoints(_return, mapName, numSplits);
+    }
+
+    /**
+     * The backend can't tell expired values apart, so the expired 
+     * records in the range are reclaimed before it aggregates them.
+     */
+    void aggregate(mapkeeper::AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const mapkeeper::AggregateOp::type op,
+                   const mapkeeper::ValueEncoding::type encoding) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        reclaimExpired(mapName, startKey, endKey);
+        next_->aggregate(_return, mapName, startKey, endKey, op, encoding);
+    }
+
+    void get(mapkeeper::BinaryResponse& _return, const std::string& mapName,
+             const std::string& key) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->get(_return, mapName, key);
+        if (_return.responseCode == mapkeeper::ResponseCode::Success && isExpired(mapName, key)) {
+            _return.responseCode = mapkeeper::ResponseCode::RecordNotFound;
+            _return.value.clear();
+        }
+    }
+
+    void multiGet(mapkeeper::BinaryListResponse& _return, const std::string& mapName,
+                  const std::vector<std::string>& keys) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->multiGet(_return, mapName, keys);
+        if (_return.responseCode != mapkeeper::ResponseCode::Success || !hasExpiries()) {
+            return;
+        }
+        int64_t time = now();
+        for (size_t i = 0; i < _return.responses.size() && i < keys.size(); i++) {
+            int64_t expiry = getExpiry(mapName, keys[i]);
+            if (_return.responses[i].responseCode == mapkeeper::ResponseCode::Success &&
+                expiry != 0 && expiry <= time) {
+                _return.responses[i].responseCode = mapkeeper::ResponseCode::RecordNotFound;
+                _return.responses[i].value.clear();
+            }
+        }
+    }
+
+    mapkeeper::ResponseCode::type put(const std::string& mapName, const std::string& key,
+                                      const std::string& value,
+                                      const mapkeeper::WriteOptions& options) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        mapkeeper::ResponseCode::type rc = next_->put(mapName, key, value, mapkeeper::WriteOptions());
+        if (rc == mapkeeper::ResponseCode::Success) {
+            setExpiry(mapName, key, expiryTime(options));
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type insert(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        mapkeeper::ResponseCode::type rc = next_->insert(mapName, key, value, mapkeeper::WriteOptions());
+        if (rc == mapkeeper::ResponseCode::Success) {
+            setExpiry(mapName, key, expiryTime(options));
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type insertMany(const std::string& mapName,
+                                             const std::vector<mapkeeper::Record>& records) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < records.size(); i++) {
+            keys.push_back(records[i].key);
+        }
+        StripedLock::ScopedMultiLock keyLocks(locks_, keys);
+        for (size_t i = 0; i < keys.size(); i++) {
+            reclaimIfExpired(mapName, keys[i]);
+        }
+        return next_->insertMany(mapName, records);
+    }
+
+    /**
+     * The map has to be empty, so records that have expired but haven't
+     * been reclaimed yet are removed first.
+     */
+    mapkeeper::ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        reclaimExpired(mapName, std::string(), std::string());
+        return next_->ingestFile(mapName, path);
+    }
+
+    mapkeeper::ResponseCode::type update(const std::string& mapName, const std::string& key,
+                                         const std::string& value,
+                                         const mapkeeper::WriteOptions& options) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        mapkeeper::ResponseCode::type rc = next_->update(mapName, key, value, mapkeeper::WriteOptions());
+        if (rc == mapkeeper::ResponseCode::Success) {
+            setExpiry(mapName, key, expiryTime(options));
+        }
+        return rc;
+    }
+
+    mapkeeper::ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key,
+                                                const std::string& expectedValue,
+                                                const std::string& newValue) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        return next_->compareAndSet(mapName, key, expectedValue, newValue);
+    }
+
+    void increment(mapkeeper::Int64Response& _return, const std::string& mapName,
+                   const std::string& key, const int64_t delta) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        next_->increment(_return, mapName, key, delta);
+    }
+
+    mapkeeper::ResponseCode::type append(const std::string& mapName, const std::string& key,
+                                         const std::string& value) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        return next_->append(mapName, key, value);
+    }
+
+    mapkeeper::ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        reclaimIfExpired(mapName, key);
+        mapkeeper::ResponseCode::type rc = next_->remove(mapName, key);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            setExpiry(mapName, key, 0);
+        }
+        return rc;
+    }
+
+    /**
+     * The TTLs of the removed records are cleared afterwards, unless
+     * the records were written again in the meantime.
+     */
+    void removeRange(mapkeeper::Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        std::vector<Expiry> removed = findExpiries(mapName, startKey, endKey);
+        next_->removeRange(_return, mapName, startKey, endKey);
+        if (_return.responseCode != mapkeeper::ResponseCode::Success) {
+            return;
+        }
+        for (size_t i = 0; i < removed.size(); i++) {
+            StripedLock::ScopedLock keyLock(locks_, removed[i].key);
+            if (getExpiry(mapName, removed[i].key) == removed[i].time) {
+                setExpiry(mapName, removed[i].key, 0);
+            }
+        }
+    }
+
+    mapkeeper::ResponseCode::type writeBatch(const std::string& mapName,
+                                             const std::vector<mapkeeper::Mutation>& mutations) {
+        if (isReserved(mapName)) {
+            return mapkeeper::ResponseCode::MapNotFound;
+        }
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < mutations.size(); i++) {
+            keys.push_back(mutations[i].key);
+        }
+        StripedLock::ScopedMultiLock keyLocks(locks_, keys);
+        for (size_t i = 0; i < keys.size(); i++) {
+            reclaimIfExpired(mapName, keys[i]);
+        }
+        mapkeeper::ResponseCode::type rc = next_->writeBatch(mapName, mutations);
+        if (rc == mapkeeper::ResponseCode::Success) {
+            for (size_t i = 0; i < keys.size(); i++) {
+                setExpiry(mapName, keys[i], 0);
+            }
+        }
+        return rc;
+    }
+
+    void tailChanges(mapkeeper::ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        if (isReserved(mapName)) {
+            _return.responseCode = mapkeeper::ResponseCode::MapNotFound;
+            return;
+        }
+        next_->tailChanges(_return, mapName, fromSeq, maxRecords);
+    }
+
+private:
+    static const uint32_t NUM_SHARDS = 16;
+    static const size_t SWEEP_BATCH = 1000; // expired records collected per shard at a time
+
+    /**
+     * A record with a TTL. Ordered by expiry time first.
+     */
+    /**
+     * What the cursor and snapshot tables remember: they expire and cap
+     * their entries the same way the backend does, so names of cursors a
+     * client abandoned don't pile up.
+     */
+    struct MapName {
+        MapName(const std::string& mapName) : mapName(mapName) {}
+        std::string mapName;
+    };
+
+    struct Expiry {
+        Expiry(int64_t time_, const std::string& mapName_, const std::string& key_) :
+            time(time_), mapName(mapName_), key(key_) {
+        }
+
+        bool operator<(const Expiry& other) const {
+            if (time != other.time) {
+                return time < other.time;
+            } else if (mapName != other.mapName) {
+                return mapName < other.mapName;
+            }
+            return key < other.key;
+        }
+
+        int64_t time;
+        std::string mapName;
+        std::string key;
+    };
+
+    /**
+     * The part of the key range a scan still has to cover.
+     */
+    struct ScanRange {
+        ScanRange(const std::string& startKey_, bool startKeyIncluded_,
+                  const std::string& endKey_, bool endKeyIncluded_) :
+            startKey(startKey_), startKeyIncluded(startKeyIncluded_),
+            endKey(endKey_), endKeyIncluded(endKeyIncluded_) {
+        }
+
+        std::string startKey;
+        bool startKeyIncluded;
+        std::string endKey;
+        bool endKeyIncluded;
+    };
+
+    typedef std::map<std::string, int64_t> KeyExpiries;
+
+    struct Shard {
+        std::map<std::string, KeyExpiries> expiries; // expiry time of the keys of each map
+        std::set<Expiry> queue; // every record with a TTL, soonest expiry first
+        boost::mutex mutex; // protect expiries and queue
+    };
+
+    /**
+     * @returns the name of the map that holds the index.
+     */
+    static bool isReserved(const std::string& mapName) {
+        return mapName == indexMap();
+    }
+
+    static const char* indexMap() {
+        return "mapkeeper_ttl_index";
+    }
+
+    /**
+     * @returns the current time in milliseconds.
+     */
+    static int64_t now() {
+        struct timeval time;
+        gettimeofday(&time, NULL);
+        return (int64_t)time.tv_sec * 1000 + time.tv_usec / 1000;
+    }
+
+    static int64_t expiryTime(const mapkeeper::WriteOptions& options) {
+        return options.ttlSeconds > 0 ? now() + (int64_t)options.ttlSeconds * 1000 : 0;
+    }
+
+    /**
+     * Index keys are the length of the map name, the map name, the
+     * expiry time and the record key. The lengths and times are 8 byte
+     * big-endian integers, so every index key of a map is in
+     * [indexPrefix(mapName), indexPrefix(mapName) + '\x80').
+     */
+    static std::string indexPrefix(const std::string& mapName) {
+        std::string prefix;
+        encodeCounter(mapName.size(), prefix);
+        return prefix + mapName;
+    }
+
+    static std::string indexKey(const Expiry& expiry) {
+        std::string time;
+        encodeCounter(expiry.time, time);
+        return indexPrefix(expiry.mapName) + time + expiry.key;
+    }
+
+    static bool parseIndexKey(const std::string& indexKey, Expiry& expiry) {
+        int64_t length;
+        if (indexKey.size() < 16 || !decodeCounter(indexKey.substr(0, 8), length) ||
+            length < 0 || indexKey.size() < (size_t)length + 16 ||
+            !decodeCounter(indexKey.substr(length + 8, 8), expiry.time)) {
+            return false;
+        }
+        expiry.mapName = indexKey.substr(8, length);
+        expiry.key = indexKey.substr(length + 16);
+        return true;
+    }
+
+    bool findName(const std::map<int32_t, std::string>& names, int32_t id, std::string& mapName) {
+        boost::mutex::scoped_lock lock(namesMutex_);
+        std::map<int32_t, std::string>::const_iterator itr = names.find(id);
+        if (itr == names.end()) {
+            return false;
+        }
+        mapName = itr->second;
+        return true;
+    }
+
+    /**
+     * Whether any record has a TTL. Read without a lock; a write that
+     * adds the first TTL of a key holds the stripe of the key, so it
+     * can't race with another write of the same key.
+     */
+    bool hasExpiries() const {
+        return numExpiries_ > 0;
+    }
+
+    Shard& shardOf(const std::string& key) {
+        return shards_[StripedLock::hash(key) % NUM_SHARDS];
+    }
+
+    /**
+     * @returns the expiry time of a record, or 0 if it doesn't have a
+     *          TTL. The caller holds the mutex of the shard.
+     */
+    static int64_t lookupExpiry(Shard& shard, const std::string& mapName, const std::string& key) {
+        std::map<std::string, KeyExpiries>::iterator itr = shard.expiries.find(mapName);
+        if (itr == shard.expiries.end()) {
+            return 0;
+        }
+        KeyExpiries::iterator expiry = itr->second.find(key);
+        return expiry == itr->second.end() ? 0 : expiry->second;
+    }
+
+    int64_t getExpiry(const std::string& mapName, const std::string& key) {
+        if (!hasExpiries()) {
+            return 0;
+        }
+        Shard& shard = shardOf(key);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        return lookupExpiry(shard, mapName, key);
+    }
+
+    /**
+     * @returns the records of a map in [startKey, endKey) that have a
+     *          TTL, from every shard.
+     */
+    std::vector<Expiry> findExpiries(const std::string& mapName, const std::string& startKey,
+                                     const std::string& endKey) {
+        std::vector<Expiry> expiries;
+        for (uint32_t i = 0; i < NUM_SHARDS && hasExpiries(); i++) {
+            Shard& shard = shards_[i];
+            boost::mutex::scoped_lock lock(shard.mutex);
+            std::map<std::string, KeyExpiries>::iterator itr = shard.expiries.find(mapName);
+            if (itr == shard.expiries.end()) {
+                continue;
+            }
+            KeyExpiries::iterator key;
+            for (key = itr->second.lower_bound(startKey);
+                 key != itr->second.end() && (endKey.empty() || key->first < endKey); key++) {
+                expiries.push_back(Expiry(key->second, mapName, key->first));
+            }
+        }
+        return expiries;
+    }
+
+    bool isExpired(const std::string& mapName, const std::string& key) {
+        int64_t expiry = getExpiry(mapName, key);
+        return expiry != 0 && expiry <= now();
+    }
+
+    void removeExpired(const std::string& mapName, std::vector<mapkeeper::Record>& records) {
+        if (!hasExpiries()) {
+            return;
+        }
+        int64_t time = now();
+        std::vector<mapkeeper::Record>::iterator out = records.begin();
+        std::vector<mapkeeper::Record>::iterator in;
+        for (in = records.begin(); in != records.end(); in++) {
+            int64_t expiry = getExpiry(mapName, in->key);
+            if (expiry == 0 || expiry > time) {
+                if (out != in) {
+                    std::swap(*out, *in);
+                }
+                out++;
+            }
+        }
+        records.erase(out, records.end());
+    }
+
+    /**
+     * Removes the expired records from a scan response.
+     *
+     * @returns true if every record of a scan that hasn't ended has
+     *          expired. An empty response wouldn't tell the client where
+     *          to continue from, so range is moved past the last record
+     *          and the caller scans again.
+     */
+    bool skipExpired(const std::string& mapName, mapkeeper::ScanOrder::type order,
+                     mapkeeper::RecordListResponse& response, ScanRange& range) {
+        if (response.records.empty()) {
+            return false;
+        }
+        std::string lastKey = response.records.back().key;
+        removeExpired(mapName, response.records);
+        if (response.responseCode != mapkeeper::ResponseCode::Success ||
+            !response.records.empty()) {
+            return false;
+        }
+        if (order == mapkeeper::ScanOrder::Ascending) {
+            range.startKey = lastKey;
+            range.startKeyIncluded = false;
+        } else {
+            range.endKey = lastKey;
+            range.endKeyIncluded = false;
+        }
+        return true;
+    }
+
+    /**
+     * Sets the expiry time of a record, or clears it if expiry is 0.
+     * The caller holds the stripe of the key.
+     */
+    void setExpiry(const std::string& mapName, const std::string& key, int64_t expiry) {
+        if (expiry == 0 && !hasExpiries()) {
+            return;
+        }
+        int64_t oldExpiry;
+        {
+            Shard& shard = shardOf(key);
+            boost::mutex::scoped_lock lock(shard.mutex);
+            oldExpiry = lookupExpiry(shard, mapName, key);
+            if (oldExpiry == expiry) {
+                return;
+            }
+            if (oldExpiry != 0) {
+                shard.queue.erase(Expiry(oldExpiry, mapName, key));
+                KeyExpiries& keys = shard.expiries[mapName];
+                keys.erase(key);
+                if (keys.empty()) {
+                    shard.expiries.erase(mapName);
+                }
+                __sync_fetch_and_sub(&numExpiries_, 1);
+            }
+            if (expiry != 0) {
+                shard.queue.insert(Expiry(expiry, mapName, key));
+                shard.expiries[mapName][key] = expiry;
+                __sync_fetch_and_add(&numExpiries_, 1);
+            }
+        }
+        if (expiry != 0) {
+            std::string entry = indexKey(Expiry(expiry, mapName, key));
+            mapkeeper::ResponseCode::type rc = next_->insert(indexMap(), entry, std::string(),
+                                                             mapkeeper::WriteOptions());
+            if (rc == mapkeeper::ResponseCode::MapNotFound) {
+                next_->addMap(indexMap());
+                rc = next_->insert(indexMap(), entry, std::string(), mapkeeper::WriteOptions());
+            }
+            if (rc != mapkeeper::ResponseCode::Success) {
+                fprintf(stderr, "TtlHandler failed to add an index entry: %d\n", rc);
+            }
+        }
+        if (oldExpiry != 0) {
+            next_->remove(indexMap(), indexKey(Expiry(oldExpiry, mapName, key)));
+        }
+    }
+
+    /**
+     * Removes a record that has expired but hasn't been reclaimed yet.
+     * The caller holds the stripe of the key.
+     */
+    void reclaimIfExpired(const std::string& mapName, const std::string& key) {
+        if (!isExpired(mapName, key)) {
+            return;
+        }
+        mapkeeper::ResponseCode::type rc = next_->remove(mapName, key);
+        if (rc == mapkeeper::ResponseCode::Success ||
+            rc == mapkeeper::ResponseCode::RecordNotFound ||
+            rc == mapkeeper::ResponseCode::MapNotFound) {
+            setExpiry(mapName, key, 0);
+        } else {
+            fprintf(stderr, "TtlHandler failed to remove an expired record: %d\n", rc);
+        }
+    }
+
+    /**
+     * Removes the records in [startKey, endKey) that have expired but
+     * haven't been reclaimed yet, for calls that can't skip them.
+     */
+    void reclaimExpired(const std::string& mapName, const std::string& startKey,
+                        const std::string& endKey) {
+        int64_t time = now();
+        std::vector<Expiry> expiries = findExpiries(mapName, startKey, endKey);
+        for (size_t i = 0; i < expiries.size(); i++) {
+            if (expiries[i].time <= time) {
+                StripedLock::ScopedLock keyLock(locks_, expiries[i].key);
+                reclaimIfExpired(mapName, expiries[i].key);
+            }
+        }
+    }
+
+    /**
+     * Reads the index back from the backend.
+     */
+    void loadIndex() {
+        mapkeeper::ScanOptions keysOnly;
+        keysOnly.keysOnly = true;
+        std::string startKey;
+        bool startKeyIncluded = true;
+        while (true) {
+            mapkeeper::RecordListResponse response;
+            next_->scan(response, indexMap(), mapkeeper::ScanOrder::Ascending,
+                        startKey, startKeyIncluded, std::string(), false,
+                        10000, 10000000, keysOnly);
+            if (response.responseCode == mapkeeper::ResponseCode::MapNotFound) {
+                return;
+            } else if (response.responseCode != mapkeeper::ResponseCode::Success &&
+                       response.responseCode != mapkeeper::ResponseCode::ScanEnded) {
+                fprintf(stderr, "TtlHandler failed to read the index: %d\n", response.responseCode);
+                return;
+            }
+            for (size_t i = 0; i < response.records.size(); i++) {
+                Expiry expiry(0, std::string(), std::string());
+                if (!parseIndexKey(response.records[i].key, expiry)) {
+                    fprintf(stderr, "TtlHandler skipped a malformed index entry\n");
+                    continue;
+                }
+                Shard& shard = shardOf(expiry.key);
+                KeyExpiries& keys = shard.expiries[expiry.mapName];
+                if (keys.find(expiry.key) != keys.end()) {
+                    continue;
+                }
+                shard.queue.insert(expiry);
+                keys[expiry.key] = expiry.time;
+                numExpiries_++;
+            }
+            if (response.responseCode == mapkeeper::ResponseCode::ScanEnded ||
+                response.records.empty()) {
+                return;
+            }
+            startKey = response.records.back().key;
+            startKeyIncluded = false;
+        }
+    }
+
+    /**
+     * Removes expired records in the background. It wakes up once a
+     * second and takes up to SWEEP_BATCH expired records per shard at a
+     * time, so the locks are never held for long, and keeps going until
+     * it has caught up, so the index can't grow faster than it shrinks.
+     */
+    void sweep() {
+        while (true) {
+            boost::this_thread::sleep(boost::posix_time::seconds(1));
+            bool caughtUp = false;
+            while (!caughtUp && hasExpiries()) {
+                caughtUp = true;
+                int64_t time = now();
+                for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+                    std::vector<Expiry> expired;
+                    {
+                        Shard& shard = shards_[i];
+                        boost::mutex::scoped_lock lock(shard.mutex);
+                        std::set<Expiry>::iterator itr;
+                        for (itr = shard.queue.begin();
+                             itr != shard.queue.end() && itr->time <= time && expired.size() < SWEEP_BATCH;
+                             itr++) {
+                            expired.push_back(*itr);
+                        }
+                    }
+                    if (expired.size() == SWEEP_BATCH) {
+                        caughtUp = false;
+                    }
+                    for (size_t j = 0; j < expired.size(); j++) {
+                        StripedLock::ScopedLock keyLock(locks_, expired[j].key);
+                        if (getExpiry(expired[j].mapName, expired[j].key) == expired[j].time) {
+                            reclaimIfExpired(expired[j].mapName, expired[j].key);
+                        }
+                    }
+                }
+                boost::this_thread::interruption_point();
+            }
+        }
+    }
+
+    boost::scoped_array<Shard> shards_; // the index, split by key
+    volatile int numExpiries_; // records with a TTL, across the shards
+    StripedLock locks_; // order the writes to a key
+    std::map<int32_t, std::string> handles_; // map names of the handles from openMap
+    boost::mutex namesMutex_; // protect handles_
+    CursorTable<MapName> cursors_; // map names of the cursors from openScan
+    CursorTable<MapName> snapshots_; // map names of the snapshots
+    boost::scoped_ptr<boost::thread> sweeper_;
+};
+
+#endif // TTL_HANDLER_H
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef VALUE_PROJECTION_H
+#define VALUE_PROJECTION_H
+
+/**
+ * Applies ScanOptions to record values.
+ *
+ * Backends that can read only a part of a value (BDB partial gets,
+ * for example) use projectionOffset and projectionLength to set up
+ * the read. The others read the whole value in place and use
+ * projectValue to copy only the bytes the client asked for.
+ */
+#include <string>
+#include <stdint.h>
+#include "MapKeeper.h"
+
+/**
+ * @returns offset of the first byte of the value to return.
+ */
+inline uint32_t projectionOffset(const mapkeeper::ScanOptions& options) {
+    return options.valueOffset > 0 ? options.valueOffset : 0;
+}
+
+/**
+ * @returns maximum number of bytes of the value to return.
+ */
+inline uint32_t projectionLength(const mapkeeper::ScanOptions& options) {
+    return options.valueLength >= 0 ? options.valueLength : 0xffffffff;
+}
+
+/**
+ * @returns true if the scan needs to read the whole value.
+ */
+inline bool isFullValue(const mapkeeper::ScanOptions& options) {
+    return !options.keysOnly && options.valueOffset <= 0 && options.valueLength < 0;
+}
+
+/**
+ * Copies the part of the value selected by options into value.
+ */
+inline void projectValue(const mapkeeper::ScanOptions& options,
+                         const char* data, size_t size, std::string& value) {
+    if (options.keysOnly) {
+        value.clear();
+        return;
+    }
+    uint32_t offset = projectionOffset(options);
+    if (offset >= size) {
+        value.clear();
+        return;
+    }
+    size_t length = size - offset;
+    if (projectionLength(options) < length) {
+        length = projectionLength(options);
+    }
+    value.assign(data + offset, length);
+}
+
+#endif // VALUE_PROJECTION_H
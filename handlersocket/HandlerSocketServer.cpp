@@ -20,12 +20,14 @@
  *
  * http://yoshinorimatsunobu.blogspot.com/search/label/handlersocket
  */
+#include <iostream>
 #include "MapKeeper.h"
 #include "HandlerSocketClient.h"
+#include "ServerRunner.h"
 
+#include <boost/program_options.hpp>
 #include <boost/thread/tss.hpp>
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 
@@ -36,6 +38,7 @@ using namespace ::apache::thrift::server;
 using namespace ::apache::thrift::concurrency;
 
 using boost::shared_ptr;
+namespace po = boost::program_options;
 using namespace mapkeeper;
 
 class HandlerSocketServer: virtual public MapKeeperIf {
@@ -47,6 +50,11 @@ public:
         return ResponseCode::Success;
     }
 
+    // answered by StatsHandler, which ServerRunner puts in front.
+    void getStats(StatsResponse& _return, const bool reset) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
     ResponseCode::type addMap(const std::string& mapName) {
         initClient();
         HandlerSocketClient::ResponseCode rc = client_->createTable(mapName);
@@ -73,14 +81,95 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    void openMap(MapHandleResponse& _return, const std::string& mapName) {
+        // HandlerSocketClient looks up its indexes by table name, so a
+        // handle wouldn't save anything.
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& key) {
+        _return.responseCode = ResponseCode::MapNotFound;
+    }
+
+    ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key, const std::string& value) {
+        return ResponseCode::MapNotFound;
+    }
+
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle, 
+                      const ScanOrder::type order, const std::string& startKey, 
+                      const bool startKeyIncluded, const std::string& endKey, 
+                      const bool endKeyIncluded, const int32_t maxRecords, 
+                      const int32_t maxBytes, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::MapNotFound;
+    }
+
     void scan(RecordListResponse& _return, const std::string& mapName, 
               const ScanOrder::type order, const std::string& startKey, 
               const bool startKeyIncluded, const std::string& endKey, 
               const bool endKeyIncluded, const int32_t maxRecords, 
-              const int32_t maxBytes) {
+              const int32_t maxBytes, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void openScan(ScanCursorResponse& _return, const std::string& mapName, 
+                  const ScanOrder::type order, const std::string& startKey, 
+                  const bool startKeyIncluded, const std::string& endKey, 
+                  const bool endKeyIncluded, const ScanOptions& options) {
         _return.responseCode = ResponseCode::Success;
     }
 
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        _return.responseCode = ResponseCode::ScanEnded;
+    }
+
+    ResponseCode::type closeScan(const int64_t cursorId) {
+        return ResponseCode::Success;
+    }
+
+    void createSnapshot(SnapshotResponse& _return, const std::string& mapName) {
+        // HandlerSocket reads each request at the latest version.
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        return ResponseCode::SnapshotNotFound;
+    }
+
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& key) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+    }
+
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, 
+                        const ScanOrder::type order, const std::string& startKey, 
+                        const bool startKeyIncluded, const std::string& endKey, 
+                        const bool endKeyIncluded, const int32_t maxRecords, 
+                        const int32_t maxBytes, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+    }
+
+    void countRange(Int64Response& _return, const std::string& mapName, 
+                    const std::string& startKey, const std::string& endKey) {
+        // range reads aren't supported, same as scan.
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    void approximateSize(Int64Response& _return, const std::string& mapName, 
+                         const std::string& startKey, const std::string& endKey) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    void sampleSplitPoints(KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    void aggregate(AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const AggregateOp::type op, const ValueEncoding::type encoding) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
     void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
         initClient();
         HandlerSocketClient::ResponseCode rc = client_->get(mapName, key, _return.value);
@@ -97,11 +186,37 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
+    void multiGet(BinaryListResponse& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        initClient();
+        _return.responses.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            BinaryResponse& response = _return.responses[i];
+            HandlerSocketClient::ResponseCode rc = client_->get(mapName, keys[i], response.value);
+            if (rc == HandlerSocketClient::TableNotFound) {
+                _return.responseCode = ResponseCode::MapNotFound;
+                return;
+            } else if (rc == HandlerSocketClient::RecordNotFound) {
+                response.responseCode = ResponseCode::RecordNotFound;
+            } else if (rc != HandlerSocketClient::Success) {
+                response.responseCode = ResponseCode::Error;
+            } else {
+                response.responseCode = ResponseCode::Success;
+            }
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         return ResponseCode::Success;
     }
 
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
+    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
+        if (options.ttlSeconds > 0) {
+            // records can't expire.
+            return ResponseCode::Error;
+        }
         initClient();
         HandlerSocketClient::ResponseCode rc = client_->insert(mapName, key, value);
         if (rc == HandlerSocketClient::TableNotFound) {
@@ -114,7 +229,29 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
+    ResponseCode::type insertMany(const std::string& mapName, const std::vector<Record>& records) {
+        // HandlerSocket has no transactions, so this is not atomic.
+        std::vector<Record>::const_iterator record;
+        for (record = records.begin(); record != records.end(); record++) {
+            ResponseCode::type rc = insert(mapName, record->key, record->value, WriteOptions());
+            if (rc != ResponseCode::Success) {
+                return rc;
+            }
+        }
+        return ResponseCode::Success;
+    }
+
+    // only the LevelDB backend can load table files directly.
+    ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        return ResponseCode::Error;
+    }
+
+    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
+        if (options.ttlSeconds > 0) {
+            // records can't expire.
+            return ResponseCode::Error;
+        }
         initClient();
         HandlerSocketClient::ResponseCode rc = client_->update(mapName, key, value);
         if (rc == HandlerSocketClient::TableNotFound) {
@@ -127,10 +264,42 @@ public:
         return ResponseCode::Success;
     }
 
+    ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key, 
+                                     const std::string& expectedValue, const std::string& newValue) {
+        // a get followed by an update wouldn't be atomic.
+        return ResponseCode::Error;
+    }
+
+    void increment(Int64Response& _return, const std::string& mapName, const std::string& key, const int64_t delta) {
+        // same as compareAndSet, it can't be done atomically.
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& value) {
+        return ResponseCode::Error;
+    }
+
     ResponseCode::type remove(const std::string& mapName, const std::string& key) {
         return ResponseCode::Success;
     }
 
+    void removeRange(Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    ResponseCode::type writeBatch(const std::string& mapName, const std::vector<Mutation>& mutations) {
+        // HandlerSocket has no way to group several operations into
+        // a transaction, so the batch can't be applied atomically.
+        return ResponseCode::Error;
+    }
+
+    void tailChanges(ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        // writes aren't logged.
+        _return.responseCode = ResponseCode::Error;
+    }
+
 private:
     void initClient() {
         if (client_.get() == NULL) {
@@ -142,13 +311,24 @@ private:
 };
 
 int main(int argc, char **argv) {
-    int port = 9090;
+    int port;
+    ServerRunner runner;
+    po::variables_map vm;
+    po::options_description config("");
+    config.add_options()
+        ("help,h", "produce help message")
+        ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
+        ;
+    runner.addOptions(config);
+    po::options_description cmdline_options;
+    cmdline_options.add(config);
+    store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    notify(vm);
+    if (vm.count("help")) {
+        std::cout << config << std::endl;
+        exit(0);
+    }
     shared_ptr<HandlerSocketServer> handler(new HandlerSocketServer());
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer* server = new TThreadedServer(processor, serverTransport, transportFactory, protocolFactory);
-    server->serve();
+    runner.serve(runner.cache(handler), port);
     return 0;
 }
@@ -22,6 +22,15 @@
 #include <iostream>
 #include <cstdio>
 #include "MapKeeper.h"
+#include "Aggregator.h"
+#include "ChangeLogHandler.h"
+#include "TtlHandler.h"
+#include "CursorTable.h"
+#include "MapHandleTable.h"
+#include "ScanFilter.h"
+#include "ServerRunner.h"
+#include "SplitPoints.h"
+#include "ValueProjection.h"
 #include <boost/program_options.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/thread/shared_mutex.hpp>
@@ -32,7 +41,6 @@
 #include <arpa/inet.h>
 
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 
@@ -91,6 +99,11 @@ public:
         return ResponseCode::Success;
     }
 
+    // answered by StatsHandler, which ServerRunner puts in front.
+    void getStats(StatsResponse& _return, const bool reset) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
     ResponseCode::type addMap(const std::string& mapName) {
         boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
         boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
@@ -118,6 +131,8 @@ public:
         if (itr == maps_.end()) {
             return ResponseCode::MapNotFound;
         }
+        cursors_.removeMap(mapName);
+        handles_.remove(mapName);
         if (!itr->second->close()) {
           return ResponseCode::Error;
         }
@@ -137,10 +152,66 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    void openMap(MapHandleResponse& _return, const std::string& mapName) {
+        boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        _return.handle = handles_.add(mapName, itr->second);
+        _return.responseCode = _return.handle >= 0 ? ResponseCode::Success : ResponseCode::TooManyHandles;
+    }
+
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& key) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        TreeDB* db;
+        if (!handles_.get(mapHandle, db)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        if (!db->get(key, &(_return.value))) {
+            _return.responseCode = ResponseCode::RecordNotFound;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key, const std::string& value) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        TreeDB* db;
+        if (!handles_.get(mapHandle, db)) {
+            return ResponseCode::MapNotFound;
+        }
+        if (!db->set(key, value)) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        TreeDB* db;
+        if (!handles_.get(mapHandle, db)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        if (order == ScanOrder::Ascending) {
+            scanAscending(_return, db, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        } else {
+            scanDescending(_return, db, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        }
+    }
+
     void scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
               const std::string& startKey, const bool startKeyIncluded, 
               const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -148,9 +219,9 @@ public:
             return;
         }
         if (order == ScanOrder::Ascending) {
-            scanAscending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+            scanAscending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
         } else {
-            scanDescending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+            scanDescending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
         }
  
     }
@@ -158,7 +229,8 @@ public:
     void scanAscending(RecordListResponse& _return, TreeDB* db,  
               const std::string& startKey, const bool startKeyIncluded, 
               const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         int numBytes = 0;
         DB::Cursor* cursor = db->cursor();
         _return.responseCode = ResponseCode::ScanEnded;
@@ -167,7 +239,7 @@ public:
           return;
         }
         string key, value;
-        while (cursor->get(&key, &value, true /* step */)) {
+        while (readRecord(cursor, options, key, value, true /* step */)) {
             if (!startKeyIncluded && key == startKey) {
                 continue;
             }
@@ -179,9 +251,12 @@ public:
                   break;
                 }
             }
+            if (!matchesFilter(options.filter, key.data(), key.size(), value.data(), value.size())) {
+                continue;
+            }
             Record record;
             record.key = key;
-            record.value = value;
+            projectValue(options, value.data(), value.size(), record.value);
             numBytes += record.key.size() + record.value.size();
             _return.records.push_back(record);
             if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
@@ -195,7 +270,8 @@ public:
     void scanDescending(RecordListResponse& _return, TreeDB* db,
               const std::string& startKey, const bool startKeyIncluded, 
               const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         int numBytes = 0;
         DB::Cursor* cursor = db->cursor();
         _return.responseCode = ResponseCode::ScanEnded;
@@ -212,7 +288,7 @@ public:
             }
         }
         string key, value;
-        while (cursor->get(&key, &value, false /* step */)) {
+        while (readRecord(cursor, options, key, value, false /* step */)) {
             if (!endKeyIncluded && key == endKey) {
                 cursor->step_back();
                 continue;
@@ -223,9 +299,13 @@ public:
             if (!startKeyIncluded && startKey >= key) {
                 break;
             }
+            if (!matchesFilter(options.filter, key.data(), key.size(), value.data(), value.size())) {
+                cursor->step_back();
+                continue;
+            }
             Record record;
             record.key = key;
-            record.value = value;
+            projectValue(options, value.data(), value.size(), record.value);
             numBytes += record.key.size() + record.value.size();
             _return.records.push_back(record);
             if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
@@ -237,6 +317,226 @@ public:
         delete cursor;
     }
 
+    void openScan(ScanCursorResponse& _return, const std::string& mapName, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const ScanOptions& options) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        boost::shared_ptr<ScanCursor> cursor(new ScanCursor(mapName, itr->second->cursor()));
+        cursor->order = order;
+        cursor->startKey = startKey;
+        cursor->startKeyIncluded = startKeyIncluded;
+        cursor->endKey = endKey;
+        cursor->endKeyIncluded = endKeyIncluded;
+        cursor->options = options;
+
+        // position the cursor on the first record to return.
+        string key;
+        if (order == ScanOrder::Ascending) {
+            cursor->ended = !cursor->cursor->jump(startKey);
+            if (!cursor->ended && !startKeyIncluded && 
+                cursor->cursor->get_key(&key, false) && key == startKey) {
+                cursor->ended = !cursor->cursor->step();
+            }
+        } else if (endKey.empty()) {
+            cursor->ended = !cursor->cursor->jump_back();
+        } else {
+            cursor->ended = !cursor->cursor->jump_back(endKey);
+            if (!cursor->ended && !endKeyIncluded && 
+                cursor->cursor->get_key(&key, false) && key == endKey) {
+                cursor->ended = !cursor->cursor->step_back();
+            }
+        }
+        _return.cursorId = cursors_.add(cursor);
+        _return.responseCode = _return.cursorId ? ResponseCode::Success : ResponseCode::TooManyCursors;
+    }
+
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::shared_ptr<ScanCursor> cursor = cursors_.get(cursorId);
+        if (!cursor) {
+            _return.responseCode = ResponseCode::CursorNotFound;
+            return;
+        }
+        boost::mutex::scoped_lock cursorLock(cursor->mutex);
+        int numBytes = 0;
+        _return.responseCode = ResponseCode::ScanEnded;
+        string key, value;
+        while (!cursor->ended && cursor->cursor->get(&key, &value, false /* step */)) {
+            if (cursor->order == ScanOrder::Ascending) {
+                if (!cursor->endKey.empty()) {
+                    if (cursor->endKeyIncluded && cursor->endKey < key) {
+                        break;
+                    }
+                    if (!cursor->endKeyIncluded && cursor->endKey <= key) {
+                        break;
+                    }
+                }
+                cursor->ended = !cursor->cursor->step();
+            } else {
+                if (cursor->startKeyIncluded && cursor->startKey > key) {
+                    break;
+                }
+                if (!cursor->startKeyIncluded && cursor->startKey >= key) {
+                    break;
+                }
+                cursor->ended = !cursor->cursor->step_back();
+            }
+            if (!matchesFilter(cursor->options.filter, key.data(), key.size(),
+                               value.data(), value.size())) {
+                continue;
+            }
+            Record record;
+            record.key = key;
+            projectValue(cursor->options, value.data(), value.size(), record.value);
+            numBytes += record.key.size() + record.value.size();
+            _return.records.push_back(record);
+            if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
+                _return.responseCode = ResponseCode::Success;
+                return;
+            }
+        }
+        cursors_.remove(cursorId);
+    }
+
+    ResponseCode::type closeScan(const int64_t cursorId) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        if (!cursors_.remove(cursorId)) {
+            return ResponseCode::CursorNotFound;
+        }
+        return ResponseCode::Success;
+    }
+
+    void createSnapshot(SnapshotResponse& _return, const std::string& mapName) {
+        // TreeDB keeps a single version of each record, so there is
+        // nothing to read an old version from.
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        return ResponseCode::SnapshotNotFound;
+    }
+
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& key) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+    }
+
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+    }
+
+    void countRange(Int64Response& _return, const std::string& mapName,
+                    const std::string& startKey, const std::string& endKey) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        _return.value = countKeys(itr->second, startKey, endKey);
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    /**
+     * Kyoto Cabinet only knows the size of the whole file, so it's 
+     * spread evenly over the records.
+     */
+    void approximateSize(Int64Response& _return, const std::string& mapName,
+                         const std::string& startKey, const std::string& endKey) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        int64_t size = itr->second->size();
+        int64_t count = itr->second->count();
+        if (size < 0 || count < 0) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        if (startKey.empty() && endKey.empty()) {
+            _return.value = size;
+        } else {
+            _return.value = count ? size * countKeys(itr->second, startKey, endKey) / count : 0;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void aggregate(AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const AggregateOp::type op, const ValueEncoding::type encoding) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        Aggregator aggregator(op, encoding);
+        if (!aggregator.isValid()) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        DB::Cursor* cursor = itr->second->cursor();
+        if (cursor->jump(startKey)) {
+            string key;
+            string value;
+            // Count only reads the keys.
+            while (aggregator.needsValues() ? cursor->get(&key, &value, true /* step */)
+                                            : cursor->get_key(&key, true /* step */)) {
+                if (!endKey.empty() && endKey <= key) {
+                    break;
+                }
+                aggregator.add(value.data(), value.size());
+            }
+        }
+        delete cursor;
+        aggregator.getResult(_return);
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    /**
+     * TreeDB doesn't expose its inner nodes, but it knows its record 
+     * count, so every n-th key is an exact split point. Only the keys 
+     * up to the last split point are read.
+     */
+    void sampleSplitPoints(KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        int64_t count = itr->second->count();
+        if (count < 0 || !validSplitCount(numSplits)) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        StridePicker picker(count, numSplits);
+        DB::Cursor* cursor = itr->second->cursor();
+        if (cursor->jump()) {
+            string key;
+            for (uint64_t i = 0; !picker.done() && cursor->get_key(&key, true /* step */); i++) {
+                if (picker.pick(i)) {
+                    _return.keys.push_back(key);
+                }
+            }
+        }
+        delete cursor;
+        _return.responseCode = ResponseCode::Success;
+    }
+
     void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
@@ -251,7 +551,37 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
+    void multiGet(BinaryListResponse& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+
+        // get_bulk() returns -1 on failure, and records that don't exist
+        // are simply missing from the result.
+        // http://fallabs.com/kyotocabinet/api/classkyotocabinet_1_1BasicDB.html
+        std::map<std::string, std::string> records;
+        if (itr->second->get_bulk(keys, &records, true /* atomic */) < 0) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.responses.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            std::map<std::string, std::string>::iterator record = records.find(keys[i]);
+            if (record == records.end()) {
+                _return.responses[i].responseCode = ResponseCode::RecordNotFound;
+                continue;
+            }
+            _return.responses[i].responseCode = ResponseCode::Success;
+            _return.responses[i].value = record->second;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         std::string mapName_ = mapName;
         boost::ptr_map<std::string, TreeDB>::iterator itr;
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
@@ -262,8 +592,8 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
-        // TODO Get and Put should be within a same transaction
+    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -279,8 +609,37 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
-        // TODO Get and Put should be within a same transaction
+    ResponseCode::type insertMany(const std::string& mapName, const std::vector<Record>& records) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        TreeDB* db = itr->second;
+        if (!db->begin_transaction(sync_)) {
+            return ResponseCode::Error;
+        }
+        ResponseCode::type rc = ResponseCode::Success;
+        std::vector<Record>::const_iterator record;
+        for (record = records.begin(); record != records.end(); record++) {
+            if (!db->add(record->key, record->value)) {
+                rc = ResponseCode::RecordExists;
+                break;
+            }
+        }
+        if (!db->end_transaction(rc == ResponseCode::Success)) {
+            return ResponseCode::Error;
+        }
+        return rc;
+    }
+
+    // only the LevelDB backend can load table files directly.
+    ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        return ResponseCode::Error;
+    }
+
+    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -297,6 +656,59 @@ public:
 
     }
 
+    ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key, 
+                                     const std::string& expectedValue, const std::string& newValue) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        if (itr->second->cas(key, expectedValue, newValue)) {
+            return ResponseCode::Success;
+        }
+        if (itr->second->error().code() != BasicDB::Error::LOGIC) {
+            return ResponseCode::Error;
+        }
+        // cas() fails with LOGIC both when the record doesn't exist and
+        // when its value doesn't match. The lookup only picks the error
+        // code, the record is never modified here.
+        std::string value;
+        if (!itr->second->get(key, &value)) {
+            return ResponseCode::RecordNotFound;
+        }
+        return ResponseCode::ValueMismatch;
+    }
+
+    void increment(Int64Response& _return, const std::string& mapName, const std::string& key, const int64_t delta) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        // missing records start from 0. INT64MIN means failure, e.g. the
+        // record isn't 8 bytes long.
+        int64_t value = itr->second->increment(key, delta, 0);
+        if (value == INT64MIN) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+        _return.value = value;
+    }
+
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& value) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        if (!itr->second->append(key, value)) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
     ResponseCode::type remove(const std::string& mapName, const std::string& key) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
@@ -309,18 +721,160 @@ public:
         return ResponseCode::Success;
     }
 
+    /**
+     * Removes the records through a cursor, which moves to the next 
+     * record after each removal. There's no transaction around it; a
+     * transaction would block every other writer of the map until the
+     * whole range is gone.
+     */
+    void removeRange(Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        _return.value = 0;
+        _return.responseCode = ResponseCode::Success;
+        DB::Cursor* cursor = itr->second->cursor();
+        if (cursor->jump(startKey)) {
+            string key;
+            while (cursor->get_key(&key)) {
+                if (!endKey.empty() && endKey <= key) {
+                    break;
+                }
+                if (!cursor->remove()) {
+                    _return.responseCode = ResponseCode::Error;
+                    break;
+                }
+                _return.value++;
+            }
+        }
+        delete cursor;
+    }
+
+    ResponseCode::type writeBatch(const std::string& mapName, const std::vector<Mutation>& mutations) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, TreeDB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        TreeDB* db = itr->second;
+        if (!db->begin_transaction(sync_)) {
+            return ResponseCode::Error;
+        }
+        ResponseCode::type rc = ResponseCode::Success;
+        std::vector<Mutation>::const_iterator mutation;
+        for (mutation = mutations.begin(); mutation != mutations.end(); mutation++) {
+            if (mutation->type == MutationType::Put) {
+                if (!db->set(mutation->key, mutation->value)) {
+                    rc = ResponseCode::Error;
+                }
+            } else if (mutation->type == MutationType::Insert) {
+                if (!db->add(mutation->key, mutation->value)) {
+                    rc = ResponseCode::RecordExists;
+                }
+            } else if (mutation->type == MutationType::Update) {
+                if (!db->replace(mutation->key, mutation->value)) {
+                    rc = ResponseCode::RecordNotFound;
+                }
+            } else {
+                if (!db->remove(mutation->key)) {
+                    rc = ResponseCode::RecordNotFound;
+                }
+            }
+            if (rc != ResponseCode::Success) {
+                break;
+            }
+        }
+        if (!db->end_transaction(rc == ResponseCode::Success)) {
+            return ResponseCode::Error;
+        }
+        return rc;
+    }
+
+    void tailChanges(ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        // changes are logged by ChangeLogHandler, which main() puts in
+        // front of this handler.
+        _return.responseCode = ResponseCode::Error;
+    }
+
 private:
+    /**
+     * Counts the records in [startKey, endKey) without reading the values.
+     */
+    int64_t countKeys(TreeDB* db, const std::string& startKey, const std::string& endKey) {
+        int64_t count = 0;
+        DB::Cursor* cursor = db->cursor();
+        if (cursor->jump(startKey)) {
+            string key;
+            while (cursor->get_key(&key, true /* step */)) {
+                if (!endKey.empty() && endKey <= key) {
+                    break;
+                }
+                count++;
+            }
+        }
+        delete cursor;
+        return count;
+    }
+
+    /**
+     * Reads the record at the cursor. Keys-only scans don't read 
+     * the value at all.
+     */
+    bool readRecord(DB::Cursor* cursor, const ScanOptions& options,
+                    string& key, string& value, bool step) {
+        if (options.keysOnly && !hasValueFilter(options.filter)) {
+            return cursor->get_key(&key, step);
+        }
+        return cursor->get(&key, &value, step);
+    }
+
+    /**
+     * State of a scan opened with openScan. Kyoto Cabinet cursors stay
+     * valid while the database is modified, but don't give a snapshot.
+     */
+    struct ScanCursor {
+        ScanCursor(const std::string& mapName_, DB::Cursor* cursor_) :
+            mapName(mapName_),
+            cursor(cursor_),
+            ended(false) {
+        }
+
+        ~ScanCursor() {
+            delete cursor;
+        }
+
+        std::string mapName;
+        DB::Cursor* cursor;
+        bool ended;
+        ScanOrder::type order;
+        std::string startKey;
+        bool startKeyIncluded;
+        std::string endKey;
+        bool endKeyIncluded;
+        ScanOptions options;
+        boost::mutex mutex; // serialize nextScan calls on this cursor
+    };
+
     std::string directoryName_; // directory to store db files.
     bool sync_; // synchronous write
     int64_t mmapSizeMb_; // used for DB->tune_map
     boost::ptr_map<std::string, TreeDB> maps_;
     boost::shared_mutex mutex_; // protect map_
+    CursorTable<ScanCursor> cursors_;
+    MapHandleTable<TreeDB*> handles_;
 };
 
 int main(int argc, char **argv) {
     int port;
     int mmapSizeMb;
+    int changeLogSize;
     std::string dir;
+    ServerRunner runner;
     po::variables_map vm;
     po::options_description config("");
     config.add_options()
@@ -329,7 +883,9 @@ int main(int argc, char **argv) {
         ("mmap-size-mb,m", po::value<int>(&mmapSizeMb)->default_value(64), "size of the memory-mapped region in MB")
         ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
         ("datadir,d", po::value<std::string>(&dir)->default_value("data"), "data directory")
+        ("change-log-size", po::value<int>(&changeLogSize)->default_value(10000), "number of changes per map to keep for tailChanges (0 to disable)")
         ;
+    runner.addOptions(config);
     po::options_description cmdline_options;
     cmdline_options.add(config);
     store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
@@ -339,12 +895,13 @@ int main(int argc, char **argv) {
         exit(0);
     }
     bool sync = vm.count("sync") > 0;
-    shared_ptr<KyotoCabinetServer> handler(new KyotoCabinetServer(dir, sync, mmapSizeMb));
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server(processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    shared_ptr<MapKeeperIf> handler(new KyotoCabinetServer(dir, sync, mmapSizeMb));
+    handler = runner.groupCommit(handler);
+    handler = runner.cache(handler);
+    if (changeLogSize > 0) {
+        handler.reset(new ChangeLogHandler(handler, changeLogSize));
+    }
+    handler.reset(new TtlHandler(handler));
+    runner.serve(handler, port);
     return 0;
 }
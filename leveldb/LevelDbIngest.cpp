@@ -0,0 +1,61 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Loads a sorted file of records into a map of a stopped LevelDB server.
+ * The map is created if it doesn't exist. See TableIngester.h for the
+ * format of the input file.
+ */
+#include <cstdio>
+#include <iostream>
+#include <boost/program_options.hpp>
+#include "TableIngester.h"
+
+namespace po = boost::program_options;
+
+int main(int argc, char **argv) {
+    int tableSizeMb;
+    std::string dir;
+    std::string mapName;
+    std::string input;
+    po::variables_map vm;
+    po::options_description config("");
+    config.add_options()
+        ("help,h", "produce help message")
+        ("datadir,d", po::value<std::string>(&dir)->default_value("data"), "data directory of the server")
+        ("map,m", po::value<std::string>(&mapName), "map to load")
+        ("input,f", po::value<std::string>(&input), "sorted input file")
+        ("table-size-mb,t", po::value<int>(&tableSizeMb)->default_value(32), "size of the table files in MB")
+        ;
+    po::options_description cmdline_options;
+    cmdline_options.add(config);
+    store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    notify(vm);
+    if (vm.count("help") || mapName.empty() || input.empty()) {
+        std::cout << config << std::endl;
+        exit(vm.count("help") ? 0 : 1);
+    }
+    leveldb::Options options;
+    TableIngester ingester(dir + "/" + mapName, options, (uint64_t)tableSizeMb * 1024 * 1024);
+    uint64_t numRecords;
+    leveldb::Status status = ingester.ingest(input, numRecords);
+    if (!status.ok()) {
+        fprintf(stderr, "ingest failed: %s\n", status.ToString().c_str());
+        return 1;
+    }
+    printf("loaded %llu records into %s\n", (unsigned long long)numRecords, mapName.c_str());
+    return 0;
+}
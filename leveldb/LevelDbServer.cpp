@@ -22,9 +22,25 @@
  */
 #include <iostream>
 #include <cstdio>
+#include <map>
+#include <set>
 #include "MapKeeper.h"
+#include "Aggregator.h"
+#include "ChangeLogHandler.h"
+#include "TtlHandler.h"
+#include "TableIngester.h"
+#include "CursorTable.h"
+#include "MapHandleTable.h"
+#include "MergeOperator.h"
+#include "ScanFilter.h"
+#include "StripedLock.h"
+#include "ScanStreamServer.h"
+#include "ServerRunner.h"
+#include "SplitPoints.h"
+#include "ValueProjection.h"
 #include <leveldb/db.h>
 #include <leveldb/cache.h>
+#include <leveldb/write_batch.h>
 #include <boost/program_options.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/thread/shared_mutex.hpp>
@@ -35,7 +51,6 @@
 #include <arpa/inet.h>
 
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 
@@ -90,12 +105,17 @@ public:
         return ResponseCode::Success;
     }
 
+    // answered by StatsHandler, which ServerRunner puts in front.
+    void getStats(StatsResponse& _return, const bool reset) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
     ResponseCode::type addMap(const std::string& mapName) {
         std::string mapName_ = mapName;
         boost::ptr_map<std::string, leveldb::DB>::iterator itr;
         boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
         itr = maps_.find(mapName_);
-        if (itr != maps_.end())
+        if (itr != maps_.end() || ingesting_.count(mapName) > 0)
 		return ResponseCode::MapExists;
         leveldb::DB* db;
         leveldb::Options options;
@@ -121,6 +141,9 @@ public:
         if (itr == maps_.end()) {
             return ResponseCode::MapNotFound;
         }
+        cursors_.removeMap(mapName);
+        snapshots_.removeMap(mapName);
+        handles_.remove(mapName);
         maps_.erase(itr);
         //DestroyDB(directoryName_ + "/" + mapName, leveldb::Options());
         return ResponseCode::Success;
@@ -135,10 +158,59 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    void openMap(MapHandleResponse& _return, const std::string& mapName) {
+        boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        _return.handle = handles_.add(mapName, itr->second);
+        _return.responseCode = _return.handle >= 0 ? ResponseCode::Success : ResponseCode::TooManyHandles;
+    }
+
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& key) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        leveldb::DB* db;
+        if (!handles_.get(mapHandle, db) || db == NULL) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        getRecord(_return, db, key);
+    }
+
+    ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key, const std::string& value) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        leveldb::DB* db;
+        if (!handles_.get(mapHandle, db) || db == NULL) {
+            return ResponseCode::MapNotFound;
+        }
+        return putRecord(db, key, value);
+    }
+
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle, const ScanOrder::type order,
+                      const std::string& startKey, const bool startKeyIncluded, 
+                      const std::string& endKey, const bool endKeyIncluded,
+                      const int32_t maxRecords, const int32_t maxBytes,
+                      const ScanOptions& options) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        leveldb::DB* db;
+        if (!handles_.get(mapHandle, db) || db == NULL) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        if (order == ScanOrder::Ascending) {
+            scanAscending(_return, db, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        } else {
+            scanDescending(_return, db, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        }
+    }
+
     void scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
               const std::string& startKey, const bool startKeyIncluded, 
               const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -146,24 +218,26 @@ public:
             return;
         }
         if (order == ScanOrder::Ascending) {
-            scanAscending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+            scanAscending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
         } else {
-            scanDescending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+            scanDescending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
         }
     }
 
     void scanAscending(RecordListResponse& _return, leveldb::DB* db, 
               const std::string& startKey, const bool startKeyIncluded, 
               const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options, const leveldb::Snapshot* snapshot = NULL) {
         _return.responseCode = ResponseCode::ScanEnded;
         int numBytes = 0;
-        leveldb::Iterator* itr = db->NewIterator(leveldb::ReadOptions());
+        leveldb::ReadOptions readOptions;
+        readOptions.snapshot = snapshot;
+        leveldb::Iterator* itr = db->NewIterator(readOptions);
         _return.responseCode = ResponseCode::ScanEnded;
         for (itr->Seek(startKey); itr->Valid(); itr->Next()) {
             Record record;
             record.key = itr->key().ToString();
-            record.value = itr->value().ToString();
             if (!startKeyIncluded && startKey == record.key) {
                 continue;
             }
@@ -175,6 +249,15 @@ public:
                   break;
                 }
             }
+            // value() points into the iterator's block, so records the
+            // filter skips aren't copied, and only the projected bytes 
+            // of the others are.
+            leveldb::Slice value = itr->value();
+            if (!matchesFilter(options.filter, record.key.data(), record.key.size(),
+                               value.data(), value.size())) {
+                continue;
+            }
+            projectValue(options, value.data(), value.size(), record.value);
             numBytes += record.key.size() + record.value.size();
             _return.records.push_back(record);
             if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
@@ -189,9 +272,12 @@ public:
     void scanDescending(RecordListResponse& _return, leveldb::DB* db,
               const std::string& startKey, const bool startKeyIncluded, 
               const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options, const leveldb::Snapshot* snapshot = NULL) {
         int numBytes = 0;
-        leveldb::Iterator* itr = db->NewIterator(leveldb::ReadOptions());
+        leveldb::ReadOptions readOptions;
+        readOptions.snapshot = snapshot;
+        leveldb::Iterator* itr = db->NewIterator(readOptions);
         _return.responseCode = ResponseCode::ScanEnded;
         if (endKey.empty()) {
             itr->SeekToLast();
@@ -201,7 +287,6 @@ public:
         for (; itr->Valid(); itr->Prev()) {
             Record record;
             record.key = itr->key().ToString();
-            record.value = itr->value().ToString();
             if (!endKeyIncluded && endKey == record.key) {
                 continue;
             }
@@ -211,6 +296,12 @@ public:
             if (!startKeyIncluded && startKey >= record.key) {
                 break;
             }
+            leveldb::Slice value = itr->value();
+            if (!matchesFilter(options.filter, record.key.data(), record.key.size(),
+                               value.data(), value.size())) {
+                continue;
+            }
+            projectValue(options, value.data(), value.size(), record.value);
             numBytes += record.key.size() + record.value.size();
             _return.records.push_back(record);
             if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
@@ -222,25 +313,335 @@ public:
         delete itr;
     }
 
-    void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
+    void openScan(ScanCursorResponse& _return, const std::string& mapName, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const ScanOptions& options) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
             _return.responseCode = ResponseCode::MapNotFound;
             return;
         }
-        leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &(_return.value));
-        if (status.IsNotFound()) {
-            _return.responseCode = ResponseCode::RecordNotFound;
+        boost::shared_ptr<ScanCursor> cursor(new ScanCursor(mapName, itr->second));
+        cursor->order = order;
+        cursor->startKey = startKey;
+        cursor->startKeyIncluded = startKeyIncluded;
+        cursor->endKey = endKey;
+        cursor->endKeyIncluded = endKeyIncluded;
+        cursor->options = options;
+
+        // position the iterator on the first record to return.
+        leveldb::Iterator* dbitr = cursor->itr;
+        if (order == ScanOrder::Ascending) {
+            dbitr->Seek(startKey);
+            if (!startKeyIncluded && dbitr->Valid() && dbitr->key() == startKey) {
+                dbitr->Next();
+            }
+        } else if (endKey.empty()) {
+            dbitr->SeekToLast();
+        } else {
+            dbitr->Seek(endKey);
+            if (!dbitr->Valid()) {
+                dbitr->SeekToLast();
+            } else if (dbitr->key().compare(endKey) > 0 || 
+                       (!endKeyIncluded && dbitr->key() == endKey)) {
+                dbitr->Prev();
+            }
+        }
+        _return.cursorId = cursors_.add(cursor);
+        _return.responseCode = _return.cursorId ? ResponseCode::Success : ResponseCode::TooManyCursors;
+    }
+
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::shared_ptr<ScanCursor> cursor = cursors_.get(cursorId);
+        if (!cursor) {
+            _return.responseCode = ResponseCode::CursorNotFound;
             return;
-        } else if (!status.ok()) {
+        }
+        boost::mutex::scoped_lock cursorLock(cursor->mutex);
+        leveldb::Iterator* dbitr = cursor->itr;
+        int numBytes = 0;
+        _return.responseCode = ResponseCode::ScanEnded;
+        while (dbitr->Valid()) {
+            leveldb::Slice key = dbitr->key();
+            if (cursor->order == ScanOrder::Ascending) {
+                if (!cursor->endKey.empty()) {
+                    int cmp = key.compare(cursor->endKey);
+                    if (cmp > 0 || (cmp == 0 && !cursor->endKeyIncluded)) {
+                        break;
+                    }
+                }
+            } else {
+                int cmp = key.compare(cursor->startKey);
+                if (cmp < 0 || (cmp == 0 && !cursor->startKeyIncluded)) {
+                    break;
+                }
+            }
+            leveldb::Slice value = dbitr->value();
+            if (matchesFilter(cursor->options.filter, key.data(), key.size(),
+                              value.data(), value.size())) {
+                Record record;
+                record.key = key.ToString();
+                projectValue(cursor->options, value.data(), value.size(), record.value);
+                numBytes += record.key.size() + record.value.size();
+                _return.records.push_back(record);
+            }
+            if (cursor->order == ScanOrder::Ascending) {
+                dbitr->Next();
+            } else {
+                dbitr->Prev();
+            }
+            if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
+                _return.responseCode = ResponseCode::Success;
+                return;
+            }
+        }
+        if (!dbitr->status().ok()) {
             _return.responseCode = ResponseCode::Error;
+        }
+        cursors_.remove(cursorId);
+    }
+
+    ResponseCode::type closeScan(const int64_t cursorId) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        if (!cursors_.remove(cursorId)) {
+            return ResponseCode::CursorNotFound;
+        }
+        return ResponseCode::Success;
+    }
+
+    void createSnapshot(SnapshotResponse& _return, const std::string& mapName) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
             return;
         }
+        boost::shared_ptr<Snapshot> snapshot(new Snapshot(mapName, itr->second));
+        _return.snapshotId = snapshots_.add(snapshot);
+        _return.responseCode = _return.snapshotId ? ResponseCode::Success : ResponseCode::TooManySnapshots;
+    }
+
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        if (!snapshots_.remove(snapshotId)) {
+            return ResponseCode::SnapshotNotFound;
+        }
+        return ResponseCode::Success;
+    }
+
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& key) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+        if (!snapshot) {
+            _return.responseCode = ResponseCode::SnapshotNotFound;
+            return;
+        }
+        getRecord(_return, snapshot->db, key, snapshot->snapshot);
+    }
+
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, const ScanOrder::type order,
+                        const std::string& startKey, const bool startKeyIncluded, 
+                        const std::string& endKey, const bool endKeyIncluded,
+                        const int32_t maxRecords, const int32_t maxBytes,
+                        const ScanOptions& options) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+        if (!snapshot) {
+            _return.responseCode = ResponseCode::SnapshotNotFound;
+            return;
+        }
+        if (order == ScanOrder::Ascending) {
+            scanAscending(_return, snapshot->db, startKey, startKeyIncluded, endKey, endKeyIncluded, 
+                          maxRecords, maxBytes, options, snapshot->snapshot);
+        } else {
+            scanDescending(_return, snapshot->db, startKey, startKeyIncluded, endKey, endKeyIncluded, 
+                           maxRecords, maxBytes, options, snapshot->snapshot);
+        }
+    }
+
+    void countRange(Int64Response& _return, const std::string& mapName,
+                    const std::string& startKey, const std::string& endKey) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        leveldb::ReadOptions options;
+        options.fill_cache = false;
+        leveldb::Iterator* dbitr = itr->second->NewIterator(options);
+        _return.value = 0;
+        for (dbitr->Seek(startKey); dbitr->Valid(); dbitr->Next()) {
+            if (!endKey.empty() && dbitr->key().compare(endKey) >= 0) {
+                break;
+            }
+            _return.value++;
+        }
+        _return.responseCode = dbitr->status().ok() ? ResponseCode::Success : ResponseCode::Error;
+        delete dbitr;
+    }
+
+    /**
+     * The values are decoded straight from the iterator's slices, and 
+     * Count doesn't look at them.
+     */
+    void aggregate(AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const AggregateOp::type op, const ValueEncoding::type encoding) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        Aggregator aggregator(op, encoding);
+        if (!aggregator.isValid()) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        leveldb::ReadOptions options;
+        options.fill_cache = false;
+        leveldb::Iterator* dbitr = itr->second->NewIterator(options);
+        for (dbitr->Seek(startKey); dbitr->Valid(); dbitr->Next()) {
+            if (!endKey.empty() && dbitr->key().compare(endKey) >= 0) {
+                break;
+            }
+            if (aggregator.needsValues()) {
+                leveldb::Slice value = dbitr->value();
+                aggregator.add(value.data(), value.size());
+            } else {
+                aggregator.add(NULL, 0);
+            }
+        }
+        aggregator.getResult(_return);
+        _return.responseCode = dbitr->status().ok() ? ResponseCode::Success : ResponseCode::Error;
+        delete dbitr;
+    }
+
+    /**
+     * Uses the sstable index, so records still in the memtable aren't
+     * counted.
+     */
+    void approximateSize(Int64Response& _return, const std::string& mapName,
+                         const std::string& startKey, const std::string& endKey) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        std::string limit = endKey;
+        if (limit.empty()) {
+            // the range needs an upper bound. the smallest key after 
+            // the last key of the map will do.
+            leveldb::Iterator* dbitr = itr->second->NewIterator(leveldb::ReadOptions());
+            dbitr->SeekToLast();
+            if (dbitr->Valid()) {
+                limit = dbitr->key().ToString() + '\0';
+            }
+            delete dbitr;
+        }
+        uint64_t size = 0;
+        if (!limit.empty()) {
+            leveldb::Range range(startKey, limit);
+            itr->second->GetApproximateSizes(&range, 1, &size);
+        }
+        _return.value = size;
         _return.responseCode = ResponseCode::Success;
     }
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
+    /**
+     * Bisects the key space with GetApproximateSizes, which only reads
+     * the sstable indexes. Records still in the memtable aren't counted
+     * by it, so a map that hasn't been flushed yet has its keys walked 
+     * instead; that's about as cheap as reading the memtable.
+     */
+    void sampleSplitPoints(KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        if (!validSplitCount(numSplits)) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        leveldb::ReadOptions options;
+        options.fill_cache = false;
+        leveldb::Iterator* dbitr = itr->second->NewIterator(options);
+        dbitr->SeekToFirst();
+        if (!dbitr->Valid()) {
+            _return.responseCode = dbitr->status().ok() ? ResponseCode::Success : ResponseCode::Error;
+            delete dbitr;
+            return;
+        }
+        std::string firstKey = dbitr->key().ToString();
+        dbitr->SeekToLast();
+        std::string lastKey = dbitr->key().ToString();
+        SizeEstimator estimator(itr->second, firstKey, lastKey);
+        if (estimator.totalSize > 0) {
+            bisectSplitPoints(estimator, firstKey, lastKey, numSplits, _return.keys);
+        } else {
+            uint64_t count = 0;
+            for (dbitr->SeekToFirst(); dbitr->Valid(); dbitr->Next()) {
+                count++;
+            }
+            StridePicker picker(count, numSplits);
+            uint64_t i = 0;
+            for (dbitr->SeekToFirst(); dbitr->Valid() && !picker.done(); dbitr->Next()) {
+                if (picker.pick(i++)) {
+                    _return.keys.push_back(dbitr->key().ToString());
+                }
+            }
+        }
+        _return.responseCode = dbitr->status().ok() ? ResponseCode::Success : ResponseCode::Error;
+        delete dbitr;
+    }
+
+    void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        getRecord(_return, itr->second, key);
+    }
+
+    void multiGet(BinaryListResponse& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        // read all the keys from the same snapshot.
+        leveldb::ReadOptions options;
+        options.snapshot = itr->second->GetSnapshot();
+        _return.responses.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            BinaryResponse& response = _return.responses[i];
+            leveldb::Status status = itr->second->Get(options, keys[i], &(response.value));
+            if (status.IsNotFound()) {
+                response.responseCode = ResponseCode::RecordNotFound;
+            } else if (!status.ok()) {
+                response.responseCode = ResponseCode::Error;
+            } else {
+                response.responseCode = ResponseCode::Success;
+            }
+        }
+        itr->second->ReleaseSnapshot(options.snapshot);
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& writeOptions) {
         std::string mapName_ = mapName;
         boost::ptr_map<std::string, leveldb::DB>::iterator itr;
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
@@ -249,24 +650,18 @@ public:
         if (itr == maps_.end()) {
             return ResponseCode::MapNotFound;
         }
-
-        leveldb::WriteOptions options;
-        options.sync = syncmode ? true : false;
-        leveldb::Status status = itr->second->Put(options, key, value);
-
-        if (!status.ok()) {
-            return ResponseCode::Error;
-        }
-        return ResponseCode::Success;
+        return putRecord(itr->second, key, value);
     }
 
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
-        // TODO Get and Put should be within a same transaction
+    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& writeOptions) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
             return ResponseCode::MapNotFound;
         }
+        // Get and Put are done under the key's lock.
+        StripedLock::ScopedLock keyLock(locks_, key);
 	if(!blindinsert) {
 	  std::string recordValue;
 	  leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &recordValue);
@@ -286,13 +681,111 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
-        // TODO Get and Put should be within a same transaction
+    ResponseCode::type insertMany(const std::string& mapName, const std::vector<Record>& records) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
             return ResponseCode::MapNotFound;
         }
+        leveldb::DB* db = itr->second;
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < records.size(); i++) {
+            keys.push_back(records[i].key);
+        }
+        StripedLock::ScopedMultiLock keyLocks(locks_, keys);
+        std::set<std::string> batchKeys;
+        leveldb::WriteBatch batch;
+        std::vector<Record>::const_iterator record;
+        for (record = records.begin(); record != records.end(); record++) {
+            if (!blindinsert) {
+                if (!batchKeys.insert(record->key).second) {
+                    return ResponseCode::RecordExists;
+                }
+                std::string recordValue;
+                leveldb::Status status = db->Get(leveldb::ReadOptions(), record->key, &recordValue);
+                if (status.ok()) {
+                    return ResponseCode::RecordExists;
+                } else if (!status.IsNotFound()) {
+                    return ResponseCode::Error;
+                }
+            }
+            batch.Put(record->key, record->value);
+        }
+        leveldb::WriteOptions options;
+        options.sync = syncmode ? true : false;
+        leveldb::Status status = db->Write(options, &batch);
+        if (!status.ok()) {
+            printf("insertMany not ok! %s\n", status.ToString().c_str());
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    /**
+     * Takes the map out of maps_ while TableIngester rebuilds it, so the
+     * other maps stay available. Requests to this one get MapNotFound 
+     * until it's opened again, and its handles are kept pointing to 
+     * NULL meanwhile.
+     */
+    ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        std::string mapName_ = mapName;
+        std::string dbPath = directoryName_ + "/" + mapName;
+        {
+            boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
+            boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+            if (itr == maps_.end()) {
+                return ResponseCode::MapNotFound;
+            }
+            // no write can be running, so the map stays empty once it's
+            // found empty.
+            leveldb::Iterator* dbitr = itr->second->NewIterator(leveldb::ReadOptions());
+            dbitr->SeekToFirst();
+            bool empty = !dbitr->Valid();
+            delete dbitr;
+            if (!empty) {
+                fprintf(stderr, "ingestFile: map %s isn't empty\n", mapName.c_str());
+                return ResponseCode::Error;
+            }
+            cursors_.removeMap(mapName);
+            snapshots_.removeMap(mapName);
+            handles_.update(mapName, NULL);
+            maps_.erase(itr);
+            ingesting_.insert(mapName);
+        }
+
+        leveldb::Options options;
+        options.write_buffer_size = writeBufferSizeMb_ * 1024 * 1024;
+        options.block_cache = cache_;
+        TableIngester ingester(dbPath, options);
+        uint64_t numRecords;
+        leveldb::Status status = ingester.ingest(path, numRecords);
+        if (!status.ok()) {
+            fprintf(stderr, "ingestFile: %s\n", status.ToString().c_str());
+        }
+
+        boost::unique_lock< boost::shared_mutex> writeLock(mutex_);;
+        ingesting_.erase(mapName);
+        leveldb::DB* db;
+        leveldb::Status openStatus = leveldb::DB::Open(options, dbPath, &db);
+        if (!openStatus.ok()) {
+            fprintf(stderr, "ingestFile: failed to reopen %s: %s\n", mapName.c_str(), 
+                    openStatus.ToString().c_str());
+            handles_.remove(mapName);
+            return ResponseCode::Error;
+        }
+        maps_.insert(mapName_, db);
+        handles_.update(mapName, db);
+        return status.ok() ? ResponseCode::Success : ResponseCode::Error;
+    }
+
+    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& writeOptions) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
         std::string recordValue;
 	if(!blindupdate) {
 	  leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &recordValue);
@@ -311,38 +804,359 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+    ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key, 
+                                     const std::string& expectedValue, const std::string& newValue) {
         boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
         boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
             return ResponseCode::MapNotFound;
         }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        std::string recordValue;
+        leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &recordValue);
+        if (status.IsNotFound()) {
+            return ResponseCode::RecordNotFound;
+        } else if (!status.ok()) {
+            return ResponseCode::Error;
+        }
+        if (recordValue != expectedValue) {
+            return ResponseCode::ValueMismatch;
+        }
         leveldb::WriteOptions options;
-        options.sync = true;
-        leveldb::Status status = itr->second->Delete(options, key);
-        printf("status: %s %s %s\n", mapName.c_str(), key.c_str(), status.ToString().c_str());
+        options.sync = syncmode ? true : false;
+        status = itr->second->Put(options, key, newValue);
+        if (!status.ok()) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    void increment(Int64Response& _return, const std::string& mapName, const std::string& key, const int64_t delta) {
+        std::string operand;
+        std::string result;
+        encodeCounter(delta, operand);
+        _return.responseCode = merge(mapName, key, operand, mergeIncrement, result);
+        if (_return.responseCode == ResponseCode::Success) {
+            decodeCounter(result, _return.value);
+        }
+    }
+
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& value) {
+        std::string result;
+        return merge(mapName, key, value, mergeAppend, result);
+    }
+
+    ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        // Delete succeeds whether or not the record exists, so check
+        // first. Get and Delete are done under the key's lock.
+        StripedLock::ScopedLock keyLock(locks_, key);
+        std::string recordValue;
+        leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &recordValue);
         if (status.IsNotFound()) {
             return ResponseCode::RecordNotFound;
         } else if (!status.ok()) {
             return ResponseCode::Error;
         }
+        leveldb::WriteOptions options;
+        options.sync = syncmode ? true : false;
+        status = itr->second->Delete(options, key);
+        if (!status.ok()) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    /**
+     * Deletes the range in batches, then compacts it so that the 
+     * tombstones don't slow down later reads.
+     */
+    void removeRange(Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        leveldb::DB* db = itr->second;
+        leveldb::ReadOptions readOptions;
+        readOptions.fill_cache = false;
+        leveldb::WriteOptions writeOptions;
+        writeOptions.sync = syncmode ? true : false;
+        // one batch per batchSize keys keeps the memory use and the time
+        // the key locks are held bounded.
+        const size_t batchSize = 10000;
+        leveldb::Iterator* dbitr = db->NewIterator(readOptions);
+        _return.value = 0;
+        _return.responseCode = ResponseCode::Success;
+        dbitr->Seek(startKey);
+        while (dbitr->Valid() && _return.responseCode == ResponseCode::Success) {
+            std::vector<std::string> keys;
+            for (; dbitr->Valid() && keys.size() < batchSize; dbitr->Next()) {
+                if (!endKey.empty() && dbitr->key().compare(endKey) >= 0) {
+                    break;
+                }
+                keys.push_back(dbitr->key().ToString());
+            }
+            if (keys.empty()) {
+                break;
+            }
+            leveldb::WriteBatch batch;
+            for (size_t i = 0; i < keys.size(); i++) {
+                batch.Delete(keys[i]);
+            }
+            StripedLock::ScopedMultiLock keyLocks(locks_, keys);
+            if (!db->Write(writeOptions, &batch).ok()) {
+                _return.responseCode = ResponseCode::Error;
+            } else {
+                _return.value += keys.size();
+            }
+        }
+        if (!dbitr->status().ok()) {
+            _return.responseCode = ResponseCode::Error;
+        }
+        delete dbitr;
+
+        if (_return.value > 0) {
+            leveldb::Slice begin(startKey);
+            leveldb::Slice end(endKey);
+            db->CompactRange(&begin, endKey.empty() ? NULL : &end);
+        }
+    }
+
+    ResponseCode::type writeBatch(const std::string& mapName, const std::vector<Mutation>& mutations) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        leveldb::DB* db = itr->second;
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < mutations.size(); i++) {
+            keys.push_back(mutations[i].key);
+        }
+        StripedLock::ScopedMultiLock keyLocks(locks_, keys);
+
+        // records touched by earlier mutations in this batch aren't in the
+        // db yet, so remember whether they exist after each mutation.
+        std::map<std::string, bool> pending;
+        leveldb::WriteBatch batch;
+        std::vector<Mutation>::const_iterator mutation;
+        for (mutation = mutations.begin(); mutation != mutations.end(); mutation++) {
+            bool checkExists = 
+                (mutation->type == MutationType::Insert && !blindinsert) ||
+                (mutation->type == MutationType::Update && !blindupdate) ||
+                mutation->type == MutationType::Remove;
+            if (checkExists) {
+                bool exists;
+                std::map<std::string, bool>::iterator entry = pending.find(mutation->key);
+                if (entry != pending.end()) {
+                    exists = entry->second;
+                } else {
+                    std::string recordValue;
+                    leveldb::Status status = db->Get(leveldb::ReadOptions(), mutation->key, &recordValue);
+                    if (!status.ok() && !status.IsNotFound()) {
+                        return ResponseCode::Error;
+                    }
+                    exists = status.ok();
+                }
+                if (mutation->type == MutationType::Insert && exists) {
+                    return ResponseCode::RecordExists;
+                } else if (mutation->type != MutationType::Insert && !exists) {
+                    return ResponseCode::RecordNotFound;
+                }
+            }
+            if (mutation->type == MutationType::Remove) {
+                batch.Delete(mutation->key);
+                pending[mutation->key] = false;
+            } else {
+                batch.Put(mutation->key, mutation->value);
+                pending[mutation->key] = true;
+            }
+        }
+        leveldb::WriteOptions options;
+        options.sync = syncmode ? true : false;
+        leveldb::Status status = db->Write(options, &batch);
+        if (!status.ok()) {
+            return ResponseCode::Error;
+        }
         return ResponseCode::Success;
     }
 
+    void tailChanges(ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        // changes are logged by ChangeLogHandler, which main() puts in
+        // front of this handler.
+        _return.responseCode = ResponseCode::Error;
+    }
+
 private:
+    void getRecord(BinaryResponse& _return, leveldb::DB* db, const std::string& key,
+                   const leveldb::Snapshot* snapshot = NULL) {
+        leveldb::ReadOptions readOptions;
+        readOptions.snapshot = snapshot;
+        leveldb::Status status = db->Get(readOptions, key, &(_return.value));
+        if (status.IsNotFound()) {
+            _return.responseCode = ResponseCode::RecordNotFound;
+            return;
+        } else if (!status.ok()) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type putRecord(leveldb::DB* db, const std::string& key, const std::string& value) {
+        StripedLock::ScopedLock keyLock(locks_, key);
+        leveldb::WriteOptions options;
+        options.sync = syncmode ? true : false;
+        leveldb::Status status = db->Put(options, key, value);
+        if (!status.ok()) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    /**
+     * Replaces the value of a record with mergeFunction(value, operand).
+     * Get and Put are done under the key's lock.
+     */
+    ResponseCode::type merge(const std::string& mapName, const std::string& key, 
+                             const std::string& operand, MergeFunction mergeFunction,
+                             std::string& result) {
+        boost::shared_lock< boost::shared_mutex> readLock(mutex_);;
+        boost::ptr_map<std::string, leveldb::DB>::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        StripedLock::ScopedLock keyLock(locks_, key);
+        std::string recordValue;
+        leveldb::Status status = itr->second->Get(leveldb::ReadOptions(), key, &recordValue);
+        if (!status.ok() && !status.IsNotFound()) {
+            return ResponseCode::Error;
+        }
+        if (!mergeFunction(status.ok() ? &recordValue : NULL, operand, result)) {
+            return ResponseCode::Error;
+        }
+        leveldb::WriteOptions options;
+        options.sync = syncmode ? true : false;
+        status = itr->second->Put(options, key, result);
+        if (!status.ok()) {
+            return ResponseCode::Error;
+        }
+        return ResponseCode::Success;
+    }
+
+    /**
+     * State of a scan opened with openScan. The iterator reads from 
+     * a snapshot taken when the scan was opened.
+     */
+    struct ScanCursor {
+        ScanCursor(const std::string& mapName_, leveldb::DB* db_) :
+            mapName(mapName_),
+            db(db_),
+            snapshot(db_->GetSnapshot()) {
+            leveldb::ReadOptions options;
+            options.snapshot = snapshot;
+            options.fill_cache = false;
+            itr = db->NewIterator(options);
+        }
+
+        ~ScanCursor() {
+            delete itr;
+            db->ReleaseSnapshot(snapshot);
+        }
+
+        std::string mapName;
+        leveldb::DB* db;
+        const leveldb::Snapshot* snapshot;
+        leveldb::Iterator* itr;
+        ScanOrder::type order;
+        std::string startKey;
+        bool startKeyIncluded;
+        std::string endKey;
+        bool endKeyIncluded;
+        ScanOptions options;
+        boost::mutex mutex; // serialize nextScan calls on this cursor
+    };
+
+    /**
+     * Estimates the fraction of a map before a key from the sstable 
+     * sizes of [firstKey, key) and [firstKey, lastKey].
+     */
+    struct SizeEstimator: public KeyRankEstimator {
+        SizeEstimator(leveldb::DB* db_, const std::string& firstKey_,
+                      const std::string& lastKey) :
+            db(db_),
+            firstKey(firstKey_),
+            totalSize(0) {
+            std::string limit = lastKey + '\0';
+            leveldb::Range range(firstKey, limit);
+            db->GetApproximateSizes(&range, 1, &totalSize);
+        }
+
+        bool fractionBelow(const std::string& key, double& fraction) {
+            uint64_t size = 0;
+            if (key > firstKey) {
+                leveldb::Range range(firstKey, key);
+                db->GetApproximateSizes(&range, 1, &size);
+            }
+            fraction = (double)size / totalSize;
+            return true;
+        }
+
+        leveldb::DB* db;
+        std::string firstKey;
+        uint64_t totalSize;
+    };
+
+    /**
+     * A snapshot handed out by createSnapshot. leveldb snapshots can be
+     * read from by several threads at once.
+     */
+    struct Snapshot {
+        Snapshot(const std::string& mapName_, leveldb::DB* db_) :
+            mapName(mapName_),
+            db(db_),
+            snapshot(db_->GetSnapshot()) {
+        }
+
+        ~Snapshot() {
+            db->ReleaseSnapshot(snapshot);
+        }
+
+        std::string mapName;
+        leveldb::DB* db;
+        const leveldb::Snapshot* snapshot;
+    };
+
     std::string directoryName_; // directory to store db files.
     uint32_t writeBufferSizeMb_; 
     uint32_t blockCacheSizeMb_; 
     leveldb::Cache* cache_;
     boost::ptr_map<std::string, leveldb::DB> maps_;
     boost::shared_mutex mutex_; // protect map_
+    CursorTable<ScanCursor> cursors_;
+    CursorTable<Snapshot> snapshots_;
+    StripedLock locks_; // serialize writes to the same key
+    MapHandleTable<leveldb::DB*> handles_;
+    std::set<std::string> ingesting_; // maps closed by ingestFile, protected by mutex_
 };
 
 int main(int argc, char **argv) {
     int port;
+    int streamPort;
+    int maxStreams;
     int writeBufferSizeMb;
     int blockCacheSizeMb;
+    int changeLogSize;
     std::string dir;
+    ServerRunner runner("threaded", true);
     po::variables_map vm;
     po::options_description config("");
     config.add_options()
@@ -351,10 +1165,14 @@ int main(int argc, char **argv) {
         ("blindinsert,i", "skip record existence check for inserts")
         ("blindupdate,u",  "skip record existence check for updates")
         ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
+        ("stream-port", po::value<int>(&streamPort)->default_value(0), "port for streaming scans (0 to disable)")
+        ("max-streams", po::value<int>(&maxStreams)->default_value(64), "scans streamed at once before the rest get Busy")
         ("datadir,d", po::value<std::string>(&dir)->default_value("data"), "data directory")
         ("write-buffer-mb,w", po::value<int>(&writeBufferSizeMb)->default_value(1024), "LevelDB write buffer size in MB")
         ("block-cache-mb,b", po::value<int>(&blockCacheSizeMb)->default_value(1024), "LevelDB block cache size in MB")
+        ("change-log-size", po::value<int>(&changeLogSize)->default_value(10000), "number of changes per map to keep for tailChanges (0 to disable)")
         ;
+    runner.addOptions(config);
     po::options_description cmdline_options;
     cmdline_options.add(config);
     store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
@@ -364,14 +1182,25 @@ int main(int argc, char **argv) {
         exit(0);
     }
     syncmode = vm.count("sync");
+    if (syncmode && runner.eventLoops()) {
+        // every synced write would hold up the connections on its loop.
+        fprintf(stderr, "--sync can't be used with the %s server, which runs "
+                "requests on its event loops\n", runner.serverType().c_str());
+        exit(1);
+    }
     blindinsert = vm.count("blindinsert");
     blindupdate = vm.count("blindupdate");
-    shared_ptr<LevelDbServer> handler(new LevelDbServer(dir, writeBufferSizeMb, blockCacheSizeMb));
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server (processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    shared_ptr<MapKeeperIf> handler(new LevelDbServer(dir, writeBufferSizeMb, blockCacheSizeMb));
+    handler = runner.groupCommit(handler);
+    handler = runner.cache(handler);
+    if (changeLogSize > 0) {
+        handler.reset(new ChangeLogHandler(handler, changeLogSize));
+    }
+    handler.reset(new TtlHandler(handler));
+    ScanStreamServer streamServer(runner.admit(handler), streamPort, maxStreams);
+    if (streamPort) {
+        streamServer.start();
+    }
+    runner.serve(handler, port);
     return 0;
 }
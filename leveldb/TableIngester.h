@@ -0,0 +1,260 @@
+/*
+ * Copyright 2012 Yahoo! Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef TABLE_INGESTER_H
+#define TABLE_INGESTER_H
+
+/**
+ * Loads a file of sorted records into an empty LevelDB database
+ * without going through the log, the memtable or compactions.
+ *
+ * LevelDB has no API to add table files to a database, but RepairDB
+ * rebuilds the manifest from the tables it finds in the directory. So
+ * the records are written straight into table files, in the internal
+ * key format LevelDB uses (the key followed by its sequence number and
+ * type), and RepairDB adds them to level 0. The tables don't overlap,
+ * so compactions move them down to the other levels without rewriting
+ * them.
+ *
+ * The input file is a sequence of records, each a key and a value
+ * preceded by their lengths as 4 byte big-endian integers:
+ *
+ *   <key length><key><value length><value>
+ *
+ * The keys must be in strictly ascending bytewise order.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+#include <leveldb/comparator.h>
+#include <leveldb/db.h>
+#include <leveldb/env.h>
+#include <leveldb/table_builder.h>
+
+class TableIngester {
+public:
+    /**
+     * @param dbPath directory of the database.
+     * @param options options the database is opened with.
+     * @param tableSizeBytes size at which a table file is finished and
+     *                       the next one started.
+     */
+    TableIngester(const std::string& dbPath, const leveldb::Options& options,
+                  uint64_t tableSizeBytes = 32 * 1024 * 1024) :
+        dbPath_(dbPath),
+        options_(options),
+        tableSizeBytes_(tableSizeBytes) {
+    }
+
+    /**
+     * Loads the records of a file into the database, which must not
+     * have any records. The database must not be open while this runs.
+     * On errors the database is left empty.
+     *
+     * @param numRecords number of records loaded.
+     */
+    leveldb::Status ingest(const std::string& inputPath, uint64_t& numRecords) {
+        numRecords = 0;
+        leveldb::Status status = checkEmpty();
+        if (!status.ok()) {
+            return status;
+        }
+        FILE* input = fopen(inputPath.c_str(), "rb");
+        if (input == NULL) {
+            return leveldb::Status::IOError(inputPath, strerror(errno));
+        }
+        // the database has no records, but it may still have deletions
+        // that would hide the new ones. start from an empty directory.
+        status = leveldb::DestroyDB(dbPath_, options_);
+        if (status.ok()) {
+            status = options_.env->CreateDir(dbPath_);
+        }
+        if (status.ok()) {
+            status = writeTables(input, numRecords);
+        }
+        fclose(input);
+        if (status.ok()) {
+            status = leveldb::RepairDB(dbPath_, options_);
+        }
+        if (!status.ok()) {
+            numRecords = 0;
+            reset();
+        }
+        return status;
+    }
+
+private:
+    /**
+     * Orders internal keys by key. Every record gets the same sequence
+     * number, so that's enough. Index keys aren't shortened.
+     */
+    class InternalKeyComparator: public leveldb::Comparator {
+    public:
+        int Compare(const leveldb::Slice& a, const leveldb::Slice& b) const {
+            return leveldb::Slice(a.data(), a.size() - 8).compare(
+                   leveldb::Slice(b.data(), b.size() - 8));
+        }
+
+        const char* Name() const {
+            return "leveldb.InternalKeyComparator";
+        }
+
+        void FindShortestSeparator(std::string* start, const leveldb::Slice& limit) const {
+        }
+
+        void FindShortSuccessor(std::string* key) const {
+        }
+    };
+
+    leveldb::Status checkEmpty() {
+        leveldb::Options options = options_;
+        options.create_if_missing = true;
+        options.error_if_exists = false;
+        leveldb::DB* db;
+        leveldb::Status status = leveldb::DB::Open(options, dbPath_, &db);
+        if (!status.ok()) {
+            return status;
+        }
+        leveldb::Iterator* itr = db->NewIterator(leveldb::ReadOptions());
+        itr->SeekToFirst();
+        if (itr->Valid()) {
+            status = leveldb::Status::InvalidArgument(dbPath_, "database isn't empty");
+        } else {
+            status = itr->status();
+        }
+        delete itr;
+        delete db;
+        return status;
+    }
+
+    /**
+     * Leaves an empty database behind after a failed ingest.
+     */
+    void reset() {
+        leveldb::DestroyDB(dbPath_, options_);
+        leveldb::Options options = options_;
+        options.create_if_missing = true;
+        leveldb::DB* db;
+        if (leveldb::DB::Open(options, dbPath_, &db).ok()) {
+            delete db;
+        }
+    }
+
+    leveldb::Status writeTables(FILE* input, uint64_t& numRecords) {
+        leveldb::Options tableOptions = options_;
+        tableOptions.comparator = &comparator_;
+        tableOptions.filter_policy = NULL;
+        // sequence number 1, type kTypeValue, as a little-endian fixed64.
+        const std::string trailer("\x01\x01\0\0\0\0\0\0", 8);
+        leveldb::WritableFile* file = NULL;
+        leveldb::TableBuilder* builder = NULL;
+        uint64_t fileNumber = 0;
+        std::string key;
+        std::string value;
+        std::string previousKey;
+        leveldb::Status status;
+        while (status.ok()) {
+            bool found = false;
+            status = readRecord(input, key, value, found);
+            if (!status.ok() || !found) {
+                break;
+            }
+            if (numRecords > 0 && key <= previousKey) {
+                status = leveldb::Status::InvalidArgument("input isn't sorted at key", key);
+                break;
+            }
+            if (builder == NULL) {
+                status = options_.env->NewWritableFile(tableName(++fileNumber), &file);
+                if (!status.ok()) {
+                    break;
+                }
+                builder = new leveldb::TableBuilder(tableOptions, file);
+            }
+            builder->Add(key + trailer, value);
+            previousKey.swap(key);
+            numRecords++;
+            if (builder->FileSize() >= tableSizeBytes_) {
+                status = finishTable(builder, file);
+            }
+        }
+        if (builder != NULL) {
+            if (status.ok()) {
+                status = finishTable(builder, file);
+            } else {
+                builder->Abandon();
+                delete builder;
+                delete file;
+            }
+        }
+        return status;
+    }
+
+    leveldb::Status finishTable(leveldb::TableBuilder*& builder, leveldb::WritableFile*& file) {
+        leveldb::Status status = builder->Finish();
+        if (status.ok()) {
+            status = file->Sync();
+        }
+        if (status.ok()) {
+            status = file->Close();
+        }
+        delete builder;
+        delete file;
+        builder = NULL;
+        file = NULL;
+        return status;
+    }
+
+    /**
+     * @param found set to false at the end of the file.
+     */
+    leveldb::Status readRecord(FILE* input, std::string& key, std::string& value, bool& found) {
+        uint32_t length;
+        size_t size = fread(&length, 1, sizeof(length), input);
+        if (size == 0 && feof(input)) {
+            found = false;
+            return leveldb::Status::OK();
+        }
+        if (size != sizeof(length) || !readBytes(input, ntohl(length), key) ||
+            fread(&length, 1, sizeof(length), input) != sizeof(length) ||
+            !readBytes(input, ntohl(length), value)) {
+            return leveldb::Status::Corruption("truncated record in input");
+        }
+        found = true;
+        return leveldb::Status::OK();
+    }
+
+    bool readBytes(FILE* input, uint32_t length, std::string& data) {
+        data.resize(length);
+        return length == 0 || fread(&data[0], 1, length, input) == length;
+    }
+
+    /**
+     * RepairDB recognizes table files by their name.
+     */
+    std::string tableName(uint64_t fileNumber) {
+        char name[32];
+        snprintf(name, sizeof(name), "/%06llu.sst", (unsigned long long)fileNumber);
+        return dbPath_ + name;
+    }
+
+    std::string dbPath_;
+    leveldb::Options options_;
+    uint64_t tableSizeBytes_;
+    InternalKeyComparator comparator_;
+};
+
+#endif // TABLE_INGESTER_H
@@ -14,16 +14,25 @@
  * limitations under the License.
  */
 #include "MapKeeper.h"
+#include "Aggregator.h"
+#include "ChangeLogHandler.h"
+#include "TtlHandler.h"
+#include "CursorTable.h"
+#include "MapHandleTable.h"
+#include "ValueProjection.h"
+#include "MergeOperator.h"
+#include "ScanFilter.h"
+#include "ServerRunner.h"
+#include "SplitPoints.h"
 
 #include <iostream>
+#include <cstring>
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadPoolServer.h>
-#include <server/TThreadedServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
-#include <thrift/concurrency/ThreadManager.h>
-#include <thrift/concurrency/PosixThreadFactory.h>
 #include <boost/program_options.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <lmdb.h>
 
 using namespace ::apache::thrift;
@@ -40,10 +49,17 @@ using namespace mapkeeper;
 int syncmode;
 int blindupdate;
 
+// Each call, open scan cursor and snapshot holds a read transaction, and
+// thus a reader slot.
+const uint32_t MAX_SCAN_CURSORS = 64;
+const uint32_t MAX_SNAPSHOTS = 64;
+
 class LmdbServer: virtual public MapKeeperIf {
 public:
     LmdbServer(const std::string& directoryName,
-    size_t maxSize, size_t numThreads, int maxMaps) {
+    size_t maxSize, size_t maxCalls, int maxMaps) :
+        cursors_(MAX_SCAN_CURSORS),
+        snapshots_(MAX_SNAPSHOTS) {
     int rc;
     MDB_txn *txn;
     MDB_cursor *mc;
@@ -52,16 +68,22 @@ public:
 
     rc = mdb_env_create(&env);
     rc = mdb_env_set_mapsize(env, maxSize);
-    numThreads += 4;
-    if (numThreads > 126)
-        rc = mdb_env_set_maxreaders(env, numThreads);
+    // a few more for the TTL sweeper and the like, which call the
+    // handler outside of requests.
+    size_t maxReaders = maxCalls + 4 + MAX_SCAN_CURSORS + MAX_SNAPSHOTS;
+    if (maxReaders > 126)
+        rc = mdb_env_set_maxreaders(env, maxReaders);
     rc = mdb_env_set_maxdbs(env, maxMaps);
-    rc = mdb_env_open(env, directoryName.c_str(), MDB_WRITEMAP|MDB_MAPASYNC | (syncmode ? MDB_NOMETASYNC:MDB_NOSYNC), 0664);
+    rc = mdb_env_open(env, directoryName.c_str(), MDB_WRITEMAP|MDB_MAPASYNC|MDB_NOTLS | (syncmode ? MDB_NOMETASYNC:MDB_NOSYNC), 0664);
     if (rc) {
         fprintf(stderr, "env_open returned %s\n", mdb_strerror(rc));
         return;
     }
     rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        fprintf(stderr, "txn_begin returned %s\n", mdb_strerror(rc));
+        return;
+    }
     rc = mdb_open(txn, NULL, 0, &dbi);
     /* Open all maps */
     rc = mdb_cursor_open(txn, dbi, &mc);
@@ -79,82 +101,1039 @@ public:
     ~LmdbServer() {
     mdb_env_close(env);
     }
-
-    ResponseCode::type ping() {
-        return ResponseCode::Success;
+
+    ResponseCode::type ping() {
+        return ResponseCode::Success;
+    }
+
+    // answered by StatsHandler, which ServerRunner puts in front.
+    void getStats(StatsResponse& _return, const bool reset) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    ResponseCode::type addMap(const std::string& mapName) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc, exist = 0;
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc)
+        rc = mdb_open(txn, mapName.c_str(), MDB_CREATE, &dbi);
+    else
+        exist = 1;
+    rc = mdb_txn_commit(txn);
+        return exist ? ResponseCode::MapExists : ResponseCode::Success;
+    }
+
+    ResponseCode::type dropMap(const std::string& mapName) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc, found = 0;
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (!rc) {
+        rc = mdb_drop(txn, dbi, 0);
+        found = 1;
+    }
+    cursors_.removeMap(mapName);
+    snapshots_.removeMap(mapName);
+    {
+        boost::mutex::scoped_lock handlesLock(handlesMutex_);
+        handles_.remove(mapName);
+    }
+    rc = mdb_txn_commit(txn);
+        return found ? ResponseCode::Success : ResponseCode::MapNotFound;
+    }
+
+    void listMaps(StringListResponse& _return) {
+    MDB_txn *txn;
+    MDB_cursor *mc;
+    MDB_dbi dbi;
+    MDB_val key;
+    std::string str;
+    int rc;
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, NULL, 0, &dbi);
+    rc = mdb_cursor_open(txn, dbi, &mc);
+    while ((rc = mdb_cursor_get(mc, &key, NULL, MDB_NEXT)) == 0) {
+        str.assign((char *)key.mv_data, key.mv_size);
+        _return.values.push_back(str);
+    }
+    mdb_cursor_close(mc);
+    mdb_txn_abort(txn);
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void openMap(MapHandleResponse& _return, const std::string& mapName) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc;
+
+    /* The dbi stays valid after the txn that opened it commits. */
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        mdb_txn_abort(txn);
+        if (rc == MDB_NOTFOUND)
+            _return.responseCode = ResponseCode::MapNotFound;
+        else
+            _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_txn_commit(txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    boost::mutex::scoped_lock handlesLock(handlesMutex_);
+    _return.handle = handles_.add(mapName, dbi);
+        _return.responseCode = _return.handle >= 0 ? ResponseCode::Success : ResponseCode::TooManyHandles;
+    }
+
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& key) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+
+    if (!resolveHandle(mapHandle, &dbi)) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_get(txn, dbi, &k, &data);
+    if (!rc) {
+        _return.value.assign((char *)data.mv_data, data.mv_size);
+        _return.responseCode = ResponseCode::Success;
+    } else if (rc == MDB_NOTFOUND) {
+        _return.responseCode = ResponseCode::RecordNotFound;
+    } else {
+        _return.responseCode = ResponseCode::Error;
+    }
+    mdb_txn_abort(txn);
+    }
+
+    ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key, const std::string& value) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+
+    if (!resolveHandle(mapHandle, &dbi))
+        return ResponseCode::MapNotFound;
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    data.mv_data = (void *)value.data();
+    data.mv_size = value.size();
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_put(txn, dbi, &k, &data, 0);
+    if (rc) {
+        mdb_txn_abort(txn);
+        return ResponseCode::Error;
+    }
+    rc = mdb_txn_commit(txn);
+        return rc ? ResponseCode::Error : ResponseCode::Success;
+    }
+
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle,
+              const ScanOrder::type order, const std::string& startKey,
+              const bool startKeyIncluded, const std::string& endKey,
+              const bool endKeyIncluded, const int32_t maxRecords,
+              const int32_t maxBytes, const ScanOptions& options) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc;
+
+    if (!resolveHandle(mapHandle, &dbi)) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    scanRecords(_return, txn, dbi, order, startKey, startKeyIncluded,
+        endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    mdb_txn_abort(txn);
+    }
+
+    void scan(RecordListResponse& _return, const std::string& mapName,
+              const ScanOrder::type order, const std::string& startKey,
+              const bool startKeyIncluded, const std::string& endKey,
+              const bool endKeyIncluded, const int32_t maxRecords,
+              const int32_t maxBytes, const ScanOptions& options) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc;
+
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        mdb_txn_abort(txn);
+        if (rc == MDB_NOTFOUND)
+            _return.responseCode = ResponseCode::MapNotFound;
+        else
+            _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    scanRecords(_return, txn, dbi, order, startKey, startKeyIncluded,
+        endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    mdb_txn_abort(txn);
+    }
+
+    void openScan(ScanCursorResponse& _return, const std::string& mapName,
+              const ScanOrder::type order, const std::string& startKey,
+              const bool startKeyIncluded, const std::string& endKey,
+              const bool endKeyIncluded, const ScanOptions& options) {
+    boost::shared_ptr<ScanCursor> cursor(new ScanCursor());
+    MDB_val key, data, k2;
+    int rc, cmp;
+
+    cursor->mapName = mapName;
+    cursor->order = order;
+    cursor->startKey = startKey;
+    cursor->startKeyIncluded = startKeyIncluded;
+    cursor->endKey = endKey;
+    cursor->endKeyIncluded = endKeyIncluded;
+    cursor->options = options;
+    /* The read txn outlives this call and may be used by other threads,
+     * which is why the env is opened with MDB_NOTLS.
+     */
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &cursor->txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(cursor->txn, mapName.c_str(), 0, &cursor->dbi);
+    if (rc) {
+        if (rc == MDB_NOTFOUND)
+            _return.responseCode = ResponseCode::MapNotFound;
+        else
+            _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_cursor_open(cursor->txn, cursor->dbi, &cursor->mc);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    /* Position the cursor, and pick the op that returns the first record. */
+    if (order == ScanOrder::Ascending) {
+        cursor->op = MDB_FIRST;
+        if (!startKey.empty()) {
+            key.mv_data = (void *)startKey.data();
+            key.mv_size = startKey.size();
+            k2 = key;
+            rc = mdb_cursor_get(cursor->mc, &key, &data, MDB_SET_RANGE);
+            if (rc == MDB_NOTFOUND) {
+                cursor->ended = true;
+            } else if (!rc) {
+                cmp = mdb_cmp(cursor->txn, cursor->dbi, &key, &k2);
+                cursor->op = (cmp || startKeyIncluded) ? MDB_GET_CURRENT : MDB_NEXT;
+            }
+        }
+    } else {
+        cursor->op = MDB_LAST;
+        if (!endKey.empty()) {
+            key.mv_data = (void *)endKey.data();
+            key.mv_size = endKey.size();
+            k2 = key;
+            rc = mdb_cursor_get(cursor->mc, &key, &data, MDB_SET_RANGE);
+            if (!rc) {
+                cmp = mdb_cmp(cursor->txn, cursor->dbi, &key, &k2);
+                cursor->op = (cmp > 0 || !endKeyIncluded) ? MDB_PREV : MDB_GET_CURRENT;
+            } else if (rc == MDB_NOTFOUND) {
+                rc = 0;
+            }
+        }
+    }
+    if (rc && rc != MDB_NOTFOUND) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.cursorId = cursors_.add(cursor);
+        _return.responseCode = _return.cursorId ? ResponseCode::Success : ResponseCode::TooManyCursors;
+    }
+
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
+              const int32_t maxRecords, const int32_t maxBytes) {
+    boost::shared_ptr<ScanCursor> cursor = cursors_.get(cursorId);
+    MDB_val key, data, k2, *datap;
+    Record rec;
+    int rc = MDB_NOTFOUND, cmp;
+    int32_t resultSize = 0;
+
+    if (!cursor) {
+        _return.responseCode = ResponseCode::CursorNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock cursorLock(cursor->mutex);
+    if (cursor->order == ScanOrder::Ascending) {
+        k2.mv_data = (void *)cursor->endKey.data();
+        k2.mv_size = cursor->endKey.size();
+    } else {
+        k2.mv_data = (void *)cursor->startKey.data();
+        k2.mv_size = cursor->startKey.size();
+    }
+    datap = cursor->options.keysOnly && !hasValueFilter(cursor->options.filter) ? NULL : &data;
+    while (!cursor->ended &&
+        (rc = mdb_cursor_get(cursor->mc, &key, datap, cursor->op)) == 0) {
+        cursor->op = (cursor->order == ScanOrder::Ascending) ? MDB_NEXT : MDB_PREV;
+        if (k2.mv_size) {
+            cmp = mdb_cmp(cursor->txn, cursor->dbi, &key, &k2);
+            if (cursor->order == ScanOrder::Ascending) {
+                if (cmp > 0 || (!cmp && !cursor->endKeyIncluded))
+                    break;
+            } else {
+                if (cmp < 0 || (!cmp && !cursor->startKeyIncluded))
+                    break;
+            }
+        }
+        if (!matchesKey(cursor->options.filter, (char *)key.mv_data, key.mv_size) ||
+            (datap && !matchesValue(cursor->options.filter, (char *)data.mv_data, data.mv_size)))
+            continue;
+        rec.key.assign((char *)key.mv_data, key.mv_size);
+        projectValue(cursor->options, (char *)data.mv_data, data.mv_size, rec.value);
+        _return.records.push_back(rec);
+        resultSize += key.mv_size + rec.value.size();
+        if ((int32_t)_return.records.size() >= maxRecords || resultSize >= maxBytes) {
+            _return.responseCode = ResponseCode::Success;
+            return;
+        }
+    }
+    if (rc && rc != MDB_NOTFOUND)
+        _return.responseCode = ResponseCode::Error;
+    else
+        _return.responseCode = ResponseCode::ScanEnded;
+    cursor->ended = true;
+        cursors_.remove(cursorId);
+    }
+
+    ResponseCode::type closeScan(const int64_t cursorId) {
+        return cursors_.remove(cursorId) ? ResponseCode::Success : ResponseCode::CursorNotFound;
+    }
+
+    void createSnapshot(SnapshotResponse& _return, const std::string& mapName) {
+    boost::shared_ptr<Snapshot> snapshot(new Snapshot());
+    int rc;
+
+    snapshot->mapName = mapName;
+    /* Like a scan cursor, the read txn outlives this call. */
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &snapshot->txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(snapshot->txn, mapName.c_str(), 0, &snapshot->dbi);
+    if (rc) {
+        if (rc == MDB_NOTFOUND)
+            _return.responseCode = ResponseCode::MapNotFound;
+        else
+            _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.snapshotId = snapshots_.add(snapshot);
+        _return.responseCode = _return.snapshotId ? ResponseCode::Success : ResponseCode::TooManySnapshots;
+    }
+
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        return snapshots_.remove(snapshotId) ? ResponseCode::Success : ResponseCode::SnapshotNotFound;
+    }
+
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& key) {
+    boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+    MDB_val k, data;
+    int rc;
+
+    if (!snapshot) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock snapshotLock(snapshot->mutex);
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    rc = mdb_get(snapshot->txn, snapshot->dbi, &k, &data);
+    if (!rc) {
+        _return.value.assign((char *)data.mv_data, data.mv_size);
+        _return.responseCode = ResponseCode::Success;
+    } else if (rc == MDB_NOTFOUND) {
+        _return.responseCode = ResponseCode::RecordNotFound;
+    } else {
+        _return.responseCode = ResponseCode::Error;
+    }
+    }
+
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId,
+              const ScanOrder::type order, const std::string& startKey,
+              const bool startKeyIncluded, const std::string& endKey,
+              const bool endKeyIncluded, const int32_t maxRecords,
+              const int32_t maxBytes, const ScanOptions& options) {
+    boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+    if (!snapshot) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock snapshotLock(snapshot->mutex);
+    scanRecords(_return, snapshot->txn, snapshot->dbi, order, startKey, startKeyIncluded,
+        endKey, endKeyIncluded, maxRecords, maxBytes, options);
+    }
+
+    void countRange(Int64Response& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    int rc;
+
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (!rc)
+        rc = countKeys(txn, dbi, startKey, endKey, &_return.value);
+    mdb_txn_abort(txn);
+    if (rc == MDB_NOTFOUND)
+        _return.responseCode = ResponseCode::MapNotFound;
+    else if (rc)
+        _return.responseCode = ResponseCode::Error;
+    else
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    /* The values are decoded in place in the map, and Count doesn't
+     * read them at all.
+     */
+    void aggregate(AggregateResponse& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey,
+              const AggregateOp::type op, const ValueEncoding::type encoding) {
+    Aggregator aggregator(op, encoding);
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    MDB_cursor *mc;
+    MDB_val key, data, k2;
+    MDB_cursor_op cop = MDB_FIRST;
+    int rc;
+
+    if (!aggregator.isValid()) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (!rc)
+        rc = mdb_cursor_open(txn, dbi, &mc);
+    if (!rc) {
+        if (!startKey.empty()) {
+            key.mv_data = (void *)startKey.data();
+            key.mv_size = startKey.size();
+            cop = MDB_SET_RANGE;
+        }
+        k2.mv_data = (void *)endKey.data();
+        k2.mv_size = endKey.size();
+        while ((rc = mdb_cursor_get(mc, &key,
+                aggregator.needsValues() ? &data : NULL, cop)) == 0) {
+            cop = MDB_NEXT;
+            if (k2.mv_size && mdb_cmp(txn, dbi, &key, &k2) >= 0)
+                break;
+            if (aggregator.needsValues())
+                aggregator.add((char *)data.mv_data, data.mv_size);
+            else
+                aggregator.add(NULL, 0);
+        }
+        mdb_cursor_close(mc);
+        if (rc == MDB_NOTFOUND)
+            rc = 0;
+    }
+    mdb_txn_abort(txn);
+    if (rc == MDB_NOTFOUND) {
+        _return.responseCode = ResponseCode::MapNotFound;
+    } else if (rc) {
+        _return.responseCode = ResponseCode::Error;
+    } else {
+        aggregator.getResult(_return);
+        _return.responseCode = ResponseCode::Success;
+    }
+    }
+
+    /* LMDB keeps no per-range statistics. The page count of the whole
+     * map is spread evenly over its records, which only requires
+     * counting the keys in the range.
+     */
+    void approximateSize(Int64Response& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    MDB_stat st;
+    int64_t count = 0, total;
+    int rc;
+
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (!rc)
+        rc = mdb_stat(txn, dbi, &st);
+    if (!rc) {
+        total = (int64_t)st.ms_psize *
+            (st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages);
+        if (startKey.empty() && endKey.empty()) {
+            _return.value = total;
+        } else {
+            rc = countKeys(txn, dbi, startKey, endKey, &count);
+            _return.value = st.ms_entries ? total * count / st.ms_entries : 0;
+        }
+    }
+    mdb_txn_abort(txn);
+    if (rc == MDB_NOTFOUND)
+        _return.responseCode = ResponseCode::MapNotFound;
+    else if (rc)
+        _return.responseCode = ResponseCode::Error;
+    else
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    /* The branch pages aren't reachable through the LMDB API, but the
+     * entry count is, so every n-th key is an exact split point. The
+     * keys are walked in a read-only txn without reading the data, and
+     * the walk stops at the last split point.
+     */
+    void sampleSplitPoints(KeyListResponse& _return, const std::string& mapName,
+              const int32_t numSplits) {
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    MDB_stat st;
+    MDB_cursor *mc;
+    MDB_val key;
+    MDB_cursor_op op = MDB_FIRST;
+    uint64_t i = 0;
+    int rc;
+
+    if (!validSplitCount(numSplits)) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (!rc)
+        rc = mdb_stat(txn, dbi, &st);
+    if (!rc)
+        rc = mdb_cursor_open(txn, dbi, &mc);
+    if (!rc) {
+        StridePicker picker(st.ms_entries, numSplits);
+        while (!picker.done() && (rc = mdb_cursor_get(mc, &key, NULL, op)) == 0) {
+            op = MDB_NEXT;
+            if (picker.pick(i++))
+                _return.keys.push_back(std::string((char *)key.mv_data, key.mv_size));
+        }
+        mdb_cursor_close(mc);
+        if (rc == MDB_NOTFOUND)
+            rc = 0;
+    }
+    mdb_txn_abort(txn);
+    if (rc == MDB_NOTFOUND)
+        _return.responseCode = ResponseCode::MapNotFound;
+    else if (rc)
+        _return.responseCode = ResponseCode::Error;
+    else
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        _return.responseCode = ResponseCode::MapNotFound;
+    } else {
+        rc = mdb_get(txn, dbi, &k, &data);
+        if (!rc) {
+            _return.value.assign((char *)data.mv_data, data.mv_size);
+            _return.responseCode = ResponseCode::Success;
+        } else if (rc == MDB_NOTFOUND) {
+            _return.responseCode = ResponseCode::RecordNotFound;
+        } else {
+            _return.responseCode = ResponseCode::Error;
+        }
+    }
+    mdb_txn_abort(txn);
+    }
+
+    void multiGet(BinaryListResponse& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+
+    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        _return.responseCode = ResponseCode::MapNotFound;
+    } else {
+        _return.responses.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            BinaryResponse& response = _return.responses[i];
+            k.mv_data = (void *)keys[i].data();
+            k.mv_size = keys[i].size();
+            rc = mdb_get(txn, dbi, &k, &data);
+            if (!rc) {
+                response.value.assign((char *)data.mv_data, data.mv_size);
+                response.responseCode = ResponseCode::Success;
+            } else if (rc == MDB_NOTFOUND) {
+                response.responseCode = ResponseCode::RecordNotFound;
+            } else {
+                response.responseCode = ResponseCode::Error;
+            }
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+    mdb_txn_abort(txn);
+    }
+
+    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+    ResponseCode::type rv;
+
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    data.mv_data = (void *)value.data();
+    data.mv_size = value.size();
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        rv = ResponseCode::MapNotFound;
+    } else {
+        rc = mdb_put(txn, dbi, &k, &data, 0);
+        if (!rc) {
+            rc = mdb_txn_commit(txn);
+            txn = NULL;
+            rv = ResponseCode::Success;
+        }
+        if (rc)
+            rv = ResponseCode::Error;
+    }
+    if (txn)
+        mdb_txn_abort(txn);
+        return rv;
+    }
+
+    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+    ResponseCode::type rv;
+
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    data.mv_data = (void *)value.data();
+    data.mv_size = value.size();
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        rv = ResponseCode::MapNotFound;
+    } else {
+        rc = mdb_put(txn, dbi, &k, &data, MDB_NOOVERWRITE);
+        if (!rc) {
+            rc = mdb_txn_commit(txn);
+            txn = NULL;
+            rv = ResponseCode::Success;
+        }
+        if (rc) {
+            if (rc == MDB_KEYEXIST)
+                rv = ResponseCode::RecordExists;
+            else
+                rv = ResponseCode::Error;
+        }
+    }
+    if (txn)
+        mdb_txn_abort(txn);
+        return rv;
+    }
+
+    ResponseCode::type insertMany(const std::string& mapName, const std::vector<Record>& records) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc = 0;
+    std::vector<Record>::const_iterator record;
+
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        mdb_txn_abort(txn);
+        return ResponseCode::MapNotFound;
+    }
+    for (record = records.begin(); record != records.end(); record++) {
+        k.mv_data = (void *)record->key.data();
+        k.mv_size = record->key.size();
+        data.mv_data = (void *)record->value.data();
+        data.mv_size = record->value.size();
+        rc = mdb_put(txn, dbi, &k, &data, MDB_NOOVERWRITE);
+        if (rc)
+            break;
+    }
+    if (rc) {
+        mdb_txn_abort(txn);
+        if (rc == MDB_KEYEXIST)
+            return ResponseCode::RecordExists;
+        return ResponseCode::Error;
+    }
+    if (mdb_txn_commit(txn))
+        return ResponseCode::Error;
+    return ResponseCode::Success;
+    }
+
+    /* Only the LevelDB backend can load table files directly. */
+    ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+    return ResponseCode::Error;
+    }
+
+    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
+    MDB_txn *txn;
+    MDB_cursor *mc;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+    ResponseCode::type rv;
+
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    data.mv_data = (void *)value.data();
+    data.mv_size = value.size();
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        rv = ResponseCode::MapNotFound;
+    } else {
+        rv = ResponseCode::Success;
+        rc = mdb_cursor_open(txn, dbi, &mc);
+        if (!blindupdate) {
+            rc = mdb_cursor_get(mc, &k, NULL, MDB_SET);
+            if (rc == MDB_NOTFOUND)
+                rv = ResponseCode::RecordNotFound;
+        }
+        if (rv == ResponseCode::Success) {
+            rc = mdb_cursor_put(mc, &k, &data, 0);
+            if (!rc) {
+                mdb_cursor_close(mc);
+                mc = NULL;
+                rc = mdb_txn_commit(txn);
+                txn = NULL;
+                rv = ResponseCode::Success;
+            }
+            if (rc)
+                rv = ResponseCode::Error;
+        }
+        if (mc)
+            mdb_cursor_close(mc);
+    }
+    if (txn)
+        mdb_txn_abort(txn);
+        return rv;
+    }
+
+    ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key,
+              const std::string& expectedValue, const std::string& newValue) {
+    MDB_txn *txn;
+    MDB_val k, data;
+    MDB_dbi dbi;
+    int rc;
+    ResponseCode::type rv;
+
+    /* Write txns are serialized, so nothing can change the record
+     * between the get and the put.
+     */
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        rv = ResponseCode::MapNotFound;
+    } else {
+        rc = mdb_get(txn, dbi, &k, &data);
+        if (rc == MDB_NOTFOUND) {
+            rv = ResponseCode::RecordNotFound;
+        } else if (rc) {
+            rv = ResponseCode::Error;
+        } else if (data.mv_size != expectedValue.size() ||
+            memcmp(data.mv_data, expectedValue.data(), data.mv_size)) {
+            rv = ResponseCode::ValueMismatch;
+        } else {
+            data.mv_data = (void *)newValue.data();
+            data.mv_size = newValue.size();
+            rc = mdb_put(txn, dbi, &k, &data, 0);
+            if (!rc) {
+                rc = mdb_txn_commit(txn);
+                txn = NULL;
+            }
+            rv = rc ? ResponseCode::Error : ResponseCode::Success;
+        }
+    }
+    if (txn)
+        mdb_txn_abort(txn);
+        return rv;
+    }
+
+    void increment(Int64Response& _return, const std::string& mapName, const std::string& key, const int64_t delta) {
+    std::string operand, result;
+
+    encodeCounter(delta, operand);
+    _return.responseCode = merge(mapName, key, operand, mergeIncrement, result);
+    if (_return.responseCode == ResponseCode::Success)
+        decodeCounter(result, _return.value);
+    }
+
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& value) {
+    std::string result;
+
+        return merge(mapName, key, value, mergeAppend, result);
+    }
+
+    ResponseCode::type remove(const std::string& mapName, const std::string& key) {
+    MDB_txn *txn;
+    MDB_val k;
+    MDB_dbi dbi;
+    int rc;
+    ResponseCode::type rv = ResponseCode::Success;
+
+    k.mv_data = (void *)key.data();
+    k.mv_size = key.size();
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
+    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
+    if (rc) {
+        rv = ResponseCode::MapNotFound;
+    } else {
+        rc = mdb_del(txn, dbi, &k, NULL);
+        if (!rc) {
+            rc = mdb_txn_commit(txn);
+            txn = NULL;
+        }
+        if (rc == MDB_NOTFOUND)
+            rv = ResponseCode::RecordNotFound;
+        else if (rc)
+            rv = ResponseCode::Error;
+    }
+        return rv;
     }
 
-    ResponseCode::type addMap(const std::string& mapName) {
+    /* All the deletes are done in one write txn. */
+    void removeRange(Int64Response& _return, const std::string& mapName,
+              const std::string& startKey, const std::string& endKey) {
     MDB_txn *txn;
+    MDB_cursor *mc;
+    MDB_val key, k2;
     MDB_dbi dbi;
-    int rc, exist = 0;
+    MDB_cursor_op op = MDB_FIRST;
+    int rc;
+
+    _return.value = 0;
     rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
     rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
-    if (rc)
-        rc = mdb_open(txn, mapName.c_str(), MDB_CREATE, &dbi);
+    if (rc) {
+        mdb_txn_abort(txn);
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    rc = mdb_cursor_open(txn, dbi, &mc);
+    if (!rc) {
+        if (!startKey.empty()) {
+            key.mv_data = (void *)startKey.data();
+            key.mv_size = startKey.size();
+            op = MDB_SET_RANGE;
+        }
+        k2.mv_data = (void *)endKey.data();
+        k2.mv_size = endKey.size();
+        /* After a delete the cursor is already on the next record,
+         * and MDB_NEXT returns that record.
+         */
+        while ((rc = mdb_cursor_get(mc, &key, NULL, op)) == 0) {
+            op = MDB_NEXT;
+            if (k2.mv_size && mdb_cmp(txn, dbi, &key, &k2) >= 0)
+                break;
+            rc = mdb_cursor_del(mc, 0);
+            if (rc)
+                break;
+            _return.value++;
+        }
+        mdb_cursor_close(mc);
+        if (rc == MDB_NOTFOUND)
+            rc = 0;
+    }
+    if (!rc)
+        rc = mdb_txn_commit(txn);
     else
-        exist = 1;
-    rc = mdb_txn_commit(txn);
-        return exist ? ResponseCode::MapExists : ResponseCode::Success;
+        mdb_txn_abort(txn);
+    if (rc) {
+        _return.value = 0;
+        _return.responseCode = ResponseCode::Error;
+    } else
+        _return.responseCode = ResponseCode::Success;
     }
 
-    ResponseCode::type dropMap(const std::string& mapName) {
+    ResponseCode::type writeBatch(const std::string& mapName, const std::vector<Mutation>& mutations) {
     MDB_txn *txn;
+    MDB_val k, data;
     MDB_dbi dbi;
-    int rc, found = 0;
+    int rc;
+    ResponseCode::type rv = ResponseCode::Success;
+
     rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
     rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
-    if (!rc) {
-        rc = mdb_drop(txn, dbi, 0);
-        found = 1;
+    if (rc) {
+        mdb_txn_abort(txn);
+        return ResponseCode::MapNotFound;
+    }
+    std::vector<Mutation>::const_iterator mutation;
+    for (mutation = mutations.begin(); mutation != mutations.end(); mutation++) {
+        k.mv_data = (void *)mutation->key.data();
+        k.mv_size = mutation->key.size();
+        data.mv_data = (void *)mutation->value.data();
+        data.mv_size = mutation->value.size();
+        switch (mutation->type) {
+        case MutationType::Put:
+            rc = mdb_put(txn, dbi, &k, &data, 0);
+            break;
+        case MutationType::Insert:
+            rc = mdb_put(txn, dbi, &k, &data, MDB_NOOVERWRITE);
+            if (rc == MDB_KEYEXIST)
+                rv = ResponseCode::RecordExists;
+            break;
+        case MutationType::Update:
+            if (!blindupdate) {
+                MDB_val current;
+                rc = mdb_get(txn, dbi, &k, &current);
+                if (rc == MDB_NOTFOUND)
+                    rv = ResponseCode::RecordNotFound;
+                if (rc)
+                    break;
+            }
+            rc = mdb_put(txn, dbi, &k, &data, 0);
+            break;
+        case MutationType::Remove:
+            rc = mdb_del(txn, dbi, &k, NULL);
+            if (rc == MDB_NOTFOUND)
+                rv = ResponseCode::RecordNotFound;
+            break;
+        }
+        if (rc)
+            break;
+    }
+    if (rc) {
+        mdb_txn_abort(txn);
+        return rv == ResponseCode::Success ? ResponseCode::Error : rv;
     }
     rc = mdb_txn_commit(txn);
-        return found ? ResponseCode::Success : ResponseCode::MapNotFound;
+        return rc ? ResponseCode::Error : ResponseCode::Success;
     }
 
-    void listMaps(StringListResponse& _return) {
-    MDB_txn *txn;
-    MDB_cursor *mc;
-    MDB_dbi dbi;
-    MDB_val key;
-    std::string str;
-    int rc;
-    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
-    rc = mdb_open(txn, NULL, 0, &dbi);
-    rc = mdb_cursor_open(txn, dbi, &mc);
-    while ((rc = mdb_cursor_get(mc, &key, NULL, MDB_NEXT)) == 0) {
-        str.assign((char *)key.mv_data, key.mv_size);
-        _return.values.push_back(str);
+    void tailChanges(ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        // changes are logged by ChangeLogHandler, which main() puts in
+        // front of this handler.
+        _return.responseCode = ResponseCode::Error;
     }
-    mdb_cursor_close(mc);
-    mdb_txn_abort(txn);
-        _return.responseCode = ResponseCode::Success;
+
+private:
+    /*
+     * Doesn't take handlesMutex_: a dbi is just a number, and LMDB keeps
+     * it valid (and empty) after dropMap, so there is nothing else to
+     * protect.
+     */
+    bool resolveHandle(int32_t mapHandle, MDB_dbi *dbi) {
+        return handles_.get(mapHandle, *dbi);
     }
 
-    void scan(RecordListResponse& _return, const std::string& mapName,
+    /* Does the work of scan in a read txn. The txn is left open. */
+    void scanRecords(RecordListResponse& _return, MDB_txn *txn, MDB_dbi dbi,
               const ScanOrder::type order, const std::string& startKey,
               const bool startKeyIncluded, const std::string& endKey,
               const bool endKeyIncluded, const int32_t maxRecords,
-              const int32_t maxBytes) {
-    MDB_txn *txn;
+              const int32_t maxBytes, const ScanOptions& options) {
     MDB_cursor *mc;
-    MDB_dbi dbi;
     MDB_val key, data, k2;
+    /* Without a data pointer the cursor doesn't read the data node.
+     * Value filters need it even for keys-only scans. */
+    MDB_val *datap = options.keysOnly && !hasValueFilter(options.filter) ? NULL : &data;
     Record rec;
     int rc = 0, scanbeg = 0;
     MDB_cursor_op dflag;
     int32_t resultSize = 0;
     int32_t count = 0;
 
-    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
-    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
-    if (rc) {
-        if (rc == MDB_NOTFOUND)
-            _return.responseCode = ResponseCode::MapNotFound;
-        else
-            _return.responseCode = ResponseCode::Error;
-        return;
-    }
     rc = mdb_cursor_open(txn, dbi, &mc);
     if (order == ScanOrder::Ascending) {
         dflag = MDB_NEXT;
@@ -201,11 +1180,12 @@ public:
         else
             _return.responseCode = ResponseCode::Error;
         mdb_cursor_close(mc);
-        mdb_txn_abort(txn);
         return;
     }
-    while ((rc = mdb_cursor_get(mc, &key, &data, dflag)) == 0) {
+    while ((rc = mdb_cursor_get(mc, &key, datap, dflag)) == 0) {
         scanbeg = 1;
+        if (dflag == MDB_GET_CURRENT)
+            dflag = (order == ScanOrder::Ascending) ? MDB_NEXT : MDB_PREV;
         if (k2.mv_size) {
             rc = mdb_cmp(txn, dbi, &key, &k2);
             if (order == ScanOrder::Ascending) {
@@ -220,17 +1200,18 @@ public:
                     break;
             }
         }
-        if ((int)key.mv_size + (int)data.mv_size + resultSize > maxBytes)
+        if (!matchesKey(options.filter, (char *)key.mv_data, key.mv_size) ||
+            (datap && !matchesValue(options.filter, (char *)data.mv_data, data.mv_size)))
+            continue;
+        projectValue(options, (char *)data.mv_data, data.mv_size, rec.value);
+        if ((int)key.mv_size + (int)rec.value.size() + resultSize > maxBytes)
             break;
         rec.key.assign((char *)key.mv_data, key.mv_size);
-        rec.value.assign((char *)data.mv_data, data.mv_size);
         _return.records.push_back(rec);
-        resultSize += key.mv_size + data.mv_size;
+        resultSize += key.mv_size + rec.value.size();
         count++;
         if (count >= maxRecords)
             break;
-        if (dflag == MDB_GET_CURRENT)
-            dflag = (order == ScanOrder::Ascending) ? MDB_NEXT : MDB_PREV;
     }
         if (rc == MDB_NOTFOUND) {
             if (scanbeg)
@@ -243,36 +1224,13 @@ public:
             _return.responseCode = ResponseCode::ScanEnded;
         }
         mdb_cursor_close(mc);
-        mdb_txn_abort(txn);
-    }
-
-    void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
-    MDB_txn *txn;
-    MDB_val k, data;
-    MDB_dbi dbi;
-    int rc;
-
-    k.mv_data = (void *)key.data();
-    k.mv_size = key.size();
-    rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
-    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
-    if (rc) {
-        _return.responseCode = ResponseCode::MapNotFound;
-    } else {
-        rc = mdb_get(txn, dbi, &k, &data);
-        if (!rc) {
-            _return.value.assign((char *)data.mv_data, data.mv_size);
-            _return.responseCode = ResponseCode::Success;
-        } else if (rc == MDB_NOTFOUND) {
-            _return.responseCode = ResponseCode::RecordNotFound;
-        } else {
-            _return.responseCode = ResponseCode::Error;
-        }
-    }
-    mdb_txn_abort(txn);
     }
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
+    /* Replaces the value of a record with mergeFunction(value, operand).
+     * The get and the put are in the same write txn.
+     */
+    ResponseCode::type merge(const std::string& mapName, const std::string& key,
+              const std::string& operand, MergeFunction mergeFunction, std::string& result) {
     MDB_txn *txn;
     MDB_val k, data;
     MDB_dbi dbi;
@@ -281,54 +1239,32 @@ public:
 
     k.mv_data = (void *)key.data();
     k.mv_size = key.size();
-    data.mv_data = (void *)value.data();
-    data.mv_size = value.size();
     rc = mdb_txn_begin(env, NULL, 0, &txn);
+    if (rc)
+        return ResponseCode::Error;
     rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
     if (rc) {
         rv = ResponseCode::MapNotFound;
     } else {
-        rc = mdb_put(txn, dbi, &k, &data, 0);
-        if (!rc) {
-            rc = mdb_txn_commit(txn);
-            txn = NULL;
-            rv = ResponseCode::Success;
-        }
-        if (rc)
+        rc = mdb_get(txn, dbi, &k, &data);
+        if (rc && rc != MDB_NOTFOUND) {
             rv = ResponseCode::Error;
-    }
-    if (txn)
-        mdb_txn_abort(txn);
-        return rv;
-    }
-
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
-    MDB_txn *txn;
-    MDB_val k, data;
-    MDB_dbi dbi;
-    int rc;
-    ResponseCode::type rv;
-
-    k.mv_data = (void *)key.data();
-    k.mv_size = key.size();
-    data.mv_data = (void *)value.data();
-    data.mv_size = value.size();
-    rc = mdb_txn_begin(env, NULL, 0, &txn);
-    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
-    if (rc) {
-        rv = ResponseCode::MapNotFound;
-    } else {
-        rc = mdb_put(txn, dbi, &k, &data, MDB_NOOVERWRITE);
-        if (!rc) {
-            rc = mdb_txn_commit(txn);
-            txn = NULL;
-            rv = ResponseCode::Success;
-        }
-        if (rc) {
-            if (rc == MDB_KEYEXIST)
-                rv = ResponseCode::RecordExists;
-            else
+        } else {
+            std::string current;
+            if (!rc)
+                current.assign((const char *)data.mv_data, data.mv_size);
+            if (!mergeFunction(rc ? NULL : &current, operand, result)) {
                 rv = ResponseCode::Error;
+            } else {
+                data.mv_data = (void *)result.data();
+                data.mv_size = result.size();
+                rc = mdb_put(txn, dbi, &k, &data, 0);
+                if (!rc) {
+                    rc = mdb_txn_commit(txn);
+                    txn = NULL;
+                }
+                rv = rc ? ResponseCode::Error : ResponseCode::Success;
+            }
         }
     }
     if (txn)
@@ -336,92 +1272,85 @@ public:
         return rv;
     }
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
-    MDB_txn *txn;
+    /* Counts the keys in [startKey, endKey) without reading the data. */
+    int countKeys(MDB_txn *txn, MDB_dbi dbi, const std::string& startKey,
+              const std::string& endKey, int64_t *count) {
     MDB_cursor *mc;
-    MDB_val k, data;
-    MDB_dbi dbi;
+    MDB_val key, k2;
+    MDB_cursor_op op = MDB_FIRST;
     int rc;
-    ResponseCode::type rv;
 
-    k.mv_data = (void *)key.data();
-    k.mv_size = key.size();
-    data.mv_data = (void *)value.data();
-    data.mv_size = value.size();
-    rc = mdb_txn_begin(env, NULL, 0, &txn);
-    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
-    if (rc) {
-        rv = ResponseCode::MapNotFound;
-    } else {
-        rv = ResponseCode::Success;
-        rc = mdb_cursor_open(txn, dbi, &mc);
-        if (!blindupdate) {
-            rc = mdb_cursor_get(mc, &k, NULL, MDB_SET);
-            if (rc == MDB_NOTFOUND)
-                rv = ResponseCode::RecordNotFound;
-        }
-        if (rv == ResponseCode::Success) {
-            rc = mdb_cursor_put(mc, &k, &data, 0);
-            if (!rc) {
-                mdb_cursor_close(mc);
-                mc = NULL;
-                rc = mdb_txn_commit(txn);
-                txn = NULL;
-                rv = ResponseCode::Success;
-            }
-            if (rc)
-                rv = ResponseCode::Error;
-        }
-        if (mc)
-            mdb_cursor_close(mc);
+    *count = 0;
+    rc = mdb_cursor_open(txn, dbi, &mc);
+    if (rc)
+        return rc;
+    if (!startKey.empty()) {
+        key.mv_data = (void *)startKey.data();
+        key.mv_size = startKey.size();
+        op = MDB_SET_RANGE;
     }
-    if (txn)
-        mdb_txn_abort(txn);
-        return rv;
+    k2.mv_data = (void *)endKey.data();
+    k2.mv_size = endKey.size();
+    while ((rc = mdb_cursor_get(mc, &key, NULL, op)) == 0) {
+        op = MDB_NEXT;
+        if (k2.mv_size && mdb_cmp(txn, dbi, &key, &k2) >= 0)
+            break;
+        (*count)++;
+    }
+    mdb_cursor_close(mc);
+        return rc == MDB_NOTFOUND ? 0 : rc;
     }
 
-    ResponseCode::type remove(const std::string& mapName, const std::string& key) {
-    MDB_txn *txn;
-    MDB_val k;
-    MDB_dbi dbi;
-    int rc;
-    ResponseCode::type rv = ResponseCode::Success;
+    struct ScanCursor {
+        ScanCursor() : txn(NULL), mc(NULL), ended(false) {}
+        ~ScanCursor() {
+            if (mc)
+                mdb_cursor_close(mc);
+            if (txn)
+                mdb_txn_abort(txn);
+        }
+        std::string mapName;
+        MDB_txn *txn;
+        MDB_cursor *mc;
+        MDB_dbi dbi;
+        MDB_cursor_op op;   /* op that returns the next record */
+        bool ended;
+        ScanOrder::type order;
+        std::string startKey;
+        bool startKeyIncluded;
+        std::string endKey;
+        bool endKeyIncluded;
+        ScanOptions options;
+        boost::mutex mutex; /* serialize nextScan calls on this cursor */
+    };
 
-    k.mv_data = (void *)key.data();
-    k.mv_size = key.size();
-    rc = mdb_txn_begin(env, NULL, 0, &txn);
-    rc = mdb_open(txn, mapName.c_str(), 0, &dbi);
-    if (rc) {
-        rv = ResponseCode::MapNotFound;
-    } else {
-        rc = mdb_del(txn, dbi, &k, NULL);
-        if (!rc) {
-            rc = mdb_txn_commit(txn);
-            txn = NULL;
+    /* A read txn handed out by createSnapshot. */
+    struct Snapshot {
+        Snapshot() : txn(NULL) {}
+        ~Snapshot() {
+            if (txn)
+                mdb_txn_abort(txn);
         }
-        if (rc == MDB_NOTFOUND)
-            rv = ResponseCode::RecordNotFound;
-        else if (rc)
-            rv = ResponseCode::Error;
-    }
-        return rv;
-    }
+        std::string mapName;
+        MDB_txn *txn;
+        MDB_dbi dbi;
+        boost::mutex mutex; /* a txn can't be used by two threads at once */
+    };
 
-private:
     MDB_env *env;
+    CursorTable<ScanCursor> cursors_;
+    CursorTable<Snapshot> snapshots_;
+    MapHandleTable<MDB_dbi> handles_;
+    boost::mutex handlesMutex_; // serialize changes to handles_
 };
 
-void usage(char* programName) {
-    fprintf(stderr, "%s [nonblocking|threaded|threadpool]\n", programName);
-    exit(1);
-}
-
 int main(int argc, char **argv) {
     int port;
     size_t maxSizeMb;
-    size_t numThreads;
     int maxMaps;
+    int changeLogSize;
     std::string dir;
+    ServerRunner runner("threadpool", true);
     po::variables_map vm;
     po::options_description config("");
     config.add_options()
@@ -432,8 +1361,9 @@ int main(int argc, char **argv) {
         ("datadir,d", po::value<std::string>(&dir)->default_value("data"), "data directory")
         ("maxsize-mb,m", po::value<size_t>(&maxSizeMb)->default_value(1024), "LMDB max size in MB")
         ("maps,q", po::value<int>(&maxMaps)->default_value(256), "LMDB max maps")
-        ("threads,t", po::value<size_t>(&numThreads)->default_value(32), "Number of threads")
+        ("change-log-size", po::value<int>(&changeLogSize)->default_value(10000), "number of changes per map to keep for tailChanges (0 to disable)")
         ;
+    runner.addOptions(config);
     po::options_description cmdline_options;
     cmdline_options.add(config);
     store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
@@ -443,19 +1373,28 @@ int main(int argc, char **argv) {
         exit(0);
     }
     syncmode = vm.count("sync");
+    if (syncmode && runner.eventLoops()) {
+        // every synced write would hold up the connections on its loop.
+        fprintf(stderr, "--sync can't be used with the %s server, which runs "
+                "requests on its event loops\n", runner.serverType().c_str());
+        exit(1);
+    }
     blindupdate = vm.count("blindupdate");
     maxSizeMb *= 1048576;
-    shared_ptr<LmdbServer> handler(new LmdbServer(dir, maxSizeMb, numThreads, maxMaps));
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(numThreads);
-    shared_ptr<ThreadFactory> threadFactory(new PosixThreadFactory());
-    threadManager->threadFactory(threadFactory);
-    threadManager->start();
-    TThreadPoolServer server (processor, serverTransport, transportFactory, protocolFactory, threadManager);
-//    TThreadedServer server (processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    size_t maxCalls = runner.maxConcurrentCalls();
+    if (maxCalls == 0) {
+        // every call takes a reader slot, and LMDB has a fixed number.
+        fprintf(stderr, "the threaded server can run any number of calls at once; "
+                "use another --server-type or set --max-requests\n");
+        exit(1);
+    }
+    shared_ptr<MapKeeperIf> handler(new LmdbServer(dir, maxSizeMb, maxCalls, maxMaps));
+    handler = runner.groupCommit(handler);
+    handler = runner.cache(handler);
+    if (changeLogSize > 0) {
+        handler.reset(new ChangeLogHandler(handler, changeLogSize));
+    }
+    handler.reset(new TtlHandler(handler));
+    runner.serve(handler, port);
     return 0;
 }
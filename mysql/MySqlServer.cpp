@@ -17,15 +17,28 @@
 /**
  * This is a implementation of the mapkeeper interface that uses mysql.
  */
+#include <iostream>
+#include <map>
+#include <cstdlib>
 #include <mysql.h>
 #include <mysqld_error.h>
 #include <arpa/inet.h>
 #include "MapKeeper.h"
+#include "Aggregator.h"
+#include "ChangeLogHandler.h"
+#include "TtlHandler.h"
+#include "CursorTable.h"
+#include "MapHandleTable.h"
+#include "MergeOperator.h"
+#include "ServerRunner.h"
+#include "SplitPoints.h"
+#include "ValueProjection.h"
+#include <boost/program_options.hpp>
 #include <boost/thread/tss.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <boost/lexical_cast.hpp>
 
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 
@@ -33,6 +46,7 @@ using namespace ::apache::thrift::transport;
 using namespace ::apache::thrift::server;
 using namespace mapkeeper;
 using boost::shared_ptr;
+namespace po = boost::program_options;
 
 class MySqlServer: virtual public MapKeeperIf {
 public:
@@ -50,6 +64,11 @@ public:
         return ResponseCode::Success;
     }
 
+    // answered by StatsHandler, which ServerRunner puts in front.
+    void getStats(StatsResponse& _return, const bool reset) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
     ResponseCode::type addMap(const std::string& mapName) {
         initMySql();
         std::string query = "create table " + escapeString(mapName) + 
@@ -69,6 +88,10 @@ public:
 
     ResponseCode::type dropMap(const std::string& mapName) {
         initMySql();
+        {
+            boost::unique_lock< boost::shared_mutex> writeLock(handlesMutex_);;
+            handles_.remove(mapName);
+        }
         std::string query = "drop table " + escapeString(mapName);
         int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
         if (result != 0) {
@@ -105,18 +128,72 @@ public:
         mysql_free_result(res);
     }
 
+    void openMap(MapHandleResponse& _return, const std::string& mapName) {
+        initMySql();
+        std::string query = "select 1 from " + escapeString(mapName) + " limit 0";
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                _return.responseCode = ResponseCode::MapNotFound;
+                return;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                _return.responseCode = ResponseCode::Error;
+                return;
+            }
+        }
+        mysql_free_result(mysql_store_result(mysql_->get()));
+        boost::unique_lock< boost::shared_mutex> writeLock(handlesMutex_);;
+        _return.handle = handles_.add(mapName, mapName);
+        _return.responseCode = _return.handle >= 0 ? ResponseCode::Success : ResponseCode::TooManyHandles;
+    }
+
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& key) {
+        std::string mapName;
+        if (!resolveHandle(mapHandle, mapName)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        get(_return, mapName, key);
+    }
+
+    ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key, const std::string& value) {
+        std::string mapName;
+        if (!resolveHandle(mapHandle, mapName)) {
+            return ResponseCode::MapNotFound;
+        }
+        return put(mapName, key, value, WriteOptions());
+    }
+
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
+        std::string mapName;
+        if (!resolveHandle(mapHandle, mapName)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        scan(_return, mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded,
+             maxRecords, maxBytes, options);
+    }
+
     void scan(RecordListResponse& _return, const std::string& mapName, const ScanOrder::type order,
               const std::string& startKey, const bool startKeyIncluded, 
               const std::string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         initMySql();
-        std::string query = "select record_key, record_value from " + 
+        std::string query = "select record_key, " + valueColumn(options) + " from " + 
             escapeString(mapName) + " where record_key " + 
             (startKeyIncluded ? ">=" : ">") + " '" + escapeString(startKey) + "'";
         if (!endKey.empty()) {
             query += " and record_key " +
                 (endKeyIncluded ? std::string("<=") : std::string("<")) + "'" + escapeString(endKey) + "'";
         }
+        query += filterCondition(options.filter);
         query += " order by record_key";
         if (order == mapkeeper::ScanOrder::Descending) {
             query += " desc";
@@ -159,6 +236,229 @@ public:
         _return.responseCode = mapkeeper::ResponseCode::ScanEnded;
     }
 
+    void openScan(ScanCursorResponse& _return, const std::string& mapName, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const ScanOptions& options) {
+        initMySql();
+        std::string query = "select 1 from " + escapeString(mapName) + " limit 0";
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                _return.responseCode = ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                _return.responseCode = ResponseCode::Error;
+            }
+            return;
+        }
+        mysql_free_result(mysql_store_result(mysql_->get()));
+
+        boost::shared_ptr<ScanCursor> cursor(new ScanCursor());
+        cursor->mapName = mapName;
+        cursor->order = order;
+        cursor->startKey = startKey;
+        cursor->startKeyIncluded = startKeyIncluded;
+        cursor->endKey = endKey;
+        cursor->endKeyIncluded = endKeyIncluded;
+        cursor->options = options;
+        _return.cursorId = cursors_.add(cursor);
+        _return.responseCode = _return.cursorId ? ResponseCode::Success : ResponseCode::TooManyCursors;
+    }
+
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        boost::shared_ptr<ScanCursor> cursor = cursors_.get(cursorId);
+        if (!cursor) {
+            _return.responseCode = ResponseCode::CursorNotFound;
+            return;
+        }
+        boost::mutex::scoped_lock cursorLock(cursor->mutex);
+
+        // Connections are per thread, so a result set can't be kept open
+        // across calls. Instead the cursor remembers the last key it 
+        // returned and narrows the range past it; the primary key index
+        // makes that a single range lookup.
+        scan(_return, cursor->mapName, cursor->order, cursor->startKey, cursor->startKeyIncluded,
+             cursor->endKey, cursor->endKeyIncluded, maxRecords, maxBytes, cursor->options);
+        if (!_return.records.empty()) {
+            if (cursor->order == ScanOrder::Ascending) {
+                cursor->startKey = _return.records.back().key;
+                cursor->startKeyIncluded = false;
+            } else {
+                cursor->endKey = _return.records.back().key;
+                cursor->endKeyIncluded = false;
+                if (cursor->endKey.empty()) {
+                    // empty endKey would mean the end of the map.
+                    _return.responseCode = ResponseCode::ScanEnded;
+                }
+            }
+        }
+        if (_return.responseCode != ResponseCode::Success) {
+            cursors_.remove(cursorId);
+        }
+    }
+
+    ResponseCode::type closeScan(const int64_t cursorId) {
+        if (!cursors_.remove(cursorId)) {
+            return ResponseCode::CursorNotFound;
+        }
+        return ResponseCode::Success;
+    }
+
+    void createSnapshot(SnapshotResponse& _return, const std::string& mapName) {
+        // a consistent snapshot is a transaction on one connection, but
+        // connections belong to the server threads, not to the client.
+        _return.responseCode = ResponseCode::Error;
+    }
+
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        return ResponseCode::SnapshotNotFound;
+    }
+
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& key) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+    }
+
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, const ScanOrder::type order,
+              const std::string& startKey, const bool startKeyIncluded, 
+              const std::string& endKey, const bool endKeyIncluded,
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+    }
+
+    void countRange(Int64Response& _return, const std::string& mapName,
+                    const std::string& startKey, const std::string& endKey) {
+        selectRange(_return, "count(*)", mapName, startKey, endKey);
+    }
+
+    void approximateSize(Int64Response& _return, const std::string& mapName,
+                         const std::string& startKey, const std::string& endKey) {
+        selectRange(_return, "sum(length(record_key) + length(record_value))", 
+                    mapName, startKey, endKey);
+    }
+
+    /**
+     * MySQL can't decode the values, so the ones that could be decoded
+     * are streamed to the server, which still saves sending them to the 
+     * client. Count is left to MySQL.
+     */
+    void aggregate(AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const AggregateOp::type op, const ValueEncoding::type encoding) {
+        Aggregator aggregator(op, encoding);
+        if (!aggregator.isValid()) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        if (!aggregator.needsValues()) {
+            Int64Response count;
+            countRange(count, mapName, startKey, endKey);
+            _return.responseCode = count.responseCode;
+            _return.count = count.value;
+            _return.int64Value = count.value;
+            return;
+        }
+        initMySql();
+        std::string query = "select record_value from " + escapeString(mapName) + 
+            " where record_key >= '" + escapeString(startKey) + "'";
+        if (!endKey.empty()) {
+            query += " and record_key < '" + escapeString(endKey) + "'";
+        }
+        query += " and length(record_value) = 8";
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                _return.responseCode = ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                _return.responseCode = ResponseCode::Error;
+            }
+            return;
+        }
+        // the range can be large; read the rows as they come instead of
+        // buffering them all.
+        MYSQL_RES* res = mysql_use_result(mysql_->get());
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(res))) {
+            uint64_t* lengths = mysql_fetch_lengths(res);
+            aggregator.add(row[0], lengths[0]);
+        }
+        bool failed = mysql_errno(mysql_->get()) != 0;
+        if (failed) {
+            fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+        }
+        mysql_free_result(res);
+        aggregator.getResult(_return);
+        _return.responseCode = failed ? ResponseCode::Error : ResponseCode::Success;
+    }
+
+    /**
+     * MySQL doesn't expose its index pages, so every n-th key is picked
+     * from a walk of the primary key that stops at the last split point.
+     * The row count comes from the table statistics, which InnoDB only
+     * estimates, so the ranges are as even as the estimate is good. 
+     * Tables without statistics yet are counted.
+     */
+    void sampleSplitPoints(KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        initMySql();
+        if (!validSplitCount(numSplits)) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        std::string query = "select table_rows from information_schema.tables "
+            "where table_schema = database() and table_name = '" + escapeString(mapName) + "'";
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        MYSQL_RES* res = mysql_store_result(mysql_->get());
+        MYSQL_ROW row = mysql_fetch_row(res);
+        int64_t count = row && row[0] ? strtoll(row[0], NULL, 10) : 0;
+        mysql_free_result(res);
+        if (count == 0) {
+            Int64Response rows;
+            countRange(rows, mapName, "", "");
+            if (rows.responseCode != ResponseCode::Success) {
+                _return.responseCode = rows.responseCode;
+                return;
+            }
+            count = rows.value;
+        }
+
+        uint64_t limit = (uint64_t)(numSplits - 1) * count / numSplits + 1;
+        query = "select record_key from " + escapeString(mapName) + 
+            " order by record_key limit " + boost::lexical_cast<std::string>(limit);
+        result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                _return.responseCode = ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                _return.responseCode = ResponseCode::Error;
+            }
+            return;
+        }
+        res = mysql_store_result(mysql_->get());
+        StridePicker picker(count, numSplits);
+        for (uint64_t i = 0; (row = mysql_fetch_row(res)) && !picker.done(); i++) {
+            uint64_t* lengths = mysql_fetch_lengths(res);
+            if (picker.pick(i)) {
+                _return.keys.push_back(std::string(row[0], lengths[0]));
+            }
+        }
+        mysql_free_result(res);
+        _return.responseCode = ResponseCode::Success;
+    }
+
     void get(BinaryResponse& _return, const std::string& mapName, const std::string& key) {
         initMySql();
 
@@ -196,11 +496,61 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
+    void multiGet(BinaryListResponse& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        initMySql();
+        _return.responses.resize(keys.size());
+        if (keys.empty()) {
+            _return.responseCode = ResponseCode::Success;
+            return;
+        }
+
+        std::string query = "select record_key, record_value from " + escapeString(mapName) +
+            " where record_key in (";
+        for (size_t i = 0; i < keys.size(); i++) {
+            query += (i == 0 ? "'" : ", '") + escapeString(keys[i]) + "'";
+        }
+        query += ")";
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                _return.responseCode = ResponseCode::MapNotFound;
+                return;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                _return.responseCode = ResponseCode::Error;
+                return;
+            }
+        }
+
+        MYSQL_RES* res = mysql_store_result(mysql_->get());
+        MYSQL_ROW row;
+        std::map<std::string, std::string> records;
+        while ((row = mysql_fetch_row(res))) {
+            uint64_t* lengths = mysql_fetch_lengths(res);
+            records[std::string(row[0], lengths[0])] = std::string(row[1], lengths[1]);
+        }
+        mysql_free_result(res);
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            std::map<std::string, std::string>::iterator record = records.find(keys[i]);
+            if (record == records.end()) {
+                _return.responses[i].responseCode = ResponseCode::RecordNotFound;
+                continue;
+            }
+            _return.responses[i].responseCode = ResponseCode::Success;
+            _return.responses[i].value = record->second;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         return ResponseCode::Success;
     }
 
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
+    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         initMySql();
         std::string query = "insert " + escapeString(mapName) + " values('" + 
             escapeString(key) + "', '" + 
@@ -220,7 +570,52 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
+    ResponseCode::type insertMany(const std::string& mapName, const std::vector<Record>& records) {
+        initMySql();
+        std::string query = "start transaction";
+        if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+            fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+            return ResponseCode::Error;
+        }
+        // Insert multiple rows per statement, but keep each statement well 
+        // under max_allowed_packet.
+        const size_t maxQueryLength = 512 * 1024;
+        ResponseCode::type rc = ResponseCode::Success;
+        std::vector<Record>::const_iterator record = records.begin();
+        while (record != records.end() && rc == ResponseCode::Success) {
+            query = "insert " + escapeString(mapName) + " values";
+            for (bool first = true; record != records.end() && query.length() < maxQueryLength; record++) {
+                query += first ? "('" : ", ('";
+                query += escapeString(record->key) + "', '" + escapeString(record->value) + "')";
+                first = false;
+            }
+            if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+                uint32_t error = mysql_errno(mysql_->get());
+                if (error == ER_NO_SUCH_TABLE) {
+                    rc = ResponseCode::MapNotFound;
+                } else if (error == ER_DUP_ENTRY) {
+                    rc = ResponseCode::RecordExists;
+                } else {
+                    fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                    rc = ResponseCode::Error;
+                }
+            }
+        }
+        query = rc == ResponseCode::Success ? "commit" : "rollback";
+        if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+            fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+            return ResponseCode::Error;
+        }
+        return rc;
+    }
+
+    // only the LevelDB backend can load table files directly.
+    ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        return ResponseCode::Error;
+    }
+
+    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         initMySql();
         std::string query = "update " + escapeString(mapName) + " set record_value = '" + 
             escapeString(value) + "' where record_key = '" +  escapeString(key) + "'";
@@ -244,6 +639,65 @@ public:
         return ResponseCode::Success;
     }
 
+    ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key, 
+                                     const std::string& expectedValue, const std::string& newValue) {
+        initMySql();
+        // the condition is checked by the update itself, so it's atomic.
+        std::string query = "update " + escapeString(mapName) + " set record_value = '" + 
+            escapeString(newValue) + "' where record_key = '" +  escapeString(key) + 
+            "' and record_value = '" + escapeString(expectedValue) + "'";
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                return ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                return ResponseCode::Error;
+            }
+        }
+        if (mysql_affected_rows(mysql_->get()) == 1) {
+            return ResponseCode::Success;
+        }
+
+        // find out why nothing was updated.
+        Int64Response count;
+        selectRange(count, "count(*)", mapName, key, key + '\0');
+        if (count.responseCode != ResponseCode::Success) {
+            return count.responseCode;
+        }
+        return count.value ? ResponseCode::ValueMismatch : ResponseCode::RecordNotFound;
+    }
+
+    void increment(Int64Response& _return, const std::string& mapName, const std::string& key, const int64_t delta) {
+        std::string operand;
+        std::string result;
+        encodeCounter(delta, operand);
+        _return.responseCode = merge(mapName, key, operand, mergeIncrement, result);
+        if (_return.responseCode == ResponseCode::Success) {
+            decodeCounter(result, _return.value);
+        }
+    }
+
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& value) {
+        initMySql();
+        // a single statement, so it's atomic.
+        std::string query = "insert " + escapeString(mapName) + " values('" + 
+            escapeString(key) + "', '" + escapeString(value) + "') " +
+            "on duplicate key update record_value = concat(record_value, values(record_value))";
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                return ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                return ResponseCode::Error;
+            }
+        }
+        return ResponseCode::Success;
+    }
+
     ResponseCode::type remove(const std::string& mapName, const std::string& key) {
         initMySql();
         std::string query = "delete from " + escapeString(mapName) + 
@@ -268,7 +722,259 @@ public:
         return ResponseCode::Success;
     }
 
+    void removeRange(Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        initMySql();
+        std::string query = "delete from " + escapeString(mapName) + 
+            " where record_key >= '" + escapeString(startKey) + "'";
+        if (!endKey.empty()) {
+            query += " and record_key < '" + escapeString(endKey) + "'";
+        }
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                _return.responseCode = ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                _return.responseCode = ResponseCode::Error;
+            }
+            return;
+        }
+        _return.value = mysql_affected_rows(mysql_->get());
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type writeBatch(const std::string& mapName, const std::vector<Mutation>& mutations) {
+        initMySql();
+        std::string query = "start transaction";
+        if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+            fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+            return ResponseCode::Error;
+        }
+        ResponseCode::type rc = ResponseCode::Success;
+        std::vector<Mutation>::const_iterator mutation;
+        for (mutation = mutations.begin(); mutation != mutations.end(); mutation++) {
+            rc = applyMutation(mapName, *mutation);
+            if (rc != ResponseCode::Success) {
+                break;
+            }
+        }
+        query = rc == ResponseCode::Success ? "commit" : "rollback";
+        if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+            fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+            return ResponseCode::Error;
+        }
+        return rc;
+    }
+
+    void tailChanges(ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        // changes are logged by ChangeLogHandler, which main() puts in
+        // front of this handler.
+        _return.responseCode = ResponseCode::Error;
+    }
+
 private:
+    /**
+     * Queries name the table anyway, so a handle just maps back to the
+     * table name.
+     */
+    bool resolveHandle(int32_t mapHandle, std::string& mapName) {
+        boost::shared_lock< boost::shared_mutex> readLock(handlesMutex_);;
+        return handles_.get(mapHandle, mapName);
+    }
+
+    /**
+     * Executes a single mutation of a batch. The caller is responsible for
+     * the surrounding transaction.
+     */
+    ResponseCode::type applyMutation(const std::string& mapName, const Mutation& mutation) {
+        std::string query;
+        if (mutation.type == MutationType::Put) {
+            query = "insert " + escapeString(mapName) + " values('" + 
+                escapeString(mutation.key) + "', '" + 
+                escapeString(mutation.value) + "') on duplicate key update record_value = values(record_value)";
+        } else if (mutation.type == MutationType::Insert) {
+            query = "insert " + escapeString(mapName) + " values('" + 
+                escapeString(mutation.key) + "', '" + 
+                escapeString(mutation.value) + "')";
+        } else if (mutation.type == MutationType::Update) {
+            query = "update " + escapeString(mapName) + " set record_value = '" + 
+                escapeString(mutation.value) + "' where record_key = '" +  escapeString(mutation.key) + "'";
+        } else {
+            query = "delete from " + escapeString(mapName) + 
+                " where record_key = '" +  escapeString(mutation.key) + "'";
+        }
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                return ResponseCode::MapNotFound;
+            } else if (error == ER_DUP_ENTRY) {
+                return ResponseCode::RecordExists;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                return ResponseCode::Error;
+            }
+        }
+        if (mutation.type == MutationType::Update || mutation.type == MutationType::Remove) {
+            if (mysql_affected_rows(mysql_->get()) == 0) {
+                return ResponseCode::RecordNotFound;
+            }
+        }
+        return ResponseCode::Success;
+    }
+
+    /**
+     * Replaces the value of a record with mergeFunction(value, operand).
+     * The record is read with "select ... for update" in the same 
+     * transaction as the write, so concurrent merges are serialized.
+     */
+    ResponseCode::type merge(const std::string& mapName, const std::string& key,
+                             const std::string& operand, MergeFunction mergeFunction,
+                             std::string& result) {
+        initMySql();
+        std::string query = "start transaction";
+        if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+            fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+            return ResponseCode::Error;
+        }
+        ResponseCode::type rc = ResponseCode::Success;
+        query = "select record_value from " + escapeString(mapName) + 
+            " where record_key = '" + escapeString(key) + "' for update";
+        if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                rc = ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                rc = ResponseCode::Error;
+            }
+        } else {
+            MYSQL_RES* res = mysql_store_result(mysql_->get());
+            MYSQL_ROW row = mysql_fetch_row(res);
+            bool merged;
+            if (row) {
+                uint64_t* lengths = mysql_fetch_lengths(res);
+                std::string current(row[0], lengths[0]);
+                merged = mergeFunction(&current, operand, result);
+            } else {
+                merged = mergeFunction(NULL, operand, result);
+            }
+            mysql_free_result(res);
+            if (!merged) {
+                rc = ResponseCode::Error;
+            }
+        }
+        if (rc == ResponseCode::Success) {
+            query = "insert " + escapeString(mapName) + " values('" + escapeString(key) + 
+                "', '" + escapeString(result) + "') " +
+                "on duplicate key update record_value = values(record_value)";
+            if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+                fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+                rc = ResponseCode::Error;
+            }
+        }
+        query = rc == ResponseCode::Success ? "commit" : "rollback";
+        if (0 != mysql_real_query(mysql_->get(), query.c_str(), query.length())) {
+            fprintf(stderr, "%d %s\n", mysql_errno(mysql_->get()), mysql_error(mysql_->get()));
+            return ResponseCode::Error;
+        }
+        return rc;
+    }
+
+    /**
+     * Evaluates an aggregate expression over the records in 
+     * [startKey, endKey).
+     */
+    void selectRange(Int64Response& _return, const std::string& expression, 
+                     const std::string& mapName, 
+                     const std::string& startKey, const std::string& endKey) {
+        initMySql();
+        std::string query = "select " + expression + " from " + escapeString(mapName) + 
+            " where record_key >= '" + escapeString(startKey) + "'";
+        if (!endKey.empty()) {
+            query += " and record_key < '" + escapeString(endKey) + "'";
+        }
+        int result = mysql_real_query(mysql_->get(), query.c_str(), query.length());
+        if (result != 0) {
+            uint32_t error = mysql_errno(mysql_->get());
+            if (error == ER_NO_SUCH_TABLE) {
+                _return.responseCode = ResponseCode::MapNotFound;
+            } else {
+                fprintf(stderr, "%d %s\n", error, mysql_error(mysql_->get()));
+                _return.responseCode = ResponseCode::Error;
+            }
+            return;
+        }
+        MYSQL_RES* res = mysql_store_result(mysql_->get());
+        MYSQL_ROW row = mysql_fetch_row(res);
+        assert(row);
+        // sum() is null over an empty range.
+        _return.value = row[0] ? strtoll(row[0], NULL, 10) : 0;
+        mysql_free_result(res);
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    /**
+     * Returns the select expression for the part of record_value that 
+     * a scan asked for, so that MySQL doesn't send the rest.
+     */
+    std::string valueColumn(const ScanOptions& options) {
+        if (options.keysOnly) {
+            return "''";
+        }
+        if (isFullValue(options)) {
+            return "record_value";
+        }
+        // substring positions start from 1.
+        std::string column = "substring(record_value, " + 
+            boost::lexical_cast<std::string>(projectionOffset(options) + 1);
+        if (options.valueLength >= 0) {
+            column += ", " + boost::lexical_cast<std::string>(options.valueLength);
+        }
+        return column + ")";
+    }
+
+    /**
+     * Returns the where clause terms for a scan filter, so that MySQL 
+     * skips the records that don't match. The columns are binary, so
+     * comparisons are byte by byte.
+     */
+    std::string filterCondition(const ScanFilter& filter) {
+        std::string condition;
+        if (!filter.keyPrefix.empty()) {
+            condition += " and left(record_key, " + boost::lexical_cast<std::string>(filter.keyPrefix.size()) + 
+                ") = '" + escapeString(filter.keyPrefix) + "'";
+        }
+        if (!filter.keySuffix.empty()) {
+            condition += " and right(record_key, " + boost::lexical_cast<std::string>(filter.keySuffix.size()) + 
+                ") = '" + escapeString(filter.keySuffix) + "'";
+        }
+        if (!filter.valuePrefix.empty()) {
+            condition += " and left(record_value, " + boost::lexical_cast<std::string>(filter.valuePrefix.size()) + 
+                ") = '" + escapeString(filter.valuePrefix) + "'";
+        }
+        static const char* ops[] = {"=", "<>", "<", "<=", ">", ">="};
+        std::vector<ValueCondition>::const_iterator itr;
+        for (itr = filter.valueConditions.begin(); itr != filter.valueConditions.end(); itr++) {
+            if (itr->offset < 0 || itr->op < CompareOp::Equal || itr->op > CompareOp::GreaterOrEqual) {
+                // matches nothing, like matchesCondition.
+                condition += " and false";
+                continue;
+            }
+            std::string length = boost::lexical_cast<std::string>(itr->operand.size());
+            // substring positions start from 1.
+            std::string position = boost::lexical_cast<std::string>(itr->offset + 1);
+            condition += " and length(record_value) >= " + 
+                boost::lexical_cast<std::string>((int64_t)itr->offset + itr->operand.size()) +
+                " and substring(record_value, " + position + ", " + length + ") " + 
+                ops[itr->op] + " '" + escapeString(itr->operand) + "'";
+        }
+        return condition;
+    }
+
     std::string escapeString(const std::string& str) {
         initMySql();
         // http://dev.mysql.com/doc/refman/4.1/en/mysql-real-escape-string.html
@@ -297,7 +1003,7 @@ private:
             NULL,           // default database
             port_,          // port 
             NULL,           // unix socket
-            0               // flags
+            CLIENT_FOUND_ROWS // affected rows include unchanged rows
         ));
         std::string query = "create database if not exists mapkeeper";
         assert(0 == mysql_real_query(mysql_->get(), query.c_str(), query.length()));
@@ -310,19 +1016,52 @@ private:
         free(mysql);
     }
 
+    struct ScanCursor {
+        std::string mapName;
+        ScanOrder::type order;
+        std::string startKey;
+        bool startKeyIncluded;
+        std::string endKey;
+        bool endKeyIncluded;
+        ScanOptions options;
+        boost::mutex mutex; // serialize nextScan calls on this cursor
+    };
+
     std::string host_;
     uint32_t port_;
     boost::thread_specific_ptr<MYSQL>* mysql_;
+    CursorTable<ScanCursor> cursors_;
+    MapHandleTable<std::string> handles_;
+    boost::shared_mutex handlesMutex_; // protect handles_
 };
 
 int main(int argc, char **argv) {
-    int port = 9090;
-    shared_ptr<MySqlServer> handler(new MySqlServer("localhost", 3306));
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server(processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    int port;
+    int changeLogSize;
+    ServerRunner runner;
+    po::variables_map vm;
+    po::options_description config("");
+    config.add_options()
+        ("help,h", "produce help message")
+        ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
+        ("change-log-size", po::value<int>(&changeLogSize)->default_value(10000), "number of changes per map to keep for tailChanges (0 to disable)")
+        ;
+    runner.addOptions(config);
+    po::options_description cmdline_options;
+    cmdline_options.add(config);
+    store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    notify(vm);
+    if (vm.count("help")) {
+        std::cout << config << std::endl;
+        exit(0);
+    }
+    shared_ptr<MapKeeperIf> handler(new MySqlServer("localhost", 3306));
+    handler = runner.groupCommit(handler);
+    handler = runner.cache(handler);
+    if (changeLogSize > 0) {
+        handler.reset(new ChangeLogHandler(handler, changeLogSize));
+    }
+    handler.reset(new TtlHandler(handler));
+    runner.serve(handler, port);
     return 0;
 }
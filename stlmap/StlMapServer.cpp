@@ -18,14 +18,26 @@
  * This is a stub implementation of the mapkeeper interface that uses 
  * std::map. Data is not persisted.
  */
+#include <iostream>
 #include <map>
 #include <string>
 #include <arpa/inet.h>
 #include "MapKeeper.h"
+#include "Aggregator.h"
+#include "ChangeLogHandler.h"
+#include "TtlHandler.h"
+#include "CursorTable.h"
+#include "MapHandleTable.h"
+#include "MergeOperator.h"
+#include "ScanFilter.h"
+#include "ScanStreamServer.h"
+#include "ServerRunner.h"
+#include "SplitPoints.h"
+#include "ValueProjection.h"
 
+#include <boost/program_options.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include <protocol/TBinaryProtocol.h>
-#include <server/TThreadedServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 
@@ -35,6 +47,7 @@ using namespace ::apache::thrift::transport;
 using namespace ::apache::thrift::server;
 
 using boost::shared_ptr;
+namespace po = boost::program_options;
 
 class StlMapServer: virtual public MapKeeperIf {
 public:
@@ -42,6 +55,11 @@ public:
         return ResponseCode::Success;
     }
 
+    // answered by StatsHandler, which ServerRunner puts in front.
+    void getStats(StatsResponse& _return, const bool reset) {
+        _return.responseCode = ResponseCode::Error;
+    }
+
     ResponseCode::type addMap(const string& mapName) {
         boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
         map<string, map<string, string> >::iterator itr = maps_.find(mapName);
@@ -60,6 +78,9 @@ public:
         if (itr == maps_.end()) {
             return ResponseCode::MapNotFound;
         }
+        cursors_.removeMap(mapName);
+        snapshots_.removeMap(mapName);
+        handles_.remove(mapName);
         maps_.erase(itr);
         return ResponseCode::Success;
     }
@@ -73,10 +94,66 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    void openMap(MapHandleResponse& _return, const string& mapName) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        _return.handle = handles_.add(mapName, &itr->second);
+        _return.responseCode = _return.handle >= 0 ? ResponseCode::Success : ResponseCode::TooManyHandles;
+    }
+
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const string& key) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, string>* mymap;
+        if (!handles_.get(mapHandle, mymap)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        map<string, string>::iterator recordIterator = mymap->find(key);
+        if (recordIterator == mymap->end()) {
+            _return.responseCode = ResponseCode::RecordNotFound;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+        _return.value = recordIterator->second;
+    }
+
+    ResponseCode::type putByHandle(const int32_t mapHandle, const string& key, const string& value) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, string>* mymap;
+        if (!handles_.get(mapHandle, mymap)) {
+            return ResponseCode::MapNotFound;
+        }
+        (*mymap)[key] = value;
+        return ResponseCode::Success;
+    }
+
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle, const ScanOrder::type order,
+                      const string& startKey, const bool startKeyIncluded,
+                      const string& endKey, const bool endKeyIncluded,
+                      const int32_t maxRecords, const int32_t maxBytes,
+                      const ScanOptions& options) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, string>* mymap;
+        if (!handles_.get(mapHandle, mymap)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        if (order == ScanOrder::Ascending) {
+          scanAscending(_return, *mymap, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        } else {
+          scanDescending(_return, *mymap, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        }
+    }
+
     void scan(RecordListResponse& _return, const string& mapName, const ScanOrder::type order,
               const string& startKey, const bool startKeyIncluded,
               const string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
         map<string, map<string, string> >::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -84,16 +161,17 @@ public:
             return;
         }
         if (order == ScanOrder::Ascending) {
-          scanAscending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+          scanAscending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
         } else {
-          scanDescending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes);
+          scanDescending(_return, itr->second, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
         }
     }
 
     void scanAscending(RecordListResponse& _return, const map<string, string>& mymap,
               const string& startKey, const bool startKeyIncluded,
               const string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         map<string, string>::const_iterator itr = startKeyIncluded ? 
             mymap.lower_bound(startKey):
             mymap.upper_bound(startKey);
@@ -107,9 +185,14 @@ public:
                   break;
                 }
             }
+            if (!matchesFilter(options.filter, itr->first.data(), itr->first.size(),
+                               itr->second.data(), itr->second.size())) {
+                itr++;
+                continue;
+            }
             Record record;
             record.key = itr->first;
-            record.value = itr->second;
+            projectValue(options, itr->second.data(), itr->second.size(), record.value);
             numBytes += record.key.size() + record.value.size();
             _return.records.push_back(record);
             if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
@@ -124,7 +207,8 @@ public:
     void scanDescending(RecordListResponse& _return, const map<string, string>& mymap,
               const string& startKey, const bool startKeyIncluded,
               const string& endKey, const bool endKeyIncluded,
-              const int32_t maxRecords, const int32_t maxBytes) {
+              const int32_t maxRecords, const int32_t maxBytes,
+              const ScanOptions& options) {
         map<string, string>::const_iterator itr;
         if (endKey.empty()) {
             itr = mymap.end();
@@ -140,9 +224,13 @@ public:
             if (!startKeyIncluded && startKey >= itr->first) {
                 break;
             }
+            if (!matchesFilter(options.filter, itr->first.data(), itr->first.size(),
+                               itr->second.data(), itr->second.size())) {
+                continue;
+            }
             Record record;
             record.key = itr->first;
-            record.value = itr->second;
+            projectValue(options, itr->second.data(), itr->second.size(), record.value);
             numBytes += record.key.size() + record.value.size();
             _return.records.push_back(record);
             if (_return.records.size() >= (uint32_t)maxRecords || numBytes >= maxBytes) {
@@ -153,6 +241,207 @@ public:
         _return.responseCode = ResponseCode::ScanEnded;
     }
  
+    void openScan(ScanCursorResponse& _return, const string& mapName, const ScanOrder::type order,
+              const string& startKey, const bool startKeyIncluded,
+              const string& endKey, const bool endKeyIncluded,
+              const ScanOptions& options) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        if (maps_.find(mapName) == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        shared_ptr<ScanCursor> cursor(new ScanCursor());
+        cursor->mapName = mapName;
+        cursor->order = order;
+        cursor->startKey = startKey;
+        cursor->startKeyIncluded = startKeyIncluded;
+        cursor->endKey = endKey;
+        cursor->endKeyIncluded = endKeyIncluded;
+        cursor->options = options;
+        _return.cursorId = cursors_.add(cursor);
+        _return.responseCode = _return.cursorId ? ResponseCode::Success : ResponseCode::TooManyCursors;
+    }
+
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        shared_ptr<ScanCursor> cursor = cursors_.get(cursorId);
+        if (!cursor) {
+            _return.responseCode = ResponseCode::CursorNotFound;
+            return;
+        }
+        const map<string, string>& mymap = maps_[cursor->mapName];
+
+        // std::map lookups are cheap, so the cursor just remembers the
+        // last key it returned and narrows the range past it.
+        if (cursor->order == ScanOrder::Ascending) {
+            scanAscending(_return, mymap, cursor->startKey, cursor->startKeyIncluded, 
+                          cursor->endKey, cursor->endKeyIncluded, maxRecords, maxBytes,
+                          cursor->options);
+            if (!_return.records.empty()) {
+                cursor->startKey = _return.records.back().key;
+                cursor->startKeyIncluded = false;
+            }
+        } else {
+            scanDescending(_return, mymap, cursor->startKey, cursor->startKeyIncluded, 
+                           cursor->endKey, cursor->endKeyIncluded, maxRecords, maxBytes,
+                           cursor->options);
+            if (!_return.records.empty()) {
+                cursor->endKey = _return.records.back().key;
+                cursor->endKeyIncluded = false;
+                if (cursor->endKey.empty()) {
+                    // empty endKey would mean the end of the map.
+                    _return.responseCode = ResponseCode::ScanEnded;
+                }
+            }
+        }
+        if (_return.responseCode == ResponseCode::ScanEnded) {
+            cursors_.remove(cursorId);
+        }
+    }
+
+    ResponseCode::type closeScan(const int64_t cursorId) {
+        if (!cursors_.remove(cursorId)) {
+            return ResponseCode::CursorNotFound;
+        }
+        return ResponseCode::Success;
+    }
+
+    /**
+     * std::map has no versions, so a snapshot is a copy of the map.
+     */
+    void createSnapshot(SnapshotResponse& _return, const string& mapName) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        shared_ptr<Snapshot> snapshot(new Snapshot());
+        snapshot->mapName = mapName;
+        snapshot->records = itr->second;
+        _return.snapshotId = snapshots_.add(snapshot);
+        _return.responseCode = _return.snapshotId ? ResponseCode::Success : ResponseCode::TooManySnapshots;
+    }
+
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        if (!snapshots_.remove(snapshotId)) {
+            return ResponseCode::SnapshotNotFound;
+        }
+        return ResponseCode::Success;
+    }
+
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const string& key) {
+        shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+        if (!snapshot) {
+            _return.responseCode = ResponseCode::SnapshotNotFound;
+            return;
+        }
+        map<string, string>::const_iterator recordIterator = snapshot->records.find(key);
+        if (recordIterator == snapshot->records.end()) {
+            _return.responseCode = ResponseCode::RecordNotFound;
+            return;
+        }
+        _return.responseCode = ResponseCode::Success;
+        _return.value = recordIterator->second;
+    }
+
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, const ScanOrder::type order,
+                        const string& startKey, const bool startKeyIncluded,
+                        const string& endKey, const bool endKeyIncluded,
+                        const int32_t maxRecords, const int32_t maxBytes,
+                        const ScanOptions& options) {
+        shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+        if (!snapshot) {
+            _return.responseCode = ResponseCode::SnapshotNotFound;
+            return;
+        }
+        if (order == ScanOrder::Ascending) {
+          scanAscending(_return, snapshot->records, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        } else {
+          scanDescending(_return, snapshot->records, startKey, startKeyIncluded, endKey, endKeyIncluded, maxRecords, maxBytes, options);
+        }
+    }
+
+    void countRange(Int64Response& _return, const string& mapName,
+                    const string& startKey, const string& endKey) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        int64_t numBytes;
+        sumRange(itr->second, startKey, endKey, _return.value, numBytes);
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void approximateSize(Int64Response& _return, const string& mapName,
+                         const string& startKey, const string& endKey) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        int64_t numRecords;
+        sumRange(itr->second, startKey, endKey, numRecords, _return.value);
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    /**
+     * The map knows its size, so every n-th key is an exact split point
+     * and no sampling is needed. It's still a walk over the keys, but 
+     * the values aren't touched.
+     */
+    void sampleSplitPoints(KeyListResponse& _return, const string& mapName,
+                           const int32_t numSplits) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        if (!validSplitCount(numSplits)) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        StridePicker picker(itr->second.size(), numSplits);
+        map<string, string>::iterator recordIterator = itr->second.begin();
+        for (uint64_t i = 0; recordIterator != itr->second.end() && !picker.done(); i++) {
+            if (picker.pick(i)) {
+                _return.keys.push_back(recordIterator->first);
+            }
+            recordIterator++;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void aggregate(AggregateResponse& _return, const string& mapName,
+                   const string& startKey, const string& endKey,
+                   const AggregateOp::type op, const ValueEncoding::type encoding) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        Aggregator aggregator(op, encoding);
+        if (!aggregator.isValid()) {
+            _return.responseCode = ResponseCode::Error;
+            return;
+        }
+        map<string, string>::iterator recordIterator = itr->second.lower_bound(startKey);
+        for (; recordIterator != itr->second.end(); recordIterator++) {
+            if (!endKey.empty() && endKey <= recordIterator->first) {
+                break;
+            }
+            aggregator.add(recordIterator->second.data(), recordIterator->second.size());
+        }
+        aggregator.getResult(_return);
+        _return.responseCode = ResponseCode::Success;
+    }
+
     void get(BinaryResponse& _return, const string& mapName, const string& key) {
         boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
         map<string, map<string, string> >::iterator itr = maps_.find(mapName);
@@ -169,7 +458,28 @@ public:
         _return.value = recordIterator->second;
     }
 
-    ResponseCode::type put(const string& mapName, const string& key, const string& value) {
+    void multiGet(BinaryListResponse& _return, const string& mapName, const vector<string>& keys) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        _return.responses.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            map<string, string>::iterator recordIterator = itr->second.find(keys[i]);
+            if (recordIterator == itr->second.end()) {
+                _return.responses[i].responseCode = ResponseCode::RecordNotFound;
+                continue;
+            }
+            _return.responses[i].responseCode = ResponseCode::Success;
+            _return.responses[i].value = recordIterator->second;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type put(const string& mapName, const string& key, const string& value,
+            const WriteOptions& options) {
         boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
         map<string, map<string, string> >::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -179,7 +489,8 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type insert(const string& mapName, const string& key, const string& value) {
+    ResponseCode::type insert(const string& mapName, const string& key, const string& value,
+            const WriteOptions& options) {
         boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
         map<string, map<string, string> >::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -192,7 +503,31 @@ public:
         return ResponseCode::Success;
     }
 
-    ResponseCode::type update(const string& mapName, const string& key, const string& value) {
+    ResponseCode::type insertMany(const string& mapName, const vector<Record>& records) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        map<string, string> newRecords;
+        vector<Record>::const_iterator record;
+        for (record = records.begin(); record != records.end(); record++) {
+            if (itr->second.find(record->key) != itr->second.end() ||
+                !newRecords.insert(pair<string, string>(record->key, record->value)).second) {
+                return ResponseCode::RecordExists;
+            }
+        }
+        itr->second.insert(newRecords.begin(), newRecords.end());
+        return ResponseCode::Success;
+    }
+
+    // only the LevelDB backend can load table files directly.
+    ResponseCode::type ingestFile(const string& mapName, const string& path) {
+        return ResponseCode::Error;
+    }
+
+    ResponseCode::type update(const string& mapName, const string& key, const string& value,
+            const WriteOptions& options) {
         boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
         map<string, map<string, string> >::iterator itr = maps_.find(mapName);
         if (itr == maps_.end()) {
@@ -205,6 +540,39 @@ public:
         return ResponseCode::Success;
     }
 
+    ResponseCode::type compareAndSet(const string& mapName, const string& key, 
+                                     const string& expectedValue, const string& newValue) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        map<string, string>::iterator recordIterator = itr->second.find(key);
+        if (recordIterator == itr->second.end()) {
+            return ResponseCode::RecordNotFound;
+        }
+        if (recordIterator->second != expectedValue) {
+            return ResponseCode::ValueMismatch;
+        }
+        recordIterator->second = newValue;
+        return ResponseCode::Success;
+    }
+
+    void increment(Int64Response& _return, const string& mapName, const string& key, const int64_t delta) {
+        string operand;
+        string result;
+        encodeCounter(delta, operand);
+        _return.responseCode = merge(mapName, key, operand, mergeIncrement, result);
+        if (_return.responseCode == ResponseCode::Success) {
+            decodeCounter(result, _return.value);
+        }
+    }
+
+    ResponseCode::type append(const string& mapName, const string& key, const string& value) {
+        string result;
+        return merge(mapName, key, value, mergeAppend, result);
+    }
+
     ResponseCode::type remove(const string& mapName, const string& key) {
         boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
         map<string, map<string, string> >::iterator itr = maps_.find(mapName);
@@ -219,19 +587,172 @@ public:
         return ResponseCode::Success;
     }
 
+    void removeRange(Int64Response& _return, const string& mapName,
+                     const string& startKey, const string& endKey) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+        map<string, string>& mymap = itr->second;
+        _return.value = 0;
+        _return.responseCode = ResponseCode::Success;
+        if (!endKey.empty() && endKey <= startKey) {
+            return;
+        }
+        map<string, string>::iterator first = mymap.lower_bound(startKey);
+        map<string, string>::iterator last = endKey.empty() ? mymap.end() : mymap.lower_bound(endKey);
+        _return.value = distance(first, last);
+        mymap.erase(first, last);
+    }
+
+    ResponseCode::type writeBatch(const string& mapName, const vector<Mutation>& mutations) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        map<string, string>& mymap = itr->second;
+
+        // original state of every key touched by the batch, so that we can
+        // roll back if one of the mutations fails.
+        map<string, pair<bool, string> > undo;
+        ResponseCode::type rc = ResponseCode::Success;
+        vector<Mutation>::const_iterator mutation;
+        for (mutation = mutations.begin(); mutation != mutations.end(); mutation++) {
+            map<string, string>::iterator record = mymap.find(mutation->key);
+            bool exists = record != mymap.end();
+            if (mutation->type == MutationType::Insert && exists) {
+                rc = ResponseCode::RecordExists;
+                break;
+            }
+            if ((mutation->type == MutationType::Update || mutation->type == MutationType::Remove) && !exists) {
+                rc = ResponseCode::RecordNotFound;
+                break;
+            }
+            if (undo.find(mutation->key) == undo.end()) {
+                undo[mutation->key] = make_pair(exists, exists ? record->second : string());
+            }
+            if (mutation->type == MutationType::Remove) {
+                mymap.erase(record);
+            } else {
+                mymap[mutation->key] = mutation->value;
+            }
+        }
+        if (rc != ResponseCode::Success) {
+            map<string, pair<bool, string> >::iterator entry;
+            for (entry = undo.begin(); entry != undo.end(); entry++) {
+                if (entry->second.first) {
+                    mymap[entry->first] = entry->second.second;
+                } else {
+                    mymap.erase(entry->first);
+                }
+            }
+        }
+        return rc;
+    }
+
+    void tailChanges(ChangeListResponse& _return, const string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        // changes are logged by ChangeLogHandler, which main() puts in
+        // front of this handler.
+        _return.responseCode = ResponseCode::Error;
+    }
+
 private:
+    /**
+     * Replaces the value of a record with mergeFunction(value, operand),
+     * under the write lock.
+     */
+    ResponseCode::type merge(const string& mapName, const string& key, const string& operand,
+                             MergeFunction mergeFunction, string& result) {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        map<string, map<string, string> >::iterator itr = maps_.find(mapName);
+        if (itr == maps_.end()) {
+            return ResponseCode::MapNotFound;
+        }
+        map<string, string>::iterator recordIterator = itr->second.find(key);
+        const string* current = recordIterator == itr->second.end() ? NULL : &recordIterator->second;
+        if (!mergeFunction(current, operand, result)) {
+            return ResponseCode::Error;
+        }
+        itr->second[key] = result;
+        return ResponseCode::Success;
+    }
+
+    /**
+     * Counts the records in [startKey, endKey), and the bytes they take.
+     */
+    void sumRange(const map<string, string>& mymap, const string& startKey, const string& endKey,
+                  int64_t& numRecords, int64_t& numBytes) {
+        numRecords = 0;
+        numBytes = 0;
+        map<string, string>::const_iterator itr = mymap.lower_bound(startKey);
+        for (; itr != mymap.end(); itr++) {
+            if (!endKey.empty() && endKey <= itr->first) {
+                break;
+            }
+            numRecords++;
+            numBytes += itr->first.size() + itr->second.size();
+        }
+    }
+
+    struct ScanCursor {
+        string mapName;
+        ScanOrder::type order;
+        string startKey;
+        bool startKeyIncluded;
+        string endKey;
+        bool endKeyIncluded;
+        ScanOptions options;
+    };
+
+    struct Snapshot {
+        string mapName;
+        map<string, string> records; // never modified after the copy
+    };
+
     map<string, map<string, string> > maps_;
     boost::shared_mutex mutex_; // protect map_
+    CursorTable<ScanCursor> cursors_;
+    CursorTable<Snapshot> snapshots_;
+    MapHandleTable<map<string, string>*> handles_;
 };
 
 int main(int argc, char **argv) {
-    int port = 9090;
-    shared_ptr<StlMapServer> handler(new StlMapServer());
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server(processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    int port;
+    int streamPort;
+    int maxStreams;
+    int changeLogSize;
+    ServerRunner runner("threaded", true);
+    po::variables_map vm;
+    po::options_description config("");
+    config.add_options()
+        ("help,h", "produce help message")
+        ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
+        ("stream-port", po::value<int>(&streamPort)->default_value(0), "port for streaming scans (0 to disable)")
+        ("max-streams", po::value<int>(&maxStreams)->default_value(64), "scans streamed at once before the rest get Busy")
+        ("change-log-size", po::value<int>(&changeLogSize)->default_value(10000), "number of changes per map to keep for tailChanges (0 to disable)")
+        ;
+    runner.addOptions(config);
+    po::options_description cmdline_options;
+    cmdline_options.add(config);
+    store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    notify(vm);
+    if (vm.count("help")) {
+        std::cout << config << std::endl;
+        exit(0);
+    }
+    shared_ptr<MapKeeperIf> handler(new StlMapServer());
+    if (changeLogSize > 0) {
+        handler.reset(new ChangeLogHandler(handler, changeLogSize));
+    }
+    handler.reset(new TtlHandler(handler));
+    ScanStreamServer streamServer(runner.admit(handler), streamPort, maxStreams);
+    if (streamPort) {
+        streamServer.start();
+    }
+    runner.serve(handler, port);
     return 0;
 }
@@ -18,17 +18,11 @@
  * This is a stub implementation of the mapkeeper interface that
  * doesn't do anything.
  */
+#include <iostream>
 #include "MapKeeper.h"
+#include "ServerRunner.h"
 
-#include <protocol/TBinaryProtocol.h>
-#include <server/TServer.h>
-#include <server/TThreadPoolServer.h>
-#include <server/TNonblockingServer.h>
-#include <server/TThreadedServer.h>
-#include <transport/TServerSocket.h>
-#include <transport/TBufferTransports.h>
-#include <thrift/concurrency/ThreadManager.h>
-#include <thrift/concurrency/PosixThreadFactory.h>
+#include <boost/program_options.hpp>
 
 using namespace ::apache::thrift;
 using namespace ::apache::thrift::protocol;
@@ -37,6 +31,7 @@ using namespace ::apache::thrift::server;
 using namespace ::apache::thrift::concurrency;
 
 using boost::shared_ptr;
+namespace po = boost::program_options;
 using namespace mapkeeper;
 
 class StubServer: virtual public MapKeeperIf {
@@ -48,6 +43,10 @@ public:
         return ResponseCode::Success;
     }
 
+    void getStats(StatsResponse& _return, const bool reset) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
     ResponseCode::type addMap(const std::string& mapName) {
         return ResponseCode::Success;
     }
@@ -60,11 +59,90 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
+    void openMap(MapHandleResponse& _return, const std::string& mapName) {
+        _return.responseCode = ResponseCode::Success;
+        _return.handle = 0;
+    }
+
+    void getByHandle(BinaryResponse& _return, const int32_t mapHandle, const std::string& key) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type putByHandle(const int32_t mapHandle, const std::string& key, const std::string& value) {
+        return ResponseCode::Success;
+    }
+
+    void scanByHandle(RecordListResponse& _return, const int32_t mapHandle, 
+                      const ScanOrder::type order, const std::string& startKey, 
+                      const bool startKeyIncluded, const std::string& endKey, 
+                      const bool endKeyIncluded, const int32_t maxRecords, 
+                      const int32_t maxBytes, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
     void scan(RecordListResponse& _return, const std::string& mapName, 
               const ScanOrder::type order, const std::string& startKey, 
               const bool startKeyIncluded, const std::string& endKey, 
               const bool endKeyIncluded, const int32_t maxRecords, 
-              const int32_t maxBytes) {
+              const int32_t maxBytes, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void openScan(ScanCursorResponse& _return, const std::string& mapName, 
+                  const ScanOrder::type order, const std::string& startKey, 
+                  const bool startKeyIncluded, const std::string& endKey, 
+                  const bool endKeyIncluded, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
+                  const int32_t maxRecords, const int32_t maxBytes) {
+        _return.responseCode = ResponseCode::ScanEnded;
+    }
+
+    ResponseCode::type closeScan(const int64_t cursorId) {
+        return ResponseCode::Success;
+    }
+
+    void createSnapshot(SnapshotResponse& _return, const std::string& mapName) {
+        _return.responseCode = ResponseCode::Success;
+        _return.snapshotId = 0;
+    }
+
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId) {
+        return ResponseCode::Success;
+    }
+
+    void getAtSnapshot(BinaryResponse& _return, const int64_t snapshotId, const std::string& key) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void scanAtSnapshot(RecordListResponse& _return, const int64_t snapshotId, 
+                        const ScanOrder::type order, const std::string& startKey, 
+                        const bool startKeyIncluded, const std::string& endKey, 
+                        const bool endKeyIncluded, const int32_t maxRecords, 
+                        const int32_t maxBytes, const ScanOptions& options) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void countRange(Int64Response& _return, const std::string& mapName, 
+                    const std::string& startKey, const std::string& endKey) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void approximateSize(Int64Response& _return, const std::string& mapName, 
+                         const std::string& startKey, const std::string& endKey) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void sampleSplitPoints(KeyListResponse& _return, const std::string& mapName,
+                           const int32_t numSplits) {
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    void aggregate(AggregateResponse& _return, const std::string& mapName,
+                   const std::string& startKey, const std::string& endKey,
+                   const AggregateOp::type op, const ValueEncoding::type encoding) {
         _return.responseCode = ResponseCode::Success;
     }
 
@@ -72,53 +150,91 @@ public:
         _return.responseCode = ResponseCode::Success;
     }
 
-    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value) {
+    void multiGet(BinaryListResponse& _return, const std::string& mapName, const std::vector<std::string>& keys) {
+        _return.responses.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            _return.responses[i].responseCode = ResponseCode::Success;
+        }
+        _return.responseCode = ResponseCode::Success;
+    }
+
+    ResponseCode::type put(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type insertMany(const std::string& mapName, const std::vector<Record>& records) {
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type ingestFile(const std::string& mapName, const std::string& path) {
+        return ResponseCode::Success;
+    }
+
+    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value,
+            const WriteOptions& options) {
         return ResponseCode::Success;
     }
 
-    ResponseCode::type insert(const std::string& mapName, const std::string& key, const std::string& value) {
+    ResponseCode::type compareAndSet(const std::string& mapName, const std::string& key, 
+                                     const std::string& expectedValue, const std::string& newValue) {
         return ResponseCode::Success;
     }
 
-    ResponseCode::type update(const std::string& mapName, const std::string& key, const std::string& value) {
+    void increment(Int64Response& _return, const std::string& mapName, const std::string& key, const int64_t delta) {
+        _return.responseCode = ResponseCode::Success;
+        _return.value = delta;
+    }
+
+    ResponseCode::type append(const std::string& mapName, const std::string& key, const std::string& value) {
         return ResponseCode::Success;
     }
 
     ResponseCode::type remove(const std::string& mapName, const std::string& key) {
         return ResponseCode::Success;
     }
-};
 
-void usage(char* programName) {
-    fprintf(stderr, "%s [nonblocking|threaded|threadpool]\n", programName);
-    exit(1);
-}
+    void removeRange(Int64Response& _return, const std::string& mapName,
+                     const std::string& startKey, const std::string& endKey) {
+        _return.responseCode = ResponseCode::Success;
+        _return.value = 0;
+    }
+
+    ResponseCode::type writeBatch(const std::string& mapName, const std::vector<Mutation>& mutations) {
+        return ResponseCode::Success;
+    }
+
+    void tailChanges(ChangeListResponse& _return, const std::string& mapName,
+                     const int64_t fromSeq, const int32_t maxRecords) {
+        _return.responseCode = ResponseCode::Success;
+        _return.nextSeq = fromSeq;
+    }
+};
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        usage(argv[0]);
+    int port;
+    ServerRunner runner;
+    po::variables_map vm;
+    po::options_description config("");
+    config.add_options()
+        ("help,h", "produce help message")
+        ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
+        ;
+    runner.addOptions(config);
+    po::options_description cmdline_options;
+    cmdline_options.add(config);
+    store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    notify(vm);
+    if (vm.count("help")) {
+        std::cout << config << std::endl;
+        exit(0);
     }
-    int port = 9090;
-    size_t numThreads = 32;
     shared_ptr<StubServer> handler(new StubServer());
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    shared_ptr<ThreadManager> threadManager = ThreadManager::newSimpleThreadManager(numThreads);
-    shared_ptr<ThreadFactory> threadFactory(new PosixThreadFactory());
-    threadManager->threadFactory(threadFactory);
-    threadManager->start();
-    TServer* server = NULL;
-    if (strcmp(argv[1], "nonblocking") == 0) {
-        server = new TNonblockingServer(processor, protocolFactory, port, threadManager);
-    } else if (strcmp(argv[1], "threaded") == 0) {
-        server = new TThreadedServer(processor, serverTransport, transportFactory, protocolFactory);
-    } else if (strcmp(argv[1], "threadpool") == 0) {
-        server = new TThreadPoolServer(processor, serverTransport, transportFactory, protocolFactory, threadManager);
-    } else {
-        usage(argv[0]);
-    }
-    server->serve();
+    runner.serve(handler, port);
     return 0;
 }
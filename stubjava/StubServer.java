@@ -13,6 +13,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+import java.util.ArrayList;
 import java.util.List;
 import java.nio.ByteBuffer;
 import com.yahoo.mapkeeper.*;
@@ -27,6 +28,13 @@ class StubServer implements MapKeeper.Iface {
         return ResponseCode.Success;
     }
 
+    public StatsResponse getStats(boolean reset) throws TException
+    {
+        StatsResponse response = new StatsResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
     public ResponseCode addMap(String databaseName) throws TException
     {
         return ResponseCode.Success;
@@ -44,16 +52,127 @@ class StubServer implements MapKeeper.Iface {
         return response;
     }
 
+    public MapHandleResponse openMap(String databaseName) throws TException
+    {
+        MapHandleResponse response = new MapHandleResponse();
+        response.responseCode = ResponseCode.Success;
+        response.handle = 0;
+        return response;
+    }
+
+    public BinaryResponse getByHandle(int mapHandle, ByteBuffer recordKey) throws TException
+    {
+        BinaryResponse response = new BinaryResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public ResponseCode putByHandle(int mapHandle, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public RecordListResponse scanByHandle(int mapHandle, ScanOrder order, 
+        ByteBuffer startKey, boolean startKeyIncluded, 
+        ByteBuffer endKey, boolean endKeyIncluded, 
+        int maxRecords, int maxBytes, ScanOptions options) throws TException 
+    {
+        RecordListResponse response = new RecordListResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
     public RecordListResponse scan(String databaseName, ScanOrder order, 
         ByteBuffer startKey, boolean startKeyIncluded, 
         ByteBuffer endKey, boolean endKeyIncluded, 
-        int maxRecords, int maxBytes) throws TException 
+        int maxRecords, int maxBytes, ScanOptions options) throws TException 
+    {
+        RecordListResponse response = new RecordListResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public ScanCursorResponse openScan(String databaseName, ScanOrder order, 
+        ByteBuffer startKey, boolean startKeyIncluded, 
+        ByteBuffer endKey, boolean endKeyIncluded, 
+        ScanOptions options) throws TException 
+    {
+        ScanCursorResponse response = new ScanCursorResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public RecordListResponse nextScan(long cursorId, int maxRecords, int maxBytes) throws TException
+    {
+        RecordListResponse response = new RecordListResponse();
+        response.responseCode = ResponseCode.ScanEnded;
+        return response;
+    }
+
+    public ResponseCode closeScan(long cursorId) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public SnapshotResponse createSnapshot(String databaseName) throws TException
+    {
+        SnapshotResponse response = new SnapshotResponse();
+        response.responseCode = ResponseCode.Success;
+        response.snapshotId = 0;
+        return response;
+    }
+
+    public ResponseCode releaseSnapshot(long snapshotId) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public BinaryResponse getAtSnapshot(long snapshotId, ByteBuffer recordKey) throws TException
+    {
+        BinaryResponse response = new BinaryResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public RecordListResponse scanAtSnapshot(long snapshotId, ScanOrder order, 
+        ByteBuffer startKey, boolean startKeyIncluded, 
+        ByteBuffer endKey, boolean endKeyIncluded, 
+        int maxRecords, int maxBytes, ScanOptions options) throws TException 
     {
         RecordListResponse response = new RecordListResponse();
         response.responseCode = ResponseCode.Success;
         return response;
     }
 
+    public Int64Response countRange(String databaseName, ByteBuffer startKey, ByteBuffer endKey) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public Int64Response approximateSize(String databaseName, ByteBuffer startKey, ByteBuffer endKey) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public KeyListResponse sampleSplitPoints(String databaseName, int numSplits) throws TException
+    {
+        KeyListResponse response = new KeyListResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public AggregateResponse aggregate(String databaseName, ByteBuffer startKey, ByteBuffer endKey,
+        AggregateOp op, ValueEncoding encoding) throws TException
+    {
+        AggregateResponse response = new AggregateResponse();
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
     public BinaryResponse get(String databaseName, ByteBuffer recordKey) throws TException
     {
         BinaryResponse response = new BinaryResponse();
@@ -61,12 +180,27 @@ class StubServer implements MapKeeper.Iface {
         return response;
     }
 
-    public ResponseCode put(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    public BinaryListResponse multiGet(String databaseName, List<ByteBuffer> recordKeys) throws TException
+    {
+        BinaryListResponse response = new BinaryListResponse();
+        response.responses = new ArrayList<BinaryResponse>();
+        for (int i = 0; i < recordKeys.size(); i++) {
+            BinaryResponse record = new BinaryResponse();
+            record.responseCode = ResponseCode.Success;
+            response.responses.add(record);
+        }
+        response.responseCode = ResponseCode.Success;
+        return response;
+    }
+
+    public ResponseCode put(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue,
+        WriteOptions options) throws TException
     {
         return ResponseCode.Success;
     }
 
-    public ResponseCode insert(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    public ResponseCode insert(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue,
+        WriteOptions options) throws TException
     {
         return ResponseCode.Success;
     }
@@ -74,8 +208,33 @@ class StubServer implements MapKeeper.Iface {
     public ResponseCode insertMany(String databaseName, List<Record> records) throws TException {
         return ResponseCode.Success;
     }
+
+    public ResponseCode ingestFile(String databaseName, String path) throws TException
+    {
+        return ResponseCode.Success;
+    }
     
-    public ResponseCode update(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
+    public ResponseCode update(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue,
+        WriteOptions options) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public ResponseCode compareAndSet(String databaseName, ByteBuffer recordKey,
+        ByteBuffer expectedValue, ByteBuffer newValue) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public Int64Response increment(String databaseName, ByteBuffer recordKey, long delta) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Success;
+        response.value = delta;
+        return response;
+    }
+
+    public ResponseCode append(String databaseName, ByteBuffer recordKey, ByteBuffer recordValue) throws TException
     {
         return ResponseCode.Success;
     }
@@ -85,6 +244,27 @@ class StubServer implements MapKeeper.Iface {
         return ResponseCode.Success;
     }
 
+    public Int64Response removeRange(String databaseName, ByteBuffer startKey, ByteBuffer endKey) throws TException
+    {
+        Int64Response response = new Int64Response();
+        response.responseCode = ResponseCode.Success;
+        response.value = 0;
+        return response;
+    }
+
+    public ResponseCode writeBatch(String databaseName, List<Mutation> mutations) throws TException
+    {
+        return ResponseCode.Success;
+    }
+
+    public ChangeListResponse tailChanges(String databaseName, long fromSeq, int maxRecords) throws TException
+    {
+        ChangeListResponse response = new ChangeListResponse();
+        response.responseCode = ResponseCode.Success;
+        response.nextSeq = fromSeq;
+        return response;
+    }
+
     public static void usage() {
         System.err.println("Usage: java -jar stub_server.jar [hsha|nonblocking|threadpool|selector]");
         System.exit(1);
@@ -28,6 +28,14 @@ enum ResponseCode
     RecordNotFound,
     RecordExists,
     ScanEnded,
+    CursorNotFound,
+    TooManyCursors,
+    ValueMismatch,
+    TooManyHandles,
+    SnapshotNotFound,
+    TooManySnapshots,
+    ChangesTruncated,
+    Busy,
 }
 
 enum ScanOrder 
@@ -36,12 +44,144 @@ enum ScanOrder
     Descending,
 }
 
+enum MutationType 
+{
+    Put,
+    Insert,
+    Update,
+    Remove,
+}
+
+enum ChangeType 
+{
+    Put,
+    Remove,
+    RemoveRange,
+}
+
 struct Record 
 {
     1:binary key,
     2:binary value,
 }
 
+/**
+ * A single write in a writeBatch request. value is ignored for Remove.
+ */
+struct Mutation 
+{
+    1:MutationType type,
+    2:binary key,
+    3:binary value,
+}
+
+/**
+ * An entry of a map's change log (see tailChanges). Put sets key to 
+ * value, Remove removes key, and RemoveRange removes the records in
+ * [key, endKey). Writes that modify a record in place (update, append,
+ * increment, ...) show up as a Put of the resulting value.
+ */
+struct Change 
+{
+    1:i64 seq,
+    2:ChangeType type,
+    3:binary key,
+    4:binary value,
+    5:binary endKey,
+}
+
+enum CompareOp 
+{
+    Equal,
+    NotEqual,
+    Less,
+    LessOrEqual,
+    Greater,
+    GreaterOrEqual,
+}
+
+/**
+ * Compares the operand.size() bytes of a value starting at offset with
+ * operand, as unsigned bytes. A value too short to have these bytes 
+ * doesn't match, whatever the op.
+ */
+struct ValueCondition 
+{
+    1:i32 offset = 0,
+    2:CompareOp op = CompareOp.Equal,
+    3:binary operand,
+}
+
+/**
+ * Records a scan skips on the server. A record is returned only if its
+ * key starts with keyPrefix and ends with keySuffix, its value starts 
+ * with valuePrefix, and it meets every valueCondition. Empty fields 
+ * match every record.
+ *
+ * The filter is applied to the whole value, before it's cut down by
+ * keysOnly, valueOffset and valueLength. Skipped records don't count 
+ * against maxRecords and maxBytes.
+ */
+struct ScanFilter 
+{
+    1:binary keyPrefix,
+    2:binary keySuffix,
+    3:binary valuePrefix,
+    4:list<ValueCondition> valueConditions,
+}
+
+/**
+ * Controls which records a scan returns, and which part of each one.
+ *
+ * If keysOnly is set, records come back with an empty value. Otherwise
+ * each value is cut down to the valueLength bytes starting at 
+ * valueOffset; a negative valueLength returns everything from 
+ * valueOffset to the end of the value. maxBytes is applied to the 
+ * records after they've been cut down.
+ */
+struct ScanOptions 
+{
+    1:bool keysOnly = false,
+    2:i32 valueOffset = 0,
+    3:i32 valueLength = -1,
+    4:ScanFilter filter,
+}
+
+/**
+ * Options for put, insert and update.
+ *
+ * A record written with a positive ttlSeconds expires ttlSeconds 
+ * seconds later. Expired records are hidden from reads right away and
+ * removed in the background. Writing a record again with put, insert or
+ * update replaces its TTL (0, the default, means it never expires); 
+ * other writes (compareAndSet, increment, append, ...) keep it.
+ */
+struct WriteOptions 
+{
+    1:i32 ttlSeconds = 0,
+}
+
+enum AggregateOp 
+{
+    Count,
+    Sum,
+    Min,
+    Max,
+}
+
+/**
+ * How aggregate decodes values. Sum, Min and Max only look at values 
+ * that are exactly 8 bytes and skip the others. Int64BigEndian is the
+ * encoding increment uses for counters.
+ */
+enum ValueEncoding 
+{
+    Int64BigEndian,
+    Int64LittleEndian,
+    DoubleBigEndian,
+    DoubleLittleEndian,
+}
+
 struct RecordListResponse 
 {
     1:ResponseCode responseCode,
@@ -60,12 +200,121 @@ struct StringListResponse
     2:list<string> values,
 }
 
+struct BinaryListResponse 
+{
+    1:ResponseCode responseCode,
+    2:list<BinaryResponse> responses,
+}
+
+struct Int64Response 
+{
+    1:ResponseCode responseCode,
+    2:i64 value,
+}
+
+struct KeyListResponse 
+{
+    1:ResponseCode responseCode,
+    2:list<binary> keys,
+}
+
+struct AggregateResponse 
+{
+    1:ResponseCode responseCode,
+    2:i64 count,
+    3:i64 int64Value,
+    4:double doubleValue,
+}
+
+/**
+ * Latency of one phase of an operation, in microseconds. Percentiles
+ * are the upper bounds of histogram buckets, within 3% of the actual
+ * latency.
+ */
+struct LatencyStats 
+{
+    1:string phase,
+    2:i64 count,
+    3:i64 p50,
+    4:i64 p99,
+    5:i64 p999,
+    6:i64 max,
+}
+
+struct OperationStats 
+{
+    1:string operation,
+    2:string mapName,
+    3:double requestsPerSecond,
+    4:list<LatencyStats> latencies,
+}
+
+struct StatsResponse 
+{
+    1:ResponseCode responseCode,
+    2:double seconds,
+    3:list<OperationStats> operations,
+}
+
+struct MapHandleResponse 
+{
+    1:ResponseCode responseCode,
+    2:i32 handle,
+}
+
+struct SnapshotResponse 
+{
+    1:ResponseCode responseCode,
+    2:i64 snapshotId,
+}
+
+struct ChangeListResponse 
+{
+    1:ResponseCode responseCode,
+    2:list<Change> changes,
+    3:i64 nextSeq,
+}
+
+struct ScanCursorResponse 
+{
+    1:ResponseCode responseCode,
+    2:i64 cursorId,
+}
+
+/**
+ * Request sent to the streaming scan port (see common/ScanStreamServer.h).
+ *
+ * The range arguments have the same meaning as in scan. The server 
+ * answers with a sequence of frames, each holding a RecordListResponse 
+ * of at most maxRecords records or about maxBytes bytes. Every frame but
+ * the last one has responseCode Success; the last one has ScanEnded, or
+ * the error that stopped the scan.
+ */
+struct ScanStreamRequest 
+{
+    1:string mapName,
+    2:ScanOrder order,
+    3:binary startKey,
+    4:bool startKeyIncluded,
+    5:binary endKey,
+    6:bool endKeyIncluded,
+    7:i32 maxRecords,
+    8:i32 maxBytes,
+    9:ScanOptions options,
+}
+
 /**
  * Note about map name:
  * Thrift string type translates to std::string in C++ and String in 
  * Java. Thrift does not validate whether the string is in utf8 in C++,
  * but it does in Java. If you are using this class in C++, you need to
  * make sure the map name is in utf8. Otherwise requests will fail.
+ *
+ * Note about Busy:
+ * A server started with admission limits (see common/AdmissionHandler.h)
+ * answers any call except ping, getStats, closeScan and releaseSnapshot
+ * with Busy, without running it, when it has too much work. Nothing was
+ * changed; clients should back off and retry.
  */
 service MapKeeper
 {
@@ -77,6 +326,34 @@ service MapKeeper
      */
     ResponseCode ping(),
 
+    /**
+     * Returns the latency of the requests the server has answered since
+     * it started, or since the stats were last reset.
+     *
+     * There is an entry with an empty mapName for each operation, with
+     * the latency of each phase of a request:
+     *
+     *   queueWait   - waiting for a worker thread, for server types that
+     *                 measure it (pipelined).
+     *   deserialize - reading the arguments.
+     *   call        - running the operation.
+     *   serialize   - writing the response.
+     *   total       - all of the above.
+     *
+     * and an entry for each map an operation was called on, with the
+     * call latency only. Operations that take a handle, a cursor or a
+     * snapshot instead of a map name only have the first kind.
+     *
+     * @param reset start over once the stats are read.
+     * @return StatsResponse
+     *             responseCode - Success
+     *                          - Error if the server doesn't keep stats.
+     *             seconds - time the stats were collected over.
+     *             operations - requestsPerSecond is the number of
+     *                          requests over seconds.
+     */
+    StatsResponse getStats(1:bool reset),
+
     /**
      * Add a new map.
      *
@@ -111,6 +388,52 @@ service MapKeeper
      */
     StringListResponse listMaps(),
 
+    /**
+     * Returns a handle for a map.
+     *
+     * getByHandle, putByHandle and scanByHandle take the handle instead
+     * of the map name. The server resolves a handle by indexing an 
+     * array, which is cheaper than looking up the name on every request.
+     *
+     * Opening the same map again returns the same handle. A handle 
+     * stays valid until the map is dropped; after that requests with 
+     * it return MapNotFound, even if a map with the same name is added
+     * again.
+     *
+     * @param mapName map name
+     * @return MapHandleResponse
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - TooManyHandles the server is out of 
+     *                                           handles.
+     *                          - Error on any other errors
+     *             handle - handle of the map.
+     */
+    MapHandleResponse openMap(1:string mapName),
+
+    /**
+     * Same as get, with a handle returned by openMap.
+     */
+    BinaryResponse getByHandle(1:i32 mapHandle, 2:binary key),
+
+    /**
+     * Same as put, with a handle returned by openMap.
+     */
+    ResponseCode putByHandle(1:i32 mapHandle, 2:binary key, 3:binary value),
+
+    /**
+     * Same as scan, with a handle returned by openMap.
+     */
+    RecordListResponse scanByHandle(1:i32 mapHandle,
+                                    2:ScanOrder order,
+                                    3:binary startKey,
+                                    4:bool startKeyIncluded,
+                                    5:binary endKey,
+                                    6:bool endKeyIncluded,
+                                    7:i32 maxRecords,
+                                    8:i32 maxBytes,
+                                    9:ScanOptions options),
+
     /**
      * Returns records in a map in lexicographical order.
      *
@@ -141,6 +464,8 @@ service MapKeeper
      * @param maxBytes Advise scan to return at most $maxBytes bytes. This 
      *                 method is not required to strictly keep the response
      *                 size less than $maxBytes bytes. 
+     * @param options  Skip records that don't match a filter, or return only
+     *                 the keys or a part of each value.
      * @return RecordListResponse
      *             responseCode - Success if the scan was successful
      *                          - ScanEnded if the scan was successful and 
@@ -156,7 +481,210 @@ service MapKeeper
                             5:binary endKey,
                             6:bool endKeyIncluded,
                             7:i32 maxRecords,
-                            8:i32 maxBytes),
+                            8:i32 maxBytes,
+                            9:ScanOptions options),
+
+    /**
+     * Opens a server-side scan cursor over a key range.
+     *
+     * The range arguments have the same meaning as in scan. Unlike scan, 
+     * the server keeps the cursor positioned between nextScan calls, so 
+     * paging through a large range costs only sequential iteration. Where
+     * the backend supports it, all the pages are read from the same 
+     * snapshot.
+     *
+     * Cursors that aren't used for a while are closed by the server, and
+     * the number of open cursors is capped.
+     *
+     * options applies to all the pages returned by nextScan.
+     *
+     * @return ScanCursorResponse
+     *             responseCode - Success
+     *                          - MapNotFound database doesn't exist.
+     *                          - TooManyCursors the server has too many 
+     *                                           open cursors.
+     *                          - Error on any other errors
+     *             cursorId - cursor to pass to nextScan and closeScan.
+     */
+    ScanCursorResponse openScan(1:string mapName,
+                                2:ScanOrder order,
+                                3:binary startKey,
+                                4:bool startKeyIncluded,
+                                5:binary endKey,
+                                6:bool endKeyIncluded,
+                                7:ScanOptions options),
+
+    /**
+     * Returns the next page of records from a scan cursor.
+     *
+     * The cursor is closed automatically once ScanEnded is returned.
+     *
+     * @param cursorId cursor returned by openScan.
+     * @param maxRecords 
+     *                 nextScan will return at most $maxRecords records.
+     * @param maxBytes Advise nextScan to return at most $maxBytes bytes.
+     * @return RecordListResponse
+     *             responseCode - Success if there may be more records.
+     *                          - ScanEnded if the cursor reached the end of
+     *                                      the range. 
+     *                          - CursorNotFound the cursor doesn't exist or
+     *                                           has expired.
+     *                          - Error on any other errors
+     *             records - list of records. 
+     */
+    RecordListResponse nextScan(1:i64 cursorId,
+                                2:i32 maxRecords,
+                                3:i32 maxBytes),
+
+    /**
+     * Closes a scan cursor before it reaches the end of its range.
+     *
+     * @param cursorId cursor returned by openScan.
+     * @return Success 
+     *         CursorNotFound the cursor doesn't exist or has expired.
+     */
+    ResponseCode closeScan(1:i64 cursorId),
+
+    /**
+     * Takes a snapshot of a map.
+     *
+     * getAtSnapshot and scanAtSnapshot read the map as it was when the
+     * snapshot was taken, so a read that spans several requests sees a
+     * single version of the map. A snapshot keeps old versions of 
+     * records around, so release it as soon as it's no longer needed.
+     * Snapshots that aren't used for a while are released by the 
+     * server, and the number of open snapshots is capped.
+     *
+     * @param mapName map name
+     * @return SnapshotResponse
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - TooManySnapshots the server has too many
+     *                                             open snapshots.
+     *                          - Error if the backend doesn't support 
+     *                                  snapshots, or on any other errors.
+     *             snapshotId - snapshot to pass to getAtSnapshot,
+     *                          scanAtSnapshot and releaseSnapshot.
+     */
+    SnapshotResponse createSnapshot(1:string mapName),
+
+    /**
+     * Releases a snapshot.
+     *
+     * @param snapshotId snapshot returned by createSnapshot.
+     * @return Success 
+     *         SnapshotNotFound the snapshot doesn't exist or has expired.
+     */
+    ResponseCode releaseSnapshot(1:i64 snapshotId),
+
+    /**
+     * Same as get, reading from a snapshot returned by createSnapshot.
+     * Returns SnapshotNotFound if the snapshot doesn't exist or has 
+     * expired.
+     */
+    BinaryResponse getAtSnapshot(1:i64 snapshotId, 2:binary key),
+
+    /**
+     * Same as scan, reading from a snapshot returned by createSnapshot.
+     * Returns SnapshotNotFound if the snapshot doesn't exist or has 
+     * expired.
+     */
+    RecordListResponse scanAtSnapshot(1:i64 snapshotId,
+                                      2:ScanOrder order,
+                                      3:binary startKey,
+                                      4:bool startKeyIncluded,
+                                      5:binary endKey,
+                                      6:bool endKeyIncluded,
+                                      7:i32 maxRecords,
+                                      8:i32 maxBytes,
+                                      9:ScanOptions options),
+
+    /**
+     * Counts the records in a key range without returning them.
+     *
+     * @param mapName map name
+     * @param startKey first key of the range, included. If it's empty, 
+     *                 the range starts from the smallest key in the map.
+     * @param endKey   end of the range, excluded. If it's empty, the 
+     *                 range ends at the largest key in the map.
+     * @return Int64Response
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - Error on any other errors
+     *             value - number of records in [startKey, endKey).
+     */
+    Int64Response countRange(1:string mapName, 2:binary startKey, 3:binary endKey),
+
+    /**
+     * Estimates the number of bytes the records in a key range take.
+     *
+     * The estimate comes from the backend's own statistics where it has
+     * them, so it's cheap but it can be off, typically by a page or a 
+     * file worth of data. It's meant for planning, not accounting.
+     *
+     * @param mapName map name
+     * @param startKey first key of the range, included. If it's empty, 
+     *                 the range starts from the smallest key in the map.
+     * @param endKey   end of the range, excluded. If it's empty, the 
+     *                 range ends at the largest key in the map.
+     * @return Int64Response
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - Error on any other errors
+     *             value - approximate size of [startKey, endKey) in bytes.
+     */
+    Int64Response approximateSize(1:string mapName, 2:binary startKey, 3:binary endKey),
+
+    /**
+     * Picks keys that split a map into ranges of about the same size, 
+     * for example to scan it in parallel.
+     *
+     * The split points come from the backend's statistics or a sample 
+     * of its keys rather than a full scan wherever the backend allows,
+     * so the ranges are only roughly equal, and the split points aren't
+     * necessarily keys in the map. With split points k1 < k2 < ... < kn,
+     * the ranges are [first key, k1), [k1, k2), ..., [kn, last key]; an
+     * empty startKey and endKey in scan cover the two ends.
+     *
+     * @param mapName map name
+     * @param numSplits number of ranges wanted, from 1 to 4096.
+     * @return KeyListResponse
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - Error on invalid numSplits or any other
+     *                            errors.
+     *             keys - at most numSplits - 1 split points in ascending 
+     *                    order. There are fewer if the map is small or 
+     *                    the backend can't tell its ranges apart.
+     */
+    KeyListResponse sampleSplitPoints(1:string mapName, 2:i32 numSplits),
+
+    /**
+     * Aggregates the values of the records in a key range on the server,
+     * so only the result is sent back.
+     *
+     * @param mapName map name
+     * @param startKey first key of the range, included. If it's empty, 
+     *                 the range starts from the smallest key in the map.
+     * @param endKey   end of the range, excluded. If it's empty, the 
+     *                 range ends at the largest key in the map.
+     * @param op       Count counts the records without reading their 
+     *                 values. Sum, Min and Max decode the values with
+     *                 encoding, skipping values that aren't 8 bytes. Sums
+     *                 of int64 values wrap around on overflow.
+     * @param encoding how values are decoded. Ignored by Count.
+     * @return AggregateResponse
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - Error on invalid op or encoding, or any
+     *                            other errors.
+     *             count - number of records counted, or of values 
+     *                     aggregated. Min and Max are 0 if it's 0.
+     *             int64Value - result for Count and the int64 encodings.
+     *             doubleValue - result for the double encodings.
+     */
+    AggregateResponse aggregate(1:string mapName, 2:binary startKey, 3:binary endKey,
+                                4:AggregateOp op, 5:ValueEncoding encoding),
 
     /**
      * Retrieves a record from a map.
@@ -172,17 +700,37 @@ service MapKeeper
      */
     BinaryResponse get(1:string mapName, 2:binary key),
 
+    /**
+     * Retrieves multiple records from a map in a single request.
+     *
+     * All the keys are read from the same map, and backends that support
+     * it read them from a single consistent view of the map.
+     *
+     * @param mapName map name
+     * @param keys records to retrieve.
+     * @returns BinaryListResponse 
+     *              responseCode - Ok 
+     *                             MapNotFound database doesn't exist.
+     *                             Error on any other errors.
+     *              responses - one BinaryResponse per key, in the same 
+     *                          order as keys. Each of them has responseCode
+     *                          Ok, RecordNotFound or Error.
+     */
+    BinaryListResponse multiGet(1:string mapName, 2:list<binary> keys),
+
     /**
      * Puts a record into a map.
      *
      * @param mapName database name
      * @param key record key to put
      * @param value record value to put
+     * @param options TTL of the record.
      * @returns Ok 
      *          MapNotFound map doesn't exist.
      *          Error
      */
-    ResponseCode put(1:string mapName, 2:binary key, 3:binary value),
+    ResponseCode put(1:string mapName, 2:binary key, 3:binary value, 
+                     4:WriteOptions options),
 
     /**
      * Inserts a record into a map.
@@ -192,12 +740,50 @@ service MapKeeper
      * @param databaseName database name
      * @param recordKey record key to insert
      * @param recordValue  record value to insert
+     * @param options TTL of the record.
      * @returns Ok 
      *          MapNotFound map doesn't exist.
      *          RecordExists
      *          Error
      */
-    ResponseCode insert(1:string mapName, 2:binary key, 3:binary value),
+    ResponseCode insert(1:string mapName, 2:binary key, 3:binary value, 
+                        4:WriteOptions options),
+
+    /**
+     * Inserts multiple records into a map.
+     *
+     * This operation is atomic: either all the records get inserted 
+     * into the map or none does. Backends use their bulk load path
+     * when they have one, so this is the preferred way to load 
+     * a large number of records.
+     *
+     * @param mapName map name
+     * @param records list of records to insert
+     * @returns Ok 
+     *          MapNotFound map doesn't exist.
+     *          RecordExists if one of the records already exists.
+     *          Error
+     */
+    ResponseCode insertMany(1:string mapName, 2:list<Record> records),
+
+    /**
+     * Loads a file of sorted records into an empty map, bypassing the
+     * backend's write path. Only the LevelDB backend supports it; see 
+     * leveldb/TableIngester.h for the file format.
+     *
+     * The map can't be read or written while the file is loaded. Its 
+     * open scans and snapshots are closed, and tailChanges consumers of 
+     * the map get ChangesTruncated. TTLs don't apply to loaded records.
+     *
+     * @param mapName map name
+     * @param path path of the file on the server.
+     * @returns Success
+     *          MapNotFound map doesn't exist.
+     *          Error if the map isn't empty, the file can't be read or
+     *                isn't sorted, the backend doesn't support it, or
+     *                on any other errors. The map is empty afterwards.
+     */
+    ResponseCode ingestFile(1:string mapName, 2:string path),
 
     /**
      * Updates a record in a map.
@@ -207,12 +793,69 @@ service MapKeeper
      * @param databaseName database name
      * @param recordKey record key to update
      * @param recordValue new value for the record
+     * @param options TTL of the record.
      * @returns Ok 
      *          MapNotFound map doesn't exist.
      *          RecordNotFound
      *          Error
      */
-    ResponseCode update(1:string mapName, 2:binary key, 3:binary value),
+    ResponseCode update(1:string mapName, 2:binary key, 3:binary value, 
+                        4:WriteOptions options),
+
+    /**
+     * Atomically replaces the value of a record if it's still equal to
+     * expectedValue.
+     *
+     * This gives optimistic concurrency control without client side 
+     * locking: read the record, compute the new value, and retry from
+     * the read if compareAndSet returns ValueMismatch.
+     *
+     * @param mapName map name
+     * @param key record to update
+     * @param expectedValue value the record must have for the update to 
+     *                      happen.
+     * @param newValue new value for the record
+     * @returns Success 
+     *          MapNotFound map doesn't exist.
+     *          RecordNotFound
+     *          ValueMismatch the record has a value other than 
+     *                        expectedValue. It's left unchanged.
+     *          Error
+     */
+    ResponseCode compareAndSet(1:string mapName, 2:binary key, 
+                               3:binary expectedValue, 4:binary newValue),
+
+    /**
+     * Atomically adds delta to a counter record.
+     *
+     * Counters are stored as 8 byte big-endian signed integers. A 
+     * record that doesn't exist yet is created as if it had been 0, so
+     * a hot counter takes a single call without a retry loop.
+     *
+     * @param mapName map name
+     * @param key counter record
+     * @param delta number to add. It can be negative.
+     * @return Int64Response
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - Error if the record isn't 8 bytes long,
+     *                            or on any other errors.
+     *             value - value of the counter after the increment.
+     */
+    Int64Response increment(1:string mapName, 2:binary key, 3:i64 delta),
+
+    /**
+     * Atomically appends bytes to the value of a record. A record that
+     * doesn't exist yet is created with value as its value.
+     *
+     * @param mapName map name
+     * @param key record to append to
+     * @param value bytes to append
+     * @returns Success 
+     *          MapNotFound map doesn't exist.
+     *          Error
+     */
+    ResponseCode append(1:string mapName, 2:binary key, 3:binary value),
 
     /**
      * Removes a record from a map.
@@ -225,4 +868,78 @@ service MapKeeper
      *          Error
      */
     ResponseCode remove(1:string mapName, 2:binary key),
+
+    /**
+     * Removes all the records in a key range.
+     *
+     * It's much faster than scanning the range and removing the records 
+     * one by one, but it isn't atomic: if it fails in the middle, some 
+     * of the records may already be gone.
+     *
+     * @param mapName  map name
+     * @param startKey beginning of the range, included. If it's empty, 
+     *                 the range starts from the smallest key in the map.
+     * @param endKey   end of the range, excluded. If it's empty, the 
+     *                 range ends at the largest key in the map.
+     * @return Int64Response
+     *             responseCode - Success
+     *                          - MapNotFound map doesn't exist.
+     *                          - Error on any other errors
+     *             value - number of records removed.
+     */
+    Int64Response removeRange(1:string mapName, 2:binary startKey, 3:binary endKey),
+
+    /**
+     * Atomically applies a list of mutations to a map.
+     *
+     * Mutations are applied in order, and each of them has the same 
+     * semantics as the corresponding put, insert, update or remove call.
+     * Either all the mutations are applied, or none of them are. 
+     *
+     * @param mapName map name
+     * @param mutations mutations to apply.
+     * @returns Ok 
+     *          MapNotFound map doesn't exist.
+     *          RecordExists an Insert mutation found an existing record.
+     *          RecordNotFound an Update or Remove mutation didn't find 
+     *                         its record.
+     *          Error
+     */
+    ResponseCode writeBatch(1:string mapName, 2:list<Mutation> mutations),
+
+    /**
+     * Returns the changes made to a map since a sequence number.
+     *
+     * The server keeps the most recent changes of each map in memory, so
+     * a consumer that keeps a copy of a map (a cache, an index, ...) can
+     * apply the changes instead of rescanning the map. Sequence numbers
+     * increase, but they aren't contiguous within a map. Changes to the
+     * same key are returned in the order they were applied; a 
+     * RemoveRange isn't ordered with writes to the range that happen at
+     * the same time.
+     *
+     * To start, a consumer calls tailChanges with fromSeq 0, which 
+     * returns ChangesTruncated and nextSeq, scans the map, and then 
+     * tails from nextSeq. Changes made during the scan are returned 
+     * again, so applying them has to be idempotent, which it is for the
+     * resulting values returned in Change.
+     *
+     * @param mapName    map name
+     * @param fromSeq    nextSeq from the previous call.
+     * @param maxRecords return at most $maxRecords changes.
+     * @return ChangeListResponse
+     *             responseCode - Success
+     *                          - ChangesTruncated some changes after 
+     *                                  fromSeq are no longer in the log 
+     *                                  (the consumer fell behind, the map
+     *                                  was dropped or the server 
+     *                                  restarted). The consumer has to 
+     *                                  rescan the map.
+     *                          - MapNotFound map doesn't exist.
+     *                          - Error if the server doesn't keep a change
+     *                                  log, or on any other errors.
+     *             changes - changes with seq >= fromSeq, oldest first.
+     *             nextSeq - fromSeq for the next call.
+     */
+    ChangeListResponse tailChanges(1:string mapName, 2:i64 fromSeq, 3:i32 maxRecords),
 }
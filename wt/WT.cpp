@@ -2,11 +2,14 @@
  * Copyright 2012 WiredTiger
  */
 #include <cerrno> // ENOENT
+#include <cstring> // strlen
 #include <arpa/inet.h> // ntohl
 #include <iomanip>
 #include <sstream>
 #include <boost/thread/tss.hpp>
 #include "WT.h"
+#include "ValueProjection.h"
+#include "ScanFilter.h"
 
 using namespace mapkeeper;
 using namespace std;
@@ -35,7 +38,9 @@ openCursor(const string& tableName)
     WT_CURSOR *curs;
     int rc = sess_->open_cursor(
         sess_, Name2Uri(tableName).c_str(), NULL, NULL, &curs);
-    if (rc != 0)
+    if (rc == ENOENT)
+        return DbNotFound;
+    else if (rc != 0)
         ERROR_RET(Error, rc, "Error opening cursor.\n");
     cursors_[tableName] = curs;
     curs_ = curs;
@@ -44,6 +49,8 @@ openCursor(const string& tableName)
 
 void WT::closeCursor()
 {
+    if (curs_ == NULL)
+        return;
     curs_->reset(curs_);
     curs_ = NULL;
 }
@@ -92,7 +99,20 @@ create(const string& tableName, uint32_t pageSizeKb)
 WT::ResponseCode WT::
 open(const string& tableName)
 {
-    /* TODO: Check for existence? */
+    if (cursors_.find(tableName) != cursors_.end())
+        return Success;
+    /*
+     * Opening a cursor on a missing table fails with ENOENT. Keep the
+     * cursor in the cache, the table is about to be used.
+     */
+    WT_CURSOR *curs;
+    int rc = sess_->open_cursor(
+        sess_, Name2Uri(tableName).c_str(), NULL, NULL, &curs);
+    if (rc == ENOENT)
+        return DbNotFound;
+    else if (rc != 0)
+        ERROR_RET(Error, rc, "WT::open cursor open");
+    cursors_[tableName] = curs;
     return Success;
 }
 
@@ -179,6 +199,39 @@ error:
     return ret;
 }
 
+WT::ResponseCode WT::
+multiGet(const string& tableName, const vector<string>& keys,
+    vector<BinaryResponse>& responses)
+{
+    ResponseCode ret = Success;
+    int rc = 0;
+    if ((ret = openCursor(tableName)) != Success)
+        return ret;
+    if ((rc = sess_->begin_transaction(sess_, "isolation=snapshot")) != 0) {
+        closeCursor();
+        ERROR_RET(Error, rc, "WT_SESSION::begin_transaction() failed.\n");
+    }
+    responses.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        curs_->set_key(curs_, keys[i].c_str());
+        rc = curs_->search(curs_);
+        if (rc == 0) {
+            const char *val;
+            curs_->get_value(curs_, &val);
+            responses[i].value.assign(val);
+            responses[i].responseCode = mapkeeper::ResponseCode::Success;
+        } else if (rc == WT_NOTFOUND)
+            responses[i].responseCode = mapkeeper::ResponseCode::RecordNotFound;
+        else
+            ERROR_GOTO(Error, rc, "WT::multiGet search failed\n");
+    }
+error:
+    /* Nothing was written, so the transaction is rolled back either way. */
+    closeCursor();
+    sess_->rollback_transaction(sess_, NULL);
+    return ret;
+}
+
 WT::ResponseCode WT::
 insert(const string& tableName,
     const string& key, const string& value)
@@ -223,6 +276,166 @@ error:
     return ret;
 }
 
+WT::ResponseCode WT::
+compareAndSet(const string& tableName, const string& key,
+    const string& expectedValue, const string& newValue)
+{
+    ResponseCode ret = Success;
+    int rc = 0;
+    const char *val;
+    if ((ret = openCursor(tableName)) != Success)
+        ERROR_RET(ret, 0, "WT::compareAndSet failed to open cursor\n");
+    if ((rc = sess_->begin_transaction(sess_, NULL)) != 0) {
+        closeCursor();
+        ERROR_RET(Error, rc, "WT_SESSION::begin_transaction() failed.\n");
+    }
+
+    curs_->set_key(curs_, key.c_str());
+    rc = curs_->search(curs_);
+    if (rc == WT_NOTFOUND) {
+        ret = KeyNotFound;
+        goto error;
+    } else if (rc != 0)
+        ERROR_GOTO(Error, rc, "WT::compareAndSet search failed\n");
+    curs_->get_value(curs_, &val);
+    if (expectedValue != val) {
+        ret = ValueMismatch;
+        goto error;
+    }
+    curs_->set_value(curs_, newValue.c_str());
+    rc = curs_->update(curs_);
+    if (rc == WT_ROLLBACK) {
+        ret = ValueMismatch;
+        goto error;
+    } else if (rc != 0)
+        ERROR_GOTO(Error, rc, "WT::compareAndSet operation failed\n");
+    closeCursor();
+    rc = sess_->commit_transaction(sess_, NULL);
+    if (rc == WT_ROLLBACK)
+        return ValueMismatch;
+    else if (rc != 0)
+        ERROR_RET(Error, rc, "WT_SESSION::commit_transaction() failed.\n");
+    return Success;
+error:
+    closeCursor();
+    sess_->rollback_transaction(sess_, NULL);
+    return ret;
+}
+
+WT::ResponseCode WT::
+append(const string& tableName, const string& key, const string& value)
+{
+    ResponseCode ret = Success;
+    int rc = 0;
+    const char *val;
+    if ((ret = openCursor(tableName)) != Success)
+        ERROR_RET(ret, 0, "WT::append failed to open cursor\n");
+    if ((rc = sess_->begin_transaction(sess_, NULL)) != 0) {
+        closeCursor();
+        ERROR_RET(Error, rc, "WT_SESSION::begin_transaction() failed.\n");
+    }
+
+    curs_->set_key(curs_, key.c_str());
+    rc = curs_->search(curs_);
+    if (rc == 0) {
+        curs_->get_value(curs_, &val);
+        string newValue(val);
+        newValue.append(value);
+        curs_->set_value(curs_, newValue.c_str());
+        rc = curs_->update(curs_);
+    } else if (rc == WT_NOTFOUND) {
+        curs_->set_key(curs_, key.c_str());
+        curs_->set_value(curs_, value.c_str());
+        rc = curs_->insert(curs_);
+    }
+    if (rc != 0)
+        ERROR_GOTO(Error, rc, "WT::append operation failed\n");
+    closeCursor();
+    if ((rc = sess_->commit_transaction(sess_, NULL)) != 0)
+        ERROR_RET(Error, rc, "WT_SESSION::commit_transaction() failed.\n");
+    return Success;
+error:
+    closeCursor();
+    sess_->rollback_transaction(sess_, NULL);
+    return ret;
+}
+
+WT::ResponseCode WT::
+removeRange(const string& tableName, const string& startKey,
+    const string& endKey, uint64_t& count)
+{
+    ResponseCode ret = Success;
+    int rc = 0, exact;
+    const char *key;
+    count = 0;
+    if ((ret = openCursor(tableName)) != Success)
+        ERROR_RET(ret, 0, "WT::removeRange failed to open cursor\n");
+    if ((rc = sess_->begin_transaction(sess_, NULL)) != 0) {
+        closeCursor();
+        ERROR_RET(Error, rc, "WT_SESSION::begin_transaction() failed.\n");
+    }
+
+    if (startKey.empty())
+        rc = curs_->next(curs_);
+    else {
+        curs_->set_key(curs_, startKey.c_str());
+        rc = curs_->search_near(curs_, &exact);
+        if (rc == 0 && exact < 0)
+            rc = curs_->next(curs_);
+    }
+    while (rc == 0) {
+        curs_->get_key(curs_, &key);
+        if (!endKey.empty() && endKey.compare(key) <= 0)
+            break;
+        if ((rc = curs_->remove(curs_)) != 0)
+            ERROR_GOTO(Error, rc, "WT::removeRange remove failed\n");
+        count++;
+        rc = curs_->next(curs_);
+    }
+    if (rc != 0 && rc != WT_NOTFOUND)
+        ERROR_GOTO(Error, rc, "WT::removeRange cursor failed\n");
+    closeCursor();
+    if ((rc = sess_->commit_transaction(sess_, NULL)) != 0) {
+        count = 0;
+        ERROR_RET(Error, rc, "WT_SESSION::commit_transaction() failed.\n");
+    }
+    return Success;
+error:
+    count = 0;
+    closeCursor();
+    sess_->rollback_transaction(sess_, NULL);
+    return ret;
+}
+
+WT::ResponseCode WT::
+sampleKeys(const string& tableName, uint32_t count, vector<string>& keys)
+{
+    ResponseCode ret = Success;
+    int rc = 0;
+    const char *key;
+    /* Random cursors can't be reused for other operations, so this one
+     * isn't cached. */
+    WT_CURSOR *curs;
+    rc = sess_->open_cursor(
+        sess_, Name2Uri(tableName).c_str(), NULL, "next_random=true", &curs);
+    if (rc == ENOENT)
+        return DbNotFound;
+    else if (rc != 0)
+        ERROR_RET(Error, rc, "WT::sampleKeys cursor open");
+    for (uint32_t i = 0; i < count; i++) {
+        if ((rc = curs->next(curs)) != 0)
+            break;
+        curs->get_key(curs, &key);
+        keys.push_back(string(key));
+    }
+    if (rc != 0 && rc != WT_NOTFOUND) {
+        ERROR_RET_PRINT(Error, rc, "WT::sampleKeys next failed\n");
+        ret = Error;
+    }
+    curs->close(curs);
+    return ret;
+}
+
 WT::ResponseCode WT::
 remove(const string& tableName, const string& key)
 {
@@ -242,10 +455,127 @@ error:
     return ret;
 }
 
+WT::ResponseCode WT::
+insertMany(const string& tableName,
+    const vector<Record>& records)
+{
+    ResponseCode ret = Success;
+    int rc = 0;
+    bool sorted = true;
+    for (size_t i = 1; i < records.size() && sorted; i++)
+        sorted = records[i - 1].key < records[i].key;
+
+    /*
+     * Bulk cursors only work on empty tables that nobody else has open,
+     * and need the keys in order. Fall back to a transaction otherwise.
+     * A bulk load isn't transactional, but the table was empty, so
+     * emptying it again undoes a load that failed halfway. Only a crash
+     * during the load can leave part of the records behind.
+     */
+    WT_CURSOR *bulk;
+    if (sorted && sess_->open_cursor(sess_,
+        Name2Uri(tableName).c_str(), NULL, "bulk", &bulk) == 0) {
+        for (size_t i = 0; i < records.size() && rc == 0; i++) {
+            bulk->set_key(bulk, records[i].key.c_str());
+            bulk->set_value(bulk, records[i].value.c_str());
+            rc = bulk->insert(bulk);
+        }
+        if (rc != 0)
+            bulk->close(bulk);
+        else if ((rc = bulk->close(bulk)) == 0)
+            return Success;
+        ERROR_RET_PRINT(Error, rc, "WT::insertMany bulk load failed\n");
+        if ((rc = sess_->truncate(sess_,
+            Name2Uri(tableName).c_str(), NULL, NULL, NULL)) != 0)
+            ERROR_RET(Error, rc, "WT::insertMany failed to undo the bulk load\n");
+        return Error;
+    }
+
+    if ((ret = openCursor(tableName)) != Success)
+        ERROR_RET(ret, 0, "WT::insertMany failed to open cursor\n");
+    if ((rc = sess_->begin_transaction(sess_, NULL)) != 0) {
+        closeCursor();
+        ERROR_RET(Error, rc, "WT_SESSION::begin_transaction() failed.\n");
+    }
+    for (size_t i = 0; i < records.size(); i++) {
+        curs_->set_key(curs_, records[i].key.c_str());
+        rc = curs_->search(curs_);
+        if (rc == 0) {
+            ret = KeyExists;
+            goto error;
+        } else if (rc != WT_NOTFOUND)
+            ERROR_GOTO(Error, rc, "WT::insertMany search failed\n");
+        curs_->set_key(curs_, records[i].key.c_str());
+        curs_->set_value(curs_, records[i].value.c_str());
+        if ((rc = curs_->insert(curs_)) != 0)
+            ERROR_GOTO(Error, rc, "WT::insertMany operation failed\n");
+    }
+    closeCursor();
+    if ((rc = sess_->commit_transaction(sess_, NULL)) != 0)
+        ERROR_RET(Error, rc, "WT_SESSION::commit_transaction() failed.\n");
+    return Success;
+error:
+    closeCursor();
+    sess_->rollback_transaction(sess_, NULL);
+    return ret;
+}
+
+/**
+ * Cursor must be closed before the transaction is aborted/commited.
+ */
+WT::ResponseCode WT::
+writeBatch(const string& tableName,
+    const vector<Mutation>& mutations)
+{
+    ResponseCode ret = Success;
+    int rc = 0;
+    if ((ret = openCursor(tableName)) != Success)
+        ERROR_RET(ret, 0, "WT::writeBatch failed to open cursor\n");
+    if ((rc = sess_->begin_transaction(sess_, NULL)) != 0) {
+        closeCursor();
+        ERROR_RET(Error, rc, "WT_SESSION::begin_transaction() failed.\n");
+    }
+
+    for (vector<Mutation>::const_iterator mutation = mutations.begin();
+        mutation != mutations.end(); mutation++) {
+        curs_->set_key(curs_, mutation->key.c_str());
+        if (mutation->type != MutationType::Put) {
+            rc = curs_->search(curs_);
+            if (rc == 0 && mutation->type == MutationType::Insert) {
+                ret = KeyExists;
+                goto error;
+            } else if (rc == WT_NOTFOUND &&
+                mutation->type != MutationType::Insert) {
+                ret = KeyNotFound;
+                goto error;
+            } else if (rc != 0 && rc != WT_NOTFOUND)
+                ERROR_GOTO(Error, rc, "WT::writeBatch search failed\n");
+            curs_->set_key(curs_, mutation->key.c_str());
+        }
+        if (mutation->type == MutationType::Remove)
+            rc = curs_->remove(curs_);
+        else {
+            curs_->set_value(curs_, mutation->value.c_str());
+            rc = curs_->insert(curs_);
+        }
+        if (rc != 0)
+            ERROR_GOTO(Error, rc, "WT::writeBatch operation failed\n");
+    }
+    closeCursor();
+    if ((rc = sess_->commit_transaction(sess_, NULL)) != 0)
+        ERROR_RET(Error, rc, "WT_SESSION::commit_transaction() failed.\n");
+    return Success;
+error:
+    closeCursor();
+    sess_->rollback_transaction(sess_, NULL);
+    return ret;
+}
+
 WT::ResponseCode WT::scanStart(const string &tableName,
         const ScanOrder::type order,
         const string& startKey, const bool startKeyIncluded,
-        const string& endKey, const bool endKeyIncluded)
+        const string& endKey, const bool endKeyIncluded,
+        const ScanOptions& options)
 {
     ResponseCode ret = Success;
     if ((ret = openCursor(tableName)) != Success)
@@ -258,6 +588,7 @@ WT::ResponseCode WT::scanStart(const string &tableName,
     startKeyIncluded_ = startKeyIncluded;
     endKey_ = endKey;
     endKeyIncluded_ = endKeyIncluded;
+    options_ = options;
     curs_->set_key(curs_, startKey.c_str());
 
     return Success;
@@ -269,57 +600,64 @@ WT::ResponseCode WT::scanNext(Record &rec)
         ERROR_RET(Error, 0,
             "WT::scanNext called when WT not setup for scan.\n");
 
-    int rc = 0;
-    if (!scanSetup_) {
-        if (order_ == ScanOrder::Ascending && startKey_.empty())
-            curs_->next(curs_);
-        else if (order_ == ScanOrder::Descending && endKey_.empty())
-            curs_->prev(curs_);
-        int exact;
-        curs_->search_near(curs_, &exact);
-        if (exact < 0 && order_ == ScanOrder::Ascending)
-            rc = curs_->next(curs_);
-        else if (exact > 0 && order_ == ScanOrder::Descending)
-            rc = curs_->prev(curs_);
-        else if (exact == 0 &&
-            order_ == ScanOrder::Ascending && !startKeyIncluded_)
-            rc = curs_->next(curs_);
-        else if (exact == 0 &&
-            order_ == ScanOrder::Descending && !endKeyIncluded_)
-            rc = curs_->prev(curs_);
-        scanSetup_ = true;
-    } else {
-        if (order_ == ScanOrder::Ascending)
-            rc = curs_->next(curs_);
-        else
-            rc = curs_->prev(curs_);
-    }
-    if (rc == WT_NOTFOUND &&
-        ((order_ == ScanOrder::Ascending && endKey_.empty()) ||
-        (order_ == ScanOrder::Descending && startKey_.empty())))
-        return ScanEnded;
-    else if (rc == WT_NOTFOUND)
-        return (KeyNotFound);
-    else if (rc != 0)
-        ERROR_RET(Error, rc, "WT::scanNext error.");
-    const char *key, *value;
-    curs_->get_key(curs_, &key);
-    curs_->get_value(curs_, &value);
-
-    /* Check for terminating condition. */
-    if (order_ == ScanOrder::Ascending) {
-        int exact = string(key).compare(endKey_);
-        if ((exact == 0 && !endKeyIncluded_) || exact > 0)
-            return ScanEnded;
-    } else { /* Descending */
-        int exact = string(key).compare(startKey_);
-        if ((exact == 0 && !startKeyIncluded_) || exact < 0)
+    /* Records the filter skips aren't copied out. */
+    for (;;) {
+        int rc = 0;
+        if (!scanSetup_) {
+            if (order_ == ScanOrder::Ascending && startKey_.empty())
+                curs_->next(curs_);
+            else if (order_ == ScanOrder::Descending && endKey_.empty())
+                curs_->prev(curs_);
+            int exact;
+            curs_->search_near(curs_, &exact);
+            if (exact < 0 && order_ == ScanOrder::Ascending)
+                rc = curs_->next(curs_);
+            else if (exact > 0 && order_ == ScanOrder::Descending)
+                rc = curs_->prev(curs_);
+            else if (exact == 0 &&
+                order_ == ScanOrder::Ascending && !startKeyIncluded_)
+                rc = curs_->next(curs_);
+            else if (exact == 0 &&
+                order_ == ScanOrder::Descending && !endKeyIncluded_)
+                rc = curs_->prev(curs_);
+            scanSetup_ = true;
+        } else {
+            if (order_ == ScanOrder::Ascending)
+                rc = curs_->next(curs_);
+            else
+                rc = curs_->prev(curs_);
+        }
+        if (rc == WT_NOTFOUND)
             return ScanEnded;
+        else if (rc != 0)
+            ERROR_RET(Error, rc, "WT::scanNext error.");
+        const char *key;
+        curs_->get_key(curs_, &key);
+
+        /* Check for terminating condition. */
+        if (order_ == ScanOrder::Ascending) {
+            int exact = endKey_.empty() ? -1 : string(key).compare(endKey_);
+            if ((exact == 0 && !endKeyIncluded_) || exact > 0)
+                return ScanEnded;
+        } else { /* Descending */
+            int exact = string(key).compare(startKey_);
+            if ((exact == 0 && !startKeyIncluded_) || exact < 0)
+                return ScanEnded;
+        }
+        const char *value = NULL;
+        if (!options_.keysOnly || hasValueFilter(options_.filter))
+            curs_->get_value(curs_, &value);
+        if (!matchesKey(options_.filter, key, strlen(key)) ||
+            (value != NULL && !matchesValue(options_.filter, value, strlen(value))))
+            continue;
+        /* Copy out the key and the requested part of the value. */
+        rec.key.assign(key);
+        if (options_.keysOnly)
+            rec.value.clear();
+        else
+            projectValue(options_, value, strlen(value), rec.value);
+        return Success;
     }
-    /* Copy out the key/value pair. */
-    rec.key.assign(key);
-    rec.value.assign(value);
-    return Success;
 }
 
 WT::ResponseCode WT::scanEnd()
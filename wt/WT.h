@@ -40,7 +40,8 @@ public:
         KeyNotFound,
         DbExists,
         DbNotFound,
-        ScanEnded
+        ScanEnded,
+        ValueMismatch
     };
 
     WT(WT_CONNECTION *conn, const string& tableType);
@@ -72,19 +73,65 @@ public:
     ResponseCode drop(const string& tableName);
     ResponseCode get(const string& tableName,
             const string& key, string& value);
+    /*
+     * Reads all the keys through one cursor in a single snapshot
+     * transaction. responses gets a Success or RecordNotFound entry per
+     * key.
+     *
+     * @returns DbNotFound if the table doesn't exist.
+     */
+    ResponseCode multiGet(const string& tableName,
+            const vector<string>& keys,
+            vector<mapkeeper::BinaryResponse>& responses);
     ResponseCode insert(const string& tableName,
             const string& key, const string& value);
     ResponseCode update(const string& tableName,
             const string& key, const string& value);
     ResponseCode remove(const string& tableName,
             const string& key);
+    /*
+     * Appends value to the record, or inserts the record if it doesn't
+     * exist, in a single transaction.
+     */
+    ResponseCode append(const string& tableName, const string& key,
+            const string& value);
+    /*
+     * Replaces the value if it's equal to expectedValue, in a single 
+     * transaction. A conflicting concurrent update also counts as a
+     * mismatch.
+     */
+    ResponseCode compareAndSet(const string& tableName, const string& key,
+            const string& expectedValue, const string& newValue);
+    /*
+     * Inserts all the records. A bulk cursor is used when the table is
+     * empty and the records are sorted, otherwise a single transaction.
+     * Either way, a failure leaves the table as it was.
+     */
+    ResponseCode insertMany(const string& tableName,
+            const vector<mapkeeper::Record>& records);
+    /*
+     * Removes the records in [startKey, endKey) in a single transaction.
+     * An empty endKey means the end of the table.
+     */
+    ResponseCode removeRange(const string& tableName,
+            const string& startKey, const string& endKey, uint64_t& count);
+    /* Applies all the mutations in a single transaction. */
+    ResponseCode writeBatch(const string& tableName,
+            const vector<mapkeeper::Mutation>& mutations);
+    /*
+     * Reads the keys of count random records, with repeats, through a
+     * next_random cursor. An empty table gives no keys.
+     */
+    ResponseCode sampleKeys(const string& tableName, uint32_t count,
+            vector<string>& keys);
     WT_SESSION* getSession();
 
-    /* APIs for iteration. */
+    /* APIs for iteration. options selects what scanNext copies out. */
     ResponseCode scanStart(const string& tableName,
             const mapkeeper::ScanOrder::type order,
             const string& startKey, const bool startKeyIncluded,
-            const string& endKey, const bool endKeyIncluded);
+            const string& endKey, const bool endKeyIncluded,
+            const mapkeeper::ScanOptions& options);
     ResponseCode scanNext(mapkeeper::Record &rec);
     ResponseCode scanEnd();
 
@@ -106,6 +153,7 @@ private:
     string endKey_;
     bool startKeyIncluded_;
     bool endKeyIncluded_;
+    mapkeeper::ScanOptions options_;
 };
 
 #endif // WT_H
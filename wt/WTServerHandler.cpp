@@ -2,19 +2,21 @@
  * Copyright 2012 WiredTiger
  */
 #include <arpa/inet.h>
+#include <iostream>
 #include <sstream>
 #include <cerrno>
 #include <signal.h>
 #include <stdio.h>
 #include <boost/thread/tss.hpp>
 #include <boost/thread/thread.hpp>
-#include <server/TServer.h>
-#include <server/TNonblockingServer.h>
-#include <server/TThreadedServer.h>
-#include <thrift/concurrency/PosixThreadFactory.h>
-#include <thrift/concurrency/ThreadManager.h>
+#include <boost/program_options.hpp>
 #include "WTServerHandler.h"
+#include "ChangeLogHandler.h"
+#include "TtlHandler.h"
+#include "ServerRunner.h"
 #include "MapKeeper.h"
+#include "Aggregator.h"
+#include "SplitPoints.h"
 
 using namespace ::apache::thrift;
 using namespace ::apache::thrift::protocol;
@@ -22,9 +24,13 @@ using namespace ::apache::thrift::transport;
 using namespace ::apache::thrift::server;
 using namespace ::apache::thrift::concurrency;
 using boost::shared_ptr;
+namespace po = boost::program_options;
 
 /* Signal handler. */
 static void onint(int);
+
+/* Each open scan cursor holds a WT session. */
+const uint32_t MAX_SCAN_CURSORS = 32;
 WTServerHandler *g_handler; /* Make the server accessible to signals. */
 
 void WTServerHandler::
@@ -32,7 +38,7 @@ initEnv(const string& homeDir)
 {
     string config;
     config.assign(
-        "create,transactional,cache_size=2GB,sync=false,session_max=120"
+        "create,transactional,cache_size=2GB,sync=false,session_max=160"
 	",extensions=[\"libwiredtiger_snappy.so\"]");
     /* TODO: Set a configurable cache size? */
     printf("Opening WT at: %s\n", homeDir.c_str());
@@ -45,7 +51,8 @@ initEnv(const string& homeDir)
 
 WTServerHandler::
 WTServerHandler() :
-        wt_ (new boost::thread_specific_ptr<WT>(destroyWt))
+        wt_ (new boost::thread_specific_ptr<WT>(destroyWt)),
+        cursors_(MAX_SCAN_CURSORS)
 {
     printf("Constructing new server handler\n");
 }
@@ -121,6 +128,13 @@ ping()
     return ResponseCode::Success;
 }
 
+// answered by StatsHandler, which ServerRunner puts in front.
+void WTServerHandler::
+getStats(StatsResponse& _return, const bool reset)
+{
+    _return.responseCode = ResponseCode::Error;
+}
+
 ResponseCode::type WTServerHandler::
 addMap(const string& mapName) 
 {
@@ -136,6 +150,12 @@ ResponseCode::type WTServerHandler::
 dropMap(const string& mapName) 
 {
     initWt();
+    {
+        boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+        handles_.remove(mapName);
+    }
+    cursors_.removeMap(mapName);
+    snapshots_.removeMap(mapName);
     wt_->get()->drop(mapName);
     return ResponseCode::Success;
 }
@@ -148,24 +168,99 @@ listMaps(StringListResponse& _return)
     wt_->get()->listTables(_return);
 }
 
+void WTServerHandler::
+openMap(MapHandleResponse& _return, const string& mapName) 
+{
+    initWt();
+    WT::ResponseCode rc = wt_->get()->open(mapName);
+    if (rc == WT::DbNotFound) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    } else if (rc != WT::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
+    _return.handle = handles_.add(mapName, mapName);
+    _return.responseCode = _return.handle >= 0 ?
+        ResponseCode::Success : ResponseCode::TooManyHandles;
+}
+
+void WTServerHandler::
+getByHandle(BinaryResponse& _return,
+        const int32_t mapHandle, const string& recordName) 
+{
+    string mapName;
+    {
+        boost::shared_lock< boost::shared_mutex > readLock(mutex_);;
+        if (!handles_.get(mapHandle, mapName)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+    }
+    get(_return, mapName, recordName);
+}
+
+ResponseCode::type WTServerHandler::
+putByHandle(const int32_t mapHandle,
+        const string& recordName, const string& recordBody) 
+{
+    string mapName;
+    {
+        boost::shared_lock< boost::shared_mutex > readLock(mutex_);;
+        if (!handles_.get(mapHandle, mapName)) {
+            return ResponseCode::MapNotFound;
+        }
+    }
+    return put(mapName, recordName, recordBody, WriteOptions());
+}
+
+void WTServerHandler::
+scanByHandle(RecordListResponse& _return,
+        const int32_t mapHandle, const ScanOrder::type order, 
+        const string& startKey, const bool startKeyIncluded,
+        const string& endKey, const bool endKeyIncluded,
+        const int32_t maxRecords, const int32_t maxBytes,
+        const ScanOptions& options)
+{
+    string mapName;
+    {
+        boost::shared_lock< boost::shared_mutex > readLock(mutex_);;
+        if (!handles_.get(mapHandle, mapName)) {
+            _return.responseCode = ResponseCode::MapNotFound;
+            return;
+        }
+    }
+    scan(_return, mapName, order, startKey, startKeyIncluded,
+            endKey, endKeyIncluded, maxRecords, maxBytes, options);
+}
+
 void WTServerHandler::
 scan(RecordListResponse& _return,
         const string& mapName, const ScanOrder::type order, 
         const string& startKey, const bool startKeyIncluded,
         const string& endKey, const bool endKeyIncluded,
-        const int32_t maxRecords, const int32_t maxBytes)
+        const int32_t maxRecords, const int32_t maxBytes,
+        const ScanOptions& options)
 {
     initWt();
-    wt_->get()->scanStart(
-            mapName, order, startKey, startKeyIncluded, endKey, endKeyIncluded);
+    wt_->get()->scanStart(mapName, order, startKey, startKeyIncluded,
+            endKey, endKeyIncluded, options);
+    readRecords(_return, wt_->get(), maxRecords, maxBytes);
+    wt_->get()->scanEnd();
+}
 
+void WTServerHandler::
+readRecords(RecordListResponse& _return, WT* wt,
+        const int32_t maxRecords, const int32_t maxBytes)
+{
     int32_t resultSize = 0;
     _return.responseCode = ResponseCode::Success;
     while ((maxRecords == 0 ||
            (int32_t)(_return.records.size()) < maxRecords) && 
            (maxBytes == 0 || resultSize < maxBytes)) {
         Record rec;
-        WT::ResponseCode rc = wt_->get()->scanNext(rec);
+        WT::ResponseCode rc = wt->scanNext(rec);
         if (rc == WT::ScanEnded) {
             _return.responseCode = ResponseCode::ScanEnded;
             break;
@@ -176,7 +271,234 @@ scan(RecordListResponse& _return,
         _return.records.push_back(rec);
         resultSize += rec.key.length() + rec.value.length();
     } 
+}
+
+void WTServerHandler::
+openScan(ScanCursorResponse& _return,
+        const string& mapName, const ScanOrder::type order, 
+        const string& startKey, const bool startKeyIncluded,
+        const string& endKey, const bool endKeyIncluded,
+        const ScanOptions& options)
+{
+    boost::shared_ptr<ScanCursor> cursor(
+            new ScanCursor(mapName, new WT(conn_, "lsm:")));
+    WT_SESSION *sess = cursor->wt->getSession();
+    int rc = sess->begin_transaction(sess, "isolation=snapshot");
+    if (rc != 0) {
+        fprintf(stderr, "WT_SESSION::begin_transaction: %s\n",
+            wiredtiger_strerror(rc));
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    if (cursor->wt->scanStart(mapName, order, startKey, startKeyIncluded,
+            endKey, endKeyIncluded, options) != WT::Success) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    _return.cursorId = cursors_.add(cursor);
+    _return.responseCode = _return.cursorId ?
+        ResponseCode::Success : ResponseCode::TooManyCursors;
+}
+
+void WTServerHandler::
+nextScan(RecordListResponse& _return, const int64_t cursorId,
+        const int32_t maxRecords, const int32_t maxBytes)
+{
+    boost::shared_ptr<ScanCursor> cursor = cursors_.get(cursorId);
+    if (!cursor) {
+        _return.responseCode = ResponseCode::CursorNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock cursorLock(cursor->mutex);
+    readRecords(_return, cursor->wt.get(), maxRecords, maxBytes);
+    if (_return.responseCode != ResponseCode::Success) {
+        cursors_.remove(cursorId);
+    }
+}
+
+ResponseCode::type WTServerHandler::
+closeScan(const int64_t cursorId)
+{
+    if (!cursors_.remove(cursorId)) {
+        return ResponseCode::CursorNotFound;
+    }
+    return ResponseCode::Success;
+}
+
+void WTServerHandler::
+createSnapshot(SnapshotResponse& _return, const string& mapName)
+{
+    boost::shared_ptr<Snapshot> snapshot(
+            new Snapshot(mapName, new WT(conn_, "lsm:")));
+    WT_SESSION *sess = snapshot->wt->getSession();
+    int rc = sess->begin_transaction(sess, "isolation=snapshot");
+    if (rc != 0) {
+        fprintf(stderr, "WT_SESSION::begin_transaction: %s\n",
+            wiredtiger_strerror(rc));
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    WT::ResponseCode dbrc = snapshot->wt->open(mapName);
+    if (dbrc == WT::DbNotFound) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    } else if (dbrc != WT::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    _return.snapshotId = snapshots_.add(snapshot);
+    _return.responseCode = _return.snapshotId ?
+        ResponseCode::Success : ResponseCode::TooManySnapshots;
+}
+
+ResponseCode::type WTServerHandler::
+releaseSnapshot(const int64_t snapshotId)
+{
+    if (!snapshots_.remove(snapshotId)) {
+        return ResponseCode::SnapshotNotFound;
+    }
+    return ResponseCode::Success;
+}
+
+void WTServerHandler::
+getAtSnapshot(BinaryResponse& _return,
+        const int64_t snapshotId, const string& recordName)
+{
+    boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+    if (!snapshot) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock snapshotLock(snapshot->mutex);
+    WT::ResponseCode dbrc = snapshot->wt->get(snapshot->mapName,
+            recordName, _return.value);
+    if (dbrc == WT::Success) {
+        _return.responseCode = ResponseCode::Success;
+    } else if (dbrc == WT::KeyNotFound) {
+        _return.responseCode = ResponseCode::RecordNotFound;
+    } else {
+        _return.responseCode = ResponseCode::Error;
+    }
+}
+
+void WTServerHandler::
+scanAtSnapshot(RecordListResponse& _return,
+        const int64_t snapshotId, const ScanOrder::type order, 
+        const string& startKey, const bool startKeyIncluded,
+        const string& endKey, const bool endKeyIncluded,
+        const int32_t maxRecords, const int32_t maxBytes,
+        const ScanOptions& options)
+{
+    boost::shared_ptr<Snapshot> snapshot = snapshots_.get(snapshotId);
+    if (!snapshot) {
+        _return.responseCode = ResponseCode::SnapshotNotFound;
+        return;
+    }
+    boost::mutex::scoped_lock snapshotLock(snapshot->mutex);
+    if (snapshot->wt->scanStart(snapshot->mapName, order, startKey,
+            startKeyIncluded, endKey, endKeyIncluded, options) != WT::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    readRecords(_return, snapshot->wt.get(), maxRecords, maxBytes);
+    snapshot->wt->scanEnd();
+}
+
+void WTServerHandler::
+countRange(Int64Response& _return, const string& mapName,
+        const string& startKey, const string& endKey)
+{
+    sumRange(_return, mapName, startKey, endKey, false);
+}
+
+/*
+ * WiredTiger doesn't estimate the size of a key range, so this adds up
+ * the records in the range. It still saves shipping them to the client.
+ */
+void WTServerHandler::
+approximateSize(Int64Response& _return, const string& mapName,
+        const string& startKey, const string& endKey)
+{
+    sumRange(_return, mapName, startKey, endKey, true);
+}
+
+void WTServerHandler::
+aggregate(AggregateResponse& _return, const string& mapName,
+        const string& startKey, const string& endKey,
+        const AggregateOp::type op, const ValueEncoding::type encoding)
+{
+    initWt();
+    Aggregator aggregator(op, encoding);
+    if (!aggregator.isValid()) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    ScanOptions options;
+    options.keysOnly = !aggregator.needsValues();
+    if (wt_->get()->scanStart(mapName, ScanOrder::Ascending, startKey, true,
+            endKey, false, options) != WT::Success) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    Record rec;
+    WT::ResponseCode rc;
+    while ((rc = wt_->get()->scanNext(rec)) == WT::Success) {
+        aggregator.add(rec.value.data(), rec.value.size());
+    }
     wt_->get()->scanEnd();
+    aggregator.getResult(_return);
+    _return.responseCode = rc == WT::ScanEnded ?
+        ResponseCode::Success : ResponseCode::Error;
+}
+
+/*
+ * WiredTiger doesn't estimate key ranges either, but it can read random
+ * records, so the split points are picked from a sample of keys.
+ */
+void WTServerHandler::
+sampleSplitPoints(KeyListResponse& _return, const string& mapName,
+        const int32_t numSplits)
+{
+    initWt();
+    if (!validSplitCount(numSplits)) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    vector<string> sample;
+    WT::ResponseCode rc = wt_->get()->sampleKeys(mapName,
+            numSplits * samplesPerSplit, sample);
+    if (rc == WT::DbNotFound) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    } else if (rc != WT::Success) {
+        _return.responseCode = ResponseCode::Error;
+        return;
+    }
+    pickSplitPoints(sample, numSplits, _return.keys);
+    _return.responseCode = ResponseCode::Success;
+}
+
+void WTServerHandler::
+sumRange(Int64Response& _return, const string& mapName,
+        const string& startKey, const string& endKey, bool countBytes)
+{
+    initWt();
+    ScanOptions options;
+    options.keysOnly = !countBytes;
+    if (wt_->get()->scanStart(mapName, ScanOrder::Ascending, startKey, true,
+            endKey, false, options) != WT::Success) {
+        _return.responseCode = ResponseCode::MapNotFound;
+        return;
+    }
+    _return.value = 0;
+    Record rec;
+    WT::ResponseCode rc;
+    while ((rc = wt_->get()->scanNext(rec)) == WT::Success) {
+        _return.value += countBytes ? rec.key.length() + rec.value.length() : 1;
+    }
+    wt_->get()->scanEnd();
+    _return.responseCode = rc == WT::ScanEnded ?
+        ResponseCode::Success : ResponseCode::Error;
 }
 
 void WTServerHandler::
@@ -194,19 +516,38 @@ get(BinaryResponse& _return,
     }
 }
 
+void WTServerHandler::
+multiGet(BinaryListResponse& _return,
+        const string& mapName, const vector<string>& recordNames) 
+{
+    initWt();
+    WT::ResponseCode dbrc = wt_->get()->multiGet(mapName, recordNames, _return.responses);
+    if (dbrc == WT::Success) {
+        _return.responseCode = ResponseCode::Success;
+    } else if (dbrc == WT::DbNotFound) {
+        _return.responses.clear();
+        _return.responseCode = ResponseCode::MapNotFound;
+    } else {
+        _return.responses.clear();
+        _return.responseCode = ResponseCode::Error;
+    }
+}
+
 ResponseCode::type WTServerHandler::
 put(const string& mapName, 
        const string& recordName, 
-       const string& recordBody) 
+       const string& recordBody,
+       const WriteOptions& options) 
 {
     /* TODO: What is difference between put and insert? */
-    return insert(mapName, recordName, recordBody);
+    return insert(mapName, recordName, recordBody, options);
 }
 
 ResponseCode::type WTServerHandler::
 insert(const string& mapName, 
        const string& recordName, 
-       const string& recordBody) 
+       const string& recordBody,
+       const WriteOptions& options) 
 {
     initWt();
     //boost::unique_lock< boost::shared_mutex > writeLock(mutex_);;
@@ -223,13 +564,30 @@ ResponseCode::type WTServerHandler::
 insertMany(const string& databaseName,
         const vector<Record> & records)
 {
+    initWt();
+    WT::ResponseCode dbrc = wt_->get()->insertMany(databaseName, records);
+    if (dbrc == WT::KeyExists) {
+        return ResponseCode::RecordExists;
+    } else if (dbrc != WT::Success) {
+        return ResponseCode::Error;
+    }
     return ResponseCode::Success;
 }
 
+/*
+ * Only the LevelDB backend can load table files directly.
+ */
+ResponseCode::type WTServerHandler::
+ingestFile(const string& mapName, const string& path)
+{
+    return ResponseCode::Error;
+}
+
 ResponseCode::type WTServerHandler::
 update(const string& mapName, 
        const string& recordName, 
-       const string& recordBody) 
+       const string& recordBody,
+       const WriteOptions& options) 
 {
     initWt();
     WT::ResponseCode dbrc = wt_->get()->update(mapName, recordName, recordBody);
@@ -242,6 +600,50 @@ update(const string& mapName,
     }
 }
 
+ResponseCode::type WTServerHandler::
+compareAndSet(const string& mapName, 
+       const string& recordName, 
+       const string& expectedBody,
+       const string& recordBody) 
+{
+    initWt();
+    WT::ResponseCode dbrc = wt_->get()->compareAndSet(
+            mapName, recordName, expectedBody, recordBody);
+    if (dbrc == WT::Success) {
+        return ResponseCode::Success;
+    } else if (dbrc == WT::KeyNotFound) {
+        return ResponseCode::RecordNotFound;
+    } else if (dbrc == WT::ValueMismatch) {
+        return ResponseCode::ValueMismatch;
+    } else {
+        return ResponseCode::Error;
+    }
+}
+
+void WTServerHandler::
+increment(Int64Response& _return,
+       const string& mapName, 
+       const string& recordName, 
+       const int64_t delta) 
+{
+    // Values are stored as C strings (value_format=S), so an 8 byte 
+    // counter with zero bytes in it can't be stored.
+    _return.responseCode = ResponseCode::Error;
+}
+
+ResponseCode::type WTServerHandler::
+append(const string& mapName, 
+       const string& recordName, 
+       const string& recordBody) 
+{
+    initWt();
+    WT::ResponseCode dbrc = wt_->get()->append(mapName, recordName, recordBody);
+    if (dbrc != WT::Success) {
+        return ResponseCode::Error;
+    }
+    return ResponseCode::Success;
+}
+
 ResponseCode::type WTServerHandler::
 remove(const string& mapName, const string& recordName) 
 {
@@ -256,22 +658,79 @@ remove(const string& mapName, const string& recordName)
     }
 }
 
+void WTServerHandler::
+removeRange(Int64Response& _return, const string& mapName,
+        const string& startKey, const string& endKey)
+{
+    initWt();
+    uint64_t count = 0;
+    WT::ResponseCode dbrc = wt_->get()->removeRange(mapName, startKey, endKey, count);
+    _return.value = count;
+    _return.responseCode = dbrc == WT::Success ?
+        ResponseCode::Success : ResponseCode::Error;
+}
+
+ResponseCode::type WTServerHandler::
+writeBatch(const string& mapName, const vector<Mutation>& mutations) 
+{
+    initWt();
+    WT::ResponseCode dbrc = wt_->get()->writeBatch(mapName, mutations);
+    if (dbrc == WT::Success) {
+        return ResponseCode::Success;
+    } else if (dbrc == WT::KeyExists) {
+        return ResponseCode::RecordExists;
+    } else if (dbrc == WT::KeyNotFound) {
+        return ResponseCode::RecordNotFound;
+    } else {
+        return ResponseCode::Error;
+    }
+}
+
+void WTServerHandler::
+tailChanges(ChangeListResponse& _return, const string& mapName,
+        const int64_t fromSeq, const int32_t maxRecords)
+{
+    /*
+     * Changes are logged by ChangeLogHandler, which main() puts in front
+     * of this handler.
+     */
+    _return.responseCode = ResponseCode::Error;
+}
+
 int main(int argc, char **argv) {
-    int port = 9090;
+    int port;
     string homeDir = "data";
+    int changeLogSize;
+    ServerRunner runner;
+    po::variables_map vm;
+    po::options_description config("");
+    config.add_options()
+        ("help,h", "produce help message")
+        ("port,p", po::value<int>(&port)->default_value(9090), "port to listen to")
+        ("change-log-size", po::value<int>(&changeLogSize)->default_value(10000), "number of changes per map to keep for tailChanges (0 to disable)")
+        ;
+    runner.addOptions(config);
+    po::options_description cmdline_options;
+    cmdline_options.add(config);
+    store(po::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    notify(vm);
+    if (vm.count("help")) {
+        std::cout << config << std::endl;
+        exit(0);
+    }
     /* Clean up on signal. */
     (void)signal(SIGINT, onint);
-    shared_ptr<WTServerHandler> handler(new WTServerHandler());
-    g_handler = handler.get();
-    handler->init(homeDir);
-    shared_ptr<TProcessor> processor(new MapKeeperProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(port));
-    shared_ptr<TTransportFactory> transportFactory(
-            new TFramedTransportFactory());
-    shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
-    TThreadedServer server(
-        processor, serverTransport, transportFactory, protocolFactory);
-    server.serve();
+    shared_ptr<WTServerHandler> server(new WTServerHandler());
+    g_handler = server.get();
+    server->init(homeDir);
+    shared_ptr<MapKeeperIf> handler(server);
+    handler = runner.groupCommit(handler);
+    handler = runner.cache(handler);
+    if (changeLogSize > 0) {
+        handler.reset(new ChangeLogHandler(handler, changeLogSize));
+    }
+    handler.reset(new TtlHandler(handler));
+    runner.serve(handler, port);
     return 0;
 }
 
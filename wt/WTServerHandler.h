@@ -2,12 +2,15 @@
  * Copyright 2012 WiredTiger
  */
 #include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <protocol/TBinaryProtocol.h>
 #include <server/TSimpleServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TBufferTransports.h>
 #include <wiredtiger.h>
 #include "MapKeeper.h"
+#include "CursorTable.h"
+#include "MapHandleTable.h"
 #include "WT.h"
 
 using namespace ::apache::thrift;
@@ -24,34 +27,134 @@ public:
     int init(const string& homeDir); 
     void shutdown();
     ResponseCode::type ping();
+    void getStats(StatsResponse& _return, const bool reset);
     ResponseCode::type addMap(const string& databaseName);
     ResponseCode::type dropMap(const string& databaseName);
     void listMaps(StringListResponse& _return);
+    void openMap(MapHandleResponse& _return, const string& databaseName);
+    void getByHandle(BinaryResponse& _return,
+            const int32_t mapHandle, const string& recordName);
+    ResponseCode::type putByHandle(const int32_t mapHandle,
+            const string& recordName, const string& recordBody);
+    void scanByHandle(RecordListResponse& _return,
+            const int32_t mapHandle, const ScanOrder::type order, 
+            const string& startKey, const bool startKeyIncluded,
+            const string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options);
     void scan(RecordListResponse& _return,
             const string& databaseName, const ScanOrder::type order, 
             const string& startKey, const bool startKeyIncluded,
             const string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options);
+    void openScan(ScanCursorResponse& _return,
+            const string& databaseName, const ScanOrder::type order, 
+            const string& startKey, const bool startKeyIncluded,
+            const string& endKey, const bool endKeyIncluded,
+            const ScanOptions& options);
+    void nextScan(RecordListResponse& _return, const int64_t cursorId,
             const int32_t maxRecords, const int32_t maxBytes);
+    ResponseCode::type closeScan(const int64_t cursorId);
+    void createSnapshot(SnapshotResponse& _return, const string& databaseName);
+    ResponseCode::type releaseSnapshot(const int64_t snapshotId);
+    void getAtSnapshot(BinaryResponse& _return,
+            const int64_t snapshotId, const string& recordName);
+    void scanAtSnapshot(RecordListResponse& _return,
+            const int64_t snapshotId, const ScanOrder::type order, 
+            const string& startKey, const bool startKeyIncluded,
+            const string& endKey, const bool endKeyIncluded,
+            const int32_t maxRecords, const int32_t maxBytes,
+            const ScanOptions& options);
+    void countRange(Int64Response& _return, const string& databaseName,
+            const string& startKey, const string& endKey);
+    void approximateSize(Int64Response& _return, const string& databaseName,
+            const string& startKey, const string& endKey);
+    void sampleSplitPoints(KeyListResponse& _return, const string& databaseName,
+            const int32_t numSplits);
+    void aggregate(AggregateResponse& _return, const string& databaseName,
+            const string& startKey, const string& endKey,
+            const AggregateOp::type op, const ValueEncoding::type encoding);
     void get(BinaryResponse& _return,
             const string& databaseName, const string& recordName);
+    void multiGet(BinaryListResponse& _return,
+            const string& databaseName, const vector<string>& recordNames);
     ResponseCode::type put(const string& databaseName,
-            const string& recordName, const string& recordBody);
+            const string& recordName, const string& recordBody,
+            const WriteOptions& options);
     ResponseCode::type insert(const string& databaseName,
-            const string& recordName, const string& recordBody);
+            const string& recordName, const string& recordBody,
+            const WriteOptions& options);
     ResponseCode::type insertMany(const string& databaseName,
             const vector<Record> & records);
+    ResponseCode::type ingestFile(const string& databaseName,
+            const string& path);
     ResponseCode::type update(const string& databaseName,
+            const string& recordName, const string& recordBody,
+            const WriteOptions& options);
+    ResponseCode::type compareAndSet(const string& databaseName,
+            const string& recordName, const string& expectedBody,
+            const string& recordBody);
+    void increment(Int64Response& _return, const string& databaseName,
+            const string& recordName, const int64_t delta);
+    ResponseCode::type append(const string& databaseName,
             const string& recordName, const string& recordBody);
     ResponseCode::type remove(const string& databaseName,
             const string& recordName);
+    void removeRange(Int64Response& _return, const string& databaseName,
+            const string& startKey, const string& endKey);
+    ResponseCode::type writeBatch(const string& databaseName,
+            const vector<Mutation>& mutations);
+    void tailChanges(ChangeListResponse& _return, const string& databaseName,
+            const int64_t fromSeq, const int32_t maxRecords);
     static void destroyWt(WT* wt);
     void initWt();
 
 private:
+    /*
+     * State of a scan opened with openScan. WT sessions can't be shared
+     * between threads concurrently, so each cursor gets its own WT object
+     * (and session), running a snapshot transaction.
+     */
+    struct ScanCursor {
+        ScanCursor(const string& mapName_, WT* wt_) :
+            mapName(mapName_), wt(wt_) {}
+        ~ScanCursor() { wt->scanEnd(); }
+        string mapName;
+        boost::scoped_ptr<WT> wt;
+        boost::mutex mutex; /* Serialize nextScan calls on this cursor. */
+    };
+
+    /*
+     * A snapshot handed out by createSnapshot. Like a scan cursor, it has
+     * its own WT object running a snapshot transaction.
+     */
+    struct Snapshot {
+        Snapshot(const string& mapName_, WT* wt_) :
+            mapName(mapName_), wt(wt_) {}
+        string mapName;
+        boost::scoped_ptr<WT> wt;
+        boost::mutex mutex; /* Serialize reads in the transaction. */
+    };
+
+    /* Random keys read per split point by sampleSplitPoints. */
+    static const uint32_t samplesPerSplit = 32;
+
+    void sumRange(Int64Response& _return, const string& mapName,
+            const string& startKey, const string& endKey, bool countBytes);
+    void readRecords(RecordListResponse& _return, WT* wt,
+            const int32_t maxRecords, const int32_t maxBytes);
     void checkpoint();
     void initEnv(const string& homeDir);
     WT_CONNECTION *conn_;
     boost::thread_specific_ptr<WT>* wt_;
     /* Single thread updates with the mutex. */
     boost::shared_mutex mutex_;
+    CursorTable<ScanCursor> cursors_;
+    CursorTable<Snapshot> snapshots_;
+    /*
+     * WT cursors are cached per session and keyed by table name, so a
+     * handle just maps back to the name. Protected by mutex_.
+     */
+    MapHandleTable<string> handles_;
 };